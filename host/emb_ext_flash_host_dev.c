@@ -0,0 +1,482 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "emb_ext_flash_host_dev.h"
+
+// Bus time is slept in chunks of at least this many microseconds to keep the number of system calls down
+#define HOST_DEV_BUS_SLEEP_US    200.0
+
+// Command decoder phases
+#define HOST_DEV_PHASE_CMD       0
+#define HOST_DEV_PHASE_ADDR      1
+#define HOST_DEV_PHASE_DUMMY     2
+#define HOST_DEV_PHASE_DATA      3
+#define HOST_DEV_PHASE_IGNORE    4
+
+// Device bound to the calling thread
+static __thread emb_ext_flash_host_dev_t *_bound = NULL;
+
+// Private functions
+static void host_dev_defaults(emb_ext_flash_host_dev_t *p_dev, uint32_t size)
+{
+   memset(p_dev, 0, sizeof(*p_dev));
+   p_dev->size       = size;
+   p_dev->fd         = -1;
+   p_dev->jedec_id   = 0xEF4000 | (uint8_t)(31 - __builtin_clz(size));
+   p_dev->tpp_us     = EXT_FLASH_HOST_DEV_TPP_US;
+   p_dev->t4k_us     = EXT_FLASH_HOST_DEV_T4K_US;
+   p_dev->t32k_us    = EXT_FLASH_HOST_DEV_T32K_US;
+   p_dev->t64k_us    = EXT_FLASH_HOST_DEV_T64K_US;
+   p_dev->tchip_us   = EXT_FLASH_HOST_DEV_TCHIP_US;
+   p_dev->spi_khz    = EXT_FLASH_HOST_DEV_SPI_KHZ;
+   p_dev->time_scale = 1.0;
+}
+
+static void host_dev_sleep_until(struct timespec *t)
+{
+   while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, t, NULL) == EINTR)
+   {
+      ;
+   }
+}
+
+static void host_dev_sleep_us(double us)
+{
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   uint64_t ns = (uint64_t)(us * 1000.0) + t.tv_nsec;
+   t.tv_sec  += ns / 1000000000;
+   t.tv_nsec  = ns % 1000000000;
+   host_dev_sleep_until(&t);
+}
+
+static uint8_t host_dev_busy(emb_ext_flash_host_dev_t *p_dev)
+{
+   struct timespec now;
+
+   if (p_dev->time_scale <= 0.0)
+   {
+      return(0);
+   }
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return(now.tv_sec < p_dev->ready_at.tv_sec || (now.tv_sec == p_dev->ready_at.tv_sec && now.tv_nsec < p_dev->ready_at.tv_nsec));
+}
+
+// Start an internal operation that keeps the device busy for the given typical time
+static void host_dev_start_busy(emb_ext_flash_host_dev_t *p_dev, uint32_t us)
+{
+   if (p_dev->time_scale <= 0.0)
+   {
+      return;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &p_dev->ready_at);
+   uint64_t ns = (uint64_t)(us * p_dev->time_scale * 1000.0) + p_dev->ready_at.tv_nsec;
+   p_dev->ready_at.tv_sec  += ns / 1000000000;
+   p_dev->ready_at.tv_nsec  = ns % 1000000000;
+}
+
+// Account for bytes on the bus, sleeping once enough bus time has built up
+static void host_dev_clock(emb_ext_flash_host_dev_t *p_dev, uint32_t len)
+{
+   p_dev->stat_bytes += len;
+   if (p_dev->time_scale <= 0.0)
+   {
+      return;
+   }
+
+   p_dev->bus_debt_us += len * 8000.0 / p_dev->spi_khz * p_dev->time_scale;
+   if (p_dev->bus_debt_us >= HOST_DEV_BUS_SLEEP_US)
+   {
+      host_dev_sleep_us(p_dev->bus_debt_us);
+      p_dev->bus_debt_us = 0.0;
+   }
+}
+
+// The 3-byte address form of a 4-byte address command, 0 for any other command
+static uint8_t host_dev_3byte_cmd(uint8_t cmd)
+{
+   switch (cmd)
+   {
+   case EXT_FLASH_CMD_READ_DATA_4B:
+      return(EXT_FLASH_CMD_READ_DATA);
+   case EXT_FLASH_CMD_FAST_READ_4B:
+      return(EXT_FLASH_CMD_FAST_READ);
+   case EXT_FLASH_CMD_PAGE_PROGRAM_4B:
+      return(EXT_FLASH_CMD_PAGE_PROGRAM);
+   case EXT_FLASH_CMD_SECTOR_ERASE_4B:
+      return(EXT_FLASH_CMD_SECTOR_ERASE);
+   case EXT_FLASH_CMD_BLOCK_ERASE_32K_4B:
+      return(EXT_FLASH_CMD_BLOCK_ERASE_32K);
+   case EXT_FLASH_CMD_BLOCK_ERASE_64K_4B:
+      return(EXT_FLASH_CMD_BLOCK_ERASE_64K);
+   default:
+      return(0);
+   }
+}
+
+static uint8_t host_dev_has_addr(uint8_t cmd)
+{
+   return(cmd == EXT_FLASH_CMD_READ_DATA || cmd == EXT_FLASH_CMD_FAST_READ || cmd == EXT_FLASH_CMD_PAGE_PROGRAM ||
+          cmd == EXT_FLASH_CMD_SECTOR_ERASE || cmd == EXT_FLASH_CMD_BLOCK_ERASE_32K || cmd == EXT_FLASH_CMD_BLOCK_ERASE_64K);
+}
+
+static void host_dev_select()
+{
+   emb_ext_flash_host_dev_t *p_dev = _bound;
+
+   p_dev->selected = 1;
+   p_dev->phase    = HOST_DEV_PHASE_CMD;
+   p_dev->offset   = 0;
+}
+
+static int host_dev_write(uint8_t *data, uint16_t len)
+{
+   emb_ext_flash_host_dev_t *p_dev = _bound;
+
+   if (!p_dev->selected)
+   {
+      return(-1);
+   }
+   host_dev_clock(p_dev, len);
+
+   for (uint16_t i = 0; i < len; i++)
+   {
+      switch (p_dev->phase)
+      {
+      case HOST_DEV_PHASE_CMD:
+         // 4-byte address commands are decoded as their 3-byte forms after a longer address
+         p_dev->cmd        = host_dev_3byte_cmd(data[i]) ? host_dev_3byte_cmd(data[i]) : data[i];
+         p_dev->addr       = 0;
+         p_dev->addr_count = 0;
+         p_dev->addr_len   = host_dev_3byte_cmd(data[i]) ? 4 : 3;
+         p_dev->phase      = host_dev_has_addr(p_dev->cmd) ? HOST_DEV_PHASE_ADDR : HOST_DEV_PHASE_DATA;
+
+         // Only the release command reaches a powered down device and only status reads reach a busy one
+         if ((p_dev->powered_down && data[i] != EXT_FLASH_CMD_RELEASE_POWER_DOWN) ||
+             (data[i] != EXT_FLASH_CMD_READ_STATUS_REG && host_dev_busy(p_dev)))
+         {
+            p_dev->phase = HOST_DEV_PHASE_IGNORE;
+         }
+         break;
+
+      case HOST_DEV_PHASE_ADDR:
+         p_dev->addr = (p_dev->addr << 8) | data[i];
+         if (++p_dev->addr_count == p_dev->addr_len)
+         {
+            p_dev->addr %= p_dev->size;
+            p_dev->phase = p_dev->cmd == EXT_FLASH_CMD_FAST_READ ? HOST_DEV_PHASE_DUMMY : HOST_DEV_PHASE_DATA;
+         }
+         break;
+
+      case HOST_DEV_PHASE_DUMMY:
+         p_dev->phase = HOST_DEV_PHASE_DATA;
+         break;
+
+      case HOST_DEV_PHASE_DATA:
+         // Programming can only clear bits and wraps within the page
+         if (p_dev->cmd == EXT_FLASH_CMD_PAGE_PROGRAM && p_dev->wel)
+         {
+            uint32_t a = (p_dev->addr & ~0xFFu) | ((p_dev->addr + p_dev->offset) & 0xFF);
+            p_dev->mem[a] &= data[i];
+            p_dev->offset++;
+         }
+         break;
+
+      default:
+         break;
+      }
+   }
+
+   return(0);
+}
+
+static int host_dev_read(uint8_t *data, uint16_t len)
+{
+   emb_ext_flash_host_dev_t *p_dev = _bound;
+
+   if (!p_dev->selected)
+   {
+      return(-1);
+   }
+   host_dev_clock(p_dev, len);
+
+   if (p_dev->phase != HOST_DEV_PHASE_DATA)
+   {
+      memset(data, 0xFF, len);
+      return(0);
+   }
+
+   switch (p_dev->cmd)
+   {
+   case EXT_FLASH_CMD_READ_STATUS_REG:
+      // Rather than spinning the caller through status reads, sleep out the operation in progress
+      if (host_dev_busy(p_dev))
+      {
+         host_dev_sleep_until(&p_dev->ready_at);
+      }
+      memset(data, p_dev->wel ? EXT_FLASH_STATUS_REG_WEL : 0, len);
+      break;
+
+   case EXT_FLASH_CMD_JEDEC_ID:
+      for (uint16_t i = 0; i < len; i++, p_dev->offset++)
+      {
+         data[i] = p_dev->offset < 3 ? (p_dev->jedec_id >> (16 - 8 * p_dev->offset)) & 0xFF : 0xFF;
+      }
+      break;
+
+   case EXT_FLASH_CMD_READ_DATA:
+   case EXT_FLASH_CMD_FAST_READ:
+      for (uint16_t i = 0; i < len; )
+      {
+         uint32_t a     = (p_dev->addr + p_dev->offset) % p_dev->size;
+         uint32_t chunk = p_dev->size - a < (uint32_t)(len - i) ? p_dev->size - a : (uint32_t)(len - i);
+         memcpy(&data[i], &p_dev->mem[a], chunk);
+         i             += chunk;
+         p_dev->offset += chunk;
+      }
+      break;
+
+   default:
+      memset(data, 0xFF, len);
+      break;
+   }
+
+   return(0);
+}
+
+// Commands take effect when the chip select goes high
+static void host_dev_deselect()
+{
+   emb_ext_flash_host_dev_t *p_dev = _bound;
+   uint32_t                  len   = 0;
+   uint32_t                  us    = 0;
+
+   p_dev->selected = 0;
+   if (p_dev->phase == HOST_DEV_PHASE_IGNORE || (p_dev->phase == HOST_DEV_PHASE_ADDR && p_dev->addr_count < p_dev->addr_len))
+   {
+      return;
+   }
+
+   switch (p_dev->cmd)
+   {
+   case EXT_FLASH_CMD_WRITE_ENABLE:
+      p_dev->wel = 1;
+      break;
+
+   case EXT_FLASH_CMD_WRITE_DISABLE:
+      p_dev->wel = 0;
+      break;
+
+   case EXT_FLASH_CMD_POWER_DOWN:
+      p_dev->powered_down = 1;
+      break;
+
+   case EXT_FLASH_CMD_RELEASE_POWER_DOWN:
+      p_dev->powered_down = 0;
+      break;
+
+   case EXT_FLASH_CMD_PAGE_PROGRAM:
+      if (p_dev->wel && p_dev->offset)
+      {
+         p_dev->stat_programs++;
+         host_dev_start_busy(p_dev, p_dev->tpp_us);
+      }
+      p_dev->wel = 0;
+      break;
+
+   case EXT_FLASH_CMD_SECTOR_ERASE:
+      len = EXT_FLASH_SECTOR_SIZE;
+      us  = p_dev->t4k_us;
+      break;
+
+   case EXT_FLASH_CMD_BLOCK_ERASE_32K:
+      len = EXT_FLASH_BLOCK_32K_SIZE;
+      us  = p_dev->t32k_us;
+      break;
+
+   case EXT_FLASH_CMD_BLOCK_ERASE_64K:
+      len = EXT_FLASH_BLOCK_64K_SIZE;
+      us  = p_dev->t64k_us;
+      break;
+
+   case EXT_FLASH_CMD_CHIP_ERASE:
+      p_dev->addr = 0;
+      len         = p_dev->size;
+      us          = p_dev->tchip_us;
+      break;
+
+   default:
+      break;
+   }
+
+   // Erases clear the aligned unit holding the address
+   if (len)
+   {
+      if (p_dev->wel)
+      {
+         memset(&p_dev->mem[p_dev->addr & ~(len - 1)], 0xFF, len);
+         p_dev->stat_erases++;
+         host_dev_start_busy(p_dev, us);
+      }
+      p_dev->wel = 0;
+   }
+}
+
+static void host_dev_delay_us(uint32_t duration)
+{
+   emb_ext_flash_host_dev_t *p_dev = _bound;
+
+   if (p_dev && p_dev->time_scale > 0.0)
+   {
+      host_dev_sleep_us(duration * p_dev->time_scale);
+   }
+}
+
+static uint32_t host_dev_get_time_us()
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return((uint32_t)(now.tv_sec * 1000000ull + now.tv_nsec / 1000));
+}
+
+// Public functions
+int emb_ext_flash_host_dev_open_ram(emb_ext_flash_host_dev_t *p_dev, uint32_t size)
+{
+   // Null check, the size has to be a power of two number of sectors
+   if (!p_dev || size < EXT_FLASH_SECTOR_SIZE || (size & (size - 1)))
+   {
+      return(-1);
+   }
+
+   host_dev_defaults(p_dev, size);
+   p_dev->mem = malloc(size);
+   if (!p_dev->mem)
+   {
+      return(-1);
+   }
+   memset(p_dev->mem, 0xFF, size);
+
+   return(0);
+}
+
+int emb_ext_flash_host_dev_open_file(emb_ext_flash_host_dev_t *p_dev, const char *path, uint32_t size)
+{
+   struct stat st;
+   uint8_t     blank[EXT_FLASH_SECTOR_SIZE];
+
+   // Null check, the size has to be a power of two number of sectors
+   if (!p_dev || !path || size < EXT_FLASH_SECTOR_SIZE || (size & (size - 1)))
+   {
+      return(-1);
+   }
+
+   host_dev_defaults(p_dev, size);
+   p_dev->fd = open(path, O_RDWR | O_CREAT, 0644);
+   if (p_dev->fd < 0 || fstat(p_dev->fd, &st) != 0)
+   {
+      emb_ext_flash_host_dev_close(p_dev);
+      return(-1);
+   }
+
+   // Extend short images with erased bytes
+   memset(blank, 0xFF, sizeof(blank));
+   for (off_t off = st.st_size; off < size; )
+   {
+      size_t  chunk = (size_t)(size - off) < sizeof(blank) ? (size_t)(size - off) : sizeof(blank);
+      ssize_t rtn   = pwrite(p_dev->fd, blank, chunk, off);
+      if (rtn <= 0)
+      {
+         emb_ext_flash_host_dev_close(p_dev);
+         return(-1);
+      }
+      off += rtn;
+   }
+
+   p_dev->mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, p_dev->fd, 0);
+   if (p_dev->mem == MAP_FAILED)
+   {
+      p_dev->mem = NULL;
+      emb_ext_flash_host_dev_close(p_dev);
+      return(-1);
+   }
+
+   return(0);
+}
+
+void emb_ext_flash_host_dev_close(emb_ext_flash_host_dev_t *p_dev)
+{
+   // Null check
+   if (!p_dev)
+   {
+      return;
+   }
+
+   if (p_dev->fd >= 0)
+   {
+      if (p_dev->mem)
+      {
+         msync(p_dev->mem, p_dev->size, MS_SYNC);
+         munmap(p_dev->mem, p_dev->size);
+      }
+      close(p_dev->fd);
+   }
+   else
+   {
+      free(p_dev->mem);
+   }
+   p_dev->mem = NULL;
+   p_dev->fd  = -1;
+}
+
+void emb_ext_flash_host_dev_bind(emb_ext_flash_host_dev_t *p_dev)
+{
+   _bound = p_dev;
+}
+
+int emb_ext_flash_host_dev_handle(emb_flash_intf_handle_t *p_intf)
+{
+   // Null check
+   if (!p_intf)
+   {
+      return(-1);
+   }
+
+   memset(p_intf, 0, sizeof(*p_intf));
+   p_intf->select      = host_dev_select;
+   p_intf->deselect    = host_dev_deselect;
+   p_intf->write       = host_dev_write;
+   p_intf->read        = host_dev_read;
+   p_intf->delay_us    = host_dev_delay_us;
+   p_intf->get_time_us = host_dev_get_time_us;
+
+   return(emb_ext_flash_init_intf(p_intf));
+}
@@ -0,0 +1,137 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_HOST_DEV_H_
+#define EMB_EXT_FLASH_HOST_DEV_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <time.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Emulated JEDEC serial NOR flash devices for Linux hosts, backed by RAM or by an image file.
+ *
+ * Each device decodes the same command set the driver uses, so any number of them can be driven through ordinary interface
+ * handles. The handle functions carry no context, so each thread binds the device it talks to with
+ * emb_ext_flash_host_dev_bind() and the shared bus functions go to the device bound to the calling thread. With a non zero
+ * time scale the device holds BUSY for the typical program and erase times and clocks bytes at the configured SPI rate,
+ * sleeping the calling thread, so several devices driven from several threads overlap the way real parts on separate buses
+ * do.
+ */
+
+// Typical timings in microseconds and the SPI clock in kHz used when a device is opened
+#define EXT_FLASH_HOST_DEV_TPP_US         700
+#define EXT_FLASH_HOST_DEV_T4K_US         45000
+#define EXT_FLASH_HOST_DEV_T32K_US        120000
+#define EXT_FLASH_HOST_DEV_T64K_US        150000
+#define EXT_FLASH_HOST_DEV_TCHIP_US       2000000
+#define EXT_FLASH_HOST_DEV_SPI_KHZ        8000
+
+/**
+ * @brief emb_ext_flash_host_dev_t - emulated device. The timing and JEDEC ID fields can be changed after opening, treat the
+ * rest as private apart from the statistics.
+ */
+typedef struct
+{
+   // Memory, its size and the backing file descriptor, -1 for RAM.
+   uint8_t *mem;
+   uint32_t size;
+   int      fd;
+   // JEDEC ID reported by the device.
+   uint32_t jedec_id;
+   // Timings, the SPI clock and the factor applied to all of them, 0 runs without any delays.
+   uint32_t tpp_us;
+   uint32_t t4k_us;
+   uint32_t t32k_us;
+   uint32_t t64k_us;
+   uint32_t tchip_us;
+   uint32_t spi_khz;
+   double   time_scale;
+   // Command decoder state.
+   uint8_t  cmd;
+   uint8_t  phase;
+   uint8_t  addr_count;
+   uint8_t  addr_len;
+   uint32_t addr;
+   uint32_t offset;
+   uint8_t  wel;
+   uint8_t  powered_down;
+   uint8_t  selected;
+   // Time the current program or erase completes and bus time owed but not slept yet.
+   struct timespec ready_at;
+   double          bus_debt_us;
+   // Statistics: bytes clocked, page programs and erases.
+   uint64_t stat_bytes;
+   uint32_t stat_programs;
+   uint32_t stat_erases;
+} emb_ext_flash_host_dev_t;
+
+/**
+ * @brief emb_ext_flash_host_dev_open_ram open a device backed by RAM, filled with 0xFF.
+ *
+ * @param p_dev - pointer to the device.
+ * @param size - size of the device in bytes.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_host_dev_open_ram(emb_ext_flash_host_dev_t *p_dev, uint32_t size);
+
+/**
+ * @brief emb_ext_flash_host_dev_open_file open a device backed by an image file. A missing file is created blank, a short
+ * one is extended with 0xFF, and changes reach the file as they are made.
+ *
+ * @param p_dev - pointer to the device.
+ * @param path - path of the image file.
+ * @param size - size of the device in bytes.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_host_dev_open_file(emb_ext_flash_host_dev_t *p_dev, const char *path, uint32_t size);
+
+/**
+ * @brief emb_ext_flash_host_dev_close release a device, flushing file backed ones.
+ *
+ * @param p_dev - pointer to the device.
+ */
+void emb_ext_flash_host_dev_close(emb_ext_flash_host_dev_t *p_dev);
+
+/**
+ * @brief emb_ext_flash_host_dev_bind bind a device to the calling thread, the bus functions of every handle created with
+ * emb_ext_flash_host_dev_handle() go to it from then on.
+ *
+ * @param p_dev - pointer to the device, NULL to unbind.
+ */
+void emb_ext_flash_host_dev_bind(emb_ext_flash_host_dev_t *p_dev);
+
+/**
+ * @brief emb_ext_flash_host_dev_handle fill in and initialise an interface handle wired to whichever device is bound to the
+ * calling thread.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_host_dev_handle(emb_flash_intf_handle_t *p_intf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_HOST_DEV_H_ */
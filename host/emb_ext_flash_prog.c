@@ -0,0 +1,316 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "emb_ext_flash_crc.h"
+#include "emb_ext_flash_prog.h"
+
+// Read-back chunk used by the blank check and the verify pass
+#define PROG_CHUNK_SIZE    EXT_FLASH_SECTOR_SIZE
+
+// Worker thread argument
+typedef struct
+{
+   emb_ext_flash_prog_job_t        *p_job;
+   const emb_ext_flash_prog_opts_t *p_opts;
+   const uint8_t                   *image;
+   uint32_t                         len;
+   uint32_t                         crc;
+} prog_worker_t;
+
+// Private functions
+static uint64_t prog_now_us()
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return(now.tv_sec * 1000000ull + now.tv_nsec / 1000);
+}
+
+static uint8_t prog_blank(const uint8_t *data, uint32_t len)
+{
+   for (uint32_t i = 0; i < len; i++)
+   {
+      if (data[i] != 0xFF)
+      {
+         return(0);
+      }
+   }
+
+   return(1);
+}
+
+// Check whether a range of the device reads back blank
+static int prog_read_blank(emb_flash_intf_handle_t *p_intf, uint32_t address, uint32_t len)
+{
+   uint8_t buf[PROG_CHUNK_SIZE];
+
+   for (uint32_t off = 0; off < len; off += sizeof(buf))
+   {
+      uint32_t chunk = len - off < sizeof(buf) ? len - off : sizeof(buf);
+      if (emb_ext_flash_read(p_intf, address + off, buf, chunk) != (int)chunk)
+      {
+         return(-1);
+      }
+      if (!prog_blank(buf, chunk))
+      {
+         return(0);
+      }
+   }
+
+   return(1);
+}
+
+// Erase one unit unless it is already blank
+static int prog_erase_unit(emb_ext_flash_prog_job_t *p_job, const emb_ext_flash_prog_opts_t *p_opts, uint32_t address, uint32_t len)
+{
+   if (p_opts->blank_check)
+   {
+      int blank = prog_read_blank(p_job->p_intf, address, len);
+      if (blank < 0)
+      {
+         return(-1);
+      }
+      if (blank)
+      {
+         p_job->erases_skipped++;
+         return(0);
+      }
+   }
+
+   p_job->erases++;
+   if (len == p_opts->capacity)
+   {
+      return(emb_ext_flash_chip_erase(p_job->p_intf));
+   }
+
+   return(emb_ext_flash_erase(p_job->p_intf, address, len));
+}
+
+// Cover the sectors holding the image with the fewest erase commands, a chip erase when the image spans the whole part
+static int prog_erase(emb_ext_flash_prog_job_t *p_job, const emb_ext_flash_prog_opts_t *p_opts, uint32_t len)
+{
+   uint32_t addr = p_opts->address & ~(uint32_t)(EXT_FLASH_SECTOR_SIZE - 1);
+   uint32_t end  = (p_opts->address + len + EXT_FLASH_SECTOR_SIZE - 1) & ~(uint32_t)(EXT_FLASH_SECTOR_SIZE - 1);
+
+   if (p_opts->capacity && addr == 0 && end >= p_opts->capacity)
+   {
+      return(prog_erase_unit(p_job, p_opts, 0, p_opts->capacity));
+   }
+
+   while (addr < end)
+   {
+      uint32_t step = EXT_FLASH_SECTOR_SIZE;
+      if (!(addr % EXT_FLASH_BLOCK_64K_SIZE) && end - addr >= EXT_FLASH_BLOCK_64K_SIZE)
+      {
+         step = EXT_FLASH_BLOCK_64K_SIZE;
+      }
+      else if (!(addr % EXT_FLASH_BLOCK_32K_SIZE) && end - addr >= EXT_FLASH_BLOCK_32K_SIZE)
+      {
+         step = EXT_FLASH_BLOCK_32K_SIZE;
+      }
+      if (prog_erase_unit(p_job, p_opts, addr, step) != 0)
+      {
+         return(-1);
+      }
+      addr += step;
+   }
+
+   return(0);
+}
+
+// Program every page of the image that holds something other than 0xFF
+static int prog_program(emb_ext_flash_prog_job_t *p_job, const emb_ext_flash_prog_opts_t *p_opts, const uint8_t *image, uint32_t len)
+{
+   uint32_t off = 0;
+
+   while (off < len)
+   {
+      uint32_t addr  = p_opts->address + off;
+      uint32_t chunk = EXT_FLASH_PAGE_SIZE - (addr % EXT_FLASH_PAGE_SIZE);
+      if (chunk > len - off)
+      {
+         chunk = len - off;
+      }
+
+      if (prog_blank(&image[off], chunk))
+      {
+         p_job->pages_skipped++;
+      }
+      else
+      {
+         if (emb_ext_flash_write(p_job->p_intf, addr, (uint8_t *)&image[off], chunk) != (int)chunk)
+         {
+            return(-1);
+         }
+         p_job->pages_programmed++;
+      }
+      off += chunk;
+   }
+
+   return(0);
+}
+
+static int prog_verify(emb_ext_flash_prog_job_t *p_job, const emb_ext_flash_prog_opts_t *p_opts, uint32_t len)
+{
+   uint8_t buf[PROG_CHUNK_SIZE];
+
+   p_job->crc = EXT_FLASH_CRC32_INIT;
+   for (uint32_t off = 0; off < len; off += sizeof(buf))
+   {
+      uint32_t chunk = len - off < sizeof(buf) ? len - off : sizeof(buf);
+      if (emb_ext_flash_read(p_job->p_intf, p_opts->address + off, buf, chunk) != (int)chunk)
+      {
+         return(-1);
+      }
+      p_job->crc = emb_ext_flash_crc32(p_job->crc, buf, chunk);
+   }
+
+   return(0);
+}
+
+static void *prog_worker(void *arg)
+{
+   prog_worker_t            *p_w   = arg;
+   emb_ext_flash_prog_job_t *p_job = p_w->p_job;
+   uint64_t                  start = prog_now_us();
+   uint64_t                  t;
+
+   if (p_job->bind)
+   {
+      p_job->bind(p_job->bind_ctx);
+   }
+
+   t = prog_now_us();
+   if (prog_erase(p_job, p_w->p_opts, p_w->len) != 0)
+   {
+      return(NULL);
+   }
+   p_job->erase_us = prog_now_us() - t;
+
+   t = prog_now_us();
+   if (prog_program(p_job, p_w->p_opts, p_w->image, p_w->len) != 0)
+   {
+      return(NULL);
+   }
+   p_job->program_us = prog_now_us() - t;
+
+   if (p_w->p_opts->verify)
+   {
+      t = prog_now_us();
+      if (prog_verify(p_job, p_w->p_opts, p_w->len) != 0)
+      {
+         return(NULL);
+      }
+      p_job->verify_us = prog_now_us() - t;
+      if (p_job->crc != p_w->crc)
+      {
+         p_job->result = EXT_FLASH_PROG_ERR_VERIFY;
+         return(NULL);
+      }
+   }
+
+   p_job->total_us = prog_now_us() - start;
+   p_job->result   = EXT_FLASH_PROG_OK;
+
+   return(NULL);
+}
+
+static void prog_bind_host_dev(void *ctx)
+{
+   emb_ext_flash_host_dev_bind(ctx);
+}
+
+// Public functions
+int emb_ext_flash_prog_job_host_dev(emb_ext_flash_prog_job_t *p_job, emb_flash_intf_handle_t *p_intf, emb_ext_flash_host_dev_t *p_dev)
+{
+   // Null check
+   if (!p_job || !p_intf || !p_dev)
+   {
+      return(-1);
+   }
+
+   memset(p_job, 0, sizeof(*p_job));
+   p_job->p_intf   = p_intf;
+   p_job->bind     = prog_bind_host_dev;
+   p_job->bind_ctx = p_dev;
+
+   return(emb_ext_flash_host_dev_handle(p_intf));
+}
+
+int emb_ext_flash_prog_run(emb_ext_flash_prog_job_t *jobs, uint32_t count, const uint8_t *image, uint32_t len,
+                           const emb_ext_flash_prog_opts_t *p_opts)
+{
+   // Null check
+   if (!jobs || !count || !image || !len || !p_opts)
+   {
+      return(-1);
+   }
+
+   prog_worker_t *workers = calloc(count, sizeof(*workers));
+   pthread_t     *threads = calloc(count, sizeof(*threads));
+   uint8_t       *started = calloc(count, 1);
+   if (!workers || !threads || !started)
+   {
+      free(workers);
+      free(threads);
+      free(started);
+      return(-1);
+   }
+
+   // The image CRC is worked out once and shared by every verify pass
+   uint32_t crc = emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, image, len);
+   for (uint32_t i = 0; i < count; i++)
+   {
+      // Clear the results of any previous run
+      emb_ext_flash_prog_job_t job = { .p_intf = jobs[i].p_intf, .bind = jobs[i].bind, .bind_ctx = jobs[i].bind_ctx };
+      jobs[i]        = job;
+      jobs[i].result = EXT_FLASH_PROG_ERR_IO;
+
+      workers[i].p_job  = &jobs[i];
+      workers[i].p_opts = p_opts;
+      workers[i].image  = image;
+      workers[i].len    = len;
+      workers[i].crc    = crc;
+      started[i]        = pthread_create(&threads[i], NULL, prog_worker, &workers[i]) == 0;
+   }
+
+   int rtn = 0;
+   for (uint32_t i = 0; i < count; i++)
+   {
+      if (started[i])
+      {
+         pthread_join(threads[i], NULL);
+      }
+      if (jobs[i].result != EXT_FLASH_PROG_OK)
+      {
+         rtn = -1;
+      }
+   }
+
+   free(workers);
+   free(threads);
+   free(started);
+
+   return(rtn);
+}
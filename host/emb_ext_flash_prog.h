@@ -0,0 +1,110 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_PROG_H_
+#define EMB_EXT_FLASH_PROG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+#include "emb_ext_flash_host_dev.h"
+
+/*
+ * Parallel production programmer for Linux hosts. One worker thread per device erases the image range with the largest
+ * aligned erase commands that fit (or a chip erase when the image covers the whole part), skipping units that read back
+ * blank, programs every page of the image that is not all 0xFF and verifies by comparing a streaming CRC-32 of the range
+ * against that of the image, so no read-back buffer is needed.
+ */
+
+// Programmer results
+#define EXT_FLASH_PROG_OK                0
+#define EXT_FLASH_PROG_ERR_IO           -1
+#define EXT_FLASH_PROG_ERR_VERIFY       -2
+
+/**
+ * @brief emb_ext_flash_prog_opts_t - options shared by every device in a run.
+ */
+typedef struct
+{
+   // Address the image is programmed to.
+   uint32_t address;
+   // Capacity of the devices in bytes, used to decide on a chip erase, 0 if unknown.
+   uint32_t capacity;
+   // Flag to read each erase unit first and skip the erase if it is already blank.
+   uint8_t blank_check;
+   // Flag to verify the programmed range.
+   uint8_t verify;
+} emb_ext_flash_prog_opts_t;
+
+/**
+ * @brief emb_ext_flash_prog_job_t - one device in a run. The caller fills in the handle and the bind hook, the rest is
+ * written by the worker.
+ */
+typedef struct
+{
+   // Interface handle of the device, and a hook run on the worker thread before the handle is used, may be NULL.
+   emb_flash_intf_handle_t *p_intf;
+   void                   (*bind)(void *ctx);
+   void                    *bind_ctx;
+   // Result, one of EXT_FLASH_PROG_*, and the CRC-32 read back.
+   int      result;
+   uint32_t crc;
+   // Time spent in each phase and in total, in microseconds.
+   uint32_t erase_us;
+   uint32_t program_us;
+   uint32_t verify_us;
+   uint32_t total_us;
+   // Erase commands issued and erase units found blank, pages programmed and pages skipped for being all 0xFF.
+   uint32_t erases;
+   uint32_t erases_skipped;
+   uint32_t pages_programmed;
+   uint32_t pages_skipped;
+} emb_ext_flash_prog_job_t;
+
+/**
+ * @brief emb_ext_flash_prog_job_host_dev set up a job for an emulated device.
+ *
+ * @param p_job - pointer to the job.
+ * @param p_intf - pointer to an interface handle to wire to the device.
+ * @param p_dev - pointer to the device.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_prog_job_host_dev(emb_ext_flash_prog_job_t *p_job, emb_flash_intf_handle_t *p_intf, emb_ext_flash_host_dev_t *p_dev);
+
+/**
+ * @brief emb_ext_flash_prog_run program an image to every device at once and wait for all of them.
+ *
+ * @param jobs - array of jobs, one per device.
+ * @param count - number of jobs.
+ * @param image - the image.
+ * @param len - length of the image.
+ * @param p_opts - pointer to the options.
+ * @return int - 0 if every device programmed and verified, -1 otherwise, see each job's result.
+ */
+int emb_ext_flash_prog_run(emb_ext_flash_prog_job_t *jobs, uint32_t count, const uint8_t *image, uint32_t len,
+                           const emb_ext_flash_prog_opts_t *p_opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_PROG_H_ */
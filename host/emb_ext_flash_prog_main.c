@@ -0,0 +1,173 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "emb_ext_flash_prog.h"
+
+// Limits of the command line tool
+#define PROG_MAX_DEVICES     256
+#define PROG_DEFAULT_SIZE    0x400000
+
+static void usage(const char *name)
+{
+   fprintf(stderr,
+           "usage: %s [options] image.bin\n"
+           "  -a ADDR   address to program the image to (default 0)\n"
+           "  -s SIZE   device size in bytes (default 4 MiB)\n"
+           "  -n N      program N RAM backed simulated devices\n"
+           "  -f FILE   program an image file backed device, may be repeated\n"
+           "  -t SCALE  scale applied to the simulated program, erase and bus times, 0 for none (default 1)\n"
+           "  -B        skip the blank check before erasing\n"
+           "  -V        skip the verify pass\n", name);
+}
+
+static uint8_t *load_image(const char *path, uint32_t *len)
+{
+   FILE *f = fopen(path, "rb");
+   if (!f)
+   {
+      return(NULL);
+   }
+
+   fseek(f, 0, SEEK_END);
+   long size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+
+   uint8_t *image = size > 0 ? malloc(size) : NULL;
+   if (image && fread(image, 1, size, f) != (size_t)size)
+   {
+      free(image);
+      image = NULL;
+   }
+   fclose(f);
+   *len = size;
+
+   return(image);
+}
+
+int main(int argc, char **argv)
+{
+   static emb_ext_flash_host_dev_t devs[PROG_MAX_DEVICES];
+   static emb_flash_intf_handle_t  intfs[PROG_MAX_DEVICES];
+   static emb_ext_flash_prog_job_t jobs[PROG_MAX_DEVICES];
+   const char                     *files[PROG_MAX_DEVICES];
+   emb_ext_flash_prog_opts_t       opts  = { 0, 0, 1, 1 };
+   uint32_t                        size  = PROG_DEFAULT_SIZE;
+   uint32_t                        sims  = 0;
+   uint32_t                        nfile = 0;
+   double                          scale = 1.0;
+   int                             opt;
+
+   while ((opt = getopt(argc, argv, "a:s:n:f:t:BVh")) != -1)
+   {
+      switch (opt)
+      {
+      case 'a':
+         opts.address = strtoul(optarg, NULL, 0);
+         break;
+
+      case 's':
+         size = strtoul(optarg, NULL, 0);
+         break;
+
+      case 'n':
+         sims = strtoul(optarg, NULL, 0);
+         break;
+
+      case 'f':
+         if (nfile < PROG_MAX_DEVICES)
+         {
+            files[nfile++] = optarg;
+         }
+         break;
+
+      case 't':
+         scale = strtod(optarg, NULL);
+         break;
+
+      case 'B':
+         opts.blank_check = 0;
+         break;
+
+      case 'V':
+         opts.verify = 0;
+         break;
+
+      default:
+         usage(argv[0]);
+         return(opt == 'h' ? 0 : 2);
+      }
+   }
+   if (optind != argc - 1 || (!sims && !nfile) || sims + nfile > PROG_MAX_DEVICES)
+   {
+      usage(argv[0]);
+      return(2);
+   }
+
+   uint32_t len;
+   uint8_t *image = load_image(argv[optind], &len);
+   if (!image || opts.address + len > size)
+   {
+      fprintf(stderr, "cannot load %s or it does not fit the device\n", argv[optind]);
+      return(1);
+   }
+   opts.capacity = size;
+
+   // Open the backends, image files first
+   uint32_t count = sims + nfile;
+   for (uint32_t i = 0; i < count; i++)
+   {
+      int rtn = i < nfile ? emb_ext_flash_host_dev_open_file(&devs[i], files[i], size) : emb_ext_flash_host_dev_open_ram(&devs[i], size);
+      if (rtn != 0 || emb_ext_flash_prog_job_host_dev(&jobs[i], &intfs[i], &devs[i]) != 0)
+      {
+         fprintf(stderr, "cannot open device %u\n", (unsigned)i);
+         return(1);
+      }
+      devs[i].time_scale = scale;
+   }
+
+   struct timespec t0, t1;
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   int rtn = emb_ext_flash_prog_run(jobs, count, image, len, &opts);
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   double wall_ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+
+   // Per device timing
+   printf("%-4s %-24s %10s %10s %10s %10s %8s %8s %8s %8s  %s\n", "dev", "backend", "erase ms", "program ms", "verify ms", "total ms",
+          "erases", "blank", "pages", "skipped", "result");
+   for (uint32_t i = 0; i < count; i++)
+   {
+      emb_ext_flash_prog_job_t *j = &jobs[i];
+      printf("%-4u %-24.24s %10.1f %10.1f %10.1f %10.1f %8u %8u %8u %8u  %s\n", (unsigned)i, i < nfile ? files[i] : "ram",
+             j->erase_us / 1e3, j->program_us / 1e3, j->verify_us / 1e3, j->total_us / 1e3, (unsigned)j->erases,
+             (unsigned)j->erases_skipped, (unsigned)j->pages_programmed, (unsigned)j->pages_skipped,
+             j->result == EXT_FLASH_PROG_OK ? "ok" : j->result == EXT_FLASH_PROG_ERR_VERIFY ? "VERIFY FAILED" : "IO ERROR");
+      emb_ext_flash_host_dev_close(&devs[i]);
+   }
+   printf("%u devices, %u bytes each, %.1f ms wall, %.1f KiB/s aggregate\n", (unsigned)count, (unsigned)len, wall_ms,
+          (double)len * count / 1024.0 / (wall_ms / 1e3));
+
+   free(image);
+
+   return(rtn == 0 ? 0 : 1);
+}
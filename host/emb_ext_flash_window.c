@@ -0,0 +1,432 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#define _GNU_SOURCE
+#include <string.h>
+#include "emb_ext_flash_window.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Largest single flash read, the length is 16 bits and the count comes back as an int so a 64K page is read in halves
+#define EXT_FLASH_WINDOW_READ_MAX 0x8000
+
+// Private functions
+static uint32_t window_pages(emb_ext_flash_window_t *p_win)
+{
+   return((p_win->size + p_win->page_size - 1) / p_win->page_size);
+}
+
+static uint8_t window_present(emb_ext_flash_window_t *p_win, uint32_t page)
+{
+   return((p_win->present[page >> 3] >> (page & 7)) & 1);
+}
+
+static void window_set_present(emb_ext_flash_window_t *p_win, uint32_t page, uint8_t value)
+{
+   if (value)
+   {
+      p_win->present[page >> 3] |= (uint8_t)(1 << (page & 7));
+   }
+   else
+   {
+      p_win->present[page >> 3] &= (uint8_t)~(1 << (page & 7));
+   }
+}
+
+// Drop the oldest resident page, the next access to it faults again
+static void window_evict(emb_ext_flash_window_t *p_win)
+{
+   uint32_t page = p_win->resident[p_win->res_head];
+
+   madvise((void *)(p_win->mem + (size_t)page * p_win->page_size), p_win->page_size, MADV_DONTNEED);
+   window_set_present(p_win, page, 0);
+   p_win->res_head = (p_win->res_head + 1) % p_win->max_resident;
+   p_win->res_count--;
+   p_win->stat_evictions++;
+}
+
+// Read a run of pages into the staging buffer, anything past the end of the flash or that fails to read reads as 0xFF
+static void window_fetch(emb_ext_flash_window_t *p_win, uint32_t page, uint32_t count)
+{
+   uint32_t len = count * p_win->page_size;
+   uint32_t at  = page * p_win->page_size;
+   uint32_t chunk;
+
+   memset(p_win->staging, 0xFF, len);
+   for (uint32_t off = 0; off < len && at + off < p_win->size; off += chunk)
+   {
+      chunk = p_win->size - (at + off) < len - off ? p_win->size - (at + off) : len - off;
+      if (chunk > EXT_FLASH_WINDOW_READ_MAX)
+      {
+         chunk = EXT_FLASH_WINDOW_READ_MAX;
+      }
+      if (emb_ext_flash_read(p_win->p_intf, at + off, p_win->staging + off, (uint16_t)chunk) != (int)chunk)
+      {
+         memset(p_win->staging + off, 0xFF, chunk);
+         p_win->stat_read_errors++;
+      }
+      p_win->stat_bytes_read += chunk;
+   }
+}
+
+// Serve a fault: fetch the page and the following pages that are not resident, up to the read-ahead
+static void window_serve(emb_ext_flash_window_t *p_win, uint64_t address)
+{
+   uint32_t pages = window_pages(p_win);
+   uint32_t page  = (uint32_t)((address - (uintptr_t)p_win->mem) / p_win->page_size);
+   uint32_t count = 1;
+
+   pthread_mutex_lock(&p_win->lock);
+
+   // Another fault already brought the page in, only the faulting thread needs waking
+   if (window_present(p_win, page))
+   {
+      struct uffdio_range wake;
+      wake.start = (uintptr_t)p_win->mem + (uint64_t)page * p_win->page_size;
+      wake.len   = p_win->page_size;
+      ioctl(p_win->uffd, UFFDIO_WAKE, &wake);
+      pthread_mutex_unlock(&p_win->lock);
+      return;
+   }
+
+   while (count < p_win->readahead && page + count < pages && !window_present(p_win, page + count))
+   {
+      count++;
+   }
+
+   // Make room first, the new pages go to the back of the list
+   while (p_win->res_count + count > p_win->max_resident)
+   {
+      window_evict(p_win);
+   }
+
+   window_fetch(p_win, page, count);
+
+   // Book the pages in before the copy wakes the faulting thread
+   for (uint32_t i = 0; i < count; i++)
+   {
+      window_set_present(p_win, page + i, 1);
+      p_win->resident[(p_win->res_head + p_win->res_count) % p_win->max_resident] = page + i;
+      p_win->res_count++;
+   }
+   p_win->stat_faults++;
+   p_win->stat_pages_fetched   += count;
+   p_win->stat_readahead_pages += count - 1;
+
+   struct uffdio_copy copy;
+   memset(&copy, 0, sizeof(copy));
+   copy.dst = (uintptr_t)p_win->mem + (uint64_t)page * p_win->page_size;
+   copy.src = (uintptr_t)p_win->staging;
+   copy.len = (uint64_t)count * p_win->page_size;
+   if (ioctl(p_win->uffd, UFFDIO_COPY, &copy) != 0 && errno != EEXIST)
+   {
+      p_win->stat_read_errors++;
+   }
+
+   pthread_mutex_unlock(&p_win->lock);
+}
+
+static void *window_handler(void *arg)
+{
+   emb_ext_flash_window_t *p_win = arg;
+   struct pollfd           fds[2];
+
+   if (p_win->bind)
+   {
+      p_win->bind(p_win->bind_ctx);
+   }
+
+   fds[0].fd     = p_win->uffd;
+   fds[0].events = POLLIN;
+   fds[1].fd     = p_win->stop_fd[0];
+   fds[1].events = POLLIN;
+
+   for ( ; ; )
+   {
+      if (poll(fds, 2, -1) < 0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+         break;
+      }
+      if (fds[1].revents)
+      {
+         break;
+      }
+
+      struct uffd_msg msg;
+      if (read(p_win->uffd, &msg, sizeof(msg)) != sizeof(msg))
+      {
+         continue;
+      }
+      if (msg.event == UFFD_EVENT_PAGEFAULT)
+      {
+         window_serve(p_win, msg.arg.pagefault.address);
+      }
+   }
+
+   return(NULL);
+}
+
+static int window_uffd()
+{
+   int fd = -1;
+
+   // User mode only faults are all a window needs, and do not need privileges
+#ifdef UFFD_USER_MODE_ONLY
+   fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+#endif
+   if (fd < 0)
+   {
+      fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+   }
+   if (fd < 0)
+   {
+      return(-1);
+   }
+
+   struct uffdio_api api;
+   memset(&api, 0, sizeof(api));
+   api.api = UFFD_API;
+   if (ioctl(fd, UFFDIO_API, &api) != 0)
+   {
+      close(fd);
+      return(-1);
+   }
+
+   return(fd);
+}
+
+static void window_release(emb_ext_flash_window_t *p_win)
+{
+   if (p_win->mem)
+   {
+      munmap((void *)p_win->mem, (size_t)window_pages(p_win) * p_win->page_size);
+   }
+   if (p_win->uffd >= 0)
+   {
+      close(p_win->uffd);
+   }
+   if (p_win->stop_fd[0] >= 0)
+   {
+      close(p_win->stop_fd[0]);
+      close(p_win->stop_fd[1]);
+   }
+   free(p_win->resident);
+   free(p_win->present);
+   free(p_win->staging);
+   p_win->mem = NULL;
+}
+
+static void window_bind_host_dev(void *ctx)
+{
+   emb_ext_flash_host_dev_bind(ctx);
+}
+
+// Public functions
+int emb_ext_flash_window_open(emb_ext_flash_window_t *p_win, emb_flash_intf_handle_t *p_intf, void (*bind)(void *ctx),
+                              void *bind_ctx, uint32_t size, uint32_t readahead, uint32_t max_resident)
+{
+   // Null check
+   if (!p_win || !p_intf || !p_intf->initialized || !size)
+   {
+      return(-1);
+   }
+
+   memset(p_win, 0, sizeof(*p_win));
+   p_win->p_intf       = p_intf;
+   p_win->bind         = bind;
+   p_win->bind_ctx     = bind_ctx;
+   p_win->size         = size;
+   p_win->page_size    = (uint32_t)sysconf(_SC_PAGESIZE);
+   p_win->max_resident = max_resident ? max_resident : EXT_FLASH_WINDOW_RESIDENT;
+   p_win->readahead    = readahead ? readahead : EXT_FLASH_WINDOW_READAHEAD;
+   p_win->uffd         = -1;
+   p_win->stop_fd[0]   = -1;
+   if (p_win->readahead > p_win->max_resident)
+   {
+      p_win->readahead = p_win->max_resident;
+   }
+
+   uint32_t pages = window_pages(p_win);
+   p_win->resident = malloc(p_win->max_resident * sizeof(uint32_t));
+   p_win->present  = calloc((pages + 7) / 8, 1);
+   p_win->staging  = malloc((size_t)p_win->readahead * p_win->page_size);
+   if (!p_win->resident || !p_win->present || !p_win->staging || pipe(p_win->stop_fd) != 0)
+   {
+      p_win->stop_fd[0] = -1;
+      window_release(p_win);
+      return(-1);
+   }
+
+   // Reserve the range and hand its missing page faults to the handler thread
+   void *mem = mmap(NULL, (size_t)pages * p_win->page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   if (mem == MAP_FAILED)
+   {
+      window_release(p_win);
+      return(-1);
+   }
+   p_win->mem  = mem;
+   p_win->uffd = window_uffd();
+
+   struct uffdio_register reg;
+   memset(&reg, 0, sizeof(reg));
+   reg.range.start = (uintptr_t)mem;
+   reg.range.len   = (uint64_t)pages * p_win->page_size;
+   reg.mode        = UFFDIO_REGISTER_MODE_MISSING;
+   if (p_win->uffd < 0 || ioctl(p_win->uffd, UFFDIO_REGISTER, &reg) != 0)
+   {
+      window_release(p_win);
+      return(-1);
+   }
+
+   pthread_mutex_init(&p_win->lock, NULL);
+   if (pthread_create(&p_win->thread, NULL, window_handler, p_win) != 0)
+   {
+      pthread_mutex_destroy(&p_win->lock);
+      window_release(p_win);
+      return(-1);
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_window_open_host_dev(emb_ext_flash_window_t *p_win, emb_flash_intf_handle_t *p_intf,
+                                       emb_ext_flash_host_dev_t *p_dev, uint32_t readahead, uint32_t max_resident)
+{
+   // Null check
+   if (!p_win || !p_intf || !p_dev || emb_ext_flash_host_dev_handle(p_intf) != 0)
+   {
+      return(-1);
+   }
+
+   return(emb_ext_flash_window_open(p_win, p_intf, window_bind_host_dev, p_dev, p_dev->size, readahead, max_resident));
+}
+
+int emb_ext_flash_window_drop(emb_ext_flash_window_t *p_win)
+{
+   // Null check
+   if (!p_win || !p_win->mem)
+   {
+      return(-1);
+   }
+
+   pthread_mutex_lock(&p_win->lock);
+   while (p_win->res_count)
+   {
+      window_evict(p_win);
+   }
+   pthread_mutex_unlock(&p_win->lock);
+
+   return(0);
+}
+
+uint32_t emb_ext_flash_window_resident(emb_ext_flash_window_t *p_win)
+{
+   // Null check
+   if (!p_win || !p_win->mem)
+   {
+      return(0);
+   }
+
+   pthread_mutex_lock(&p_win->lock);
+   uint32_t count = p_win->res_count;
+   pthread_mutex_unlock(&p_win->lock);
+
+   return(count);
+}
+
+void emb_ext_flash_window_close(emb_ext_flash_window_t *p_win)
+{
+   // Null check
+   if (!p_win || !p_win->mem)
+   {
+      return;
+   }
+
+   // Stop the handler thread, then tear everything down
+   uint8_t stop = 1;
+   if (write(p_win->stop_fd[1], &stop, 1) == 1)
+   {
+      pthread_join(p_win->thread, NULL);
+   }
+   pthread_mutex_destroy(&p_win->lock);
+   window_release(p_win);
+}
+
+#else
+
+int emb_ext_flash_window_open(emb_ext_flash_window_t *p_win, emb_flash_intf_handle_t *p_intf, void (*bind)(void *ctx),
+                              void *bind_ctx, uint32_t size, uint32_t readahead, uint32_t max_resident)
+{
+   (void)p_intf;
+   (void)bind;
+   (void)bind_ctx;
+   (void)size;
+   (void)readahead;
+   (void)max_resident;
+
+   if (p_win)
+   {
+      memset(p_win, 0, sizeof(*p_win));
+   }
+
+   return(-1);
+}
+
+int emb_ext_flash_window_open_host_dev(emb_ext_flash_window_t *p_win, emb_flash_intf_handle_t *p_intf,
+                                       emb_ext_flash_host_dev_t *p_dev, uint32_t readahead, uint32_t max_resident)
+{
+   (void)p_dev;
+
+   return(emb_ext_flash_window_open(p_win, p_intf, NULL, NULL, 0, readahead, max_resident));
+}
+
+int emb_ext_flash_window_drop(emb_ext_flash_window_t *p_win)
+{
+   (void)p_win;
+
+   return(-1);
+}
+
+uint32_t emb_ext_flash_window_resident(emb_ext_flash_window_t *p_win)
+{
+   (void)p_win;
+
+   return(0);
+}
+
+void emb_ext_flash_window_close(emb_ext_flash_window_t *p_win)
+{
+   (void)p_win;
+}
+
+#endif
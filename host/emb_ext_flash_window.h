@@ -0,0 +1,146 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_WINDOW_H_
+#define EMB_EXT_FLASH_WINDOW_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include "emb_ext_flash.h"
+#include "emb_ext_flash_host_dev.h"
+
+/*
+ * Demand-paged read-only memory window over a flash device for Linux host tools.
+ *
+ * The window reserves a virtual address range the size of the flash and registers it with userfaultfd. The first access to
+ * a page faults, and a handler thread serves the fault by reading that page and the next few pages that are not resident yet
+ * through the interface handle, so a tool gets plain pointer access while only the pages it touches are fetched. The number of
+ * resident pages is capped. Pages are dropped in the order they were fetched, which is the least recently faulted order
+ * because an access that does not fault cannot be seen from user space. A dropped page that is still in use faults back in
+ * and goes to the back of the list. Writes to the window fault with SIGSEGV.
+ *
+ * Other platforms get stubs that fail.
+ */
+#ifndef EXT_FLASH_WINDOW_READAHEAD
+#define EXT_FLASH_WINDOW_READAHEAD    4
+#endif
+
+#ifndef EXT_FLASH_WINDOW_RESIDENT
+#define EXT_FLASH_WINDOW_RESIDENT     256
+#endif
+
+/**
+ * @brief emb_ext_flash_window_t - memory window. Treat the contents as private apart from mem and the statistics.
+ */
+typedef struct
+{
+   // Interface handle, and a hook run on the handler thread before the handle is used, may be NULL.
+   emb_flash_intf_handle_t *p_intf;
+   void                   (*bind)(void *ctx);
+   void                    *bind_ctx;
+   // Start of the window, its size in bytes and the host page size.
+   const uint8_t *mem;
+   uint32_t       size;
+   uint32_t       page_size;
+   // Pages read per fault and the resident page limit.
+   uint32_t readahead;
+   uint32_t max_resident;
+   // Resident pages in fetch order as a ring, and a bitmap of resident pages.
+   uint32_t *resident;
+   uint32_t  res_head;
+   uint32_t  res_count;
+   uint8_t  *present;
+   // Staging buffer for the reads.
+   uint8_t *staging;
+   // userfaultfd, the pipe that stops the handler thread, the thread and the lock over the resident pages.
+   int             uffd;
+   int             stop_fd[2];
+   pthread_t       thread;
+   pthread_mutex_t lock;
+   // Statistics: faults served, pages fetched, the share of them fetched by read-ahead, pages dropped, reads that failed.
+   uint32_t stat_faults;
+   uint32_t stat_pages_fetched;
+   uint32_t stat_readahead_pages;
+   uint32_t stat_evictions;
+   uint32_t stat_read_errors;
+   uint64_t stat_bytes_read;
+} emb_ext_flash_window_t;
+
+/**
+ * @brief emb_ext_flash_window_open map the start of a flash device into memory. Bytes past the end of the device up to the
+ * next page read as 0xFF. Pages that fail to read are filled with 0xFF and counted.
+ *
+ * @param p_win - pointer to the window.
+ * @param p_intf - pointer to an initialised interface handle, used from the handler thread only while the window is open.
+ * @param bind - hook run on the handler thread before the handle is first used, may be NULL.
+ * @param bind_ctx - context passed to the hook.
+ * @param size - number of bytes of flash to map.
+ * @param readahead - pages read per fault, 0 for EXT_FLASH_WINDOW_READAHEAD.
+ * @param max_resident - resident page limit, 0 for EXT_FLASH_WINDOW_RESIDENT.
+ * @return int - 0 on success, -1 on failure, including when userfaultfd is not available.
+ */
+int emb_ext_flash_window_open(emb_ext_flash_window_t *p_win, emb_flash_intf_handle_t *p_intf, void (*bind)(void *ctx),
+                              void *bind_ctx, uint32_t size, uint32_t readahead, uint32_t max_resident);
+
+/**
+ * @brief emb_ext_flash_window_open_host_dev map a whole emulated device, wiring the interface handle to it.
+ *
+ * @param p_win - pointer to the window.
+ * @param p_intf - pointer to an interface handle to wire to the device.
+ * @param p_dev - pointer to the device.
+ * @param readahead - pages read per fault, 0 for EXT_FLASH_WINDOW_READAHEAD.
+ * @param max_resident - resident page limit, 0 for EXT_FLASH_WINDOW_RESIDENT.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_window_open_host_dev(emb_ext_flash_window_t *p_win, emb_flash_intf_handle_t *p_intf,
+                                       emb_ext_flash_host_dev_t *p_dev, uint32_t readahead, uint32_t max_resident);
+
+/**
+ * @brief emb_ext_flash_window_drop drop every resident page so the next accesses read the flash again, for use after the
+ * flash has been changed.
+ *
+ * @param p_win - pointer to the window.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_window_drop(emb_ext_flash_window_t *p_win);
+
+/**
+ * @brief emb_ext_flash_window_resident get the number of resident pages.
+ *
+ * @param p_win - pointer to the window.
+ * @return uint32_t - number of resident pages.
+ */
+uint32_t emb_ext_flash_window_resident(emb_ext_flash_window_t *p_win);
+
+/**
+ * @brief emb_ext_flash_window_close stop the handler thread and unmap the window.
+ *
+ * @param p_win - pointer to the window.
+ */
+void emb_ext_flash_window_close(emb_ext_flash_window_t *p_win);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_WINDOW_H_ */
@@ -17,130 +17,477 @@
 *  GitHub: https://github.com/warrenwoolseyiii
 *********************************************************************************/
 
+#include <string.h>
 #include "emb_ext_flash.h"
 #include "emb_ext_flash_version.h"
 
+// Limit of the waits behind the functions without a timeout
+#define EXT_FLASH_WAIT_FOREVER    0xFFFFFFFF
+
 // Private functions
-uint8_t emb_ext_flash_busy(emb_flash_intf_handle_t *p_intf)
+static uint32_t emb_ext_flash_now(emb_flash_intf_handle_t *p_intf)
 {
-   return(emb_ext_flash_get_status(p_intf) & EXT_FLASH_STATUS_REG_BUSY);
+   return(p_intf->get_time_us ? p_intf->get_time_us() : 0);
 }
 
-void emb_ext_flash_write_enable(emb_flash_intf_handle_t *p_intf)
+static uint32_t emb_ext_flash_t_res1(emb_flash_intf_handle_t *p_intf)
 {
-   // Make the command
-   uint8_t cmd = EXT_FLASH_CMD_WRITE_ENABLE;
+   if (p_intf->t_res1_us)
+   {
+      return(p_intf->t_res1_us);
+   }
 
-   // Null check
-   if (!p_intf || !p_intf->initialized)
+   return(p_intf->p_chip && p_intf->p_chip->t_res1_us ? p_intf->p_chip->t_res1_us : EXT_FLASH_DEFAULT_T_RES1_US);
+}
+
+// Close out the current power state period in the asleep / awake totals
+static void emb_ext_flash_pm_account(emb_flash_intf_handle_t *p_intf, uint32_t now)
+{
+   emb_ext_flash_pm_t *p_pm = &p_intf->pm;
+
+   if (!p_intf->get_time_us)
    {
       return;
    }
 
-   // Do the transfer
+   if (p_pm->asleep)
+   {
+      p_pm->asleep_us += now - p_pm->state_since_us;
+   }
+   else
+   {
+      p_pm->awake_us += now - p_pm->state_since_us;
+   }
+   p_pm->state_since_us = now;
+}
+
+// Send a single byte command in its own transaction
+static int emb_ext_flash_cmd(emb_flash_intf_handle_t *p_intf, uint8_t cmd)
+{
    p_intf->select();
-   p_intf->write(&cmd, 1);
+   int rtn = p_intf->write(&cmd, 1);
    p_intf->deselect();
 
-   // Block while the WEL bit in the status register is unset
-   while (!(emb_ext_flash_get_status(p_intf) & EXT_FLASH_STATUS_REG_WEL))
+   return(rtn);
+}
+
+// Close the read command read-ahead left open
+static void emb_ext_flash_ra_close(emb_flash_intf_handle_t *p_intf)
+{
+   if (p_intf->ra.open)
    {
-      ;
+      p_intf->deselect();
+      p_intf->ra.open = 0;
    }
 }
 
-// Pubic functions
-int emb_ext_flash_init_intf(emb_flash_intf_handle_t *p_intf)
+// Throw away what was prefetched
+static void emb_ext_flash_ra_drop(emb_flash_intf_handle_t *p_intf)
 {
-   // Null check
-   if (!p_intf)
+   emb_ext_flash_ra_t *p_ra = &p_intf->ra;
+
+   emb_ext_flash_ra_close(p_intf);
+   p_ra->wasted += p_ra->len - p_ra->pos;
+   p_ra->len     = 0;
+   p_ra->pos     = 0;
+}
+
+// Build a command followed by its address, switching to the 4-byte address form for chips that need it, returns the length
+static uint8_t emb_ext_flash_addr_cmd(emb_flash_intf_handle_t *p_intf, uint8_t type, uint32_t address, uint8_t *cmd)
+{
+   uint8_t n = 0;
+
+   cmd[n++] = type;
+   if (p_intf->p_chip && (p_intf->p_chip->flags & EXT_FLASH_CHIP_FLAG_4BYTE_ADDR))
    {
-      return(-1);
+      switch (type)
+      {
+      case EXT_FLASH_CMD_READ_DATA:
+         cmd[0] = EXT_FLASH_CMD_READ_DATA_4B;
+         break;
+      case EXT_FLASH_CMD_FAST_READ:
+         cmd[0] = EXT_FLASH_CMD_FAST_READ_4B;
+         break;
+      case EXT_FLASH_CMD_PAGE_PROGRAM:
+         cmd[0] = EXT_FLASH_CMD_PAGE_PROGRAM_4B;
+         break;
+      case EXT_FLASH_CMD_SECTOR_ERASE:
+         cmd[0] = EXT_FLASH_CMD_SECTOR_ERASE_4B;
+         break;
+      case EXT_FLASH_CMD_BLOCK_ERASE_32K:
+         cmd[0] = EXT_FLASH_CMD_BLOCK_ERASE_32K_4B;
+         break;
+      case EXT_FLASH_CMD_BLOCK_ERASE_64K:
+         cmd[0] = EXT_FLASH_CMD_BLOCK_ERASE_64K_4B;
+         break;
+      default:
+         break;
+      }
+      cmd[n++] = (address >> 24) & 0xFF;
    }
+   cmd[n++] = (address >> 16) & 0xFF;
+   cmd[n++] = (address >> 8) & 0xFF;
+   cmd[n++] = address & 0xFF;
 
-   // Set the initialized flag to 0;
-   p_intf->initialized = 0;
+   return(n);
+}
 
-   // Check all of the function pointers, if any are null return -1
-   if (!p_intf->select || !p_intf->deselect || !p_intf->write || !p_intf->read || !p_intf->delay_us)
+// Build the read command for address, fast read adds a dummy byte, returns the command length
+static uint8_t emb_ext_flash_read_cmd(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *cmd)
+{
+   // Use fast read when the chip has it, so the bus can run at the full clock rate
+   if (p_intf->p_chip && p_intf->p_chip->read_mode >= EXT_FLASH_READ_MODE_FAST)
    {
-      return(-1);
+      uint8_t n = emb_ext_flash_addr_cmd(p_intf, EXT_FLASH_CMD_FAST_READ, address, cmd);
+      cmd[n++]  = 0xFF;
+      return(n);
    }
 
-   // Set the initialized flag to 1
-   p_intf->initialized = 1;
+   return(emb_ext_flash_addr_cmd(p_intf, EXT_FLASH_CMD_READ_DATA, address, cmd));
+}
 
-   return(0);
+// Set the chip's wrap length, 0 for linear reads
+static int emb_ext_flash_wrap_cmd(emb_flash_intf_handle_t *p_intf, uint8_t len)
+{
+   // W6-W5 select 8, 16, 32 or 64 bytes and W4 set turns wrapping off, after three dummy bytes
+   uint8_t w = 0x10;
+   if (len)
+   {
+      w = 0;
+      for (uint8_t l = 8; l < len; l <<= 1)
+      {
+         w += 0x20;
+      }
+   }
+   uint8_t cmd[5] = { EXT_FLASH_CMD_SET_BURST_WRAP, 0xFF, 0xFF, 0xFF, w };
+
+   p_intf->select();
+   int rtn = p_intf->write(cmd, sizeof(cmd));
+   p_intf->deselect();
+   if (rtn == 0)
+   {
+      p_intf->wrap.active = len;
+      p_intf->wrap.sets++;
+   }
+
+   return(rtn);
 }
 
-int emb_ext_flash_get_jedec_id(emb_flash_intf_handle_t *p_intf, uint8_t *manufacturer_id, uint8_t *memory_type, uint8_t *capacity)
+// Turn wrapping off before a linear read
+static int emb_ext_flash_unwrap(emb_flash_intf_handle_t *p_intf)
 {
-   // Build the command and the payload
-   uint8_t cmd     = EXT_FLASH_CMD_JEDEC_ID;
-   uint8_t data[3] = { 0 };
+   return(p_intf->wrap.active ? emb_ext_flash_wrap_cmd(p_intf, 0) : 0);
+}
 
-   // Null check
-   if (!p_intf || !p_intf->initialized || !manufacturer_id || !memory_type || !capacity)
+// Called at the start of every operation, closes an open read, wakes the chip if needed and waits out whatever is left of tRES1
+static void emb_ext_flash_access(emb_flash_intf_handle_t *p_intf)
+{
+   emb_ext_flash_pm_t *p_pm = &p_intf->pm;
+   uint32_t            now  = emb_ext_flash_now(p_intf);
+
+   emb_ext_flash_ra_close(p_intf);
+
+   if (p_pm->asleep)
    {
-      return(-1);
+      emb_ext_flash_pm_account(p_intf, now);
+      emb_ext_flash_cmd(p_intf, EXT_FLASH_CMD_RELEASE_POWER_DOWN);
+      p_pm->asleep     = 0;
+      p_pm->waking     = 1;
+      p_pm->release_us = now;
+      p_pm->wakes++;
+   }
+
+   if (p_pm->waking)
+   {
+      uint32_t t_res1  = emb_ext_flash_t_res1(p_intf);
+      uint32_t elapsed = p_intf->get_time_us ? now - p_pm->release_us : 0;
+      if (elapsed < t_res1)
+      {
+         p_intf->delay_us(t_res1 - elapsed);
+         now = emb_ext_flash_now(p_intf);
+      }
+      else
+      {
+         p_pm->wakes_no_delay++;
+      }
+      p_pm->waking = 0;
    }
 
+   p_pm->last_access_us = now;
+}
+
+static uint8_t emb_ext_flash_read_status(emb_flash_intf_handle_t *p_intf)
+{
+   // Build the command
+   uint8_t cmd    = EXT_FLASH_CMD_READ_STATUS_REG;
+   uint8_t status = 0;
+
    // Do the transfer
    p_intf->select();
    p_intf->write(&cmd, 1);
-   int rtn = p_intf->read(data, 3);
+   p_intf->read(&status, 1);
    p_intf->deselect();
 
-   // Populate the fields
-   *manufacturer_id = data[0];
-   *memory_type     = data[1];
-   *capacity        = data[2];
+   return(status);
+}
+
+// Read the status register, in low round trip mode answered from the last status while the chip is known to be idle
+static uint8_t emb_ext_flash_status(emb_flash_intf_handle_t *p_intf)
+{
+   emb_ext_flash_rt_t *p_rt = &p_intf->rt;
+
+   if (p_rt->enabled && p_rt->valid)
+   {
+      p_rt->status_reused++;
+      return(p_rt->status);
+   }
+
+   uint8_t status = emb_ext_flash_read_status(p_intf);
+   p_rt->valid    = !(status & EXT_FLASH_STATUS_REG_BUSY);
+   p_rt->status   = status;
+
+   return(status);
+}
+
+uint8_t emb_ext_flash_busy(emb_flash_intf_handle_t *p_intf)
+{
+   return(emb_ext_flash_get_status(p_intf) & EXT_FLASH_STATUS_REG_BUSY);
+}
+
+// Wait for the status register bits in mask to read as value. For a known chip most of the typical time is slept through
+// before the first poll and the polls after that are spaced out, otherwise the status is polled back to back. A bounded wait
+// always delays between polls, as without a time base its delays are the measure of time, gives up after limit_us or when
+// cancelled and records how much of its limit it used. The time waited is added to elapsed when given. In low round trip mode
+// the whole wait is one status read, with a status byte clocked out per poll.
+static int emb_ext_flash_wait_status(emb_flash_intf_handle_t *p_intf, uint8_t mask, uint8_t value, uint32_t typ_us,
+                                     uint32_t limit_us, uint8_t kind, uint32_t *elapsed)
+{
+   emb_ext_flash_deadline_t *p_dl     = &p_intf->dl;
+   uint8_t                   bounded  = limit_us != EXT_FLASH_WAIT_FOREVER;
+   uint32_t                  interval = p_intf->p_chip ? typ_us / EXT_FLASH_POLL_DIVISOR : 0;
+   uint32_t                  start    = emb_ext_flash_now(p_intf);
+   uint32_t                  delayed  = 0;
+   uint32_t                  waited   = 0;
+   uint8_t                   held     = p_intf->rt.enabled;
+   uint8_t                   cmd      = EXT_FLASH_CMD_READ_STATUS_REG;
+   uint8_t                   status   = 0;
+   int                       rtn      = 0;
+
+   if (bounded && interval < EXT_FLASH_MIN_POLL_US)
+   {
+      interval = EXT_FLASH_MIN_POLL_US;
+   }
+
+   if (p_intf->p_chip && typ_us)
+   {
+      uint32_t first = typ_us / EXT_FLASH_FIRST_POLL_DIVISOR;
+      if (bounded && first > limit_us)
+      {
+         first = limit_us;
+      }
+      p_intf->delay_us(first);
+      delayed += first;
+   }
+
+   if (held)
+   {
+      p_intf->select();
+      p_intf->write(&cmd, 1);
+   }
+
+   for ( ; ; )
+   {
+      waited = p_intf->get_time_us ? emb_ext_flash_now(p_intf) - start : delayed;
+      if (held)
+      {
+         p_intf->read(&status, 1);
+      }
+      else
+      {
+         status = emb_ext_flash_read_status(p_intf);
+      }
+      if ((status & mask) == value)
+      {
+         break;
+      }
+
+      // Give up when out of time or asked to
+      if (bounded && waited >= limit_us)
+      {
+         p_dl->timeouts++;
+         rtn = EXT_FLASH_ERR_TIMEOUT;
+         break;
+      }
+      if (bounded && p_dl->cancel)
+      {
+         p_dl->cancel = 0;
+         p_dl->cancels++;
+         rtn = EXT_FLASH_ERR_CANCELLED;
+         break;
+      }
+
+      if (interval)
+      {
+         p_intf->delay_us(interval);
+         delayed += interval;
+      }
+   }
+
+   if (held)
+   {
+      p_intf->deselect();
+   }
+
+   // Remember whether the wait left the chip idle
+   p_intf->rt.valid  = !(status & EXT_FLASH_STATUS_REG_BUSY);
+   p_intf->rt.status = status;
+
+   // Keep track of how close the wait came to its limit
+   if (bounded && limit_us)
+   {
+      uint64_t permille = (uint64_t)waited * 1000 / limit_us;
+      if (permille > 1000)
+      {
+         permille = 1000;
+      }
+      if (permille > p_dl->max_permille[kind])
+      {
+         p_dl->max_permille[kind] = (uint16_t)permille;
+      }
+   }
+
+   if (elapsed)
+   {
+      *elapsed += waited;
+   }
 
-   // Return 0 for non error, -1 for error
    return(rtn);
 }
 
-int emb_ext_flash_read(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint16_t len)
+// Send write enable and wait for WEL, the caller has done the null check
+static int emb_ext_flash_wren(emb_flash_intf_handle_t *p_intf, uint32_t limit_us, uint32_t *elapsed)
 {
-   // Build the command
-   uint8_t cmd[4] = { EXT_FLASH_CMD_READ_DATA, (address >> 16) & 0xFF, (address >> 8) & 0xFF, address & 0xFF };
+   emb_ext_flash_rt_t *p_rt = &p_intf->rt;
+
+   // Make sure the chip is awake
+   emb_ext_flash_access(p_intf);
+
+   // Do the transfer
+   int rtn = emb_ext_flash_cmd(p_intf, EXT_FLASH_CMD_WRITE_ENABLE);
+
+   // In low round trip mode an idle chip sets WEL, it is only read back when the chip may be busy or the command failed
+   if (p_rt->enabled)
+   {
+      if (rtn == 0 && p_rt->valid)
+      {
+         p_rt->status |= EXT_FLASH_STATUS_REG_WEL;
+         p_rt->wel_trusted++;
+         return(0);
+      }
+      p_rt->wel_verified++;
+   }
+
+   // Block while the WEL bit in the status register is unset
+   return(emb_ext_flash_wait_status(p_intf, EXT_FLASH_STATUS_REG_WEL, EXT_FLASH_STATUS_REG_WEL, 0, limit_us, EXT_FLASH_WAIT_WEL,
+                                    elapsed));
+}
 
+void emb_ext_flash_write_enable(emb_flash_intf_handle_t *p_intf)
+{
    // Null check
-   if (!p_intf || !p_intf->initialized || !data || !len)
+   if (!p_intf || !p_intf->initialized)
    {
-      return(0);
+      return;
    }
 
-   // Do the transfer
-   p_intf->select();
-   p_intf->write(cmd, sizeof(cmd));
-   int rtn = p_intf->read(data, len);
-   p_intf->deselect();
+   emb_ext_flash_wren(p_intf, EXT_FLASH_WAIT_FOREVER, NULL);
+}
 
-   // Return the number of bytes read
-   return(rtn == 0 ? len : 0);
+// Limit for the next wait of an operation. Unbounded operations pass EXT_FLASH_WAIT_FOREVER through, without a timeout each wait
+// gets the chip's own limit, otherwise each wait gets what is left of the timeout.
+static uint32_t emb_ext_flash_limit(uint32_t timeout_us, uint32_t elapsed, uint32_t max_us)
+{
+   if (timeout_us == EXT_FLASH_WAIT_FOREVER || !timeout_us)
+   {
+      return(timeout_us ? timeout_us : max_us);
+   }
+
+   return(elapsed < timeout_us ? timeout_us - elapsed : 0);
 }
 
-int emb_ext_flash_write(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint16_t len)
+// Typical program and erase times of the chip, 0 when unknown
+static uint32_t emb_ext_flash_tpp_us(emb_flash_intf_handle_t *p_intf)
+{
+   return(p_intf->p_chip ? p_intf->p_chip->tpp_typ_us : 0);
+}
+
+static uint32_t emb_ext_flash_tse_us(emb_flash_intf_handle_t *p_intf)
+{
+   return(p_intf->p_chip ? p_intf->p_chip->tse_typ_ms * 1000 : 0);
+}
+
+// Maximum program and erase times of the chip, the generic limits when unknown
+static uint32_t emb_ext_flash_tpp_max_us(emb_flash_intf_handle_t *p_intf)
+{
+   return(p_intf->p_chip && p_intf->p_chip->tpp_max_us ? p_intf->p_chip->tpp_max_us : EXT_FLASH_DEFAULT_TPP_MAX_US);
+}
+
+static uint32_t emb_ext_flash_tse_max_us(emb_flash_intf_handle_t *p_intf)
+{
+   return((p_intf->p_chip && p_intf->p_chip->tse_max_ms ? p_intf->p_chip->tse_max_ms : EXT_FLASH_DEFAULT_TSE_MAX_MS) * 1000);
+}
+
+// A chip erase is limited to a few sector erase times per 64K block, capped to what fits in the time base
+static uint32_t emb_ext_flash_chip_erase_max_us(emb_flash_intf_handle_t *p_intf)
+{
+   if (!p_intf->p_chip || !p_intf->p_chip->tse_max_ms || p_intf->p_chip->capacity_log2 < 16)
+   {
+      return(EXT_FLASH_DEFAULT_CHIP_ERASE_MAX_MS * 1000);
+   }
+
+   uint64_t max = ((uint64_t)1 << (p_intf->p_chip->capacity_log2 - 16)) * emb_ext_flash_tse_max_us(p_intf) * 5;
+   return(max < EXT_FLASH_WAIT_FOREVER ? (uint32_t)max : EXT_FLASH_WAIT_FOREVER - 1);
+}
+
+// Report an erase to the erase hook before it is issued, while the chip is still idle
+static void emb_ext_flash_erasing(emb_flash_intf_handle_t *p_intf, uint32_t address, uint32_t len)
+{
+   if (p_intf->erase_hook)
+   {
+      p_intf->erase_hook(p_intf->p_erase_ctx, address, len);
+   }
+}
+
+static int emb_ext_flash_write_deadline(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint16_t len,
+                                        uint32_t timeout_us)
 {
    uint16_t t_len         = len;
+   uint32_t elapsed       = 0;
    int      rtn           = 0;
    int      bytes_written = 0;
 
-   do
+   // Null check
+   if (!p_intf || !p_intf->initialized || !data || !len)
    {
-      // Enable writes
-      emb_ext_flash_write_enable(p_intf);
+      return(0);
+   }
 
-      // Build the command
-      uint8_t cmd[4] = { EXT_FLASH_CMD_PAGE_PROGRAM, (address >> 16) & 0xFF, (address >> 8) & 0xFF, address & 0xFF };
+   // The program may change what was prefetched
+   emb_ext_flash_ra_drop(p_intf);
 
-      // Null check
-      if (!p_intf || !p_intf->initialized || !data || !len)
+   do
+   {
+      // Enable writes
+      rtn = emb_ext_flash_wren(p_intf, emb_ext_flash_limit(timeout_us, elapsed, EXT_FLASH_WEL_TIMEOUT_US), &elapsed);
+      if (rtn < 0)
       {
-         return(0);
+         return(rtn);
       }
 
+      // Build the command
+      uint8_t cmd[EXT_FLASH_CMD_MAX_LEN];
+      uint8_t cmd_len = emb_ext_flash_addr_cmd(p_intf, EXT_FLASH_CMD_PAGE_PROGRAM, address, cmd);
+
       // If the address + the length is going to cross a 256 byte page boundary, we need to split this into 2 transactions.
       int w_len = len;
       if ((address & 0xFF) + len > 0xFF)
@@ -150,14 +497,18 @@ int emb_ext_flash_write(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8
 
       // Do the transfer
       p_intf->select();
-      p_intf->write(cmd, sizeof(cmd));
+      p_intf->write(cmd, cmd_len);
       rtn = p_intf->write(data, w_len);
       p_intf->deselect();
+      p_intf->rt.valid = 0;
 
       // Block while the flash chip commits the write
-      while (emb_ext_flash_busy(p_intf))
+      int wait = emb_ext_flash_wait_status(p_intf, EXT_FLASH_STATUS_REG_BUSY, 0, emb_ext_flash_tpp_us(p_intf),
+                                           emb_ext_flash_limit(timeout_us, elapsed, emb_ext_flash_tpp_max_us(p_intf)),
+                                           EXT_FLASH_WAIT_PROGRAM, &elapsed);
+      if (wait < 0)
       {
-         ;
+         return(wait);
       }
 
       // Keep track of the number of bytes written
@@ -180,10 +531,9 @@ int emb_ext_flash_write(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8
    return(bytes_written);
 }
 
-int emb_ext_flash_erase(emb_flash_intf_handle_t *p_intf, uint32_t address, uint32_t len)
+static int emb_ext_flash_erase_deadline(emb_flash_intf_handle_t *p_intf, uint32_t address, uint32_t len, uint32_t timeout_us)
 {
-   // Enable writes
-   emb_ext_flash_write_enable(p_intf);
+   uint32_t elapsed = 0;
 
    // Null check
    if (!p_intf || !p_intf->initialized)
@@ -191,128 +541,801 @@ int emb_ext_flash_erase(emb_flash_intf_handle_t *p_intf, uint32_t address, uint3
       return(-1);
    }
 
-   // Determine the most efficient command to use
-   uint8_t type = EXT_FLASH_CMD_SECTOR_ERASE;
-   if (len > 4096)
+   // The erase changes what was prefetched
+   emb_ext_flash_ra_drop(p_intf);
+
+   // Determine the most efficient command to use, limited to the sizes a known chip supports
+   uint8_t  sizes = p_intf->p_chip ? p_intf->p_chip->erase_sizes : EXT_FLASH_CHIP_ERASE_ALL;
+   uint8_t  type  = EXT_FLASH_CMD_SECTOR_ERASE;
+   uint32_t unit  = EXT_FLASH_SECTOR_SIZE;
+   uint32_t typ   = emb_ext_flash_tse_us(p_intf);
+   uint32_t max   = emb_ext_flash_tse_max_us(p_intf);
+   if (len > 4096 && (sizes & EXT_FLASH_CHIP_ERASE_32K))
    {
       type = EXT_FLASH_CMD_BLOCK_ERASE_32K;
+      unit = EXT_FLASH_BLOCK_32K_SIZE;
    }
-   if (len > 32768)
+   if (len > 32768 && (sizes & EXT_FLASH_CHIP_ERASE_64K))
    {
       type = EXT_FLASH_CMD_BLOCK_ERASE_64K;
+      unit = EXT_FLASH_BLOCK_64K_SIZE;
    }
 
-   // Build the command
-   uint8_t cmd[4] = { type, (address >> 16) & 0xFF, (address >> 8) & 0xFF, address & 0xFF };
-
-   // Do the transfer
-   p_intf->select();
-   int rtn = p_intf->write(cmd, sizeof(cmd));
-   p_intf->deselect();
-
-   // Block while the erase is committed
-   while (emb_ext_flash_busy(p_intf))
+   // Block erases typically take two to three times as long as a sector erase, and up to four to five times at worst
+   if (unit == EXT_FLASH_BLOCK_32K_SIZE)
+   {
+      typ *= 2;
+      max *= 4;
+   }
+   else if (unit == EXT_FLASH_BLOCK_64K_SIZE)
    {
-      ;
+      typ *= 3;
+      max *= 5;
    }
 
-   // Return 0 if successful -1 otherwise
-   return(rtn);
-}
+   // When the chip lacks the block size the length asks for, cover the length with the smaller units instead
+   uint32_t span  = len > 32768 ? EXT_FLASH_BLOCK_64K_SIZE : len > 4096 ? EXT_FLASH_BLOCK_32K_SIZE : EXT_FLASH_SECTOR_SIZE;
+   uint32_t count = span > unit ? ((len < span ? len : span) + unit - 1) / unit : 1;
 
-int emb_ext_flash_chip_erase(emb_flash_intf_handle_t *p_intf)
-{
-   // Enable writes
-   emb_ext_flash_write_enable(p_intf);
+   int rtn = 0;
+   for (uint32_t i = 0; i < count && rtn == 0; i++)
+   {
+      uint32_t addr = address + i * unit;
+      emb_ext_flash_erasing(p_intf, addr & ~(unit - 1), unit);
 
-   // Null check
+      // Enable writes
+      int wait = emb_ext_flash_wren(p_intf, emb_ext_flash_limit(timeout_us, elapsed, EXT_FLASH_WEL_TIMEOUT_US), &elapsed);
+      if (wait < 0)
+      {
+         return(wait);
+      }
+
+      // Build the command
+      uint8_t cmd[EXT_FLASH_CMD_MAX_LEN];
+      uint8_t cmd_len = emb_ext_flash_addr_cmd(p_intf, type, addr, cmd);
+
+      // Do the transfer
+      p_intf->select();
+      rtn = p_intf->write(cmd, cmd_len);
+      p_intf->deselect();
+      p_intf->rt.valid = 0;
+
+      // Block while the erase is committed
+      wait = emb_ext_flash_wait_status(p_intf, EXT_FLASH_STATUS_REG_BUSY, 0, typ, emb_ext_flash_limit(timeout_us, elapsed, max),
+                                       EXT_FLASH_WAIT_ERASE, &elapsed);
+      if (wait < 0)
+      {
+         return(wait);
+      }
+   }
+
+   // Return 0 if successful -1 otherwise
+   return(rtn);
+}
+
+static int emb_ext_flash_chip_erase_deadline(emb_flash_intf_handle_t *p_intf, uint32_t timeout_us)
+{
+   uint32_t elapsed = 0;
+
+   // Null check
    if (!p_intf || !p_intf->initialized)
    {
       return(-1);
    }
 
-   // Build the command
-   uint8_t cmd = EXT_FLASH_CMD_CHIP_ERASE;
+   emb_ext_flash_ra_drop(p_intf);
+   emb_ext_flash_erasing(p_intf, 0, p_intf->p_chip && p_intf->p_chip->capacity_log2 < 32 ?
+                         (uint32_t)1 << p_intf->p_chip->capacity_log2 : 0xFFFFFFFF);
+
+   // Enable writes
+   int wait = emb_ext_flash_wren(p_intf, emb_ext_flash_limit(timeout_us, elapsed, EXT_FLASH_WEL_TIMEOUT_US), &elapsed);
+   if (wait < 0)
+   {
+      return(wait);
+   }
 
    // Do the transfer
-   p_intf->select();
-   int rtn = p_intf->write(&cmd, 1);
-   p_intf->deselect();
+   int rtn = emb_ext_flash_cmd(p_intf, EXT_FLASH_CMD_CHIP_ERASE);
+   p_intf->rt.valid = 0;
 
-   // Block while the erase is committed - this can take 2 minutes + on a chip a erase
-   while (emb_ext_flash_busy(p_intf))
+   // Block while the erase is committed - this can take 2 minutes + on a chip a erase, polled every sector erase time
+   wait = emb_ext_flash_wait_status(p_intf, EXT_FLASH_STATUS_REG_BUSY, 0, emb_ext_flash_tse_us(p_intf) * EXT_FLASH_POLL_DIVISOR,
+                                    emb_ext_flash_limit(timeout_us, elapsed, emb_ext_flash_chip_erase_max_us(p_intf)),
+                                    EXT_FLASH_WAIT_CHIP_ERASE, &elapsed);
+   if (wait < 0)
    {
-      ;
+      return(wait);
    }
 
    // Return 0 if successful -1 otherwise
    return(rtn);
 }
 
-uint8_t emb_ext_flash_get_status(emb_flash_intf_handle_t *p_intf)
+// Read through the read-ahead buffer, the caller has done the null check
+static int emb_ext_flash_read_ahead(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint16_t len)
 {
-   // Build the command
-   uint8_t cmd    = EXT_FLASH_CMD_READ_STATUS_REG;
-   uint8_t status = 0;
+   emb_ext_flash_ra_t *p_ra   = &p_intf->ra;
+   uint8_t             stream = address == p_ra->next;
+   uint16_t            n      = 0;
+   uint16_t            total  = len;
+   int                 rtn    = 0;
+
+   p_ra->reads++;
+   p_ra->next = address + len;
+
+   // Serve what the buffer holds, a read anywhere else throws it away
+   if (p_ra->pos < p_ra->len && address == p_ra->addr + p_ra->pos)
+   {
+      n = len < p_ra->len - p_ra->pos ? len : p_ra->len - p_ra->pos;
+      memcpy(data, &p_ra->buf[p_ra->pos], n);
+      p_ra->pos += n;
+      if (n == len)
+      {
+         p_ra->hits++;
+         p_intf->pm.last_access_us = emb_ext_flash_now(p_intf);
+         return(len);
+      }
+   }
+   else if (p_ra->pos < p_ra->len || address != p_ra->addr + p_ra->len)
+   {
+      emb_ext_flash_ra_drop(p_intf);
+   }
+   address += n;
+   data    += n;
+   len     -= n;
+
+   // Carry on with the open read command when the chip is streaming from here, otherwise start a new one
+   if (p_ra->open && address == p_ra->addr + p_ra->len)
+   {
+      p_ra->continued++;
+      p_intf->pm.last_access_us = emb_ext_flash_now(p_intf);
+   }
+   else
+   {
+      uint8_t cmd[EXT_FLASH_CMD_MAX_LEN];
+      uint8_t cmd_len = emb_ext_flash_read_cmd(p_intf, address, cmd);
+
+      // Make sure the chip is awake and reading linearly
+      emb_ext_flash_access(p_intf);
+      emb_ext_flash_unwrap(p_intf);
+
+      p_intf->select();
+      rtn = p_intf->write(cmd, cmd_len);
+   }
+   if (rtn == 0)
+   {
+      rtn = p_intf->read(data, len);
+   }
 
+   // A read that continues the last one is part of a stream, prefetch the window after it
+   p_ra->len = 0;
+   p_ra->pos = 0;
+   if (rtn == 0 && stream)
+   {
+      rtn               = p_intf->read(p_ra->buf, p_ra->size);
+      p_ra->addr        = address + len;
+      p_ra->len         = rtn == 0 ? p_ra->size : 0;
+      p_ra->prefetched += p_ra->len;
+   }
+
+   // Leave the command open for the next refill when holding the bus
+   p_ra->open = rtn == 0 && stream && p_ra->hold;
+   if (!p_ra->open)
+   {
+      p_intf->deselect();
+   }
+
+   // Return the number of bytes read
+   return(rtn == 0 ? total : 0);
+}
+
+// Pubic functions
+int emb_ext_flash_init_intf(emb_flash_intf_handle_t *p_intf)
+{
    // Null check
-   if (!p_intf || !p_intf->initialized)
+   if (!p_intf)
+   {
+      return(-1);
+   }
+
+   // Set the initialized flag to 0;
+   p_intf->initialized = 0;
+
+   // Check all of the function pointers, if any are null return -1
+   if (!p_intf->select || !p_intf->deselect || !p_intf->write || !p_intf->read || !p_intf->delay_us)
+   {
+      return(-1);
+   }
+
+   // Start from a known awake power state
+   memset(&p_intf->pm, 0, sizeof(p_intf->pm));
+   p_intf->pm.state_since_us = emb_ext_flash_now(p_intf);
+   memset(&p_intf->dl, 0, sizeof(p_intf->dl));
+   memset(&p_intf->rt, 0, sizeof(p_intf->rt));
+   memset(&p_intf->ra, 0, sizeof(p_intf->ra));
+   memset(&p_intf->wrap, 0, sizeof(p_intf->wrap));
+
+   // Set the initialized flag to 1
+   p_intf->initialized = 1;
+
+   return(0);
+}
+
+int emb_ext_flash_get_jedec_id(emb_flash_intf_handle_t *p_intf, uint8_t *manufacturer_id, uint8_t *memory_type, uint8_t *capacity)
+{
+   // Build the command and the payload
+   uint8_t cmd     = EXT_FLASH_CMD_JEDEC_ID;
+   uint8_t data[3] = { 0 };
+
+   // Null check
+   if (!p_intf || !p_intf->initialized || !manufacturer_id || !memory_type || !capacity)
    {
-      return(status);
+      return(-1);
    }
 
+   // Make sure the chip is awake
+   emb_ext_flash_access(p_intf);
+
    // Do the transfer
    p_intf->select();
    p_intf->write(&cmd, 1);
-   p_intf->read(&status, 1);
+   int rtn = p_intf->read(data, 3);
    p_intf->deselect();
 
-   // Return the status
-   return(status);
+   // Populate the fields
+   *manufacturer_id = data[0];
+   *memory_type     = data[1];
+   *capacity        = data[2];
+
+   // Return 0 for non error, -1 for error
+   return(rtn);
 }
 
-int emb_ext_flash_sleep(emb_flash_intf_handle_t *p_intf)
+int emb_ext_flash_read(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint16_t len)
+{
+   uint8_t cmd[EXT_FLASH_CMD_MAX_LEN];
+
+   // Null check
+   if (!p_intf || !p_intf->initialized || !data || !len)
+   {
+      return(0);
+   }
+
+   if (p_intf->ra.buf)
+   {
+      return(emb_ext_flash_read_ahead(p_intf, address, data, len));
+   }
+
+   // Build the command
+   uint8_t cmd_len = emb_ext_flash_read_cmd(p_intf, address, cmd);
+
+   // Make sure the chip is awake and reading linearly
+   emb_ext_flash_access(p_intf);
+   emb_ext_flash_unwrap(p_intf);
+
+   // Do the transfer
+   p_intf->select();
+   p_intf->write(cmd, cmd_len);
+   int rtn = p_intf->read(data, len);
+   p_intf->deselect();
+
+   // Return the number of bytes read
+   return(rtn == 0 ? len : 0);
+}
+
+int emb_ext_flash_write(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint16_t len)
 {
-   // Build the  command
-   uint8_t cmd = EXT_FLASH_CMD_POWER_DOWN;
+   return(emb_ext_flash_write_deadline(p_intf, address, data, len, EXT_FLASH_WAIT_FOREVER));
+}
+
+int emb_ext_flash_erase(emb_flash_intf_handle_t *p_intf, uint32_t address, uint32_t len)
+{
+   return(emb_ext_flash_erase_deadline(p_intf, address, len, EXT_FLASH_WAIT_FOREVER));
+}
 
+int emb_ext_flash_chip_erase(emb_flash_intf_handle_t *p_intf)
+{
+   return(emb_ext_flash_chip_erase_deadline(p_intf, EXT_FLASH_WAIT_FOREVER));
+}
+
+int emb_ext_flash_erase_begin(emb_flash_intf_handle_t *p_intf, uint32_t address)
+{
    // Null check
    if (!p_intf || !p_intf->initialized)
    {
       return(-1);
    }
 
-   // Do the transfer
+   address &= ~(uint32_t)(EXT_FLASH_SECTOR_SIZE - 1);
+   emb_ext_flash_ra_drop(p_intf);
+   emb_ext_flash_erasing(p_intf, address, EXT_FLASH_SECTOR_SIZE);
+
+   // Enable writes
+   int rtn = emb_ext_flash_wren(p_intf, EXT_FLASH_WEL_TIMEOUT_US, NULL);
+   if (rtn < 0)
+   {
+      return(rtn);
+   }
+
+   // Build the command
+   uint8_t cmd[EXT_FLASH_CMD_MAX_LEN];
+   uint8_t cmd_len = emb_ext_flash_addr_cmd(p_intf, EXT_FLASH_CMD_SECTOR_ERASE, address, cmd);
+
+   // Do the transfer, the erase runs on in the chip
    p_intf->select();
-   int rtn = p_intf->write(&cmd, 1);
+   rtn = p_intf->write(cmd, cmd_len);
    p_intf->deselect();
+   p_intf->rt.valid = 0;
 
+   // Return 0 if successful -1 otherwise
    return(rtn);
 }
 
-int emb_ext_flash_wake(emb_flash_intf_handle_t *p_intf)
+int emb_ext_flash_program_begin(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint16_t len)
 {
-   // Build the command
-   uint8_t cmd = EXT_FLASH_CMD_RELEASE_POWER_DOWN;
+   // Null check
+   if (!p_intf || !p_intf->initialized || !data || !len)
+   {
+      return(0);
+   }
+
+   // The program may change what was prefetched
+   emb_ext_flash_ra_drop(p_intf);
+
+   // Enable writes
+   int rtn = emb_ext_flash_wren(p_intf, EXT_FLASH_WEL_TIMEOUT_US, NULL);
+   if (rtn < 0)
+   {
+      return(rtn);
+   }
+
+   // Build the command, stopping at the end of the page
+   uint8_t  cmd[EXT_FLASH_CMD_MAX_LEN];
+   uint8_t  cmd_len = emb_ext_flash_addr_cmd(p_intf, EXT_FLASH_CMD_PAGE_PROGRAM, address, cmd);
+   uint16_t w_len   = len;
+   if ((address & 0xFF) + len > 0x100)
+   {
+      w_len = 0x100 - (address & 0xFF);
+   }
+
+   // Do the transfer, the program runs on in the chip
+   p_intf->select();
+   p_intf->write(cmd, cmd_len);
+   rtn = p_intf->write(data, w_len);
+   p_intf->deselect();
+   p_intf->rt.valid = 0;
+
+   // Return the number of bytes being programmed
+   return(rtn == 0 ? w_len : 0);
+}
+
+int emb_ext_flash_write_timeout(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint16_t len, uint32_t timeout_us)
+{
+   return(emb_ext_flash_write_deadline(p_intf, address, data, len, timeout_us));
+}
 
+int emb_ext_flash_erase_timeout(emb_flash_intf_handle_t *p_intf, uint32_t address, uint32_t len, uint32_t timeout_us)
+{
+   return(emb_ext_flash_erase_deadline(p_intf, address, len, timeout_us));
+}
+
+int emb_ext_flash_chip_erase_timeout(emb_flash_intf_handle_t *p_intf, uint32_t timeout_us)
+{
+   return(emb_ext_flash_chip_erase_deadline(p_intf, timeout_us));
+}
+
+int emb_ext_flash_wait_idle(emb_flash_intf_handle_t *p_intf, uint32_t timeout_us)
+{
    // Null check
    if (!p_intf || !p_intf->initialized)
    {
       return(-1);
    }
 
+   // Make sure the chip is awake
+   emb_ext_flash_access(p_intf);
+
+   return(emb_ext_flash_wait_status(p_intf, EXT_FLASH_STATUS_REG_BUSY, 0, 0, timeout_us, EXT_FLASH_WAIT_PROGRAM, NULL));
+}
+
+void emb_ext_flash_cancel(emb_flash_intf_handle_t *p_intf)
+{
+   // Null check
+   if (!p_intf)
+   {
+      return;
+   }
+
+   p_intf->dl.cancel = 1;
+}
+
+uint8_t emb_ext_flash_get_status(emb_flash_intf_handle_t *p_intf)
+{
+   // Null check
+   if (!p_intf || !p_intf->initialized)
+   {
+      return(0);
+   }
+
+   // Make sure the chip is awake
+   emb_ext_flash_access(p_intf);
+
+   // Return the status
+   return(emb_ext_flash_status(p_intf));
+}
+
+int emb_ext_flash_sleep(emb_flash_intf_handle_t *p_intf)
+{
+   // Null check
+   if (!p_intf || !p_intf->initialized)
+   {
+      return(-1);
+   }
+
+   // Already asleep, nothing to do
+   if (p_intf->pm.asleep)
+   {
+      return(0);
+   }
+
+   // The chip ignores commands until tRES1 has passed, so finish any wake in progress first
+   emb_ext_flash_access(p_intf);
+
    // Do the transfer
-   p_intf->select();
-   int rtn = p_intf->write(&cmd, 1);
-   p_intf->deselect();
+   int rtn = emb_ext_flash_cmd(p_intf, EXT_FLASH_CMD_POWER_DOWN);
+
+   if (rtn == 0)
+   {
+      emb_ext_flash_pm_account(p_intf, emb_ext_flash_now(p_intf));
+      p_intf->pm.asleep = 1;
+      p_intf->pm.sleeps++;
+   }
 
-   // Wait for the specified duration for wake time - this can be optimized to your use case.
-   p_intf->delay_us(3);
+   return(rtn);
+}
+
+int emb_ext_flash_wake(emb_flash_intf_handle_t *p_intf)
+{
+   // Null check
+   if (!p_intf || !p_intf->initialized)
+   {
+      return(-1);
+   }
+
+   uint32_t now = emb_ext_flash_now(p_intf);
+
+   // Do the transfer
+   emb_ext_flash_ra_close(p_intf);
+   emb_ext_flash_pm_account(p_intf, now);
+   int rtn = emb_ext_flash_cmd(p_intf, EXT_FLASH_CMD_RELEASE_POWER_DOWN);
+
+   if (p_intf->pm.asleep)
+   {
+      p_intf->pm.wakes++;
+   }
+   p_intf->pm.asleep     = 0;
+   p_intf->pm.waking     = 1;
+   p_intf->pm.release_us = now;
+
+   // Without a time base there is no way to tell how much of tRES1 has passed later on, so wait it out now
+   if (!p_intf->get_time_us)
+   {
+      emb_ext_flash_access(p_intf);
+   }
 
    // Return 0 for success -1 otherwise.
    return(rtn);
 }
 
+int emb_ext_flash_pm_enable(emb_flash_intf_handle_t *p_intf, uint32_t idle_timeout_us)
+{
+   // Null check, automatic sleep needs a time base
+   if (!p_intf || !p_intf->initialized || (idle_timeout_us && !p_intf->get_time_us))
+   {
+      return(-1);
+   }
+
+   p_intf->pm.idle_timeout_us = idle_timeout_us;
+   p_intf->pm.last_access_us  = emb_ext_flash_now(p_intf);
+
+   return(0);
+}
+
+int emb_ext_flash_pm_poll(emb_flash_intf_handle_t *p_intf)
+{
+   // Null check
+   if (!p_intf || !p_intf->initialized)
+   {
+      return(-1);
+   }
+
+   emb_ext_flash_pm_t *p_pm = &p_intf->pm;
+   if (!p_pm->idle_timeout_us || p_pm->asleep)
+   {
+      return(0);
+   }
+
+   // Not idle for long enough yet, or still inside tRES1 of a wake
+   uint32_t now = emb_ext_flash_now(p_intf);
+   if (now - p_pm->last_access_us < p_pm->idle_timeout_us ||
+       (p_pm->waking && now - p_pm->release_us < emb_ext_flash_t_res1(p_intf)))
+   {
+      return(0);
+   }
+
+   // Close an open read, and never power down in the middle of a program or erase
+   emb_ext_flash_ra_close(p_intf);
+   if (emb_ext_flash_status(p_intf) & EXT_FLASH_STATUS_REG_BUSY)
+   {
+      return(0);
+   }
+
+   return(emb_ext_flash_sleep(p_intf) == 0 ? 1 : -1);
+}
+
+int emb_ext_flash_pm_get_times(emb_flash_intf_handle_t *p_intf, uint64_t *asleep_us, uint64_t *awake_us)
+{
+   // Null check
+   if (!p_intf || !p_intf->initialized || !p_intf->get_time_us || !asleep_us || !awake_us)
+   {
+      return(-1);
+   }
+
+   // Fold in the current period
+   emb_ext_flash_pm_account(p_intf, emb_ext_flash_now(p_intf));
+   *asleep_us = p_intf->pm.asleep_us;
+   *awake_us  = p_intf->pm.awake_us;
+
+   return(0);
+}
+
+int emb_ext_flash_set_low_round_trip(emb_flash_intf_handle_t *p_intf, uint8_t enable)
+{
+   // Null check
+   if (!p_intf || !p_intf->initialized)
+   {
+      return(-1);
+   }
+
+   // Nothing is known about the chip until the next wait
+   p_intf->rt.enabled = enable ? 1 : 0;
+   p_intf->rt.valid   = 0;
+
+   return(0);
+}
+
+int emb_ext_flash_set_read_ahead(emb_flash_intf_handle_t *p_intf, uint8_t *buf, uint16_t size, uint8_t hold)
+{
+   // Null check
+   if (!p_intf || !p_intf->initialized || (buf && !size))
+   {
+      return(-1);
+   }
+
+   emb_ext_flash_ra_drop(p_intf);
+   p_intf->ra.buf  = buf;
+   p_intf->ra.size = buf ? size : 0;
+   p_intf->ra.hold = hold ? 1 : 0;
+   p_intf->ra.next = 0xFFFFFFFF;
+
+   return(0);
+}
+
+void emb_ext_flash_release(emb_flash_intf_handle_t *p_intf)
+{
+   // Null check
+   if (!p_intf || !p_intf->initialized)
+   {
+      return;
+   }
+
+   emb_ext_flash_ra_close(p_intf);
+}
+
+int emb_ext_flash_set_burst_wrap(emb_flash_intf_handle_t *p_intf, uint8_t wrap_len)
+{
+   // Null check
+   if (!p_intf || !p_intf->initialized ||
+       (wrap_len != 0 && wrap_len != 8 && wrap_len != 16 && wrap_len != 32 && wrap_len != 64))
+   {
+      return(-1);
+   }
+
+   // Without the capability the wrap setting would be ignored and the read would come back linear
+   if (wrap_len && (!p_intf->p_chip || !(p_intf->p_chip->flags & EXT_FLASH_CHIP_FLAG_WRAP_READ)))
+   {
+      return(-1);
+   }
+
+   p_intf->wrap.len = wrap_len;
+
+   return(0);
+}
+
+int emb_ext_flash_read_wrapped(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint8_t len)
+{
+   uint8_t cmd[EXT_FLASH_CMD_MAX_LEN];
+
+   // Null check
+   if (!p_intf || !p_intf->initialized || !data || (len != 8 && len != 16 && len != 32 && len != 64))
+   {
+      return(0);
+   }
+
+   // Make sure the chip is awake
+   emb_ext_flash_access(p_intf);
+
+   // Let the chip wrap when it is set up for this length and still known to wrap the driver's reads
+   uint8_t first = (uint8_t)(len - (address & (len - 1)));
+   uint8_t cmd_len;
+   int     rtn;
+   if (p_intf->wrap.len == len && p_intf->p_chip && (p_intf->p_chip->flags & EXT_FLASH_CHIP_FLAG_WRAP_READ))
+   {
+      rtn = p_intf->wrap.active == len ? 0 : emb_ext_flash_wrap_cmd(p_intf, len);
+      if (rtn == 0)
+      {
+         cmd_len = emb_ext_flash_read_cmd(p_intf, address, cmd);
+         p_intf->select();
+         rtn = p_intf->write(cmd, cmd_len);
+         if (rtn == 0)
+         {
+            rtn = p_intf->read(data, len);
+         }
+         p_intf->deselect();
+         p_intf->wrap.wrapped++;
+      }
+      return(rtn == 0 ? len : 0);
+   }
+
+   // Otherwise read up to the end of the line, then from its start
+   rtn = emb_ext_flash_unwrap(p_intf);
+   if (rtn == 0)
+   {
+      cmd_len = emb_ext_flash_read_cmd(p_intf, address, cmd);
+      p_intf->select();
+      rtn = p_intf->write(cmd, cmd_len);
+      if (rtn == 0)
+      {
+         rtn = p_intf->read(data, first);
+      }
+      p_intf->deselect();
+   }
+   if (rtn == 0 && first < len)
+   {
+      cmd_len = emb_ext_flash_read_cmd(p_intf, address & ~(uint32_t)(len - 1), cmd);
+      p_intf->select();
+      rtn = p_intf->write(cmd, cmd_len);
+      if (rtn == 0)
+      {
+         rtn = p_intf->read(&data[first], len - first);
+      }
+      p_intf->deselect();
+   }
+   p_intf->wrap.split++;
+
+   return(rtn == 0 ? len : 0);
+}
+
+int emb_ext_flash_batch(emb_flash_intf_handle_t *p_intf, emb_ext_flash_op_t *ops, uint16_t count, uint32_t *p_saved)
+{
+   uint8_t  gap[EXT_FLASH_BATCH_MAX_GAP + 1];
+   uint32_t saved  = 0;
+   int      done   = 0;
+   int      status = -1;
+
+   // Null check, and validate the whole batch before running any of it. Reads and writes run with a 16 bit length, so a
+   // longer one is rejected here rather than truncated.
+   if (!p_intf || !p_intf->initialized || !ops || !count)
+   {
+      return(-1);
+   }
+   for (uint16_t i = 0; i < count; i++)
+   {
+      emb_ext_flash_op_t *p_op = &ops[i];
+      if (p_op->type > EXT_FLASH_OP_STATUS || (p_op->type != EXT_FLASH_OP_ERASE && !p_op->data) ||
+          ((p_op->type == EXT_FLASH_OP_READ || p_op->type == EXT_FLASH_OP_WRITE) && (!p_op->len || p_op->len > 0xFFFF)))
+      {
+         return(-1);
+      }
+   }
+
+   // Make sure the chip is awake and reading linearly
+   emb_ext_flash_access(p_intf);
+   emb_ext_flash_unwrap(p_intf);
+
+   for (uint16_t i = 0; i < count; )
+   {
+      emb_ext_flash_op_t *p_op = &ops[i];
+
+      if (p_op->type == EXT_FLASH_OP_READ)
+      {
+         // Build the command
+         uint8_t cmd[EXT_FLASH_CMD_MAX_LEN];
+         uint8_t cmd_len = emb_ext_flash_read_cmd(p_intf, p_op->address, cmd);
+
+         // Read on through every following read that continues where the last one stopped, reading through small gaps
+         p_intf->select();
+         int      rtn  = p_intf->write(cmd, cmd_len);
+         uint32_t next = p_op->address;
+         uint16_t j    = i;
+         do
+         {
+            if (ops[j].address > next && rtn == 0)
+            {
+               rtn = p_intf->read(gap, (uint16_t)(ops[j].address - next));
+            }
+            if (rtn == 0)
+            {
+               rtn = p_intf->read(ops[j].data, (uint16_t)ops[j].len);
+            }
+            ops[j].result = rtn == 0 ? (int)ops[j].len : 0;
+            done         += rtn == 0;
+            next          = ops[j].address + ops[j].len;
+            j++;
+         } while (j < count && ops[j].type == EXT_FLASH_OP_READ && ops[j].address >= next &&
+                  ops[j].address - next <= EXT_FLASH_BATCH_MAX_GAP);
+         p_intf->deselect();
+
+         saved += j - i - 1;
+         status = -1;
+         i      = j;
+         continue;
+      }
+
+      switch (p_op->type)
+      {
+      case EXT_FLASH_OP_WRITE:
+         p_op->result = emb_ext_flash_write_deadline(p_intf, p_op->address, p_op->data, (uint16_t)p_op->len,
+                                                     EXT_FLASH_WAIT_FOREVER);
+         done        += p_op->result == (int)p_op->len;
+         status       = -1;
+         break;
+
+      case EXT_FLASH_OP_ERASE:
+         p_op->result = emb_ext_flash_erase_deadline(p_intf, p_op->address, p_op->len, EXT_FLASH_WAIT_FOREVER);
+         done        += p_op->result == 0;
+         status       = -1;
+         break;
+
+      default:
+         // Nothing can have changed since a status read right before this one, unless a program or erase was still running
+         if (status < 0 || (status & EXT_FLASH_STATUS_REG_BUSY))
+         {
+            status = emb_ext_flash_status(p_intf);
+         }
+         else
+         {
+            saved++;
+         }
+         *p_op->data  = (uint8_t)status;
+         p_op->result = status;
+         done++;
+         break;
+      }
+      i++;
+   }
+
+   if (p_saved)
+   {
+      *p_saved = saved;
+   }
+
+   return(done);
+}
+
+int emb_ext_flash_set_chip(emb_flash_intf_handle_t *p_intf, const emb_ext_flash_chip_t *p_chip)
+{
+   // Null check
+   if (!p_intf || !p_intf->initialized)
+   {
+      return(-1);
+   }
+
+   p_intf->p_chip = p_chip;
+
+   return(0);
+}
+
 const char *emb_ext_flash_get_lib_ver()
 {
    // Get the major, minor, and rev numbers
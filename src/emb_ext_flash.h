@@ -41,11 +41,242 @@ extern "C" {
 #define EXT_FLASH_CMD_POWER_DOWN            0xB9
 #define EXT_FLASH_CMD_RELEASE_POWER_DOWN    0xAB
 #define EXT_FLASH_CMD_JEDEC_ID              0x9F
+#define EXT_FLASH_CMD_SET_BURST_WRAP        0x77
+
+// 4-byte address forms of the commands above, issued in their place for chips with EXT_FLASH_CHIP_FLAG_4BYTE_ADDR
+#define EXT_FLASH_CMD_READ_DATA_4B          0x13
+#define EXT_FLASH_CMD_FAST_READ_4B          0x0C
+#define EXT_FLASH_CMD_PAGE_PROGRAM_4B       0x12
+#define EXT_FLASH_CMD_SECTOR_ERASE_4B       0x21
+#define EXT_FLASH_CMD_BLOCK_ERASE_32K_4B    0x5C
+#define EXT_FLASH_CMD_BLOCK_ERASE_64K_4B    0xDC
+
+// Longest address command the driver sends, a 4-byte address read with its dummy byte
+#define EXT_FLASH_CMD_MAX_LEN               6
 
 // Generic status register bits
 #define EXT_FLASH_STATUS_REG_BUSY           0x01
 #define EXT_FLASH_STATUS_REG_WEL            0x02
 
+// Generic release from deep power-down time (tRES1) in microseconds, used when the handle does not specify one
+#define EXT_FLASH_DEFAULT_T_RES1_US         3
+
+// Generic geometry, page program and erase granularity common to JEDEC serial NOR flash chips
+#define EXT_FLASH_PAGE_SIZE                 256
+#define EXT_FLASH_SECTOR_SIZE               4096
+#define EXT_FLASH_BLOCK_32K_SIZE            32768
+#define EXT_FLASH_BLOCK_64K_SIZE            65536
+
+// Erase sizes a chip supports, emb_ext_flash_chip_t erase_sizes bits
+#define EXT_FLASH_CHIP_ERASE_4K             0x01
+#define EXT_FLASH_CHIP_ERASE_32K            0x02
+#define EXT_FLASH_CHIP_ERASE_64K            0x04
+#define EXT_FLASH_CHIP_ERASE_ALL            0x07
+
+// Read modes in increasing order of speed, the driver issues EXT_FLASH_CMD_FAST_READ for anything from fast read up
+#define EXT_FLASH_READ_MODE_NORMAL          0
+#define EXT_FLASH_READ_MODE_FAST            1
+#define EXT_FLASH_READ_MODE_DUAL_OUT        2
+#define EXT_FLASH_READ_MODE_DUAL_IO         3
+#define EXT_FLASH_READ_MODE_QUAD_OUT        4
+#define EXT_FLASH_READ_MODE_QUAD_IO         5
+
+// Chip feature flags, emb_ext_flash_chip_t flags bits
+#define EXT_FLASH_CHIP_FLAG_SUSPEND         0x01
+// The chip is larger than 16 MiB and takes the 4-byte address commands, which the driver then issues for every address so the
+// chip can stay in its default 3-byte mode. Leave EXT_FLASH_CHIP_ERASE_32K out of erase_sizes on parts without 0x5C.
+#define EXT_FLASH_CHIP_FLAG_4BYTE_ADDR      0x02
+// The chip wraps the READ and FAST_READ commands the driver issues after Set Burst with Wrap. Leave it clear on parts such as
+// the Winbond and GigaDevice ones that only wrap quad I/O reads, and on Macronix parts that use a different command.
+#define EXT_FLASH_CHIP_FLAG_WRAP_READ       0x04
+
+// With a known chip the driver sleeps for the typical program or erase time divided by this before the first status poll
+// and between polls after that
+#define EXT_FLASH_FIRST_POLL_DIVISOR        2
+#define EXT_FLASH_POLL_DIVISOR              8
+
+// Error codes of the deadline bounded functions, in addition to -1 for a bus or argument failure
+#define EXT_FLASH_ERR_TIMEOUT               -2
+#define EXT_FLASH_ERR_CANCELLED             -3
+
+// Limits of the deadline bounded functions when no timeout is given and the chip does not specify its own
+#define EXT_FLASH_WEL_TIMEOUT_US            1000
+#define EXT_FLASH_DEFAULT_TPP_MAX_US        5000
+#define EXT_FLASH_DEFAULT_TSE_MAX_MS        500
+#define EXT_FLASH_DEFAULT_CHIP_ERASE_MAX_MS 200000
+
+// Shortest poll interval of a bounded wait, without a time base the delays are the only measure of elapsed time
+#define EXT_FLASH_MIN_POLL_US               10
+
+// Kinds of bounded waits, index into emb_ext_flash_deadline_t max_permille
+#define EXT_FLASH_WAIT_WEL                  0
+#define EXT_FLASH_WAIT_PROGRAM              1
+#define EXT_FLASH_WAIT_ERASE                2
+#define EXT_FLASH_WAIT_CHIP_ERASE           3
+#define EXT_FLASH_WAIT_KINDS                4
+
+// Batch operation types, emb_ext_flash_op_t type
+#define EXT_FLASH_OP_READ                   0
+#define EXT_FLASH_OP_WRITE                  1
+#define EXT_FLASH_OP_ERASE                  2
+#define EXT_FLASH_OP_STATUS                 3
+
+// Largest gap between two reads of a batch that is read through and discarded to save a read command, no more than the
+// command itself costs on the bus
+#ifndef EXT_FLASH_BATCH_MAX_GAP
+#define EXT_FLASH_BATCH_MAX_GAP             4
+#endif
+
+/**
+ * @brief emb_ext_flash_op_t - one operation of a batch, see emb_ext_flash_batch().
+ */
+typedef struct
+{
+   // One of EXT_FLASH_OP_*.
+   uint8_t type;
+   // Address, ignored for status reads.
+   uint32_t address;
+   // Buffer to read into or write from, one byte for status reads, ignored for erases.
+   uint8_t *data;
+   // Number of bytes, up to 65535 for reads and writes, ignored for status reads.
+   uint32_t len;
+   // Result written by the batch, as returned by the matching single operation function.
+   int result;
+} emb_ext_flash_op_t;
+
+/**
+ * @brief emb_ext_flash_chip_t - capabilities of a chip model, see emb_ext_flash_chips.h for the built in table.
+ */
+typedef struct
+{
+   // JEDEC ID, manufacturer in bits 23..16, memory type in bits 15..8 and capacity code in bits 7..0.
+   uint32_t jedec_id;
+   // Capacity in bytes as a power of two.
+   uint8_t capacity_log2;
+   // Supported erase sizes, EXT_FLASH_CHIP_ERASE_* bits.
+   uint8_t erase_sizes;
+   // Fastest read mode supported, one of EXT_FLASH_READ_MODE_*.
+   uint8_t read_mode;
+   // EXT_FLASH_CHIP_FLAG_* bits.
+   uint8_t flags;
+   // Typical and maximum page program time in microseconds.
+   uint16_t tpp_typ_us;
+   uint16_t tpp_max_us;
+   // Typical and maximum 4K sector erase time in milliseconds.
+   uint16_t tse_typ_ms;
+   uint16_t tse_max_ms;
+   // Release from deep power-down time (tRES1) in microseconds.
+   uint8_t t_res1_us;
+} emb_ext_flash_chip_t;
+
+/**
+ * @brief emb_ext_flash_pm_t - power management state kept in each interface handle. The driver tracks whether the chip is in
+ * deep power-down and wakes it automatically on the next operation. When the handle provides a time base the chip can also be
+ * put to sleep automatically after an idle timeout, the tRES1 wake delay is only waited out for the part that has not already
+ * passed, and the time spent asleep and awake is tracked. Treat the contents as private, use the emb_ext_flash_pm_* functions.
+ */
+typedef struct
+{
+   // Idle time in microseconds after which emb_ext_flash_pm_poll() puts the chip to sleep, 0 when disabled.
+   uint32_t idle_timeout_us;
+   // Time of the last operation.
+   uint32_t last_access_us;
+   // Time the release from deep power-down command was sent.
+   uint32_t release_us;
+   // Time the chip entered its current power state.
+   uint32_t state_since_us;
+   // Flag to indicate the chip is in deep power-down.
+   uint8_t asleep;
+   // Flag to indicate the release command has been sent but tRES1 has not been waited out yet.
+   uint8_t waking;
+   // Accumulated time asleep and awake in microseconds.
+   uint64_t asleep_us;
+   uint64_t awake_us;
+   // Number of times the chip was put to sleep and woken, and the number of wakes that needed no delay at all.
+   uint32_t sleeps;
+   uint32_t wakes;
+   uint32_t wakes_no_delay;
+} emb_ext_flash_pm_t;
+
+/**
+ * @brief emb_ext_flash_deadline_t - state of the deadline bounded functions kept in each interface handle. Each bounded wait
+ * records how much of its limit it used, so the margin to the limits can be watched in the field, and gives up early when the
+ * cancel flag is set. Set the flag with emb_ext_flash_cancel(), the rest can be read directly.
+ */
+typedef struct
+{
+   // Cancel request, consumed by the next bounded wait that sees it.
+   volatile uint8_t cancel;
+   // Largest share of its limit a wait of each EXT_FLASH_WAIT_* kind used, in 1/1000ths.
+   uint16_t max_permille[EXT_FLASH_WAIT_KINDS];
+   // Number of bounded waits that timed out and that were cancelled.
+   uint32_t timeouts;
+   uint32_t cancels;
+} emb_ext_flash_deadline_t;
+
+/**
+ * @brief emb_ext_flash_rt_t - low round trip state kept in each interface handle, see emb_ext_flash_set_low_round_trip(). The
+ * driver remembers the status of the last wait that saw the chip idle, for as long as nothing the driver sent can have changed
+ * it. Treat the contents as private apart from the counters.
+ */
+typedef struct
+{
+   // Flag to indicate the low round trip mode is enabled.
+   uint8_t enabled;
+   // Flag to indicate the chip is known to be idle, with the status register reading as status.
+   uint8_t valid;
+   uint8_t status;
+   // Number of write enables sent without reading WEL back, and the number that were verified instead.
+   uint32_t wel_trusted;
+   uint32_t wel_verified;
+   // Number of status reads answered from the remembered status.
+   uint32_t status_reused;
+} emb_ext_flash_rt_t;
+
+/**
+ * @brief emb_ext_flash_ra_t - read-ahead state kept in each interface handle, see emb_ext_flash_set_read_ahead(). Treat the
+ * contents as private apart from the counters.
+ */
+typedef struct
+{
+   // Prefetch buffer and its size, NULL when read-ahead is disabled.
+   uint8_t *buf;
+   uint16_t size;
+   // Flag to keep the read command open between reads.
+   uint8_t hold;
+   // Flag to indicate a read command is open, with the chip streaming from addr + len.
+   uint8_t open;
+   // Flash address of the first byte in the buffer, number of bytes prefetched and number of them already read.
+   uint32_t addr;
+   uint16_t len;
+   uint16_t pos;
+   // Address the next read of a sequential stream starts at.
+   uint32_t next;
+   // Number of reads, the number served from the buffer alone and the number that continued an open read command.
+   uint32_t reads;
+   uint32_t hits;
+   uint32_t continued;
+   // Number of bytes prefetched, and the number thrown away without being read.
+   uint32_t prefetched;
+   uint32_t wasted;
+} emb_ext_flash_ra_t;
+
+/**
+ * @brief emb_ext_flash_wrap_t - wrapped burst read state kept in each interface handle, see emb_ext_flash_set_burst_wrap().
+ * Treat the contents as private apart from the counters.
+ */
+typedef struct
+{
+   // Wrap length to use for wrapped reads of that length, 0 to emulate them with two linear reads.
+   uint8_t len;
+   // Wrap length the chip is currently set to, 0 for linear reads.
+   uint8_t active;
+   // Number of wrapped reads done by the chip, the number emulated and the number of Set Burst with Wrap commands sent.
+   uint32_t wrapped;
+   uint32_t split;
+   uint32_t sets;
+} emb_ext_flash_wrap_t;
+
 /**
  * @brief emb_flash_intf_handle_t - structure to hold the interface functions for the external flash memory chip.
  * This structure is used to hold the function pointers to the interface functions for the external flash memory chip.
@@ -65,6 +296,27 @@ typedef struct
    int ( *read )(uint8_t *data, uint16_t len);
    // Function pointer to delay for a specified duration in microseconds.
    void ( *delay_us )(uint32_t duration);
+   // Optional function pointer returning a free running time base in microseconds, required for automatic power management.
+   uint32_t ( *get_time_us )();
+   // Release from deep power-down time (tRES1) of the chip in microseconds, 0 selects EXT_FLASH_DEFAULT_T_RES1_US.
+   uint32_t t_res1_us;
+   // Power management state, reset by emb_ext_flash_init_intf().
+   emb_ext_flash_pm_t pm;
+   // Optional capabilities of the chip, NULL for a generic part, set with emb_ext_flash_set_chip().
+   const emb_ext_flash_chip_t *p_chip;
+   // Deadline state, reset by emb_ext_flash_init_intf().
+   emb_ext_flash_deadline_t dl;
+   // Optional hook called with the range of every erase just before the driver issues it, and its context. The chip is idle, so
+   // the hook may access it. A chip erase reports the capacity of a known chip, or 0xFFFFFFFF bytes. Set by
+   // emb_ext_flash_wear_attach() to keep per-sector erase counts.
+   void ( *erase_hook )(void *p_ctx, uint32_t address, uint32_t len);
+   void *p_erase_ctx;
+   // Low round trip state, reset by emb_ext_flash_init_intf().
+   emb_ext_flash_rt_t rt;
+   // Read-ahead state, reset by emb_ext_flash_init_intf().
+   emb_ext_flash_ra_t ra;
+   // Wrapped burst read state, reset by emb_ext_flash_init_intf().
+   emb_ext_flash_wrap_t wrap;
 } emb_flash_intf_handle_t;
 
 /**
@@ -128,6 +380,85 @@ int emb_ext_flash_erase(emb_flash_intf_handle_t *p_intf, uint32_t address, uint3
  */
 int emb_ext_flash_chip_erase(emb_flash_intf_handle_t *p_intf);
 
+/**
+ * @brief emb_ext_flash_erase_begin start erasing the 4K sector containing address and return without waiting for it to finish.
+ * Until emb_ext_flash_get_status() reports the chip idle, or emb_ext_flash_wait_idle() returns, the chip only answers status
+ * reads and no other function may be called on the handle.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param address - an address inside the sector to erase.
+ * @return int - 0 on success, -1 on failure, EXT_FLASH_ERR_TIMEOUT if the chip does not set WEL.
+ */
+int emb_ext_flash_erase_begin(emb_flash_intf_handle_t *p_intf, uint32_t address);
+
+/**
+ * @brief emb_ext_flash_program_begin start programming data from address up to the end of its page at most, and return without
+ * waiting for the program to finish. The same rules as for emb_ext_flash_erase_begin() apply until the chip is idle.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param address - address to program at.
+ * @param data - pointer to the data.
+ * @param len - number of bytes of data.
+ * @return int - number of bytes being programmed, 0 on failure, EXT_FLASH_ERR_TIMEOUT if the chip does not set WEL.
+ */
+int emb_ext_flash_program_begin(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint16_t len);
+
+/**
+ * @brief emb_ext_flash_write_timeout write data like emb_ext_flash_write(), but give up instead of hanging when the chip does
+ * not set WEL or does not finish a page program in time. With a timeout of 0 each wait is bounded by the chip's maximum page
+ * program time, or EXT_FLASH_DEFAULT_TPP_MAX_US for a generic part, otherwise the timeout bounds the whole call. Pages before
+ * the failing one have been programmed.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param address - the address to write to.
+ * @param data - pointer to the data to be written.
+ * @param len - the number of bytes to be written.
+ * @param timeout_us - deadline for the whole write in microseconds, 0 for the chip's limits.
+ * @return int - number of bytes successfully written, EXT_FLASH_ERR_TIMEOUT or EXT_FLASH_ERR_CANCELLED.
+ */
+int emb_ext_flash_write_timeout(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint16_t len, uint32_t timeout_us);
+
+/**
+ * @brief emb_ext_flash_erase_timeout erase like emb_ext_flash_erase(), but give up instead of hanging. With a timeout of 0 each
+ * erase is bounded by the chip's maximum sector erase time, scaled up for block erases.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param address - the address to erase from.
+ * @param len - the number of bytes to be erased.
+ * @param timeout_us - deadline for the whole erase in microseconds, 0 for the chip's limits.
+ * @return int - 0 on success, -1 on failure, EXT_FLASH_ERR_TIMEOUT or EXT_FLASH_ERR_CANCELLED.
+ */
+int emb_ext_flash_erase_timeout(emb_flash_intf_handle_t *p_intf, uint32_t address, uint32_t len, uint32_t timeout_us);
+
+/**
+ * @brief emb_ext_flash_chip_erase_timeout erase the entire chip like emb_ext_flash_chip_erase(), but give up instead of hanging.
+ * With a timeout of 0 the limit is derived from the chip's capacity and maximum sector erase time, or
+ * EXT_FLASH_DEFAULT_CHIP_ERASE_MAX_MS for a generic part.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param timeout_us - deadline in microseconds, 0 for the chip's limit.
+ * @return int - 0 on success, -1 on failure, EXT_FLASH_ERR_TIMEOUT or EXT_FLASH_ERR_CANCELLED.
+ */
+int emb_ext_flash_chip_erase_timeout(emb_flash_intf_handle_t *p_intf, uint32_t timeout_us);
+
+/**
+ * @brief emb_ext_flash_wait_idle wait for a program or erase in progress to finish, for example after a timeout or before
+ * handing the bus to another driver.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param timeout_us - deadline in microseconds, 0 only checks once.
+ * @return int - 0 when the chip is idle, -1 on failure, EXT_FLASH_ERR_TIMEOUT or EXT_FLASH_ERR_CANCELLED.
+ */
+int emb_ext_flash_wait_idle(emb_flash_intf_handle_t *p_intf, uint32_t timeout_us);
+
+/**
+ * @brief emb_ext_flash_cancel ask the bounded wait in progress, or the next one, to give up with EXT_FLASH_ERR_CANCELLED. Safe
+ * to call from an interrupt, another thread or the delay_us hook. The functions without a timeout are not affected.
+ *
+ * @param p_intf - pointer to the interface handle.
+ */
+void emb_ext_flash_cancel(emb_flash_intf_handle_t *p_intf);
+
 /**
  * @brief emb_ext_flash_get_status read the status register of the external flash memory chip.
  *
@@ -145,13 +476,134 @@ uint8_t emb_ext_flash_get_status(emb_flash_intf_handle_t *p_intf);
 int emb_ext_flash_sleep(emb_flash_intf_handle_t *p_intf);
 
 /**
- * @brief emb_ext_flash_wake wake the external flash memory chip from sleep mode.
+ * @brief emb_ext_flash_wake wake the external flash memory chip from sleep mode. When the handle has a time base the tRES1 delay
+ * is deferred to the next operation, so any time spent in between is not wasted. Calling this is optional, every operation
+ * wakes the chip by itself.
  *
  * @param p_intf - pointer to the interface handle.
  * @return int - 0 on success, -1 on failure.
  */
 int emb_ext_flash_wake(emb_flash_intf_handle_t *p_intf);
 
+/**
+ * @brief emb_ext_flash_pm_enable enable automatic deep power-down after the chip has been idle for idle_timeout_us. Requires the
+ * get_time_us function pointer in the handle.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param idle_timeout_us - idle time before the chip is put to sleep, 0 disables automatic sleep.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_pm_enable(emb_flash_intf_handle_t *p_intf, uint32_t idle_timeout_us);
+
+/**
+ * @brief emb_ext_flash_pm_poll put the chip to sleep if it has been idle for longer than the idle timeout. Call this from the
+ * idle loop or a periodic timer.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @return int - 1 if the chip was put to sleep, 0 if nothing was done, -1 on failure.
+ */
+int emb_ext_flash_pm_poll(emb_flash_intf_handle_t *p_intf);
+
+/**
+ * @brief emb_ext_flash_pm_get_times get the time the chip has spent asleep and awake since the handle was initialized.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param asleep_us - pointer to receive the time asleep in microseconds.
+ * @param awake_us - pointer to receive the time awake in microseconds.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_pm_get_times(emb_flash_intf_handle_t *p_intf, uint64_t *asleep_us, uint64_t *awake_us);
+
+/**
+ * @brief emb_ext_flash_set_chip tell the driver which chip it is talking to. Program and erase completion is then waited for
+ * by sleeping through most of the typical time and polling at a fraction of it instead of polling back to back, erases use
+ * only the erase sizes the chip supports, reads use the fast read command when the chip has it, and tRES1 is taken from the
+ * chip unless the handle sets its own.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param p_chip - pointer to the chip capabilities, NULL to go back to a generic part.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_set_chip(emb_flash_intf_handle_t *p_intf, const emb_ext_flash_chip_t *p_chip);
+
+/**
+ * @brief emb_ext_flash_set_low_round_trip cut the status round trips of programs and erases. Every wait for the chip reads the
+ * status in a single chip select cycle, clocking out status bytes until the chip is ready instead of sending a new command per
+ * poll. A write enable is trusted without reading WEL back when the last wait saw the chip idle and the command went out, and
+ * WEL is only polled when that is not known. Status reads are answered from the last status while the chip is known to be
+ * idle. This relies on every command to the chip going through the driver, and on the chip supporting continuous status
+ * output, as JEDEC serial NOR flash chips do.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param enable - 1 to enable, 0 to disable.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_set_low_round_trip(emb_flash_intf_handle_t *p_intf, uint8_t enable);
+
+/**
+ * @brief emb_ext_flash_set_read_ahead prefetch sequential reads. A read that starts where the previous one ended reads on past
+ * its own end, filling the buffer, and the reads that follow are served from it. The next read past the buffer refills it.
+ * With hold set the read command is left open after a prefetch, so a refill only clocks in more data. Any other operation
+ * closes it first, but chip select stays asserted until then, so only hold a bus the chip has to itself. A read elsewhere
+ * throws away what was prefetched, and so does any program or erase. The counters in the handle's ra field give the hit rate
+ * and the number of bytes prefetched for nothing.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param buf - pointer to the prefetch buffer, NULL to disable read-ahead.
+ * @param size - size of the buffer, the read-ahead window.
+ * @param hold - 1 to keep the read command open between reads.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_set_read_ahead(emb_flash_intf_handle_t *p_intf, uint8_t *buf, uint16_t size, uint8_t hold);
+
+/**
+ * @brief emb_ext_flash_release close an open read-ahead read command and deselect the chip, so another device can use the bus.
+ * What was prefetched is kept.
+ *
+ * @param p_intf - pointer to the interface handle.
+ */
+void emb_ext_flash_release(emb_flash_intf_handle_t *p_intf);
+
+/**
+ * @brief emb_ext_flash_set_burst_wrap let the chip do wrapped reads of wrap_len bytes with Set Burst with Wrap (0x77). This
+ * needs a chip set with emb_ext_flash_set_chip() that has EXT_FLASH_CHIP_FLAG_WRAP_READ. Most parts only wrap quad I/O
+ * reads, which the driver does not issue. The chip is switched on the next read that needs it: a wrapped read of this length
+ * turns wrapping on, and a linear read turns it off again. Wrapped reads of any other length, or with wrap_len 0, are done as
+ * two linear reads.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param wrap_len - 8, 16, 32 or 64, 0 to emulate every wrapped read.
+ * @return int - 0 on success, -1 on failure or if the chip cannot wrap the driver's reads.
+ */
+int emb_ext_flash_set_burst_wrap(emb_flash_intf_handle_t *p_intf, uint8_t wrap_len);
+
+/**
+ * @brief emb_ext_flash_read_wrapped fill a line critical word first. Reads the len byte line containing address, starting at
+ * address and wrapping round to the start of the line, so data[0] holds the byte at address.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param address - address of the first byte wanted, anywhere in the line.
+ * @param data - pointer to receive the line in wrapped order.
+ * @param len - line length, 8, 16, 32 or 64.
+ * @return int - the number of bytes read, 0 on failure.
+ */
+int emb_ext_flash_read_wrapped(emb_flash_intf_handle_t *p_intf, uint32_t address, uint8_t *data, uint8_t len);
+
+/**
+ * @brief emb_ext_flash_batch run an array of operations back to back. The arguments are validated and the chip woken once for
+ * the whole batch. Runs of reads that follow each other in the array and continue each other in the flash, allowing for gaps
+ * of up to EXT_FLASH_BATCH_MAX_GAP bytes, go out as a single read command, and a status read straight after another one
+ * that found the chip idle reuses its value. Each operation gets the result the matching single function would have
+ * returned: bytes read or written, 0 or -1 for erases, and the status register for status reads.
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @param ops - array of operations.
+ * @param count - number of operations.
+ * @param p_saved - pointer to receive the number of chip select cycles saved over separate calls, may be NULL.
+ * @return int - number of operations that succeeded, -1 if any operation is invalid, in which case none are run.
+ */
+int emb_ext_flash_batch(emb_flash_intf_handle_t *p_intf, emb_ext_flash_op_t *ops, uint16_t count, uint32_t *p_saved);
+
 /**
  * @brief emb_ext_flash_get_lib_ver get the version of the external flash memory library.
  * @return const char* - pointer to the version string.
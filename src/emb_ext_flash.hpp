@@ -0,0 +1,383 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_HPP_
+#define EMB_EXT_FLASH_HPP_
+
+#include <stdint.h>
+#include <type_traits>
+#include "emb_ext_flash.h"
+
+namespace emb_ext_flash
+{
+/**
+ * @brief GenericGeometry - geometry of a generic JEDEC serial NOR flash chip, this matches what the C driver assumes. Derive
+ * from it, or write a struct with the same static constexpr members, to describe a specific part.
+ */
+struct GenericGeometry
+{
+   // Capacity of the chip in bytes.
+   static constexpr uint32_t capacity = 0x1000000;
+   // Page program size in bytes, must be a power of two.
+   static constexpr uint32_t page_size = EXT_FLASH_PAGE_SIZE;
+   // Smallest erase size in bytes, must be a power of two.
+   static constexpr uint32_t sector_size = EXT_FLASH_SECTOR_SIZE;
+   // Number of address bytes sent with each command, 3 or 4. 4 byte parts use the dedicated 4 byte address commands.
+   static constexpr uint8_t address_bytes = 3;
+   // Flags to indicate the chip supports the 32K and 64K block erase commands.
+   static constexpr bool has_block_32k = true;
+   static constexpr bool has_block_64k = true;
+};
+
+/**
+ * @brief ExtFlash - header only front end for the external flash memory chip. The bus is a policy type with static select,
+ * deselect, write, read and delay_us functions that have the same signatures as the function pointers in
+ * emb_flash_intf_handle_t, so the compiler can inline every bus call. The geometry is a struct of static constexpr members, so
+ * page splitting, the erase plan and the address encoding are resolved at compile time. handle() returns a C interface
+ * handle wired to the same bus, so both APIs can drive the same chip, with the limits listed at handle().
+ */
+template <typename Bus, typename Geometry = GenericGeometry>
+class ExtFlash
+{
+public:
+   static_assert(!(Geometry::page_size & (Geometry::page_size - 1)), "page size must be a power of two");
+   static_assert(!(Geometry::sector_size & (Geometry::sector_size - 1)), "sector size must be a power of two");
+   static_assert(Geometry::address_bytes == 3 || Geometry::address_bytes == 4, "only 3 and 4 byte addressing is supported");
+
+   // Commands, picked for the address width at compile time
+   static constexpr uint8_t cmd_read         = Geometry::address_bytes == 4 ? EXT_FLASH_CMD_READ_DATA_4B : EXT_FLASH_CMD_READ_DATA;
+   static constexpr uint8_t cmd_page_program = Geometry::address_bytes == 4 ? EXT_FLASH_CMD_PAGE_PROGRAM_4B : EXT_FLASH_CMD_PAGE_PROGRAM;
+   static constexpr uint8_t cmd_sector_erase = Geometry::address_bytes == 4 ? EXT_FLASH_CMD_SECTOR_ERASE_4B : EXT_FLASH_CMD_SECTOR_ERASE;
+   static constexpr uint8_t cmd_block_32k    = Geometry::address_bytes == 4 ? EXT_FLASH_CMD_BLOCK_ERASE_32K_4B : EXT_FLASH_CMD_BLOCK_ERASE_32K;
+   static constexpr uint8_t cmd_block_64k    = Geometry::address_bytes == 4 ? EXT_FLASH_CMD_BLOCK_ERASE_64K_4B : EXT_FLASH_CMD_BLOCK_ERASE_64K;
+
+   /**
+    * @brief page_remaining number of bytes from address to the end of its page.
+    */
+   static constexpr uint32_t page_remaining(uint32_t address)
+   {
+      return(Geometry::page_size - (address & (Geometry::page_size - 1)));
+   }
+
+   /**
+    * @brief erase_step size of the largest erase that is aligned at address and no longer than remaining.
+    */
+   static constexpr uint32_t erase_step(uint32_t address, uint32_t remaining)
+   {
+      return((Geometry::has_block_64k && !(address % EXT_FLASH_BLOCK_64K_SIZE) && remaining >= EXT_FLASH_BLOCK_64K_SIZE) ?
+             EXT_FLASH_BLOCK_64K_SIZE :
+             (Geometry::has_block_32k && !(address % EXT_FLASH_BLOCK_32K_SIZE) && remaining >= EXT_FLASH_BLOCK_32K_SIZE) ?
+             EXT_FLASH_BLOCK_32K_SIZE : Geometry::sector_size);
+   }
+
+   /**
+    * @brief erase_cmd erase command for an erase step size.
+    */
+   static constexpr uint8_t erase_cmd(uint32_t size)
+   {
+      return(size == EXT_FLASH_BLOCK_64K_SIZE ? cmd_block_64k : size == EXT_FLASH_BLOCK_32K_SIZE ? cmd_block_32k : cmd_sector_erase);
+   }
+
+   /**
+    * @brief handle get a C interface handle wired to the same bus, ready to use with the emb_ext_flash_* functions. Calls
+    * through this class bypass the handle and do not see or update its state. Keep these C features off on a handle used
+    * alongside them:
+    * - power management (emb_ext_flash_pm_enable()), which may leave the chip in deep power-down where it ignores them.
+    * - read-ahead with a held command (emb_ext_flash_set_read_ahead() with hold set), which keeps chip select low between
+    *   C calls and expects the chip to still be streaming.
+    * - low round trip mode (emb_ext_flash_set_low_round_trip()), which trusts a cached status and WEL that their programs
+    *   and erases make stale.
+    * - burst wrap (emb_ext_flash_set_burst_wrap()), which may leave the chip wrapping their linear reads.
+    * Plain read-ahead is fine as long as their writes and erases do not touch the prefetched window.
+    */
+   static emb_flash_intf_handle_t handle()
+   {
+      emb_flash_intf_handle_t intf = {};
+
+      intf.select   = Bus::select;
+      intf.deselect = Bus::deselect;
+      intf.write    = Bus::write;
+      intf.read     = Bus::read;
+      intf.delay_us = Bus::delay_us;
+      emb_ext_flash_init_intf(&intf);
+
+      return(intf);
+   }
+
+   /**
+    * @brief jedec_id read the JEDEC ID, see emb_ext_flash_get_jedec_id().
+    */
+   static int jedec_id(uint8_t *manufacturer_id, uint8_t *memory_type, uint8_t *capacity)
+   {
+      uint8_t cmd     = EXT_FLASH_CMD_JEDEC_ID;
+      uint8_t data[3] = { 0 };
+
+      if (!manufacturer_id || !memory_type || !capacity)
+      {
+         return(-1);
+      }
+
+      Bus::select();
+      Bus::write(&cmd, 1);
+      int rtn = Bus::read(data, 3);
+      Bus::deselect();
+
+      *manufacturer_id = data[0];
+      *memory_type     = data[1];
+      *capacity        = data[2];
+
+      return(rtn);
+   }
+
+   /**
+    * @brief status read the status register.
+    */
+   static uint8_t status()
+   {
+      uint8_t cmd    = EXT_FLASH_CMD_READ_STATUS_REG;
+      uint8_t status = 0;
+
+      Bus::select();
+      Bus::write(&cmd, 1);
+      Bus::read(&status, 1);
+      Bus::deselect();
+
+      return(status);
+   }
+
+   /**
+    * @brief read read any length with a single command, see emb_ext_flash_read().
+    * @return int - number of bytes successfully read.
+    */
+   static int read(uint32_t address, uint8_t *data, uint32_t len)
+   {
+      uint32_t done = 0;
+
+      if (!data || !len)
+      {
+         return(0);
+      }
+
+      Bus::select();
+      if (send_cmd(cmd_read, address) != 0)
+      {
+         Bus::deselect();
+         return(0);
+      }
+      while (done < len)
+      {
+         uint16_t chunk = (len - done) > 0x8000 ? 0x8000 : (len - done);
+         if (Bus::read(&data[done], chunk) != 0)
+         {
+            break;
+         }
+         done += chunk;
+      }
+      Bus::deselect();
+
+      return(done);
+   }
+
+   /**
+    * @brief write program any length, split on page boundaries, see emb_ext_flash_write().
+    * @return int - number of bytes successfully written.
+    */
+   static int write(uint32_t address, uint8_t *data, uint32_t len)
+   {
+      uint32_t done = 0;
+
+      if (!data || !len)
+      {
+         return(0);
+      }
+
+      while (done < len)
+      {
+         uint32_t chunk = page_remaining(address);
+         if (chunk > len - done)
+         {
+            chunk = len - done;
+         }
+
+         write_enable();
+         Bus::select();
+         int rtn = send_cmd(cmd_page_program, address);
+         if (rtn == 0)
+         {
+            rtn = Bus::write(&data[done], chunk);
+         }
+         Bus::deselect();
+         wait_busy();
+
+         if (rtn != 0)
+         {
+            break;
+         }
+         done    += chunk;
+         address += chunk;
+      }
+
+      return(done);
+   }
+
+   /**
+    * @brief erase erase every sector overlapping [address, address + len) using the largest aligned erase for each step.
+    * @return int - 0 on success, -1 on failure or an empty range.
+    */
+   static int erase(uint32_t address, uint32_t len)
+   {
+      if (!len)
+      {
+         return(-1);
+      }
+
+      uint32_t end = (address + len + Geometry::sector_size - 1) & ~(Geometry::sector_size - 1);
+
+      address &= ~(Geometry::sector_size - 1);
+      while (address < end)
+      {
+         uint32_t step = erase_step(address, end - address);
+         if (erase_one(erase_cmd(step), address) != 0)
+         {
+            return(-1);
+         }
+         address += step;
+      }
+
+      return(0);
+   }
+
+   /**
+    * @brief erase erase a range known at compile time, the erase plan is fully unrolled into a fixed command sequence.
+    * @return int - 0 on success, -1 on failure.
+    */
+   template <uint32_t Address, uint32_t Len>
+   static int erase()
+   {
+      static_assert(!(Address % Geometry::sector_size) && !(Len % Geometry::sector_size), "range must be sector aligned");
+      static_assert(Address + Len <= Geometry::capacity, "range must be inside the chip");
+
+      return(erase_plan <Address, Address + Len>(std::integral_constant <bool, !Len>()));
+   }
+
+   /**
+    * @brief chip_erase erase the entire chip.
+    * @return int - 0 on success, -1 on failure.
+    */
+   static int chip_erase()
+   {
+      write_enable();
+      int rtn = send_single(EXT_FLASH_CMD_CHIP_ERASE);
+      wait_busy();
+
+      return(rtn);
+   }
+
+   /**
+    * @brief sleep put the chip into deep power-down.
+    */
+   static int sleep()
+   {
+      return(send_single(EXT_FLASH_CMD_POWER_DOWN));
+   }
+
+   /**
+    * @brief wake release the chip from deep power-down and wait tRES1.
+    */
+   static int wake(uint32_t t_res1_us = EXT_FLASH_DEFAULT_T_RES1_US)
+   {
+      int rtn = send_single(EXT_FLASH_CMD_RELEASE_POWER_DOWN);
+      Bus::delay_us(t_res1_us);
+
+      return(rtn);
+   }
+
+private:
+   // Send a command followed by the address, most significant byte first
+   static int send_cmd(uint8_t cmd, uint32_t address)
+   {
+      uint8_t buf[1 + Geometry::address_bytes];
+
+      buf[0] = cmd;
+      for (uint8_t i = 0; i < Geometry::address_bytes; i++)
+      {
+         buf[1 + i] = (address >> (8 * (Geometry::address_bytes - 1 - i))) & 0xFF;
+      }
+      return(Bus::write(buf, sizeof(buf)));
+   }
+
+   static int send_single(uint8_t cmd)
+   {
+      Bus::select();
+      int rtn = Bus::write(&cmd, 1);
+      Bus::deselect();
+
+      return(rtn);
+   }
+
+   static void write_enable()
+   {
+      send_single(EXT_FLASH_CMD_WRITE_ENABLE);
+      while (!(status() & EXT_FLASH_STATUS_REG_WEL))
+      {
+         ;
+      }
+   }
+
+   static void wait_busy()
+   {
+      while (status() & EXT_FLASH_STATUS_REG_BUSY)
+      {
+         ;
+      }
+   }
+
+   static int erase_one(uint8_t cmd, uint32_t address)
+   {
+      write_enable();
+      Bus::select();
+      int rtn = send_cmd(cmd, address);
+      Bus::deselect();
+      wait_busy();
+
+      return(rtn);
+   }
+
+   template <uint32_t Address, uint32_t End>
+   static int erase_plan(std::true_type)
+   {
+      return(0);
+   }
+
+   template <uint32_t Address, uint32_t End>
+   static int erase_plan(std::false_type)
+   {
+      constexpr uint32_t step = erase_step(Address, End - Address);
+
+      if (erase_one(erase_cmd(step), Address) != 0)
+      {
+         return(-1);
+      }
+
+      return(erase_plan <Address + step, End>(std::integral_constant <bool, (Address + step >= End)>()));
+   }
+};
+} // namespace emb_ext_flash
+
+#endif /* EMB_EXT_FLASH_HPP_ */
@@ -0,0 +1,335 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_le.h"
+#include "emb_ext_flash_bits.h"
+
+// Sector layout, the header is the magic, the base and the base inverted, programmed base first and magic last
+#define BITS_MAGIC          0x31544942 // "BIT1"
+#define BITS_SPACE          (EXT_FLASH_SECTOR_SIZE - EXT_FLASH_BITS_HEADER_SIZE)
+
+// Private functions
+// Bytes of the run after the header, and of each flag slot
+static uint32_t bits_run_bytes(emb_ext_flash_bits_t *p_bits)
+{
+   return((p_bits->capacity + 7) / 8);
+}
+
+static uint32_t bits_slot_bytes(emb_ext_flash_bits_t *p_bits)
+{
+   return((p_bits->count + 7u) / 8);
+}
+
+// Address of the current flag slot
+static uint32_t bits_slot_addr(emb_ext_flash_bits_t *p_bits)
+{
+   return(p_bits->area[p_bits->cur] + EXT_FLASH_BITS_HEADER_SIZE + bits_run_bytes(p_bits) +
+          p_bits->used * bits_slot_bytes(p_bits));
+}
+
+// Clear one bit with a single byte program, the bits left set in the byte are not touched
+static int bits_clear(emb_ext_flash_bits_t *p_bits, uint32_t address, uint8_t bit)
+{
+   uint8_t byte = (uint8_t)~(1u << bit);
+
+   p_bits->stat_programs++;
+
+   return(emb_ext_flash_write(p_bits->p_intf, address, &byte, 1) == 1 ? 0 : -1);
+}
+
+// Base value of a sector, returns 0 if it holds a header, 1 if it does not and -1 if the header is corrupt or unreadable
+static int bits_read_header(emb_ext_flash_bits_t *p_bits, uint8_t i, uint32_t *p_base)
+{
+   uint8_t hdr[EXT_FLASH_BITS_HEADER_SIZE];
+
+   if (emb_ext_flash_read(p_bits->p_intf, p_bits->area[i], hdr, sizeof(hdr)) != sizeof(hdr))
+   {
+      return(-1);
+   }
+   if (emb_ext_flash_get_u32(hdr) != BITS_MAGIC)
+   {
+      return(1);
+   }
+
+   // The magic goes on after the base, so a base that does not match its inverted copy was disturbed later
+   *p_base = emb_ext_flash_get_u32(&hdr[4]);
+
+   return(*p_base == (uint32_t)~emb_ext_flash_get_u32(&hdr[8]) ? 0 : -1);
+}
+
+// Erase a sector and make it the current one with the given base
+static int bits_format(emb_ext_flash_bits_t *p_bits, uint8_t i, uint32_t base)
+{
+   uint8_t hdr[EXT_FLASH_BITS_HEADER_SIZE];
+
+   emb_ext_flash_put_u32(hdr, BITS_MAGIC);
+   emb_ext_flash_put_u32(&hdr[4], base);
+   emb_ext_flash_put_u32(&hdr[8], ~base);
+
+   p_bits->stat_erases++;
+   if (emb_ext_flash_erase(p_bits->p_intf, p_bits->area[i], EXT_FLASH_SECTOR_SIZE) != 0)
+   {
+      return(-1);
+   }
+
+   // The magic commits the sector, so it goes last
+   p_bits->stat_programs += 2;
+   if (emb_ext_flash_write(p_bits->p_intf, p_bits->area[i] + 4, &hdr[4], 8) != 8 ||
+       emb_ext_flash_write(p_bits->p_intf, p_bits->area[i], hdr, 4) != 4)
+   {
+      return(-1);
+   }
+
+   p_bits->cur  = i;
+   p_bits->base = base;
+   p_bits->used = 0;
+   memset(p_bits->flags, 0xFF, sizeof(p_bits->flags));
+
+   return(0);
+}
+
+// Number of bits cleared in the run, the cleared bytes come first so a binary search finds the first byte that is not 0x00
+static int bits_scan(emb_ext_flash_bits_t *p_bits)
+{
+   uint32_t run  = p_bits->area[p_bits->cur] + EXT_FLASH_BITS_HEADER_SIZE;
+   uint32_t lo   = 0;
+   uint32_t hi   = bits_run_bytes(p_bits);
+   uint8_t  byte = 0xFF;
+
+   while (lo < hi)
+   {
+      uint32_t mid = (lo + hi) / 2;
+      p_bits->stat_probes++;
+      if (emb_ext_flash_read(p_bits->p_intf, run + mid, &byte, 1) != 1)
+      {
+         return(-1);
+      }
+      if (byte == 0x00)
+      {
+         lo = mid + 1;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+
+   // Bits within the first byte not fully cleared go from the least significant up
+   uint32_t used = lo * 8;
+   if (lo < bits_run_bytes(p_bits))
+   {
+      p_bits->stat_probes++;
+      if (emb_ext_flash_read(p_bits->p_intf, run + lo, &byte, 1) != 1)
+      {
+         return(-1);
+      }
+      while (used < lo * 8 + 8 && !(byte & (1u << (used & 7))))
+      {
+         used++;
+      }
+   }
+   p_bits->used = used < p_bits->capacity ? used : p_bits->capacity;
+
+   return(0);
+}
+
+// Find the current sector and the length of its run, or format the first sector when neither holds a header. A corrupt
+// header fails the open rather than falling back to the older sector, which would take the value backwards.
+static int bits_open(emb_ext_flash_bits_t *p_bits)
+{
+   uint32_t base[2];
+   int      valid[2];
+
+   for (uint8_t i = 0; i < 2; i++)
+   {
+      int rtn = bits_read_header(p_bits, i, &base[i]);
+      if (rtn < 0)
+      {
+         return(-1);
+      }
+      valid[i] = rtn == 0;
+   }
+   if (!valid[0] && !valid[1])
+   {
+      return(bits_format(p_bits, 0, 0));
+   }
+
+   p_bits->cur  = (!valid[0] || (valid[1] && base[1] > base[0])) ? 1 : 0;
+   p_bits->base = base[p_bits->cur];
+
+   return(bits_scan(p_bits));
+}
+
+// Check the arguments shared by counters and flags
+static int bits_init(emb_ext_flash_bits_t *p_bits, emb_flash_intf_handle_t *p_intf, uint32_t area_a, uint32_t area_b)
+{
+   // Null check
+   if (!p_bits || !p_intf || !p_intf->initialized || area_a == area_b || (area_a & (EXT_FLASH_SECTOR_SIZE - 1)) ||
+       (area_b & (EXT_FLASH_SECTOR_SIZE - 1)))
+   {
+      return(-1);
+   }
+
+   memset(p_bits, 0, sizeof(*p_bits));
+   p_bits->p_intf  = p_intf;
+   p_bits->area[0] = area_a;
+   p_bits->area[1] = area_b;
+
+   return(0);
+}
+
+// Pubic functions
+int emb_ext_flash_counter_open(emb_ext_flash_bits_t *p_bits, emb_flash_intf_handle_t *p_intf, uint32_t area_a, uint32_t area_b)
+{
+   if (bits_init(p_bits, p_intf, area_a, area_b) != 0)
+   {
+      return(-1);
+   }
+
+   // The whole sector after the header is the run
+   p_bits->capacity = BITS_SPACE * 8;
+
+   return(bits_open(p_bits));
+}
+
+int emb_ext_flash_counter_increment(emb_ext_flash_bits_t *p_bits)
+{
+   // Null check
+   if (!p_bits || !p_bits->p_intf || p_bits->count)
+   {
+      return(-1);
+   }
+
+   // Carry the value over to the other sector once the run is used up
+   if (p_bits->used == p_bits->capacity && bits_format(p_bits, p_bits->cur ^ 1, p_bits->base + p_bits->capacity) != 0)
+   {
+      return(-1);
+   }
+
+   uint32_t run = p_bits->area[p_bits->cur] + EXT_FLASH_BITS_HEADER_SIZE;
+   if (bits_clear(p_bits, run + p_bits->used / 8, p_bits->used & 7) != 0)
+   {
+      return(-1);
+   }
+   p_bits->used++;
+
+   return(0);
+}
+
+uint32_t emb_ext_flash_counter_value(emb_ext_flash_bits_t *p_bits)
+{
+   // Null check
+   if (!p_bits || !p_bits->p_intf || p_bits->count)
+   {
+      return(0);
+   }
+
+   return(p_bits->base + p_bits->used);
+}
+
+int emb_ext_flash_flags_open(emb_ext_flash_bits_t *p_bits, emb_flash_intf_handle_t *p_intf, uint32_t area_a, uint32_t area_b,
+                             uint16_t count)
+{
+   if (!count || count > EXT_FLASH_BITS_MAX_FLAGS || bits_init(p_bits, p_intf, area_a, area_b) != 0)
+   {
+      return(-1);
+   }
+
+   // As many slots as fit after the run that retires them
+   uint32_t slot     = (count + 7u) / 8;
+   p_bits->count     = count;
+   p_bits->capacity  = BITS_SPACE * 8 / (slot * 8 + 1);
+   while ((p_bits->capacity + 7) / 8 + p_bits->capacity * slot > BITS_SPACE)
+   {
+      p_bits->capacity--;
+   }
+
+   if (bits_open(p_bits) != 0)
+   {
+      return(-1);
+   }
+
+   // The last slot is never retired, a reset from it moves to the other sector
+   if (p_bits->used >= p_bits->capacity)
+   {
+      p_bits->used = p_bits->capacity - 1;
+   }
+
+   return(emb_ext_flash_read(p_intf, bits_slot_addr(p_bits), p_bits->flags, (uint16_t)slot) == (int)slot ? 0 : -1);
+}
+
+int emb_ext_flash_flags_set(emb_ext_flash_bits_t *p_bits, uint16_t flag)
+{
+   // Null check
+   if (!p_bits || !p_bits->p_intf || flag >= p_bits->count)
+   {
+      return(-1);
+   }
+
+   // Already set, nothing to program
+   uint8_t bit = flag & 7;
+   if (!(p_bits->flags[flag / 8] & (1u << bit)))
+   {
+      return(0);
+   }
+
+   if (bits_clear(p_bits, bits_slot_addr(p_bits) + flag / 8, bit) != 0)
+   {
+      return(-1);
+   }
+   p_bits->flags[flag / 8] &= (uint8_t)~(1u << bit);
+
+   return(0);
+}
+
+int emb_ext_flash_flags_get(emb_ext_flash_bits_t *p_bits, uint16_t flag)
+{
+   // Null check
+   if (!p_bits || !p_bits->p_intf || flag >= p_bits->count)
+   {
+      return(-1);
+   }
+
+   return((p_bits->flags[flag / 8] & (1u << (flag & 7))) ? 0 : 1);
+}
+
+int emb_ext_flash_flags_reset(emb_ext_flash_bits_t *p_bits)
+{
+   // Null check
+   if (!p_bits || !p_bits->p_intf || !p_bits->count)
+   {
+      return(-1);
+   }
+
+   // Retire the current slot, or start over in the other sector from the last one
+   if (p_bits->used + 1 < p_bits->capacity)
+   {
+      uint32_t run = p_bits->area[p_bits->cur] + EXT_FLASH_BITS_HEADER_SIZE;
+      if (bits_clear(p_bits, run + p_bits->used / 8, p_bits->used & 7) != 0)
+      {
+         return(-1);
+      }
+      p_bits->used++;
+      memset(p_bits->flags, 0xFF, sizeof(p_bits->flags));
+      return(0);
+   }
+
+   return(bits_format(p_bits, p_bits->cur ^ 1, p_bits->base + 1));
+}
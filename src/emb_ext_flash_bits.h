@@ -0,0 +1,156 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_BITS_H_
+#define EMB_EXT_FLASH_BITS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Erase-free monotonic counters and flags, kept as bits cleared by small page programs.
+ *
+ * NOR flash can clear bits without an erase, so a counter is a run of bits cleared one at a time and a flag is a single bit.
+ * Each increment or flag set is a single one byte page program. Each primitive owns two 4K sectors used in turn. A sector
+ * starts with a header holding a magic number, a base value and an inverted copy of the base, and the sector with the larger
+ * base is the current one.
+ *
+ * - A counter's value is the base plus the number of bits cleared in the run after the header. When the run is used up, the
+ *   other sector is erased and given the current value as its base, so a counter erases once every 32672 increments.
+ * - Flags live in slots of count bits after a short run that retires slots. Resetting all the flags retires the current
+ *   slot, and once every slot has been used the flags move to the other sector with a fresh set of slots.
+ *
+ * Open finds the current sector from the two headers, and the length of the run with a binary search for its first byte
+ * that is not 0x00. The header is programmed base first and magic last, so a sector whose erase or header program was cut
+ * short by a power loss is never taken for the current one. A header whose base does not match its inverted copy fails the
+ * open. A bit lost with the power is either cleared or not, so a counter
+ * never goes backwards.
+ */
+
+// Most flags a flag set can hold
+#ifndef EXT_FLASH_BITS_MAX_FLAGS
+#define EXT_FLASH_BITS_MAX_FLAGS    256
+#endif
+
+// Bytes taken by the header at the start of each sector
+#define EXT_FLASH_BITS_HEADER_SIZE  12
+
+/**
+ * @brief emb_ext_flash_bits_t - state of a counter or flag set. Treat the contents as private apart from the statistics.
+ */
+typedef struct
+{
+   // Pointer to the interface handle.
+   emb_flash_intf_handle_t *p_intf;
+   // Addresses of the two sectors, and which one is current.
+   uint32_t area[2];
+   uint8_t cur;
+   // Base value of the current sector.
+   uint32_t base;
+   // Bits in the run after the header and the number cleared so far. For flags the run retires slots, and the number
+   // cleared is the current slot.
+   uint32_t capacity;
+   uint32_t used;
+   // Number of flags, 0 for a counter, and the current slot's flags, a 0 bit for each flag that is set.
+   uint16_t count;
+   uint8_t flags[EXT_FLASH_BITS_MAX_FLAGS / 8];
+   // Statistics: page programs, sector erases and single byte reads of the binary search.
+   uint32_t stat_programs;
+   uint32_t stat_erases;
+   uint32_t stat_probes;
+} emb_ext_flash_bits_t;
+
+/**
+ * @brief emb_ext_flash_counter_open open a counter on two sectors, formatting them when neither holds one.
+ *
+ * @param p_bits - pointer to the counter.
+ * @param p_intf - pointer to the interface handle.
+ * @param area_a - address of the first sector, aligned to EXT_FLASH_SECTOR_SIZE.
+ * @param area_b - address of the second sector, aligned to EXT_FLASH_SECTOR_SIZE.
+ * @return int - 0 on success, -1 on failure or when a header is corrupt.
+ */
+int emb_ext_flash_counter_open(emb_ext_flash_bits_t *p_bits, emb_flash_intf_handle_t *p_intf, uint32_t area_a, uint32_t area_b);
+
+/**
+ * @brief emb_ext_flash_counter_increment add one to a counter with a single one byte program, or a sector erase and header
+ * first once every 32672 increments.
+ *
+ * @param p_bits - pointer to the counter.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_counter_increment(emb_ext_flash_bits_t *p_bits);
+
+/**
+ * @brief emb_ext_flash_counter_value get the value of a counter.
+ *
+ * @param p_bits - pointer to the counter.
+ * @return uint32_t - the value, 0 for a counter that is not open.
+ */
+uint32_t emb_ext_flash_counter_value(emb_ext_flash_bits_t *p_bits);
+
+/**
+ * @brief emb_ext_flash_flags_open open a set of flags on two sectors, formatting them when neither holds one. The count has to
+ * stay the same from one open to the next.
+ *
+ * @param p_bits - pointer to the flags.
+ * @param p_intf - pointer to the interface handle.
+ * @param area_a - address of the first sector, aligned to EXT_FLASH_SECTOR_SIZE.
+ * @param area_b - address of the second sector, aligned to EXT_FLASH_SECTOR_SIZE.
+ * @param count - number of flags, 1 to EXT_FLASH_BITS_MAX_FLAGS.
+ * @return int - 0 on success, -1 on failure or when a header is corrupt.
+ */
+int emb_ext_flash_flags_open(emb_ext_flash_bits_t *p_bits, emb_flash_intf_handle_t *p_intf, uint32_t area_a, uint32_t area_b,
+                             uint16_t count);
+
+/**
+ * @brief emb_ext_flash_flags_set set a flag with a single one byte program, nothing is programmed when it is already set.
+ *
+ * @param p_bits - pointer to the flags.
+ * @param flag - flag number.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_flags_set(emb_ext_flash_bits_t *p_bits, uint16_t flag);
+
+/**
+ * @brief emb_ext_flash_flags_get get a flag.
+ *
+ * @param p_bits - pointer to the flags.
+ * @param flag - flag number.
+ * @return int - 1 if set, 0 if not, -1 on failure.
+ */
+int emb_ext_flash_flags_get(emb_ext_flash_bits_t *p_bits, uint16_t flag);
+
+/**
+ * @brief emb_ext_flash_flags_reset clear every flag by moving on to a fresh slot, a single one byte program until the slots
+ * of the sector run out.
+ *
+ * @param p_bits - pointer to the flags.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_flags_reset(emb_ext_flash_bits_t *p_bits);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_BITS_H_ */
@@ -0,0 +1,135 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <stddef.h>
+#include "emb_ext_flash_chips.h"
+
+// Shorthands to keep the table on one line per part
+#define ERASE_ALL    EXT_FLASH_CHIP_ERASE_ALL
+#define ERASE_NO32   (EXT_FLASH_CHIP_ERASE_4K | EXT_FLASH_CHIP_ERASE_64K)
+#define SUSP         EXT_FLASH_CHIP_FLAG_SUSPEND
+#define ADDR4        EXT_FLASH_CHIP_FLAG_4BYTE_ADDR
+#define FAST         EXT_FLASH_READ_MODE_FAST
+#define DUAL_OUT     EXT_FLASH_READ_MODE_DUAL_OUT
+#define QUAD_IO      EXT_FLASH_READ_MODE_QUAD_IO
+
+// Sorted by JEDEC ID for the binary search
+static const emb_ext_flash_chip_t _chips[] = {
+   // jedec_id   log2 erase      read      flags        tPP typ/max us  tSE typ/max ms  tRES1
+   { 0x1F4216,   22,  ERASE_ALL, QUAD_IO,  SUSP,        400,  2500,     60,  300,       3  }, // AT25SL321
+   { 0x1F4401,   19,  ERASE_ALL, DUAL_OUT, SUSP,        1250, 3000,     40,  300,       35 }, // AT25XE041D
+   { 0x1F8401,   19,  ERASE_ALL, QUAD_IO,  SUSP,        400,  2500,     60,  300,       3  }, // AT25SF041
+   { 0x1F8501,   20,  ERASE_ALL, QUAD_IO,  SUSP,        400,  2500,     60,  300,       3  }, // AT25SF081
+   { 0x1F8601,   21,  ERASE_ALL, QUAD_IO,  SUSP,        400,  2500,     60,  300,       3  }, // AT25SF161
+   { 0x1F8701,   22,  ERASE_ALL, QUAD_IO,  SUSP,        400,  2500,     60,  300,       3  }, // AT25SF321
+   { 0x9D6015,   21,  ERASE_ALL, QUAD_IO,  SUSP,        200,  800,      45,  300,       5  }, // IS25LP016D
+   { 0x9D6016,   22,  ERASE_ALL, QUAD_IO,  SUSP,        200,  800,      45,  300,       5  }, // IS25LP032D
+   { 0x9D6017,   23,  ERASE_ALL, QUAD_IO,  SUSP,        200,  800,      45,  300,       5  }, // IS25LP064A
+   { 0x9D6018,   24,  ERASE_ALL, QUAD_IO,  SUSP,        200,  800,      45,  300,       5  }, // IS25LP128F
+   { 0x9D7017,   23,  ERASE_ALL, QUAD_IO,  SUSP,        200,  800,      45,  300,       5  }, // IS25WP064A
+   { 0xC22015,   21,  ERASE_ALL, DUAL_OUT, 0,           600,  3000,     40,  200,       9  }, // MX25L1606E
+   { 0xC22016,   22,  ERASE_ALL, QUAD_IO,  SUSP,        500,  3000,     35,  200,       9  }, // MX25L3233F
+   { 0xC22017,   23,  ERASE_ALL, QUAD_IO,  SUSP,        500,  3000,     35,  200,       9  }, // MX25L6433F
+   { 0xC22018,   24,  ERASE_ALL, QUAD_IO,  SUSP,        500,  3000,     35,  200,       9  }, // MX25L12833F
+   { 0xC22817,   23,  ERASE_ALL, QUAD_IO,  SUSP,        850,  4000,     40,  240,       35 }, // MX25R6435F
+   { 0xC84015,   21,  ERASE_ALL, QUAD_IO,  SUSP,        600,  2400,     50,  400,       20 }, // GD25Q16C
+   { 0xC84016,   22,  ERASE_ALL, QUAD_IO,  SUSP,        600,  2400,     50,  400,       20 }, // GD25Q32C
+   { 0xC84017,   23,  ERASE_ALL, QUAD_IO,  SUSP,        600,  2400,     50,  400,       20 }, // GD25Q64C
+   { 0xC84018,   24,  ERASE_ALL, QUAD_IO,  SUSP,        600,  2400,     50,  400,       20 }, // GD25Q128C
+   { 0xC86017,   23,  ERASE_ALL, QUAD_IO,  SUSP,        700,  2400,     60,  500,       20 }, // GD25LQ64C
+   { 0xEF4014,   20,  ERASE_ALL, QUAD_IO,  SUSP,        800,  3000,     45,  400,       3  }, // W25Q80DV
+   { 0xEF4015,   21,  ERASE_ALL, QUAD_IO,  SUSP,        400,  3000,     45,  400,       3  }, // W25Q16JV
+   { 0xEF4016,   22,  ERASE_ALL, QUAD_IO,  SUSP,        400,  3000,     45,  400,       3  }, // W25Q32JV
+   { 0xEF4017,   23,  ERASE_ALL, QUAD_IO,  SUSP,        400,  3000,     45,  400,       3  }, // W25Q64JV
+   { 0xEF4018,   24,  ERASE_ALL, QUAD_IO,  SUSP,        400,  3000,     45,  400,       3  }, // W25Q128JV
+   { 0xEF4019,   25,  ERASE_NO32, QUAD_IO, SUSP | ADDR4, 400, 3000,     45,  400,       3  }, // W25Q256JV, no 4-byte 32K erase
+   { 0xEF6017,   23,  ERASE_ALL, QUAD_IO,  SUSP,        400,  3000,     45,  400,       3  }, // W25Q64JW
+};
+
+// Public functions
+const emb_ext_flash_chip_t *emb_ext_flash_chip_lookup(uint32_t jedec_id)
+{
+   uint32_t lo = 0;
+   uint32_t hi = sizeof(_chips) / sizeof(_chips[0]);
+
+   while (lo < hi)
+   {
+      uint32_t mid = (lo + hi) / 2;
+      if (_chips[mid].jedec_id == jedec_id)
+      {
+         return(&_chips[mid]);
+      }
+      if (_chips[mid].jedec_id < jedec_id)
+      {
+         lo = mid + 1;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+
+   return(NULL);
+}
+
+int emb_ext_flash_chip_detect(emb_flash_intf_handle_t *p_intf)
+{
+   uint8_t manufacturer_id;
+   uint8_t memory_type;
+   uint8_t capacity;
+
+   // Null check
+   if (!p_intf || !p_intf->initialized)
+   {
+      return(-1);
+   }
+
+   if (emb_ext_flash_get_jedec_id(p_intf, &manufacturer_id, &memory_type, &capacity) != 0)
+   {
+      return(-1);
+   }
+
+   const emb_ext_flash_chip_t *p_chip = emb_ext_flash_chip_lookup(((uint32_t)manufacturer_id << 16) | (memory_type << 8) | capacity);
+   if (emb_ext_flash_set_chip(p_intf, p_chip) != 0)
+   {
+      return(-1);
+   }
+
+   return(p_chip ? 0 : 1);
+}
+
+int emb_ext_flash_chip_init(emb_flash_intf_handle_t *p_intf)
+{
+   if (emb_ext_flash_init_intf(p_intf) != 0)
+   {
+      return(-1);
+   }
+
+   return(emb_ext_flash_chip_detect(p_intf));
+}
+
+uint32_t emb_ext_flash_chip_count()
+{
+   return(sizeof(_chips) / sizeof(_chips[0]));
+}
+
+const emb_ext_flash_chip_t *emb_ext_flash_chip_get(uint32_t index)
+{
+   return(index < emb_ext_flash_chip_count() ? &_chips[index] : NULL);
+}
@@ -0,0 +1,81 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_CHIPS_H_
+#define EMB_EXT_FLASH_CHIPS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Built in table of common serial NOR parts from Winbond, Macronix, GigaDevice, Adesto/Dialog and ISSI, keyed by JEDEC ID.
+ * Timings are the typical and maximum figures from the manufacturers' datasheets at 3.3V (1.8V for the W, LQ, SL and WP
+ * parts). Parts that are not in the table can be described with an emb_ext_flash_chip_t of their own and handed to
+ * emb_ext_flash_set_chip().
+ */
+
+/**
+ * @brief emb_ext_flash_chip_lookup find a chip in the built in table.
+ *
+ * @param jedec_id - JEDEC ID, manufacturer in bits 23..16, memory type in bits 15..8 and capacity code in bits 7..0.
+ * @return const emb_ext_flash_chip_t* - pointer to the entry, NULL if the chip is not in the table.
+ */
+const emb_ext_flash_chip_t *emb_ext_flash_chip_lookup(uint32_t jedec_id);
+
+/**
+ * @brief emb_ext_flash_chip_detect read the JEDEC ID and apply the matching table entry to the handle.
+ *
+ * @param p_intf - pointer to an initialized interface handle.
+ * @return int - 0 if the chip was found, 1 if it is not in the table and is treated as a generic part, -1 on failure.
+ */
+int emb_ext_flash_chip_detect(emb_flash_intf_handle_t *p_intf);
+
+/**
+ * @brief emb_ext_flash_chip_init initialize the interface handle and apply the table entry of the chip found on it, use in
+ * place of emb_ext_flash_init_intf().
+ *
+ * @param p_intf - pointer to the interface handle.
+ * @return int - 0 if the chip was found, 1 if it is not in the table and is treated as a generic part, -1 on failure.
+ */
+int emb_ext_flash_chip_init(emb_flash_intf_handle_t *p_intf);
+
+/**
+ * @brief emb_ext_flash_chip_count get the number of entries in the built in table.
+ *
+ * @return uint32_t - number of entries.
+ */
+uint32_t emb_ext_flash_chip_count();
+
+/**
+ * @brief emb_ext_flash_chip_get get an entry of the built in table by index.
+ *
+ * @param index - index of the entry.
+ * @return const emb_ext_flash_chip_t* - pointer to the entry, NULL if the index is out of range.
+ */
+const emb_ext_flash_chip_t *emb_ext_flash_chip_get(uint32_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_CHIPS_H_ */
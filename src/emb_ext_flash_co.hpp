@@ -0,0 +1,626 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_CO_HPP_
+#define EMB_EXT_FLASH_CO_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <coroutine>
+#include "emb_ext_flash.h"
+
+/**
+ * C++20 coroutine front end. Operations on a chip are coroutines that suspend while the chip is busy instead of blocking in the
+ * driver's waits. A Loop polls the status of the chips its operations wait on and resumes each operation once its chip is
+ * idle, so any number of chips can be driven from one thread, for example from the event loop of a host or an RTOS task.
+ * Coroutine frames come from a fixed pool, nothing is allocated per operation.
+ */
+
+// Size of each pooled coroutine frame in bytes, and the number of frames
+#ifndef EXT_FLASH_CO_FRAME_SIZE
+#define EXT_FLASH_CO_FRAME_SIZE 512
+#endif
+#ifndef EXT_FLASH_CO_FRAMES
+#define EXT_FLASH_CO_FRAMES     32
+#endif
+
+// Status poll interval of a busy chip in microseconds when the device does not set its own
+#ifndef EXT_FLASH_CO_POLL_US
+#define EXT_FLASH_CO_POLL_US    100
+#endif
+
+namespace emb_ext_flash
+{
+/**
+ * @brief FramePool - the fixed pool the coroutine frames come from. A frame larger than EXT_FLASH_CO_FRAME_SIZE, or one asked for
+ * while every frame is in use, is not allocated and the operation completes straight away with -1. Not thread safe, a pool is
+ * meant to be used from the one thread running the loop.
+ */
+class FramePool
+{
+public:
+   static void *alloc(size_t size) noexcept
+   {
+      State &s = state();
+
+      if (!s.ready)
+      {
+         for (uint16_t i = 0; i < EXT_FLASH_CO_FRAMES; i++)
+         {
+            s.blocks[i].next = i + 1 < EXT_FLASH_CO_FRAMES ? &s.blocks[i + 1] : nullptr;
+         }
+         s.free_list = &s.blocks[0];
+         s.ready     = true;
+      }
+
+      if (size > EXT_FLASH_CO_FRAME_SIZE || !s.free_list)
+      {
+         s.failures++;
+         return(nullptr);
+      }
+
+      Block *p_block = s.free_list;
+      s.free_list = p_block->next;
+      s.in_use++;
+      s.high_water = s.in_use > s.high_water ? s.in_use : s.high_water;
+
+      return(p_block);
+   }
+
+   static void free(void *p) noexcept
+   {
+      State &s       = state();
+      Block *p_block = static_cast<Block *>(p);
+
+      p_block->next = s.free_list;
+      s.free_list   = p_block;
+      s.in_use--;
+   }
+
+   // Number of frames in use, the most ever in use at once and the number of frames that could not be allocated
+   static uint16_t in_use()
+   {
+      return(state().in_use);
+   }
+
+   static uint16_t high_water()
+   {
+      return(state().high_water);
+   }
+
+   static uint32_t failures()
+   {
+      return(state().failures);
+   }
+
+private:
+   union Block
+   {
+      Block        *next;
+      max_align_t   align;
+      unsigned char bytes[EXT_FLASH_CO_FRAME_SIZE];
+   };
+
+   struct State
+   {
+      Block    blocks[EXT_FLASH_CO_FRAMES];
+      Block   *free_list;
+      uint16_t in_use;
+      uint16_t high_water;
+      uint32_t failures;
+      bool     ready;
+   };
+
+   static State &state()
+   {
+      static State s;
+      return(s);
+   }
+};
+
+/**
+ * @brief Task - an operation returning int. It starts when awaited, or when start() is called on a task that is not awaited,
+ * and resumes whoever awaits it when it completes. A task whose frame could not be allocated is complete with -1.
+ */
+class Task
+{
+public:
+   struct promise_type
+   {
+      int                     value = -1;
+      std::coroutine_handle<> continuation;
+
+      static void *operator new(size_t size) noexcept
+      {
+         return(FramePool::alloc(size));
+      }
+
+      static void operator delete(void *p) noexcept
+      {
+         FramePool::free(p);
+      }
+
+      static Task get_return_object_on_allocation_failure() noexcept
+      {
+         return(Task());
+      }
+
+      Task get_return_object() noexcept
+      {
+         return(Task(std::coroutine_handle<promise_type>::from_promise(*this)));
+      }
+
+      std::suspend_always initial_suspend() noexcept
+      {
+         return(std::suspend_always());
+      }
+
+      // Hand control straight back to the awaiting operation when there is one
+      struct FinalAwaiter
+      {
+         bool await_ready() noexcept
+         {
+            return(false);
+         }
+
+         std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+         {
+            std::coroutine_handle<> next = h.promise().continuation;
+            return(next ? next : std::noop_coroutine());
+         }
+
+         void await_resume() noexcept
+         {
+         }
+      };
+
+      FinalAwaiter final_suspend() noexcept
+      {
+         return(FinalAwaiter());
+      }
+
+      void return_value(int v) noexcept
+      {
+         value = v;
+      }
+
+      void unhandled_exception() noexcept
+      {
+         value = -1;
+      }
+   };
+
+   Task() noexcept : m_h(nullptr)
+   {
+   }
+
+   explicit Task(std::coroutine_handle<promise_type> h) noexcept : m_h(h)
+   {
+   }
+
+   Task(Task &&other) noexcept : m_h(other.m_h)
+   {
+      other.m_h = nullptr;
+   }
+
+   Task &operator=(Task &&other) noexcept
+   {
+      if (this != &other)
+      {
+         destroy();
+         m_h       = other.m_h;
+         other.m_h = nullptr;
+      }
+      return(*this);
+   }
+
+   Task(const Task &)            = delete;
+   Task &operator=(const Task &) = delete;
+
+   ~Task()
+   {
+      destroy();
+   }
+
+   /**
+    * @brief start run a task that nobody awaits up to its first suspension, the loop takes it from there.
+    */
+   void start()
+   {
+      if (m_h && !m_h.done())
+      {
+         m_h.resume();
+      }
+   }
+
+   /**
+    * @brief done whether the task has completed.
+    */
+   bool done() const
+   {
+      return(!m_h || m_h.done());
+   }
+
+   /**
+    * @brief result what the task returned, -1 until it completes.
+    */
+   int result() const
+   {
+      return(m_h && m_h.done() ? m_h.promise().value : -1);
+   }
+
+   bool await_ready() const noexcept
+   {
+      return(done());
+   }
+
+   std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+   {
+      m_h.promise().continuation = awaiting;
+      return(m_h);
+   }
+
+   int await_resume() const noexcept
+   {
+      return(m_h ? m_h.promise().value : -1);
+   }
+
+private:
+   void destroy()
+   {
+      if (m_h)
+      {
+         m_h.destroy();
+         m_h = nullptr;
+      }
+   }
+
+   std::coroutine_handle<promise_type> m_h;
+};
+
+/**
+ * @brief Waiter - an operation suspended until its chip is idle. It lives in the frame of the operation, the loop only links
+ * it. A waiter without a chip is resumed on the next poll.
+ */
+struct Waiter
+{
+   Waiter                  *next;
+   emb_flash_intf_handle_t *p_intf;
+   uint32_t                 due_us;
+   uint32_t                 interval_us;
+   std::coroutine_handle<>  h;
+};
+
+/**
+ * @brief Loop - resumes the operations waiting on busy chips. Call poll() from the event loop, and sleep until next_due_us()
+ * when it resumed nothing. Time comes from the function given, normally the time base of the interface handles.
+ */
+class Loop
+{
+public:
+   explicit Loop(uint32_t ( *now_us )()) : m_now_us(now_us), m_head(nullptr), m_tail(nullptr), stat_polls(0), stat_resumes(0)
+   {
+   }
+
+   Loop(const Loop &)            = delete;
+   Loop &operator=(const Loop &) = delete;
+
+   /**
+    * @brief wait queue a waiter, its status is first polled after its interval.
+    */
+   void wait(Waiter *p_waiter)
+   {
+      p_waiter->due_us = now() + (p_waiter->p_intf ? p_waiter->interval_us : 0);
+      p_waiter->next   = nullptr;
+      if (m_tail)
+      {
+         m_tail->next = p_waiter;
+      }
+      else
+      {
+         m_head = p_waiter;
+      }
+      m_tail = p_waiter;
+   }
+
+   /**
+    * @brief poll read the status of every chip whose poll is due and resume the operations on the chips that are idle.
+    * @return int - number of operations resumed.
+    */
+   int poll()
+   {
+      Waiter  *p_waiter = m_head;
+      uint32_t t        = now();
+      int      resumed  = 0;
+
+      // Take the queue, operations that wait again while it is walked go on the new one
+      m_head = nullptr;
+      m_tail = nullptr;
+      while (p_waiter)
+      {
+         Waiter *p_next = p_waiter->next;
+         bool    ready  = (int32_t)(t - p_waiter->due_us) >= 0;
+
+         if (ready && p_waiter->p_intf)
+         {
+            stat_polls++;
+            ready = !(emb_ext_flash_get_status(p_waiter->p_intf) & EXT_FLASH_STATUS_REG_BUSY);
+         }
+
+         if (ready)
+         {
+            stat_resumes++;
+            resumed++;
+            p_waiter->h.resume();
+         }
+         else
+         {
+            // Poll again one interval later
+            if ((int32_t)(t - p_waiter->due_us) >= 0)
+            {
+               p_waiter->due_us = t + p_waiter->interval_us;
+            }
+            requeue(p_waiter);
+         }
+         p_waiter = p_next;
+      }
+
+      return(resumed);
+   }
+
+   /**
+    * @brief pending whether any operation is waiting.
+    */
+   bool pending() const
+   {
+      return(m_head != nullptr);
+   }
+
+   /**
+    * @brief next_due_us the time of the next poll that is due, now when nothing waits.
+    */
+   uint32_t next_due_us() const
+   {
+      uint32_t t    = now();
+      uint32_t next = t;
+      bool     any  = false;
+
+      for (Waiter *p_waiter = m_head; p_waiter; p_waiter = p_waiter->next)
+      {
+         if ((int32_t)(p_waiter->due_us - t) <= 0)
+         {
+            return(t);
+         }
+         if (!any || (int32_t)(p_waiter->due_us - next) < 0)
+         {
+            next = p_waiter->due_us;
+            any  = true;
+         }
+      }
+
+      return(next);
+   }
+
+   uint32_t now() const
+   {
+      return(m_now_us ? m_now_us() : 0);
+   }
+
+private:
+   void requeue(Waiter *p_waiter)
+   {
+      p_waiter->next = nullptr;
+      if (m_tail)
+      {
+         m_tail->next = p_waiter;
+      }
+      else
+      {
+         m_head = p_waiter;
+      }
+      m_tail = p_waiter;
+   }
+
+   uint32_t ( *m_now_us )();
+   Waiter *m_head;
+   Waiter *m_tail;
+
+public:
+   // Number of status polls and of operations resumed.
+   uint32_t stat_polls;
+   uint32_t stat_resumes;
+};
+
+/**
+ * @brief CoFlash - a chip driven through the coroutine front end. Operations on one chip run one at a time in the order they
+ * were started, operations on different chips run side by side. The interface handle must be initialized, and must only be
+ * used through this object while operations are in flight.
+ */
+class CoFlash
+{
+public:
+   CoFlash(emb_flash_intf_handle_t *p_intf, Loop &loop, uint32_t poll_us = EXT_FLASH_CO_POLL_US) :
+      m_p_intf(p_intf), m_loop(loop), m_poll_us(poll_us), m_locked(false), m_p_queue(nullptr), m_p_queue_tail(nullptr)
+   {
+   }
+
+   CoFlash(const CoFlash &)            = delete;
+   CoFlash &operator=(const CoFlash &) = delete;
+
+   /**
+    * @brief read read once the chip is idle, see emb_ext_flash_read().
+    * @return Task - completes with the number of bytes read.
+    */
+   Task read(uint32_t address, uint8_t *data, uint16_t len)
+   {
+      co_await lock();
+      co_await idle();
+      int rtn = emb_ext_flash_read(m_p_intf, address, data, len);
+      unlock();
+      co_return(rtn);
+   }
+
+   /**
+    * @brief write program any length, page by page, suspending while each page is programmed.
+    * @return Task - completes with the number of bytes written.
+    */
+   Task write(uint32_t address, uint8_t *data, uint32_t len)
+   {
+      uint32_t done = 0;
+
+      co_await lock();
+      while (done < len)
+      {
+         co_await idle();
+         uint32_t left = len - done;
+         int      n    = emb_ext_flash_program_begin(m_p_intf, address + done, data + done,
+                                                     (uint16_t)(left > EXT_FLASH_PAGE_SIZE ? EXT_FLASH_PAGE_SIZE : left));
+         if (n <= 0)
+         {
+            break;
+         }
+         done += n;
+      }
+      co_await idle();
+      unlock();
+      co_return((int)done);
+   }
+
+   /**
+    * @brief erase erase every 4K sector overlapping [address, address + len), suspending while each sector is erased.
+    * @return Task - completes with 0 on success, -1 on failure.
+    */
+   Task erase(uint32_t address, uint32_t len)
+   {
+      uint32_t end = address + len;
+      int      rtn = 0;
+
+      co_await lock();
+      for (address &= ~(uint32_t)(EXT_FLASH_SECTOR_SIZE - 1); address < end && rtn == 0; address += EXT_FLASH_SECTOR_SIZE)
+      {
+         co_await idle();
+         rtn = emb_ext_flash_erase_begin(m_p_intf, address) == 0 ? 0 : -1;
+      }
+      co_await idle();
+      unlock();
+      co_return(rtn);
+   }
+
+   /**
+    * @brief idle awaitable that suspends while the chip is busy.
+    */
+   struct IdleAwaiter
+   {
+      CoFlash *p_flash;
+      Waiter   waiter;
+
+      bool await_ready()
+      {
+         return(!(emb_ext_flash_get_status(p_flash->m_p_intf) & EXT_FLASH_STATUS_REG_BUSY));
+      }
+
+      void await_suspend(std::coroutine_handle<> h)
+      {
+         waiter.p_intf      = p_flash->m_p_intf;
+         waiter.interval_us = p_flash->m_poll_us;
+         waiter.h           = h;
+         p_flash->m_loop.wait(&waiter);
+      }
+
+      void await_resume()
+      {
+      }
+   };
+
+   IdleAwaiter idle()
+   {
+      return(IdleAwaiter{ this, {} });
+   }
+
+private:
+   // Awaitable that takes the chip, queueing behind the operations that have it or asked first
+   struct LockAwaiter
+   {
+      CoFlash *p_flash;
+      Waiter   waiter;
+
+      bool await_ready()
+      {
+         if (p_flash->m_locked)
+         {
+            return(false);
+         }
+         p_flash->m_locked = true;
+         return(true);
+      }
+
+      void await_suspend(std::coroutine_handle<> h)
+      {
+         waiter.next   = nullptr;
+         waiter.p_intf = nullptr;
+         waiter.h      = h;
+         if (p_flash->m_p_queue_tail)
+         {
+            p_flash->m_p_queue_tail->next = &waiter;
+         }
+         else
+         {
+            p_flash->m_p_queue = &waiter;
+         }
+         p_flash->m_p_queue_tail = &waiter;
+      }
+
+      void await_resume()
+      {
+      }
+   };
+
+   LockAwaiter lock()
+   {
+      return(LockAwaiter{ this, {} });
+   }
+
+   // Hand the chip to the next operation in line, which the loop resumes on its next poll
+   void unlock()
+   {
+      Waiter *p_waiter = m_p_queue;
+
+      if (!p_waiter)
+      {
+         m_locked = false;
+         return;
+      }
+      m_p_queue = p_waiter->next;
+      if (!m_p_queue)
+      {
+         m_p_queue_tail = nullptr;
+      }
+      m_loop.wait(p_waiter);
+   }
+
+   emb_flash_intf_handle_t *m_p_intf;
+   Loop                    &m_loop;
+   uint32_t                 m_poll_us;
+   bool                     m_locked;
+   Waiter                  *m_p_queue;
+   Waiter                  *m_p_queue_tail;
+};
+} // namespace emb_ext_flash
+
+#endif /* EMB_EXT_FLASH_CO_HPP_ */
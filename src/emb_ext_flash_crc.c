@@ -0,0 +1,46 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include "emb_ext_flash_crc.h"
+
+// Nibble table for the reflected 0xEDB88320 polynomial
+static const uint32_t crc32_nibble_table[16] = {
+   0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+   0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t emb_ext_flash_crc32(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+   // Null check
+   if (!data)
+   {
+      return(crc);
+   }
+
+   crc = ~crc;
+   for (uint32_t i = 0; i < len; i++)
+   {
+      // Process the byte a nibble at a time, low nibble first
+      crc ^= data[i];
+      crc  = (crc >> 4) ^ crc32_nibble_table[crc & 0x0F];
+      crc  = (crc >> 4) ^ crc32_nibble_table[crc & 0x0F];
+   }
+
+   return(~crc);
+}
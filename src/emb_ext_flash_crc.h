@@ -0,0 +1,48 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_CRC_H_
+#define EMB_EXT_FLASH_CRC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Seed value to start a new CRC-32 computation
+#define EXT_FLASH_CRC32_INIT    0x00000000
+
+/**
+ * @brief emb_ext_flash_crc32 compute the CRC-32 (IEEE 802.3, reflected, poly 0xEDB88320) of a buffer. The computation can be
+ * split over multiple calls by passing the result of the previous call in as the crc argument, start with EXT_FLASH_CRC32_INIT.
+ * A nibble lookup table is used to keep the ROM footprint small.
+ *
+ * @param crc - the running CRC value.
+ * @param data - pointer to the data.
+ * @param len - the number of bytes in data.
+ * @return uint32_t - the updated CRC value.
+ */
+uint32_t emb_ext_flash_crc32(uint32_t crc, const uint8_t *data, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_CRC_H_ */
@@ -0,0 +1,662 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_le.h"
+#include "emb_ext_flash_ftl.h"
+#include "emb_ext_flash_crc.h"
+
+// Summary page layout
+#define FTL_SECTOR_MAGIC       0x314C5446 // "FTL1"
+#define FTL_HEADER_SIZE        12
+#define FTL_ENTRY_OFFSET       16
+#define FTL_ENTRY_SIZE         12
+
+// Checkpoint layout, the header is programmed last and commits the checkpoint
+#define FTL_CKPT_MAGIC         0x31435446 // "FTC1"
+#define FTL_CKPT_HEADER_SIZE   24
+#define FTL_CKPT_MAP_OFFSET    32
+
+// Markers
+#define FTL_NONE               0xFFFF
+
+// Sector states
+enum
+{
+   FTL_SECTOR_FREE_DIRTY,
+   FTL_SECTOR_FREE_ERASED,
+   FTL_SECTOR_ACTIVE,
+   FTL_SECTOR_FULL,
+};
+
+// Private functions
+static uint32_t ftl_sector_addr(emb_ext_flash_ftl_t *p_ftl, uint16_t sector)
+{
+   return(p_ftl->data_start + sector * EXT_FLASH_SECTOR_SIZE);
+}
+
+static uint32_t ftl_slot_addr(emb_ext_flash_ftl_t *p_ftl, uint16_t phys)
+{
+   return(ftl_sector_addr(p_ftl, phys / EXT_FLASH_FTL_SLOTS_PER_SECTOR) + EXT_FLASH_PAGE_SIZE +
+          (phys % EXT_FLASH_FTL_SLOTS_PER_SECTOR) * EXT_FLASH_FTL_BLOCK_SIZE);
+}
+
+// Read and check a sector header, returns 0 and the allocation sequence if it is valid
+static int ftl_read_header(emb_ext_flash_ftl_t *p_ftl, uint16_t sector, uint32_t *seq)
+{
+   uint8_t hdr[FTL_HEADER_SIZE];
+
+   if (emb_ext_flash_read(p_ftl->p_intf, ftl_sector_addr(p_ftl, sector), hdr, sizeof(hdr)) != sizeof(hdr))
+   {
+      return(-1);
+   }
+   if (emb_ext_flash_get_u32(hdr) != FTL_SECTOR_MAGIC || emb_ext_flash_get_u32(&hdr[8]) != emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, hdr, 8))
+   {
+      return(-1);
+   }
+   *seq = emb_ext_flash_get_u32(&hdr[4]);
+
+   return(0);
+}
+
+// Read every summary entry of a sector in one go, marking the ones that are valid
+static int ftl_read_entries(emb_ext_flash_ftl_t *p_ftl, uint16_t sector, uint32_t *lba, uint32_t *seq)
+{
+   uint8_t entries[EXT_FLASH_FTL_SLOTS_PER_SECTOR * FTL_ENTRY_SIZE];
+
+   if (emb_ext_flash_read(p_ftl->p_intf, ftl_sector_addr(p_ftl, sector) + FTL_ENTRY_OFFSET, entries, sizeof(entries)) != sizeof(entries))
+   {
+      return(-1);
+   }
+
+   for (int i = 0; i < EXT_FLASH_FTL_SLOTS_PER_SECTOR; i++)
+   {
+      uint8_t *e = &entries[i * FTL_ENTRY_SIZE];
+      lba[i] = 0xFFFFFFFF;
+      if (emb_ext_flash_get_u32(&e[8]) == emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, e, 8))
+      {
+         lba[i] = emb_ext_flash_get_u32(e);
+         seq[i] = emb_ext_flash_get_u32(&e[4]);
+      }
+   }
+
+   return(0);
+}
+
+static int ftl_erase_sector(emb_ext_flash_ftl_t *p_ftl, uint32_t address)
+{
+   p_ftl->stat_erases++;
+
+   return(emb_ext_flash_erase(p_ftl->p_intf, address, EXT_FLASH_SECTOR_SIZE));
+}
+
+static int ftl_gc(emb_ext_flash_ftl_t *p_ftl);
+
+// Make sure the active sector has a free slot, opening a new one and collecting garbage when allowed
+static int ftl_alloc(emb_ext_flash_ftl_t *p_ftl, uint8_t allow_gc)
+{
+   for ( ; ; )
+   {
+      // A power loss during garbage collection can leave no free sector at all, collect into the active sector first
+      if (allow_gc && !p_ftl->free_count && p_ftl->active != FTL_NONE && ftl_gc(p_ftl) == 0)
+      {
+         continue;
+      }
+      if (p_ftl->active != FTL_NONE)
+      {
+         if (p_ftl->used[p_ftl->active] < EXT_FLASH_FTL_SLOTS_PER_SECTOR)
+         {
+            return(0);
+         }
+         p_ftl->state[p_ftl->active] = FTL_SECTOR_FULL;
+         p_ftl->active               = FTL_NONE;
+      }
+
+      // Keep one free sector in reserve for relocations, collect garbage before dipping into it
+      if (allow_gc && p_ftl->free_count < 2 && ftl_gc(p_ftl) == 0)
+      {
+         continue;
+      }
+      break;
+   }
+
+   // Prefer sectors that are known to be erased
+   uint16_t pick = FTL_NONE;
+   for (uint16_t s = 0; s < p_ftl->data_sectors; s++)
+   {
+      if (p_ftl->state[s] == FTL_SECTOR_FREE_ERASED)
+      {
+         pick = s;
+         break;
+      }
+      if (p_ftl->state[s] == FTL_SECTOR_FREE_DIRTY && pick == FTL_NONE)
+      {
+         pick = s;
+      }
+   }
+   if (pick == FTL_NONE)
+   {
+      return(-1);
+   }
+
+   uint32_t addr = ftl_sector_addr(p_ftl, pick);
+   if (p_ftl->state[pick] == FTL_SECTOR_FREE_DIRTY && ftl_erase_sector(p_ftl, addr) != 0)
+   {
+      return(-1);
+   }
+
+   // Stamp the sector header
+   uint8_t hdr[FTL_HEADER_SIZE];
+   emb_ext_flash_put_u32(hdr, FTL_SECTOR_MAGIC);
+   emb_ext_flash_put_u32(&hdr[4], p_ftl->sector_seq);
+   emb_ext_flash_put_u32(&hdr[8], emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, hdr, 8));
+   if (emb_ext_flash_write(p_ftl->p_intf, addr, hdr, sizeof(hdr)) != sizeof(hdr))
+   {
+      return(-1);
+   }
+
+   p_ftl->state[pick] = FTL_SECTOR_ACTIVE;
+   p_ftl->seq[pick]   = p_ftl->sector_seq++;
+   p_ftl->used[pick]  = 0;
+   p_ftl->valid[pick] = 0;
+   p_ftl->active      = pick;
+   p_ftl->free_count--;
+
+   return(0);
+}
+
+// Program a block into the next slot of the active sector and point the map at it
+static int ftl_write_slot(emb_ext_flash_ftl_t *p_ftl, uint32_t block, uint8_t *data, uint8_t allow_gc)
+{
+   if (ftl_alloc(p_ftl, allow_gc) != 0)
+   {
+      return(-1);
+   }
+
+   uint16_t sector = p_ftl->active;
+   uint16_t phys   = sector * EXT_FLASH_FTL_SLOTS_PER_SECTOR + p_ftl->used[sector];
+
+   // The slot is consumed whatever happens next
+   p_ftl->used[sector]++;
+
+   // Data first, then the summary entry that makes it count
+   if (emb_ext_flash_write(p_ftl->p_intf, ftl_slot_addr(p_ftl, phys), data, EXT_FLASH_FTL_BLOCK_SIZE) != EXT_FLASH_FTL_BLOCK_SIZE)
+   {
+      return(-1);
+   }
+
+   uint8_t entry[FTL_ENTRY_SIZE];
+   emb_ext_flash_put_u32(entry, block);
+   emb_ext_flash_put_u32(&entry[4], p_ftl->write_seq++);
+   emb_ext_flash_put_u32(&entry[8], emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, entry, 8));
+   uint32_t e_addr = ftl_sector_addr(p_ftl, sector) + FTL_ENTRY_OFFSET + (phys % EXT_FLASH_FTL_SLOTS_PER_SECTOR) * FTL_ENTRY_SIZE;
+   if (emb_ext_flash_write(p_ftl->p_intf, e_addr, entry, sizeof(entry)) != sizeof(entry))
+   {
+      return(-1);
+   }
+
+   if (p_ftl->map[block] != FTL_NONE)
+   {
+      p_ftl->valid[p_ftl->map[block] / EXT_FLASH_FTL_SLOTS_PER_SECTOR]--;
+   }
+   p_ftl->map[block] = phys;
+   p_ftl->valid[sector]++;
+   p_ftl->stat_slot_writes++;
+
+   return(0);
+}
+
+// Greedy garbage collection, relocate the valid slots of the full sector with the fewest of them and erase it
+static int ftl_gc(emb_ext_flash_ftl_t *p_ftl)
+{
+   uint16_t victim = FTL_NONE;
+   uint16_t room   = EXT_FLASH_FTL_SLOTS_PER_SECTOR;
+
+   // Without a free sector the valid slots of the victim have to fit in what is left of the active sector
+   if (!p_ftl->free_count)
+   {
+      room = p_ftl->active != FTL_NONE ? EXT_FLASH_FTL_SLOTS_PER_SECTOR - p_ftl->used[p_ftl->active] : 0;
+   }
+   for (uint16_t s = 0; s < p_ftl->data_sectors; s++)
+   {
+      if (p_ftl->state[s] == FTL_SECTOR_FULL && p_ftl->valid[s] <= room &&
+          (victim == FTL_NONE || p_ftl->valid[s] < p_ftl->valid[victim]))
+      {
+         victim = s;
+      }
+   }
+   if (victim == FTL_NONE || p_ftl->valid[victim] >= EXT_FLASH_FTL_SLOTS_PER_SECTOR)
+   {
+      return(-1);
+   }
+
+   // Relocate whatever the map still points at
+   uint32_t lba[EXT_FLASH_FTL_SLOTS_PER_SECTOR];
+   uint32_t seq[EXT_FLASH_FTL_SLOTS_PER_SECTOR];
+   if (p_ftl->valid[victim] && ftl_read_entries(p_ftl, victim, lba, seq) != 0)
+   {
+      return(-1);
+   }
+   for (uint16_t i = 0; i < EXT_FLASH_FTL_SLOTS_PER_SECTOR && p_ftl->valid[victim]; i++)
+   {
+      uint16_t phys = victim * EXT_FLASH_FTL_SLOTS_PER_SECTOR + i;
+      if (lba[i] >= p_ftl->block_count || p_ftl->map[lba[i]] != phys)
+      {
+         continue;
+      }
+      if (emb_ext_flash_read(p_ftl->p_intf, ftl_slot_addr(p_ftl, phys), p_ftl->buf, EXT_FLASH_FTL_BLOCK_SIZE) != EXT_FLASH_FTL_BLOCK_SIZE ||
+          ftl_write_slot(p_ftl, lba[i], p_ftl->buf, 0) != 0)
+      {
+         return(-1);
+      }
+   }
+
+   if (ftl_erase_sector(p_ftl, ftl_sector_addr(p_ftl, victim)) != 0)
+   {
+      return(-1);
+   }
+   p_ftl->state[victim] = FTL_SECTOR_FREE_ERASED;
+   p_ftl->valid[victim] = 0;
+   p_ftl->used[victim]  = 0;
+   p_ftl->free_count++;
+   p_ftl->stat_gc_runs++;
+
+   return(0);
+}
+
+// Load and verify a checkpoint area into the map, returns 0 with the header fields if it is good
+static int ftl_load_ckpt(emb_ext_flash_ftl_t *p_ftl, uint8_t area, uint32_t *hdr_out)
+{
+   uint8_t  hdr[FTL_CKPT_HEADER_SIZE];
+   uint8_t  chunk[64];
+   uint32_t addr = p_ftl->start + area * p_ftl->ckpt_sectors * EXT_FLASH_SECTOR_SIZE;
+
+   if (emb_ext_flash_read(p_ftl->p_intf, addr, hdr, sizeof(hdr)) != sizeof(hdr) || emb_ext_flash_get_u32(hdr) != FTL_CKPT_MAGIC ||
+       emb_ext_flash_get_u32(&hdr[16]) != p_ftl->block_count)
+   {
+      return(-1);
+   }
+
+   // Pull the map in, the CRC covers the map followed by the header fields
+   uint32_t crc = EXT_FLASH_CRC32_INIT;
+   for (uint32_t off = 0; off < p_ftl->block_count * 2; off += sizeof(chunk))
+   {
+      uint16_t len = (p_ftl->block_count * 2 - off) < sizeof(chunk) ? (p_ftl->block_count * 2 - off) : sizeof(chunk);
+      if (emb_ext_flash_read(p_ftl->p_intf, addr + FTL_CKPT_MAP_OFFSET + off, chunk, len) != len)
+      {
+         return(-1);
+      }
+      crc = emb_ext_flash_crc32(crc, chunk, len);
+      for (uint16_t i = 0; i < len; i += 2)
+      {
+         p_ftl->map[(off + i) / 2] = chunk[i] | (chunk[i + 1] << 8);
+      }
+   }
+   crc = emb_ext_flash_crc32(crc, hdr, 20);
+   if (crc != emb_ext_flash_get_u32(&hdr[20]))
+   {
+      return(-1);
+   }
+
+   for (int i = 0; i < 5; i++)
+   {
+      hdr_out[i] = emb_ext_flash_get_u32(&hdr[i * 4]);
+   }
+
+   return(0);
+}
+
+// Carry on writing into the newest sector after the last slot that was started, a slot counts as started once its data
+// or its summary entry is no longer blank
+static int ftl_resume_active(emb_ext_flash_ftl_t *p_ftl)
+{
+   uint8_t  entries[EXT_FLASH_FTL_SLOTS_PER_SECTOR * FTL_ENTRY_SIZE];
+   uint16_t newest = FTL_NONE;
+   uint16_t used   = 0;
+
+   for (uint16_t s = 0; s < p_ftl->data_sectors; s++)
+   {
+      if (p_ftl->state[s] == FTL_SECTOR_FULL && (newest == FTL_NONE || p_ftl->seq[s] > p_ftl->seq[newest]))
+      {
+         newest = s;
+      }
+   }
+   if (newest == FTL_NONE)
+   {
+      return(0);
+   }
+
+   if (emb_ext_flash_read(p_ftl->p_intf, ftl_sector_addr(p_ftl, newest) + FTL_ENTRY_OFFSET, entries, sizeof(entries)) != sizeof(entries))
+   {
+      return(-1);
+   }
+   for (uint16_t i = 0; i < sizeof(entries); i++)
+   {
+      if (entries[i] != 0xFF)
+      {
+         used = i / FTL_ENTRY_SIZE + 1;
+      }
+   }
+
+   // Data is programmed before its entry, so only the slot after the last entry can hold data without one
+   if (used < EXT_FLASH_FTL_SLOTS_PER_SECTOR)
+   {
+      uint16_t phys = newest * EXT_FLASH_FTL_SLOTS_PER_SECTOR + used;
+      if (emb_ext_flash_read(p_ftl->p_intf, ftl_slot_addr(p_ftl, phys), p_ftl->buf, EXT_FLASH_FTL_BLOCK_SIZE) != EXT_FLASH_FTL_BLOCK_SIZE)
+      {
+         return(-1);
+      }
+      for (uint16_t i = 0; i < EXT_FLASH_FTL_BLOCK_SIZE; i++)
+      {
+         if (p_ftl->buf[i] != 0xFF)
+         {
+            used++;
+            break;
+         }
+      }
+   }
+
+   if (used < EXT_FLASH_FTL_SLOTS_PER_SECTOR)
+   {
+      p_ftl->state[newest] = FTL_SECTOR_ACTIVE;
+      p_ftl->used[newest]  = used;
+      p_ftl->active        = newest;
+   }
+
+   return(0);
+}
+
+// Work out the region layout, the checkpoint areas have to hold the map of however many blocks the data sectors provide
+static int ftl_layout(emb_ext_flash_ftl_t *p_ftl, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len)
+{
+   if (!p_ftl || !p_intf || !p_intf->initialized || (start % EXT_FLASH_SECTOR_SIZE) || (len % EXT_FLASH_SECTOR_SIZE))
+   {
+      return(-1);
+   }
+
+   uint32_t total = len / EXT_FLASH_SECTOR_SIZE;
+   uint32_t ckpt  = 1;
+   uint32_t data;
+   uint32_t blocks;
+   for ( ; ; )
+   {
+      if (total < 2 * ckpt + EXT_FLASH_FTL_SPARE_SECTORS + 1)
+      {
+         return(-1);
+      }
+      data   = total - 2 * ckpt;
+      blocks = (data - EXT_FLASH_FTL_SPARE_SECTORS) * EXT_FLASH_FTL_SLOTS_PER_SECTOR;
+      if (FTL_CKPT_MAP_OFFSET + blocks * 2 <= ckpt * EXT_FLASH_SECTOR_SIZE)
+      {
+         break;
+      }
+      ckpt++;
+   }
+   if (data > EXT_FLASH_FTL_MAX_SECTORS || blocks > EXT_FLASH_FTL_MAX_BLOCKS)
+   {
+      return(-1);
+   }
+
+   memset(p_ftl, 0, sizeof(*p_ftl));
+   p_ftl->p_intf       = p_intf;
+   p_ftl->start        = start;
+   p_ftl->ckpt_sectors = ckpt;
+   p_ftl->data_sectors = data;
+   p_ftl->data_start   = start + 2 * ckpt * EXT_FLASH_SECTOR_SIZE;
+   p_ftl->block_count  = blocks;
+   p_ftl->active       = FTL_NONE;
+
+   return(0);
+}
+
+// Public functions
+int emb_ext_flash_ftl_format(emb_ext_flash_ftl_t *p_ftl, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len)
+{
+   if (ftl_layout(p_ftl, p_intf, start, len) != 0)
+   {
+      return(-1);
+   }
+
+   for (uint32_t addr = start; addr < start + len; addr += EXT_FLASH_SECTOR_SIZE)
+   {
+      if (emb_ext_flash_erase(p_intf, addr, EXT_FLASH_SECTOR_SIZE) != 0)
+      {
+         return(-1);
+      }
+   }
+
+   return(emb_ext_flash_ftl_mount(p_ftl, p_intf, start, len));
+}
+
+int emb_ext_flash_ftl_mount(emb_ext_flash_ftl_t *p_ftl, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len)
+{
+   if (ftl_layout(p_ftl, p_intf, start, len) != 0)
+   {
+      return(-1);
+   }
+
+   // Classify every data sector by its header, the newest one is reopened once the map is rebuilt
+   for (uint16_t s = 0; s < p_ftl->data_sectors; s++)
+   {
+      if (ftl_read_header(p_ftl, s, &p_ftl->seq[s]) == 0)
+      {
+         p_ftl->state[s] = FTL_SECTOR_FULL;
+         p_ftl->used[s]  = EXT_FLASH_FTL_SLOTS_PER_SECTOR;
+         if (p_ftl->seq[s] >= p_ftl->sector_seq)
+         {
+            p_ftl->sector_seq = p_ftl->seq[s] + 1;
+         }
+      }
+      else
+      {
+         p_ftl->state[s] = FTL_SECTOR_FREE_DIRTY;
+         p_ftl->free_count++;
+      }
+   }
+
+   // Start from the newest good checkpoint, falling back to the other one and then to an empty map
+   uint32_t ckpt[2][5];
+   int      good[2];
+   uint32_t scan_from = 0;
+   good[0] = ftl_load_ckpt(p_ftl, 0, ckpt[0]) == 0;
+   good[1] = ftl_load_ckpt(p_ftl, 1, ckpt[1]) == 0;
+   int pick = (good[0] && good[1]) ? (ckpt[1][1] > ckpt[0][1]) : good[1] ? 1 : good[0] ? 0 : -1;
+   if (pick >= 0 && (pick == 1 || ftl_load_ckpt(p_ftl, 0, ckpt[0]) == 0))
+   {
+      p_ftl->ckpt_seq  = ckpt[pick][1];
+      p_ftl->write_seq = ckpt[pick][2];
+      if (ckpt[pick][3] > p_ftl->sector_seq)
+      {
+         p_ftl->sector_seq = ckpt[pick][3];
+      }
+
+      // Drop mappings into sectors that have been erased or reallocated since the checkpoint
+      for (uint32_t b = 0; b < p_ftl->block_count; b++)
+      {
+         uint16_t s = p_ftl->map[b] / EXT_FLASH_FTL_SLOTS_PER_SECTOR;
+         if (p_ftl->map[b] != FTL_NONE && (s >= p_ftl->data_sectors || p_ftl->state[s] != FTL_SECTOR_FULL || p_ftl->seq[s] >= ckpt[pick][3]))
+         {
+            p_ftl->map[b] = FTL_NONE;
+         }
+      }
+
+      // The sector that was active at checkpoint time may have been written to since
+      scan_from = ckpt[pick][3] ? ckpt[pick][3] - 1 : 0;
+   }
+   else
+   {
+      memset(p_ftl->map, 0xFF, sizeof(p_ftl->map));
+   }
+
+   // Replay the summaries of newer sectors in allocation order, which is also write order
+   uint32_t next = scan_from;
+   for ( ; ; )
+   {
+      uint16_t sector = FTL_NONE;
+      for (uint16_t s = 0; s < p_ftl->data_sectors; s++)
+      {
+         if (p_ftl->state[s] == FTL_SECTOR_FULL && p_ftl->seq[s] >= next && (sector == FTL_NONE || p_ftl->seq[s] < p_ftl->seq[sector]))
+         {
+            sector = s;
+         }
+      }
+      if (sector == FTL_NONE)
+      {
+         break;
+      }
+      next = p_ftl->seq[sector] + 1;
+
+      uint32_t lba[EXT_FLASH_FTL_SLOTS_PER_SECTOR];
+      uint32_t seq[EXT_FLASH_FTL_SLOTS_PER_SECTOR];
+      if (ftl_read_entries(p_ftl, sector, lba, seq) != 0)
+      {
+         return(-1);
+      }
+      for (uint16_t i = 0; i < EXT_FLASH_FTL_SLOTS_PER_SECTOR; i++)
+      {
+         if (lba[i] < p_ftl->block_count && seq[i] >= p_ftl->write_seq)
+         {
+            p_ftl->map[lba[i]] = sector * EXT_FLASH_FTL_SLOTS_PER_SECTOR + i;
+            p_ftl->write_seq   = seq[i] + 1;
+         }
+      }
+   }
+
+   // Rebuild the valid counts from the map
+   for (uint32_t b = 0; b < p_ftl->block_count; b++)
+   {
+      if (p_ftl->map[b] != FTL_NONE)
+      {
+         p_ftl->valid[p_ftl->map[b] / EXT_FLASH_FTL_SLOTS_PER_SECTOR]++;
+      }
+   }
+
+   return(ftl_resume_active(p_ftl));
+}
+
+uint32_t emb_ext_flash_ftl_block_count(emb_ext_flash_ftl_t *p_ftl)
+{
+   return(p_ftl ? p_ftl->block_count : 0);
+}
+
+int emb_ext_flash_ftl_block_read(emb_ext_flash_ftl_t *p_ftl, uint32_t block, uint8_t *data)
+{
+   // Null check
+   if (!p_ftl || !p_ftl->p_intf || !data || block >= p_ftl->block_count)
+   {
+      return(-1);
+   }
+
+   if (p_ftl->map[block] == FTL_NONE)
+   {
+      memset(data, 0xFF, EXT_FLASH_FTL_BLOCK_SIZE);
+      return(0);
+   }
+
+   return(emb_ext_flash_read(p_ftl->p_intf, ftl_slot_addr(p_ftl, p_ftl->map[block]), data, EXT_FLASH_FTL_BLOCK_SIZE) == EXT_FLASH_FTL_BLOCK_SIZE ? 0 : -1);
+}
+
+int emb_ext_flash_ftl_block_write(emb_ext_flash_ftl_t *p_ftl, uint32_t block, uint8_t *data)
+{
+   // Null check
+   if (!p_ftl || !p_ftl->p_intf || !data || block >= p_ftl->block_count)
+   {
+      return(-1);
+   }
+
+   p_ftl->stat_host_writes++;
+
+   return(ftl_write_slot(p_ftl, block, data, 1));
+}
+
+int emb_ext_flash_ftl_trim(emb_ext_flash_ftl_t *p_ftl, uint32_t block, uint32_t count)
+{
+   // Null check
+   if (!p_ftl || !p_ftl->p_intf || block >= p_ftl->block_count || count > p_ftl->block_count - block)
+   {
+      return(-1);
+   }
+
+   for (uint32_t b = block; b < block + count; b++)
+   {
+      if (p_ftl->map[b] != FTL_NONE)
+      {
+         p_ftl->valid[p_ftl->map[b] / EXT_FLASH_FTL_SLOTS_PER_SECTOR]--;
+         p_ftl->map[b] = FTL_NONE;
+      }
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_ftl_sync(emb_ext_flash_ftl_t *p_ftl)
+{
+   uint8_t chunk[64];
+
+   // Null check
+   if (!p_ftl || !p_ftl->p_intf)
+   {
+      return(-1);
+   }
+
+   // Overwrite the older of the two areas so a failed checkpoint leaves the previous one intact
+   uint32_t seq  = p_ftl->ckpt_seq + 1;
+   uint32_t addr = p_ftl->start + (seq & 1) * p_ftl->ckpt_sectors * EXT_FLASH_SECTOR_SIZE;
+   for (uint16_t i = 0; i < p_ftl->ckpt_sectors; i++)
+   {
+      if (ftl_erase_sector(p_ftl, addr + i * EXT_FLASH_SECTOR_SIZE) != 0)
+      {
+         return(-1);
+      }
+   }
+
+   // Map first
+   uint32_t crc = EXT_FLASH_CRC32_INIT;
+   for (uint32_t off = 0; off < p_ftl->block_count * 2; off += sizeof(chunk))
+   {
+      uint16_t len = (p_ftl->block_count * 2 - off) < sizeof(chunk) ? (p_ftl->block_count * 2 - off) : sizeof(chunk);
+      for (uint16_t i = 0; i < len; i += 2)
+      {
+         chunk[i]     = p_ftl->map[(off + i) / 2] & 0xFF;
+         chunk[i + 1] = p_ftl->map[(off + i) / 2] >> 8;
+      }
+      crc = emb_ext_flash_crc32(crc, chunk, len);
+      if (emb_ext_flash_write(p_ftl->p_intf, addr + FTL_CKPT_MAP_OFFSET + off, chunk, len) != len)
+      {
+         return(-1);
+      }
+   }
+
+   // Then the header, which commits the checkpoint. The allocation sequence recorded is that of the next sector to be opened.
+   uint8_t hdr[FTL_CKPT_HEADER_SIZE];
+   emb_ext_flash_put_u32(hdr, FTL_CKPT_MAGIC);
+   emb_ext_flash_put_u32(&hdr[4], seq);
+   emb_ext_flash_put_u32(&hdr[8], p_ftl->write_seq);
+   emb_ext_flash_put_u32(&hdr[12], p_ftl->sector_seq);
+   emb_ext_flash_put_u32(&hdr[16], p_ftl->block_count);
+   emb_ext_flash_put_u32(&hdr[20], emb_ext_flash_crc32(crc, hdr, 20));
+   if (emb_ext_flash_write(p_ftl->p_intf, addr, hdr, sizeof(hdr)) != sizeof(hdr))
+   {
+      return(-1);
+   }
+
+   p_ftl->ckpt_seq = seq;
+
+   return(0);
+}
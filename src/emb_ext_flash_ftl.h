@@ -0,0 +1,169 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_FTL_H_
+#define EMB_EXT_FLASH_FTL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Flash translation layer presenting the region as an array of 512 byte logical blocks.
+ *
+ * The region starts with two checkpoint areas followed by the data sectors. Each data sector holds a summary page followed by
+ * EXT_FLASH_FTL_SLOTS_PER_SECTOR physical slots of one logical block each. The summary page carries a sector header
+ * (magic, allocation sequence, CRC) and one entry per slot (logical block, write sequence, CRC) that is programmed after the
+ * slot data, so a slot only counts once both have landed. Writes always go out of place to the next slot of the active
+ * sector, and a greedy garbage collector reclaims the full sector with the fewest valid slots when free sectors run low.
+ *
+ * The logical to physical map lives in RAM. emb_ext_flash_ftl_sync() writes it to the older of the two checkpoint areas, so
+ * mount only has to read the sector headers plus the summaries of sectors allocated since the last checkpoint. Without a
+ * checkpoint mount falls back to scanning every summary. Trims are persisted by the next checkpoint.
+ */
+#define EXT_FLASH_FTL_BLOCK_SIZE          512
+#define EXT_FLASH_FTL_SLOTS_PER_SECTOR    ((EXT_FLASH_SECTOR_SIZE - EXT_FLASH_PAGE_SIZE) / EXT_FLASH_FTL_BLOCK_SIZE)
+
+// Maximum number of data sectors and logical blocks, these size the RAM tables
+#ifndef EXT_FLASH_FTL_MAX_SECTORS
+#define EXT_FLASH_FTL_MAX_SECTORS         64
+#endif
+#ifndef EXT_FLASH_FTL_MAX_BLOCKS
+#define EXT_FLASH_FTL_MAX_BLOCKS          512
+#endif
+
+// Number of data sectors held back from the logical capacity, more spare sectors lower the write amplification
+#ifndef EXT_FLASH_FTL_SPARE_SECTORS
+#define EXT_FLASH_FTL_SPARE_SECTORS       3
+#endif
+
+/**
+ * @brief emb_ext_flash_ftl_t - flash translation layer state. Treat the contents as private apart from the statistics.
+ */
+typedef struct
+{
+   // Pointer to the interface handle.
+   emb_flash_intf_handle_t *p_intf;
+   // Start address of the region, start address of the first data sector and the number of sectors in each area.
+   uint32_t start;
+   uint32_t data_start;
+   uint16_t ckpt_sectors;
+   uint16_t data_sectors;
+   // Number of logical blocks.
+   uint32_t block_count;
+   // Next slot write sequence, next sector allocation sequence and sequence of the newest checkpoint.
+   uint32_t write_seq;
+   uint32_t sector_seq;
+   uint32_t ckpt_seq;
+   // Active sector, 0xFFFF when there is none, and the number of free sectors.
+   uint16_t active;
+   uint16_t free_count;
+   // Statistics: blocks written by the host, slots programmed including relocations, garbage collections and erases.
+   uint32_t stat_host_writes;
+   uint32_t stat_slot_writes;
+   uint32_t stat_gc_runs;
+   uint32_t stat_erases;
+   // Logical to physical slot map, 0xFFFF when unmapped.
+   uint16_t map[EXT_FLASH_FTL_MAX_BLOCKS];
+   // Per sector state, valid slot count, used slot count and allocation sequence.
+   uint8_t  state[EXT_FLASH_FTL_MAX_SECTORS];
+   uint8_t  valid[EXT_FLASH_FTL_MAX_SECTORS];
+   uint8_t  used[EXT_FLASH_FTL_MAX_SECTORS];
+   uint32_t seq[EXT_FLASH_FTL_MAX_SECTORS];
+   // Bounce buffer for garbage collection.
+   uint8_t buf[EXT_FLASH_FTL_BLOCK_SIZE];
+} emb_ext_flash_ftl_t;
+
+/**
+ * @brief emb_ext_flash_ftl_format erase the region and mount an empty translation layer on it.
+ *
+ * @param p_ftl - pointer to the translation layer.
+ * @param p_intf - pointer to the interface handle.
+ * @param start - start address of the region, must be sector aligned.
+ * @param len - length of the region, must be a multiple of the sector size.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_ftl_format(emb_ext_flash_ftl_t *p_ftl, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_ftl_mount mount the translation layer, rebuilding the map from the newest checkpoint and the sector
+ * summaries written after it. A blank region mounts as empty.
+ *
+ * @param p_ftl - pointer to the translation layer.
+ * @param p_intf - pointer to the interface handle.
+ * @param start - start address of the region, must be sector aligned.
+ * @param len - length of the region, must be a multiple of the sector size.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_ftl_mount(emb_ext_flash_ftl_t *p_ftl, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_ftl_block_count get the number of logical blocks.
+ *
+ * @param p_ftl - pointer to the translation layer.
+ * @return uint32_t - number of logical blocks.
+ */
+uint32_t emb_ext_flash_ftl_block_count(emb_ext_flash_ftl_t *p_ftl);
+
+/**
+ * @brief emb_ext_flash_ftl_block_read read a logical block, blocks that were never written or were trimmed read as 0xFF.
+ *
+ * @param p_ftl - pointer to the translation layer.
+ * @param block - logical block number.
+ * @param data - pointer to EXT_FLASH_FTL_BLOCK_SIZE bytes.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_ftl_block_read(emb_ext_flash_ftl_t *p_ftl, uint32_t block, uint8_t *data);
+
+/**
+ * @brief emb_ext_flash_ftl_block_write write a logical block out of place.
+ *
+ * @param p_ftl - pointer to the translation layer.
+ * @param block - logical block number.
+ * @param data - pointer to EXT_FLASH_FTL_BLOCK_SIZE bytes.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_ftl_block_write(emb_ext_flash_ftl_t *p_ftl, uint32_t block, uint8_t *data);
+
+/**
+ * @brief emb_ext_flash_ftl_trim mark a range of logical blocks as unused so garbage collection does not have to copy them.
+ *
+ * @param p_ftl - pointer to the translation layer.
+ * @param block - first logical block number.
+ * @param count - number of blocks.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_ftl_trim(emb_ext_flash_ftl_t *p_ftl, uint32_t block, uint32_t count);
+
+/**
+ * @brief emb_ext_flash_ftl_sync write a checkpoint of the map so the next mount is fast and trims are persisted.
+ *
+ * @param p_ftl - pointer to the translation layer.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_ftl_sync(emb_ext_flash_ftl_t *p_ftl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_FTL_H_ */
@@ -0,0 +1,863 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_crc.h"
+#include "emb_ext_flash_le.h"
+#include "emb_ext_flash_journal.h"
+
+// Group layout: a header of magic, sequence number, payload length and a CRC-32 of those, the table of rewritten sectors with
+// the CRC-32 of each one's backup, the payload, then a commit record of the CRC-32 of everything before it, a second magic
+// and the applied byte
+#define JOURNAL_MAGIC         0x314E524A // "JRN1"
+#define JOURNAL_COMMIT_MAGIC  0x31544D43 // "CMT1"
+#define JOURNAL_APPLIED_OFF   8
+#define JOURNAL_TABLE_SIZE    (EXT_FLASH_JOURNAL_MAX_REWRITES * EXT_FLASH_JOURNAL_REWRITE_SIZE)
+#define JOURNAL_PAYLOAD_OFF   (EXT_FLASH_JOURNAL_HEADER_SIZE + JOURNAL_TABLE_SIZE)
+#define JOURNAL_FIXED_SIZE    (JOURNAL_PAYLOAD_OFF + EXT_FLASH_JOURNAL_COMMIT_SIZE)
+
+// Private functions
+static uint32_t journal_sector(emb_ext_flash_journal_t *p_jrnl, uint16_t i)
+{
+   return(p_jrnl->start + (uint32_t)i * EXT_FLASH_SECTOR_SIZE);
+}
+
+static void journal_lock(emb_ext_flash_journal_t *p_jrnl)
+{
+   if (p_jrnl->lock)
+   {
+      p_jrnl->lock(p_jrnl->lock_ctx);
+   }
+}
+
+static void journal_unlock(emb_ext_flash_journal_t *p_jrnl)
+{
+   if (p_jrnl->unlock)
+   {
+      p_jrnl->unlock(p_jrnl->lock_ctx);
+   }
+}
+
+// Check the geometry and reset the state
+static int journal_init(emb_ext_flash_journal_t *p_jrnl, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len)
+{
+   if ((start % EXT_FLASH_SECTOR_SIZE) || (len % EXT_FLASH_SECTOR_SIZE) ||
+       len < (2 + EXT_FLASH_JOURNAL_MAX_REWRITES) * EXT_FLASH_SECTOR_SIZE ||
+       len / EXT_FLASH_SECTOR_SIZE > 0xFFFF)
+   {
+      return(-1);
+   }
+
+   memset(p_jrnl, 0, sizeof(emb_ext_flash_journal_t));
+   p_jrnl->p_intf  = p_intf;
+   p_jrnl->start   = start;
+   p_jrnl->sectors = (uint16_t)(len / EXT_FLASH_SECTOR_SIZE - EXT_FLASH_JOURNAL_MAX_REWRITES);
+   p_jrnl->seq     = 1;
+
+   return(0);
+}
+
+// Read a group header, returns 0 if it is intact
+static int journal_read_header(emb_ext_flash_journal_t *p_jrnl, uint32_t address, uint32_t *p_seq, uint32_t *p_len)
+{
+   uint8_t hdr[EXT_FLASH_JOURNAL_HEADER_SIZE];
+
+   if (emb_ext_flash_read(p_jrnl->p_intf, address, hdr, sizeof(hdr)) != sizeof(hdr) ||
+       emb_ext_flash_get_u32(hdr) != JOURNAL_MAGIC ||
+       emb_ext_flash_get_u32(&hdr[12]) != emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, hdr, 12))
+   {
+      return(-1);
+   }
+   *p_seq = emb_ext_flash_get_u32(&hdr[4]);
+   *p_len = emb_ext_flash_get_u32(&hdr[8]);
+
+   return(0);
+}
+
+// Read part of a group's payload, from the transactions of the running sync while the group is being written and from flash
+// on replay
+static int journal_payload(emb_ext_flash_journal_t *p_jrnl, uint8_t live, uint32_t group, uint32_t off, uint8_t *buf,
+                           uint32_t len)
+{
+   uint8_t i;
+
+   if (!live)
+   {
+      return(emb_ext_flash_read(p_jrnl->p_intf, group + JOURNAL_PAYLOAD_OFF + off, buf, (uint16_t)len) == (int)len ? 0 : -1);
+   }
+
+   // Writes never straddle two transactions, so the whole read comes from one staging buffer
+   for (i = 0; i < p_jrnl->num_active; i++)
+   {
+      emb_ext_flash_journal_txn_t *p_txn = p_jrnl->active[i];
+      if (off < p_txn->used)
+      {
+         memcpy(buf, &p_txn->buf[off], len);
+         return(0);
+      }
+      off -= p_txn->used;
+   }
+
+   return(-1);
+}
+
+// Lowest target page at or above bound that a group writes to, returns -1 if there is none
+static int journal_next_page(emb_ext_flash_journal_t *p_jrnl, uint8_t live, uint32_t group, uint32_t payload_len,
+                             uint32_t bound, uint32_t *p_page)
+{
+   uint8_t  hdr[EXT_FLASH_JOURNAL_WRITE_SIZE];
+   uint32_t off   = 0;
+   int      found = -1;
+
+   while (off + EXT_FLASH_JOURNAL_WRITE_SIZE <= payload_len)
+   {
+      if (journal_payload(p_jrnl, live, group, off, hdr, sizeof(hdr)) != 0)
+      {
+         return(-1);
+      }
+      uint32_t address = emb_ext_flash_get_u32(hdr);
+      uint16_t len     = emb_ext_flash_get_u16(&hdr[4]);
+      off += EXT_FLASH_JOURNAL_WRITE_SIZE + len;
+
+      // First page of the write at or above the bound
+      uint32_t last = (address + len - 1) & ~(uint32_t)(EXT_FLASH_PAGE_SIZE - 1);
+      if (len == 0 || last < bound)
+      {
+         continue;
+      }
+      uint32_t first = address & ~(uint32_t)(EXT_FLASH_PAGE_SIZE - 1);
+      if (first < bound)
+      {
+         first = bound;
+      }
+      if (found != 0 || first < *p_page)
+      {
+         *p_page = first;
+         found   = 0;
+      }
+   }
+
+   return(found);
+}
+
+// Lay a group's writes to a page over the page buffer in order, so the last write to a byte wins, and mark the bytes written
+static int journal_overlay(emb_ext_flash_journal_t *p_jrnl, uint8_t live, uint32_t group, uint32_t payload_len, uint32_t page)
+{
+   uint8_t  hdr[EXT_FLASH_JOURNAL_WRITE_SIZE];
+   uint32_t off = 0;
+
+   memset(p_jrnl->mask, 0, sizeof(p_jrnl->mask));
+   while (off + EXT_FLASH_JOURNAL_WRITE_SIZE <= payload_len)
+   {
+      if (journal_payload(p_jrnl, live, group, off, hdr, sizeof(hdr)) != 0)
+      {
+         return(-1);
+      }
+      uint32_t address = emb_ext_flash_get_u32(hdr);
+      uint16_t len     = emb_ext_flash_get_u16(&hdr[4]);
+      uint32_t src     = off + EXT_FLASH_JOURNAL_WRITE_SIZE;
+      off = src + len;
+
+      // Part of the write inside the page
+      uint32_t start = address > page ? address : page;
+      uint32_t end   = address + len < page + EXT_FLASH_PAGE_SIZE ? address + len : page + EXT_FLASH_PAGE_SIZE;
+      if (start >= end)
+      {
+         continue;
+      }
+      if (journal_payload(p_jrnl, live, group, src + (start - address), &p_jrnl->page[start - page], end - start) != 0)
+      {
+         return(-1);
+      }
+      for (uint32_t i = start - page; i < end - page; i++)
+      {
+         p_jrnl->mask[i / 8] |= (uint8_t)(1u << (i & 7));
+      }
+   }
+
+   return(0);
+}
+
+// Index of a sector in the list of sectors the group rewrites, -1 if it is programmed in place
+static int journal_find_rewrite(emb_ext_flash_journal_t *p_jrnl, uint32_t sector)
+{
+   for (uint8_t i = 0; i < p_jrnl->num_rewrites; i++)
+   {
+      if (p_jrnl->rewrite[i] == sector)
+      {
+         return(i);
+      }
+   }
+
+   return(-1);
+}
+
+// Work out which sectors the transactions of the running sync have to rewrite: those with a target page whose new contents
+// set a bit that is clear in flash. Returns -1 if there are too many or a write falls in the journal.
+static int journal_plan(emb_ext_flash_journal_t *p_jrnl, uint32_t payload_len)
+{
+   uint8_t  cur[EXT_FLASH_PAGE_SIZE];
+   uint32_t end   = p_jrnl->start + (uint32_t)(p_jrnl->sectors + EXT_FLASH_JOURNAL_MAX_REWRITES) * EXT_FLASH_SECTOR_SIZE;
+   uint32_t bound = 0;
+   uint32_t page;
+
+   p_jrnl->num_rewrites = 0;
+   while (journal_next_page(p_jrnl, 1, 0, payload_len, bound, &page) == 0)
+   {
+      uint32_t sector = page & ~(uint32_t)(EXT_FLASH_SECTOR_SIZE - 1);
+      bound = page + EXT_FLASH_PAGE_SIZE;
+
+      if (page >= p_jrnl->start && page < end)
+      {
+         return(-1);
+      }
+      if (journal_find_rewrite(p_jrnl, sector) >= 0)
+      {
+         continue;
+      }
+
+      memset(p_jrnl->page, 0xFF, EXT_FLASH_PAGE_SIZE);
+      if (journal_overlay(p_jrnl, 1, 0, payload_len, page) != 0 ||
+          emb_ext_flash_read(p_jrnl->p_intf, page, cur, EXT_FLASH_PAGE_SIZE) != EXT_FLASH_PAGE_SIZE)
+      {
+         return(-1);
+      }
+      for (uint16_t i = 0; i < EXT_FLASH_PAGE_SIZE; i++)
+      {
+         if ((p_jrnl->mask[i / 8] & (1u << (i & 7))) && (cur[i] & p_jrnl->page[i]) != p_jrnl->page[i])
+         {
+            if (p_jrnl->num_rewrites == EXT_FLASH_JOURNAL_MAX_REWRITES)
+            {
+               return(-1);
+            }
+            p_jrnl->rewrite[p_jrnl->num_rewrites++] = sector;
+            break;
+         }
+      }
+   }
+
+   return(0);
+}
+
+// Copy a sector to a backup sector, giving the CRC-32 of its contents
+static int journal_backup(emb_ext_flash_journal_t *p_jrnl, uint32_t sector, uint8_t slot, uint32_t *p_crc)
+{
+   uint32_t backup = journal_sector(p_jrnl, (uint16_t)(p_jrnl->sectors + slot));
+   uint32_t crc    = EXT_FLASH_CRC32_INIT;
+
+   p_jrnl->stat_erases++;
+   if (emb_ext_flash_erase(p_jrnl->p_intf, backup, EXT_FLASH_SECTOR_SIZE) != 0)
+   {
+      return(-1);
+   }
+   for (uint32_t off = 0; off < EXT_FLASH_SECTOR_SIZE; off += EXT_FLASH_PAGE_SIZE)
+   {
+      uint16_t i;
+
+      if (emb_ext_flash_read(p_jrnl->p_intf, sector + off, p_jrnl->page, EXT_FLASH_PAGE_SIZE) != EXT_FLASH_PAGE_SIZE)
+      {
+         return(-1);
+      }
+      crc = emb_ext_flash_crc32(crc, p_jrnl->page, EXT_FLASH_PAGE_SIZE);
+
+      // Erased pages need no program
+      for (i = 0; i < EXT_FLASH_PAGE_SIZE && p_jrnl->page[i] == 0xFF; i++)
+      {
+      }
+      if (i < EXT_FLASH_PAGE_SIZE)
+      {
+         p_jrnl->stat_programs++;
+         if (emb_ext_flash_write(p_jrnl->p_intf, backup + off, p_jrnl->page, EXT_FLASH_PAGE_SIZE) != EXT_FLASH_PAGE_SIZE)
+         {
+            return(-1);
+         }
+      }
+   }
+   *p_crc = crc;
+
+   return(0);
+}
+
+// Check a backup sector against the CRC-32 the group recorded for it
+static int journal_check_backup(emb_ext_flash_journal_t *p_jrnl, uint8_t slot, uint32_t crc)
+{
+   uint32_t backup = journal_sector(p_jrnl, (uint16_t)(p_jrnl->sectors + slot));
+   uint32_t check  = EXT_FLASH_CRC32_INIT;
+
+   for (uint32_t off = 0; off < EXT_FLASH_SECTOR_SIZE; off += EXT_FLASH_PAGE_SIZE)
+   {
+      if (emb_ext_flash_read(p_jrnl->p_intf, backup + off, p_jrnl->page, EXT_FLASH_PAGE_SIZE) != EXT_FLASH_PAGE_SIZE)
+      {
+         return(-1);
+      }
+      check = emb_ext_flash_crc32(check, p_jrnl->page, EXT_FLASH_PAGE_SIZE);
+   }
+
+   return(check == crc ? 0 : -1);
+}
+
+// Apply a group to its targets. Pages programmed in place get a single program of the bytes written, rewritten sectors are
+// erased and programmed from their backup with the writes laid over it.
+static int journal_apply(emb_ext_flash_journal_t *p_jrnl, uint8_t live, uint32_t group, uint32_t payload_len)
+{
+   uint8_t  table[JOURNAL_TABLE_SIZE];
+   uint32_t bound = 0;
+   uint32_t page;
+   uint8_t  slot;
+
+   // The table of rewritten sectors, with the backups checked before anything is erased on replay
+   if (emb_ext_flash_read(p_jrnl->p_intf, group + EXT_FLASH_JOURNAL_HEADER_SIZE, table, sizeof(table)) != sizeof(table))
+   {
+      return(-1);
+   }
+   p_jrnl->num_rewrites = 0;
+   for (slot = 0; slot < EXT_FLASH_JOURNAL_MAX_REWRITES; slot++)
+   {
+      uint32_t sector = emb_ext_flash_get_u32(&table[slot * EXT_FLASH_JOURNAL_REWRITE_SIZE]);
+      if (sector == 0xFFFFFFFF)
+      {
+         break;
+      }
+      if (!live && journal_check_backup(p_jrnl, slot, emb_ext_flash_get_u32(&table[slot * EXT_FLASH_JOURNAL_REWRITE_SIZE + 4])) != 0)
+      {
+         return(-1);
+      }
+      p_jrnl->rewrite[p_jrnl->num_rewrites++] = sector;
+   }
+
+   // Pages programmed in place, the bytes in between that are not written are left at 0xFF and so are not changed
+   while (journal_next_page(p_jrnl, live, group, payload_len, bound, &page) == 0)
+   {
+      uint16_t lo = EXT_FLASH_PAGE_SIZE;
+      uint16_t hi = 0;
+
+      bound = page + EXT_FLASH_PAGE_SIZE;
+      if (journal_find_rewrite(p_jrnl, page & ~(uint32_t)(EXT_FLASH_SECTOR_SIZE - 1)) >= 0)
+      {
+         continue;
+      }
+      memset(p_jrnl->page, 0xFF, EXT_FLASH_PAGE_SIZE);
+      if (journal_overlay(p_jrnl, live, group, payload_len, page) != 0)
+      {
+         return(-1);
+      }
+      for (uint16_t i = 0; i < EXT_FLASH_PAGE_SIZE; i++)
+      {
+         if (p_jrnl->mask[i / 8] & (1u << (i & 7)))
+         {
+            lo = i < lo ? i : lo;
+            hi = (uint16_t)(i + 1);
+         }
+      }
+      p_jrnl->stat_programs++;
+      if (emb_ext_flash_write(p_jrnl->p_intf, page + lo, &p_jrnl->page[lo], hi - lo) != hi - lo)
+      {
+         return(-1);
+      }
+   }
+
+   // Rewritten sectors
+   for (slot = 0; slot < p_jrnl->num_rewrites; slot++)
+   {
+      uint32_t sector = p_jrnl->rewrite[slot];
+      uint32_t backup = journal_sector(p_jrnl, (uint16_t)(p_jrnl->sectors + slot));
+
+      p_jrnl->stat_erases++;
+      p_jrnl->stat_rewrites++;
+      if (emb_ext_flash_erase(p_jrnl->p_intf, sector, EXT_FLASH_SECTOR_SIZE) != 0)
+      {
+         return(-1);
+      }
+      for (uint32_t off = 0; off < EXT_FLASH_SECTOR_SIZE; off += EXT_FLASH_PAGE_SIZE)
+      {
+         uint16_t i;
+
+         if (emb_ext_flash_read(p_jrnl->p_intf, backup + off, p_jrnl->page, EXT_FLASH_PAGE_SIZE) != EXT_FLASH_PAGE_SIZE ||
+             journal_overlay(p_jrnl, live, group, payload_len, sector + off) != 0)
+         {
+            return(-1);
+         }
+         for (i = 0; i < EXT_FLASH_PAGE_SIZE && p_jrnl->page[i] == 0xFF; i++)
+         {
+         }
+         if (i < EXT_FLASH_PAGE_SIZE)
+         {
+            p_jrnl->stat_programs++;
+            if (emb_ext_flash_write(p_jrnl->p_intf, sector + off, p_jrnl->page, EXT_FLASH_PAGE_SIZE) != EXT_FLASH_PAGE_SIZE)
+            {
+               return(-1);
+            }
+         }
+      }
+   }
+
+   // The marker goes in only once every target has been programmed
+   uint8_t applied = 0x00;
+   p_jrnl->stat_programs++;
+
+   return(emb_ext_flash_write(p_jrnl->p_intf, group + JOURNAL_PAYLOAD_OFF + payload_len + JOURNAL_APPLIED_OFF, &applied, 1) == 1 ?
+          0 : -1);
+}
+
+// Append bytes to a group through the page buffer, programming each page once it is full
+static int journal_stream(emb_ext_flash_journal_t *p_jrnl, uint32_t *p_addr, uint16_t *p_fill, const uint8_t *data,
+                          uint32_t len)
+{
+   while (len)
+   {
+      // The buffer holds from the address to the end of its page
+      uint16_t room = EXT_FLASH_PAGE_SIZE - (*p_addr % EXT_FLASH_PAGE_SIZE);
+      uint16_t n    = room - *p_fill;
+      if (n > len)
+      {
+         n = (uint16_t)len;
+      }
+      memcpy(&p_jrnl->page[*p_fill], data, n);
+      *p_fill += n;
+      data    += n;
+      len     -= n;
+
+      if (*p_fill == room)
+      {
+         p_jrnl->stat_programs++;
+         if (emb_ext_flash_write(p_jrnl->p_intf, *p_addr, p_jrnl->page, room) != room)
+         {
+            return(-1);
+         }
+         *p_addr += room;
+         *p_fill  = 0;
+      }
+   }
+
+   return(0);
+}
+
+// Write the first n transactions of the running sync as one group and apply it, the sectors it rewrites are already planned
+static int journal_group(emb_ext_flash_journal_t *p_jrnl, uint8_t n, uint32_t payload_len)
+{
+   uint8_t  hdr[EXT_FLASH_JOURNAL_HEADER_SIZE];
+   uint8_t  table[JOURNAL_TABLE_SIZE];
+   uint8_t  commit[JOURNAL_APPLIED_OFF];
+   uint32_t size = JOURNAL_FIXED_SIZE + payload_len;
+   uint16_t fill = 0;
+   uint8_t  i;
+
+   // Back up the sectors to be rewritten before the commit record can make the group count
+   memset(table, 0xFF, sizeof(table));
+   for (i = 0; i < p_jrnl->num_rewrites; i++)
+   {
+      uint32_t crc;
+      if (journal_backup(p_jrnl, p_jrnl->rewrite[i], i, &crc) != 0)
+      {
+         return(-1);
+      }
+      emb_ext_flash_put_u32(&table[i * EXT_FLASH_JOURNAL_REWRITE_SIZE], p_jrnl->rewrite[i]);
+      emb_ext_flash_put_u32(&table[i * EXT_FLASH_JOURNAL_REWRITE_SIZE + 4], crc);
+   }
+
+   // Move on to the next sector when the group does not fit, its groups have all been applied
+   if (p_jrnl->off + size > EXT_FLASH_SECTOR_SIZE)
+   {
+      p_jrnl->cur = (uint16_t)((p_jrnl->cur + 1) % p_jrnl->sectors);
+      p_jrnl->off = EXT_FLASH_SECTOR_SIZE;
+      p_jrnl->stat_erases++;
+      if (emb_ext_flash_erase(p_jrnl->p_intf, journal_sector(p_jrnl, p_jrnl->cur), EXT_FLASH_SECTOR_SIZE) != 0)
+      {
+         return(-1);
+      }
+      p_jrnl->off = 0;
+   }
+
+   uint32_t group = journal_sector(p_jrnl, p_jrnl->cur) + p_jrnl->off;
+   uint32_t addr  = group;
+
+   // Close the sector up front, a group that fails part way leaves it in an unknown state
+   p_jrnl->off = EXT_FLASH_SECTOR_SIZE;
+
+   emb_ext_flash_put_u32(hdr, JOURNAL_MAGIC);
+   emb_ext_flash_put_u32(&hdr[4], p_jrnl->seq);
+   emb_ext_flash_put_u32(&hdr[8], payload_len);
+   emb_ext_flash_put_u32(&hdr[12], emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, hdr, 12));
+   uint32_t crc = emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, hdr, sizeof(hdr));
+   crc = emb_ext_flash_crc32(crc, table, sizeof(table));
+   if (journal_stream(p_jrnl, &addr, &fill, hdr, sizeof(hdr)) != 0 || journal_stream(p_jrnl, &addr, &fill, table, sizeof(table)) != 0)
+   {
+      return(-1);
+   }
+   for (i = 0; i < n; i++)
+   {
+      emb_ext_flash_journal_txn_t *p_txn = p_jrnl->active[i];
+      crc = emb_ext_flash_crc32(crc, p_txn->buf, p_txn->used);
+      if (journal_stream(p_jrnl, &addr, &fill, p_txn->buf, p_txn->used) != 0)
+      {
+         return(-1);
+      }
+   }
+
+   // The commit record ends the same run of programs, the applied byte after it is left erased
+   emb_ext_flash_put_u32(commit, crc);
+   emb_ext_flash_put_u32(&commit[4], JOURNAL_COMMIT_MAGIC);
+   if (journal_stream(p_jrnl, &addr, &fill, commit, sizeof(commit)) != 0)
+   {
+      return(-1);
+   }
+   if (fill)
+   {
+      p_jrnl->stat_programs++;
+      if (emb_ext_flash_write(p_jrnl->p_intf, addr, p_jrnl->page, fill) != fill)
+      {
+         return(-1);
+      }
+   }
+   p_jrnl->seq++;
+   p_jrnl->stat_groups++;
+
+   if (journal_apply(p_jrnl, 1, group, payload_len) != 0)
+   {
+      return(-1);
+   }
+
+   p_jrnl->off = group - journal_sector(p_jrnl, p_jrnl->cur) + size;
+
+   return(0);
+}
+
+// Check the CRC-32 of a group against its commit record
+static int journal_verify(emb_ext_flash_journal_t *p_jrnl, uint32_t group, uint32_t payload_len, uint8_t *p_applied)
+{
+   uint8_t  commit[EXT_FLASH_JOURNAL_COMMIT_SIZE];
+   uint32_t crc  = EXT_FLASH_CRC32_INIT;
+   uint32_t left = JOURNAL_PAYLOAD_OFF + payload_len;
+   uint32_t addr = group;
+
+   while (left)
+   {
+      uint16_t n = left > EXT_FLASH_PAGE_SIZE ? EXT_FLASH_PAGE_SIZE : (uint16_t)left;
+      if (emb_ext_flash_read(p_jrnl->p_intf, addr, p_jrnl->page, n) != n)
+      {
+         return(-1);
+      }
+      crc   = emb_ext_flash_crc32(crc, p_jrnl->page, n);
+      addr += n;
+      left -= n;
+   }
+   if (emb_ext_flash_read(p_jrnl->p_intf, addr, commit, sizeof(commit)) != sizeof(commit) ||
+       emb_ext_flash_get_u32(commit) != crc || emb_ext_flash_get_u32(&commit[4]) != JOURNAL_COMMIT_MAGIC)
+   {
+      return(-1);
+   }
+   *p_applied = commit[JOURNAL_APPLIED_OFF] != 0xFF;
+
+   return(0);
+}
+
+// Finish the first n transactions of the running sync and take them off its list
+static void journal_finish(emb_ext_flash_journal_t *p_jrnl, uint8_t n, int result)
+{
+   emb_ext_flash_journal_txn_t *done[EXT_FLASH_JOURNAL_MAX_PENDING];
+   uint8_t                      i;
+
+   // Off the list before the callbacks, so they can commit again
+   memcpy(done, p_jrnl->active, n * sizeof(done[0]));
+   p_jrnl->num_active -= n;
+   memmove(p_jrnl->active, &p_jrnl->active[n], p_jrnl->num_active * sizeof(p_jrnl->active[0]));
+   for (i = 0; i < n; i++)
+   {
+      if (done[i]->cb)
+      {
+         done[i]->cb(done[i]->ctx, result);
+      }
+   }
+}
+
+// Pubic functions
+int emb_ext_flash_journal_format(emb_ext_flash_journal_t *p_jrnl, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len)
+{
+   // Null check
+   if (!p_jrnl || !p_intf)
+   {
+      return(-1);
+   }
+
+   if (journal_init(p_jrnl, p_intf, start, len) != 0)
+   {
+      return(-1);
+   }
+
+   p_jrnl->stat_erases += p_jrnl->sectors + EXT_FLASH_JOURNAL_MAX_REWRITES;
+
+   return(emb_ext_flash_erase(p_intf, start, len) == 0 ? 0 : -1);
+}
+
+int emb_ext_flash_journal_mount(emb_ext_flash_journal_t *p_jrnl, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len)
+{
+   uint32_t seq, payload_len;
+   uint32_t last     = EXT_FLASH_SECTOR_SIZE;
+   uint32_t last_len = 0;
+   int32_t  newest   = -1;
+   uint16_t i;
+
+   // Null check
+   if (!p_jrnl || !p_intf)
+   {
+      return(-1);
+   }
+
+   if (journal_init(p_jrnl, p_intf, start, len) != 0)
+   {
+      return(-1);
+   }
+
+   // The newest sector is the one whose first group has the highest sequence number
+   for (i = 0; i < p_jrnl->sectors; i++)
+   {
+      if (journal_read_header(p_jrnl, journal_sector(p_jrnl, i), &seq, &payload_len) == 0 &&
+          (newest < 0 || (int32_t)(seq - p_jrnl->seq) >= 0))
+      {
+         newest      = i;
+         p_jrnl->seq = seq + 1;
+      }
+   }
+
+   // An empty ring starts in its first sector, erasing it first
+   if (newest < 0)
+   {
+      p_jrnl->cur = p_jrnl->sectors - 1;
+      p_jrnl->off = EXT_FLASH_SECTOR_SIZE;
+      return(0);
+   }
+   p_jrnl->cur = (uint16_t)newest;
+
+   // Walk the groups of the newest sector to the first one that is missing or not intact
+   uint32_t sector = journal_sector(p_jrnl, p_jrnl->cur);
+   while (p_jrnl->off + JOURNAL_FIXED_SIZE <= EXT_FLASH_SECTOR_SIZE)
+   {
+      uint8_t commit[JOURNAL_APPLIED_OFF];
+
+      if (journal_read_header(p_jrnl, sector + p_jrnl->off, &seq, &payload_len) != 0)
+      {
+         // Appending carries on here only if no program reached the rest of this page, a torn one closes the sector
+         uint16_t room = EXT_FLASH_PAGE_SIZE - (p_jrnl->off % EXT_FLASH_PAGE_SIZE);
+         if (emb_ext_flash_read(p_intf, sector + p_jrnl->off, p_jrnl->page, room) != room)
+         {
+            return(-1);
+         }
+         for (i = 0; i < room; i++)
+         {
+            if (p_jrnl->page[i] != 0xFF)
+            {
+               p_jrnl->off = EXT_FLASH_SECTOR_SIZE;
+               break;
+            }
+         }
+         break;
+      }
+
+      // A group without its commit record was cut short and is rolled back
+      p_jrnl->seq   = seq + 1;
+      uint32_t size = JOURNAL_FIXED_SIZE + payload_len;
+      if (p_jrnl->off + size > EXT_FLASH_SECTOR_SIZE ||
+          emb_ext_flash_read(p_intf, sector + p_jrnl->off + size - EXT_FLASH_JOURNAL_COMMIT_SIZE, commit, sizeof(commit)) !=
+          sizeof(commit) || emb_ext_flash_get_u32(&commit[4]) != JOURNAL_COMMIT_MAGIC)
+      {
+         p_jrnl->stat_rollbacks++;
+         p_jrnl->off = EXT_FLASH_SECTOR_SIZE;
+         break;
+      }
+
+      last         = p_jrnl->off;
+      last_len     = payload_len;
+      p_jrnl->off += size;
+   }
+
+   // Every group but the last one was applied before the next was written, so only the last needs checking
+   if (last < EXT_FLASH_SECTOR_SIZE)
+   {
+      uint8_t applied;
+
+      if (journal_verify(p_jrnl, sector + last, last_len, &applied) != 0)
+      {
+         p_jrnl->stat_rollbacks++;
+         p_jrnl->off = EXT_FLASH_SECTOR_SIZE;
+      }
+      else if (!applied)
+      {
+         p_jrnl->stat_replays++;
+         if (journal_apply(p_jrnl, 0, sector + last, last_len) != 0)
+         {
+            return(-1);
+         }
+      }
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_journal_set_lock(emb_ext_flash_journal_t *p_jrnl, emb_ext_flash_journal_lock_t lock,
+                                   emb_ext_flash_journal_lock_t unlock, void *ctx)
+{
+   // Null check
+   if (!p_jrnl || (lock && !unlock))
+   {
+      return(-1);
+   }
+
+   p_jrnl->lock     = lock;
+   p_jrnl->unlock   = lock ? unlock : NULL;
+   p_jrnl->lock_ctx = ctx;
+
+   return(0);
+}
+
+void emb_ext_flash_journal_begin(emb_ext_flash_journal_txn_t *p_txn)
+{
+   // Null check
+   if (!p_txn)
+   {
+      return;
+   }
+
+   p_txn->cb   = NULL;
+   p_txn->ctx  = NULL;
+   p_txn->used = 0;
+}
+
+int emb_ext_flash_journal_write(emb_ext_flash_journal_txn_t *p_txn, uint32_t address, const uint8_t *data, uint16_t len)
+{
+   // Null check
+   if (!p_txn || (!data && len))
+   {
+      return(-1);
+   }
+
+   if ((uint32_t)p_txn->used + EXT_FLASH_JOURNAL_WRITE_SIZE + len > EXT_FLASH_JOURNAL_TXN_SIZE)
+   {
+      return(-1);
+   }
+
+   uint8_t *p = &p_txn->buf[p_txn->used];
+   emb_ext_flash_put_u32(p, address);
+   emb_ext_flash_put_u16(&p[4], len);
+   memcpy(&p[EXT_FLASH_JOURNAL_WRITE_SIZE], data, len);
+   p_txn->used += EXT_FLASH_JOURNAL_WRITE_SIZE + len;
+
+   return(0);
+}
+
+int emb_ext_flash_journal_commit(emb_ext_flash_journal_t *p_jrnl, emb_ext_flash_journal_txn_t *p_txn, emb_ext_flash_journal_cb_t cb,
+                                 void *ctx)
+{
+   int rtn = -1;
+
+   // Null check
+   if (!p_jrnl || !p_txn)
+   {
+      return(-1);
+   }
+
+   p_txn->cb  = cb;
+   p_txn->ctx = ctx;
+
+   journal_lock(p_jrnl);
+   if (p_jrnl->num_pending < EXT_FLASH_JOURNAL_MAX_PENDING)
+   {
+      p_jrnl->pending[p_jrnl->num_pending++] = p_txn;
+      rtn = 0;
+   }
+   journal_unlock(p_jrnl);
+
+   return(rtn);
+}
+
+int emb_ext_flash_journal_sync(emb_ext_flash_journal_t *p_jrnl)
+{
+   int committed = 0;
+
+   // Null check
+   if (!p_jrnl || !p_jrnl->p_intf)
+   {
+      return(-1);
+   }
+
+   // Only one sync runs at a time, it also writes out what others commit while it runs
+   journal_lock(p_jrnl);
+   if (p_jrnl->syncing)
+   {
+      journal_unlock(p_jrnl);
+      return(0);
+   }
+   p_jrnl->syncing = 1;
+   journal_unlock(p_jrnl);
+
+   for (;;)
+   {
+      uint32_t payload_len = 0;
+      uint8_t  n           = 0;
+
+      // Take over the pending transactions, and stop once there are none left
+      journal_lock(p_jrnl);
+      while (p_jrnl->num_pending && p_jrnl->num_active < EXT_FLASH_JOURNAL_MAX_PENDING)
+      {
+         p_jrnl->active[p_jrnl->num_active++] = p_jrnl->pending[0];
+         p_jrnl->num_pending--;
+         memmove(p_jrnl->pending, &p_jrnl->pending[1], p_jrnl->num_pending * sizeof(p_jrnl->pending[0]));
+      }
+      if (!p_jrnl->num_active)
+      {
+         p_jrnl->syncing = 0;
+         journal_unlock(p_jrnl);
+         break;
+      }
+      journal_unlock(p_jrnl);
+
+      // As many transactions as fit in a sector, oldest first, then fewer until they rewrite few enough sectors
+      while (n < p_jrnl->num_active &&
+             JOURNAL_FIXED_SIZE + payload_len + p_jrnl->active[n]->used <= EXT_FLASH_SECTOR_SIZE)
+      {
+         payload_len += p_jrnl->active[n]->used;
+         n++;
+      }
+      while (n && journal_plan(p_jrnl, payload_len) != 0)
+      {
+         n--;
+         payload_len -= p_jrnl->active[n]->used;
+      }
+
+      // A transaction that cannot go in a group on its own fails by itself
+      if (n == 0)
+      {
+         journal_finish(p_jrnl, 1, -1);
+         continue;
+      }
+
+      int rtn = journal_group(p_jrnl, n, payload_len);
+      journal_finish(p_jrnl, n, rtn);
+      if (rtn != 0)
+      {
+         journal_lock(p_jrnl);
+         p_jrnl->syncing = 0;
+         journal_unlock(p_jrnl);
+         return(-1);
+      }
+      committed            += n;
+      p_jrnl->stat_commits += n;
+   }
+
+   return(committed);
+}
@@ -0,0 +1,238 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_JOURNAL_H_
+#define EMB_EXT_FLASH_JOURNAL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Write-ahead journal that makes a set of record writes atomic, with group commit.
+ *
+ * A transaction stages writes in RAM and is then committed to the journal, a ring of sectors. emb_ext_flash_journal_sync()
+ * takes every transaction committed since the last sync and writes them as one group: a header, the staged writes of all of
+ * them and a single commit record carrying a CRC-32 of the group. The group goes out as one run of page programs. Once the
+ * commit record is in flash the group is applied to the target addresses, and then one byte of the commit record is
+ * programmed to mark the group applied.
+ *
+ * A write replaces the bytes at its target, whatever they held before. Before the group is written, each target page is
+ * checked against its new contents:
+ * - If the new contents only clear bits, the page is programmed in place. All the writes to the page are merged into one
+ *   program. Programming the same data again does no harm, so a page that was partly programmed can be programmed again.
+ * - Otherwise the sector holding the page is rewritten copy-on-write. Its old contents are first copied to one of the
+ *   EXT_FLASH_JOURNAL_MAX_REWRITES backup sectors behind the ring, and the group records the copy's CRC-32. Applying the group
+ *   erases the target sector and programs the backup with the writes laid over it. That can be done again from the backup as
+ *   often as needed.
+ *
+ * Mount therefore recovers by checking the newest group only:
+ * - If its commit record is missing or does not match, the group is rolled back. Nothing was applied before the commit.
+ * - If it is committed but not marked applied, it is replayed from the journal and the backups and then marked.
+ *
+ * Groups are packed one after the other. A program torn by a power loss only reaches the bytes it was programming, so it
+ * cannot harm the group before it. Mount only appends after the newest group if the rest of its page is still erased, and
+ * otherwise closes the sector. When a group does not fit in what is left of the sector, the next sector of the ring is erased
+ * and the group starts there. Every group but the newest has been applied, so erasing old groups and reusing the backups
+ * loses nothing.
+ *
+ * Transactions can be committed from several tasks. Give the journal a lock with emb_ext_flash_journal_set_lock() to guard
+ * the list of pending transactions. The first task to sync writes out every transaction committed before or during its sync.
+ * A sync that finds another one running returns straight away, and the task's callback is called by the running sync.
+ */
+
+// Size of the staging buffer of a transaction, each write takes 6 bytes on top of its data
+#ifndef EXT_FLASH_JOURNAL_TXN_SIZE
+#define EXT_FLASH_JOURNAL_TXN_SIZE      512
+#endif
+
+// Most transactions waiting for the next sync
+#ifndef EXT_FLASH_JOURNAL_MAX_PENDING
+#define EXT_FLASH_JOURNAL_MAX_PENDING   16
+#endif
+
+// Most sectors one group can rewrite copy-on-write, and the number of backup sectors behind the ring
+#ifndef EXT_FLASH_JOURNAL_MAX_REWRITES
+#define EXT_FLASH_JOURNAL_MAX_REWRITES  2
+#endif
+
+// Size of the group header, of each entry of its table of rewritten sectors, of the commit record and of the header of each
+// write
+#define EXT_FLASH_JOURNAL_HEADER_SIZE   16
+#define EXT_FLASH_JOURNAL_REWRITE_SIZE  8
+#define EXT_FLASH_JOURNAL_COMMIT_SIZE   12
+#define EXT_FLASH_JOURNAL_WRITE_SIZE    6
+
+/**
+ * @brief emb_ext_flash_journal_cb_t - commit callback, called from emb_ext_flash_journal_sync() with 0 once the transaction is
+ * in flash and applied, -1 if it failed.
+ */
+typedef void (*emb_ext_flash_journal_cb_t)(void *ctx, int result);
+
+/**
+ * @brief emb_ext_flash_journal_lock_t - lock or unlock function guarding the pending transactions.
+ */
+typedef void (*emb_ext_flash_journal_lock_t)(void *ctx);
+
+/**
+ * @brief emb_ext_flash_journal_txn_t - a transaction. The writes are copied in, so the caller's buffers can be reused as soon
+ * as emb_ext_flash_journal_write() returns. Treat the contents as private.
+ */
+typedef struct
+{
+   // Commit callback and its context.
+   emb_ext_flash_journal_cb_t cb;
+   void                      *ctx;
+   // Bytes used in the staging buffer.
+   uint16_t used;
+   // Staged writes, each an address and length followed by the data.
+   uint8_t buf[EXT_FLASH_JOURNAL_TXN_SIZE];
+} emb_ext_flash_journal_txn_t;
+
+/**
+ * @brief emb_ext_flash_journal_t - journal state. Treat the contents as private apart from the statistics.
+ */
+typedef struct
+{
+   // Pointer to the interface handle.
+   emb_flash_intf_handle_t *p_intf;
+   // Start address of the ring and its number of sectors, the backup sectors follow it.
+   uint32_t start;
+   uint16_t sectors;
+   // Current sector and the offset in it of the next group, EXT_FLASH_SECTOR_SIZE once the sector is closed.
+   uint16_t cur;
+   uint32_t off;
+   // Sequence number of the next group.
+   uint32_t seq;
+   // Lock guarding the pending transactions, and its context.
+   emb_ext_flash_journal_lock_t lock;
+   emb_ext_flash_journal_lock_t unlock;
+   void                        *lock_ctx;
+   // Transactions waiting for the next sync, oldest first.
+   emb_ext_flash_journal_txn_t *pending[EXT_FLASH_JOURNAL_MAX_PENDING];
+   uint8_t                      num_pending;
+   // Transactions taken by the running sync, oldest first, and whether a sync is running.
+   emb_ext_flash_journal_txn_t *active[EXT_FLASH_JOURNAL_MAX_PENDING];
+   uint8_t                      num_active;
+   uint8_t                      syncing;
+   // Target sectors the group being written rewrites.
+   uint32_t rewrite[EXT_FLASH_JOURNAL_MAX_REWRITES];
+   uint8_t  num_rewrites;
+   // Page buffer a group is programmed through and target pages are built in, and which of its bytes a group writes.
+   uint8_t page[EXT_FLASH_PAGE_SIZE];
+   uint8_t mask[EXT_FLASH_PAGE_SIZE / 8];
+   // Statistics: transactions committed, groups written, page programs, sector erases, sectors rewritten copy-on-write, and
+   // groups replayed and rolled back by mount.
+   uint32_t stat_commits;
+   uint32_t stat_groups;
+   uint32_t stat_programs;
+   uint32_t stat_erases;
+   uint32_t stat_rewrites;
+   uint32_t stat_replays;
+   uint32_t stat_rollbacks;
+} emb_ext_flash_journal_t;
+
+/**
+ * @brief emb_ext_flash_journal_format erase the journal and mount it empty.
+ *
+ * @param p_jrnl - pointer to the journal.
+ * @param p_intf - pointer to the interface handle.
+ * @param start - sector aligned start address of the journal.
+ * @param len - length of the journal, a multiple of EXT_FLASH_SECTOR_SIZE. The ring takes all but the last
+ * EXT_FLASH_JOURNAL_MAX_REWRITES sectors and needs at least two.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_journal_format(emb_ext_flash_journal_t *p_jrnl, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_journal_mount mount a journal, replaying the newest group if it was committed but not applied, and
+ * rolling it back if it was not committed.
+ *
+ * @param p_jrnl - pointer to the journal.
+ * @param p_intf - pointer to the interface handle.
+ * @param start - start address of the journal.
+ * @param len - length of the journal.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_journal_mount(emb_ext_flash_journal_t *p_jrnl, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_journal_set_lock set the lock guarding the pending transactions, for commits from several tasks. Set
+ * it after mounting and before any task commits.
+ *
+ * @param p_jrnl - pointer to the journal.
+ * @param lock - lock function, NULL when only one task uses the journal.
+ * @param unlock - unlock function.
+ * @param ctx - context passed to both.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_journal_set_lock(emb_ext_flash_journal_t *p_jrnl, emb_ext_flash_journal_lock_t lock,
+                                   emb_ext_flash_journal_lock_t unlock, void *ctx);
+
+/**
+ * @brief emb_ext_flash_journal_begin start an empty transaction.
+ *
+ * @param p_txn - pointer to the transaction.
+ */
+void emb_ext_flash_journal_begin(emb_ext_flash_journal_txn_t *p_txn);
+
+/**
+ * @brief emb_ext_flash_journal_write stage a write in a transaction. Nothing is programmed until the transaction is committed
+ * and the journal synced.
+ *
+ * @param p_txn - pointer to the transaction.
+ * @param address - target address, outside the journal. What it holds is replaced, so it does not need to be erased.
+ * @param data - pointer to the data.
+ * @param len - the number of bytes.
+ * @return int - 0 on success, -1 if the write does not fit in the staging buffer.
+ */
+int emb_ext_flash_journal_write(emb_ext_flash_journal_txn_t *p_txn, uint32_t address, const uint8_t *data, uint16_t len);
+
+/**
+ * @brief emb_ext_flash_journal_commit queue a transaction for the next sync. The transaction must not be touched until its
+ * callback has been called.
+ *
+ * @param p_jrnl - pointer to the journal.
+ * @param p_txn - pointer to the transaction.
+ * @param cb - commit callback, may be NULL.
+ * @param ctx - context passed to the callback.
+ * @return int - 0 on success, -1 if too many transactions are pending.
+ */
+int emb_ext_flash_journal_commit(emb_ext_flash_journal_t *p_jrnl, emb_ext_flash_journal_txn_t *p_txn, emb_ext_flash_journal_cb_t cb,
+                                 void *ctx);
+
+/**
+ * @brief emb_ext_flash_journal_sync write the pending transactions to the journal and apply them. As many transactions go in
+ * a group as fit in a sector and rewrite no more than EXT_FLASH_JOURNAL_MAX_REWRITES sectors, and each group is atomic as a
+ * whole. Transactions committed while the sync runs go out with it too. A transaction that cannot fit in a group on its own,
+ * or that writes to the journal, fails.
+ *
+ * @param p_jrnl - pointer to the journal.
+ * @return int - the number of transactions this call committed, 0 if another sync is running, -1 on failure.
+ */
+int emb_ext_flash_journal_sync(emb_ext_flash_journal_t *p_jrnl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_JOURNAL_H_ */
@@ -0,0 +1,62 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_LE_H_
+#define EMB_EXT_FLASH_LE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Little endian loads and stores of the fields the on-flash formats are made of, independent of the host's byte order and
+ * alignment.
+ */
+
+static inline void emb_ext_flash_put_u16(uint8_t *p, uint16_t v)
+{
+   p[0] = v & 0xFF;
+   p[1] = (v >> 8) & 0xFF;
+}
+
+static inline uint16_t emb_ext_flash_get_u16(const uint8_t *p)
+{
+   return((uint16_t)(p[0] | (p[1] << 8)));
+}
+
+static inline void emb_ext_flash_put_u32(uint8_t *p, uint32_t v)
+{
+   p[0] = v & 0xFF;
+   p[1] = (v >> 8) & 0xFF;
+   p[2] = (v >> 16) & 0xFF;
+   p[3] = (v >> 24) & 0xFF;
+}
+
+static inline uint32_t emb_ext_flash_get_u32(const uint8_t *p)
+{
+   return(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_LE_H_ */
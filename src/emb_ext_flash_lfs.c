@@ -0,0 +1,311 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_lfs.h"
+
+// Private functions
+static int lfs_check(emb_ext_flash_lfs_t *p_lfs, uint32_t block, uint32_t off, uint32_t size)
+{
+   if (!p_lfs || !p_lfs->p_intf || block >= p_lfs->block_count || off > p_lfs->block_size || size > p_lfs->block_size - off)
+   {
+      return(EXT_FLASH_LFS_ERR_INVAL);
+   }
+
+   return(0);
+}
+
+// Program whatever is staged in the page buffer
+static int lfs_flush(emb_ext_flash_lfs_t *p_lfs)
+{
+   uint16_t len = p_lfs->staged_len;
+
+   if (!len)
+   {
+      return(0);
+   }
+
+   p_lfs->staged_len = 0;
+   p_lfs->stat_programs++;
+   if (emb_ext_flash_write(p_lfs->p_intf, p_lfs->staged_addr, p_lfs->page, len) != len)
+   {
+      return(EXT_FLASH_LFS_ERR_IO);
+   }
+
+   return(0);
+}
+
+// EXT_FLASH_CHIP_ERASE_* bit for a block size, 0 when no erase command matches it
+static uint8_t lfs_erase_bit(uint32_t block_size)
+{
+   switch (block_size)
+   {
+   case EXT_FLASH_SECTOR_SIZE:
+      return(EXT_FLASH_CHIP_ERASE_4K);
+   case EXT_FLASH_BLOCK_32K_SIZE:
+      return(EXT_FLASH_CHIP_ERASE_32K);
+   case EXT_FLASH_BLOCK_64K_SIZE:
+      return(EXT_FLASH_CHIP_ERASE_64K);
+   default:
+      return(0);
+   }
+}
+
+// Pubic functions
+int emb_ext_flash_lfs_init(emb_ext_flash_lfs_t *p_lfs, emb_flash_intf_handle_t *p_intf, uint32_t base, uint32_t size,
+                           uint32_t block_size)
+{
+   // Null check
+   if (!p_lfs || !p_intf || !p_intf->initialized)
+   {
+      return(EXT_FLASH_LFS_ERR_INVAL);
+   }
+
+   // Blocks have to match an erase command the chip has, by default the smallest one from EXT_FLASH_LFS_BLOCK_SIZE up
+   uint8_t sizes = p_intf->p_chip && p_intf->p_chip->erase_sizes ? p_intf->p_chip->erase_sizes : EXT_FLASH_CHIP_ERASE_ALL;
+   if (!block_size)
+   {
+      block_size = EXT_FLASH_LFS_BLOCK_SIZE;
+      while (block_size < EXT_FLASH_BLOCK_64K_SIZE && !(sizes & lfs_erase_bit(block_size)))
+      {
+         block_size = block_size == EXT_FLASH_SECTOR_SIZE ? EXT_FLASH_BLOCK_32K_SIZE : EXT_FLASH_BLOCK_64K_SIZE;
+      }
+   }
+   if (!(sizes & lfs_erase_bit(block_size)) || (base & (block_size - 1)))
+   {
+      return(EXT_FLASH_LFS_ERR_INVAL);
+   }
+
+   // Take the rest of a known chip
+   if (!size)
+   {
+      if (!p_intf->p_chip || p_intf->p_chip->capacity_log2 >= 32 || base >= (1UL << p_intf->p_chip->capacity_log2))
+      {
+         return(EXT_FLASH_LFS_ERR_INVAL);
+      }
+      size = (1UL << p_intf->p_chip->capacity_log2) - base;
+   }
+
+   // littlefs needs at least a metadata pair
+   if (size / block_size < 2)
+   {
+      return(EXT_FLASH_LFS_ERR_INVAL);
+   }
+
+   memset(p_lfs, 0, sizeof(*p_lfs));
+   p_lfs->p_intf         = p_intf;
+   p_lfs->base           = base;
+   p_lfs->read_size      = EXT_FLASH_LFS_PROG_SIZE;
+   p_lfs->prog_size      = EXT_FLASH_LFS_PROG_SIZE;
+   p_lfs->cache_size     = EXT_FLASH_PAGE_SIZE;
+   p_lfs->lookahead_size = EXT_FLASH_LFS_LOOKAHEAD_SIZE;
+   p_lfs->block_size     = block_size;
+   p_lfs->block_count    = size / block_size;
+
+#if EXT_FLASH_LFS_READ_AHEAD
+   // Stream cache fills through one held read command
+   if (emb_ext_flash_set_read_ahead(p_intf, p_lfs->ra_buf, sizeof(p_lfs->ra_buf), 1) != 0)
+   {
+      return(EXT_FLASH_LFS_ERR_INVAL);
+   }
+#endif
+
+   return(0);
+}
+
+int emb_ext_flash_lfs_read(emb_ext_flash_lfs_t *p_lfs, uint32_t block, uint32_t off, uint8_t *buf, uint32_t size)
+{
+   int rtn = lfs_check(p_lfs, block, off, size);
+
+   // Null check
+   if (rtn < 0 || !buf)
+   {
+      return(EXT_FLASH_LFS_ERR_INVAL);
+   }
+
+   // Staged data has to be on the chip before it can be read back
+   rtn = lfs_flush(p_lfs);
+   if (rtn < 0)
+   {
+      return(rtn);
+   }
+
+   p_lfs->stat_reads++;
+   uint32_t addr = p_lfs->base + block * p_lfs->block_size + off;
+   while (size)
+   {
+      uint16_t n = size > 0x8000 ? 0x8000 : (uint16_t)size;
+      if (emb_ext_flash_read(p_lfs->p_intf, addr, buf, n) != n)
+      {
+         return(EXT_FLASH_LFS_ERR_IO);
+      }
+      addr += n;
+      buf  += n;
+      size -= n;
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_lfs_prog(emb_ext_flash_lfs_t *p_lfs, uint32_t block, uint32_t off, const uint8_t *buf, uint32_t size)
+{
+   int rtn = lfs_check(p_lfs, block, off, size);
+
+   // Null check
+   if (rtn < 0 || !buf)
+   {
+      return(EXT_FLASH_LFS_ERR_INVAL);
+   }
+
+   p_lfs->stat_progs++;
+   uint32_t addr = p_lfs->base + block * p_lfs->block_size + off;
+   while (size)
+   {
+      // Join the staged data only when this runs on from it
+      if (p_lfs->staged_len && addr != p_lfs->staged_addr + p_lfs->staged_len)
+      {
+         rtn = lfs_flush(p_lfs);
+         if (rtn < 0)
+         {
+            return(rtn);
+         }
+      }
+      if (!p_lfs->staged_len)
+      {
+         p_lfs->staged_addr = addr;
+      }
+
+      // Stage up to the end of the page, and program the page once it is complete
+      uint16_t n = (uint16_t)(EXT_FLASH_PAGE_SIZE - (addr & (EXT_FLASH_PAGE_SIZE - 1)));
+      if (n > size)
+      {
+         n = (uint16_t)size;
+      }
+      memcpy(&p_lfs->page[p_lfs->staged_len], buf, n);
+      p_lfs->staged_len += n;
+      addr += n;
+      buf  += n;
+      size -= n;
+      if (!(addr & (EXT_FLASH_PAGE_SIZE - 1)))
+      {
+         rtn = lfs_flush(p_lfs);
+         if (rtn < 0)
+         {
+            return(rtn);
+         }
+      }
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_lfs_erase(emb_ext_flash_lfs_t *p_lfs, uint32_t block)
+{
+   int rtn = lfs_check(p_lfs, block, 0, 0);
+
+   // Null check
+   if (rtn < 0)
+   {
+      return(rtn);
+   }
+
+   rtn = lfs_flush(p_lfs);
+   if (rtn < 0)
+   {
+      return(rtn);
+   }
+
+   // 32K and 64K blocks take one block erase, the driver falls back to sectors when the chip lacks it
+   p_lfs->stat_erases++;
+   uint32_t addr = p_lfs->base + block * p_lfs->block_size;
+   if (emb_ext_flash_erase(p_lfs->p_intf, addr, p_lfs->block_size) != 0)
+   {
+      return(EXT_FLASH_LFS_ERR_IO);
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_lfs_sync(emb_ext_flash_lfs_t *p_lfs)
+{
+   // Null check
+   if (!p_lfs || !p_lfs->p_intf)
+   {
+      return(EXT_FLASH_LFS_ERR_INVAL);
+   }
+
+   p_lfs->stat_syncs++;
+   int rtn = lfs_flush(p_lfs);
+
+   // Let other users of the bus in
+   emb_ext_flash_release(p_lfs->p_intf);
+
+   return(rtn);
+}
+
+#ifdef EXT_FLASH_LFS
+// littlefs callbacks
+static int lfs_cb_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
+{
+   return(emb_ext_flash_lfs_read((emb_ext_flash_lfs_t *)c->context, block, off, (uint8_t *)buffer, size));
+}
+
+static int lfs_cb_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
+{
+   return(emb_ext_flash_lfs_prog((emb_ext_flash_lfs_t *)c->context, block, off, (const uint8_t *)buffer, size));
+}
+
+static int lfs_cb_erase(const struct lfs_config *c, lfs_block_t block)
+{
+   return(emb_ext_flash_lfs_erase((emb_ext_flash_lfs_t *)c->context, block));
+}
+
+static int lfs_cb_sync(const struct lfs_config *c)
+{
+   return(emb_ext_flash_lfs_sync((emb_ext_flash_lfs_t *)c->context));
+}
+
+int emb_ext_flash_lfs_config(emb_ext_flash_lfs_t *p_lfs, struct lfs_config *p_cfg)
+{
+   // Null check
+   if (!p_lfs || !p_lfs->p_intf || !p_cfg)
+   {
+      return(EXT_FLASH_LFS_ERR_INVAL);
+   }
+
+   memset(p_cfg, 0, sizeof(*p_cfg));
+   p_cfg->context          = p_lfs;
+   p_cfg->read             = lfs_cb_read;
+   p_cfg->prog             = lfs_cb_prog;
+   p_cfg->erase            = lfs_cb_erase;
+   p_cfg->sync             = lfs_cb_sync;
+   p_cfg->read_size        = p_lfs->read_size;
+   p_cfg->prog_size        = p_lfs->prog_size;
+   p_cfg->block_size       = p_lfs->block_size;
+   p_cfg->block_count      = p_lfs->block_count;
+   p_cfg->block_cycles     = EXT_FLASH_LFS_BLOCK_CYCLES;
+   p_cfg->cache_size       = p_lfs->cache_size;
+   p_cfg->lookahead_size   = p_lfs->lookahead_size;
+   p_cfg->read_buffer      = p_lfs->read_buf;
+   p_cfg->prog_buffer      = p_lfs->prog_buf;
+   p_cfg->lookahead_buffer = p_lfs->lookahead_buf;
+
+   return(0);
+}
+#endif
@@ -0,0 +1,189 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_LFS_H_
+#define EMB_EXT_FLASH_LFS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+#ifdef EXT_FLASH_LFS
+#include "lfs.h"
+#endif
+
+/*
+ * Block device adapter for littlefs.
+ *
+ * emb_ext_flash_lfs_init() works out the littlefs geometry from the handle. Blocks are 4K sectors by default, or 32K or 64K
+ * blocks, and each block is erased with the one command that covers it. Reads and programs use the chip's page as the cache
+ * size, so a cache fill or flush is a single read or program command. Programs are staged in a page buffer and joined while
+ * they run on from each other, so a cache flush that straddles a page boundary still costs one program per page. The staged
+ * page is programmed when it fills, before any read or erase, and on sync. The adapter also gives the handle a read-ahead
+ * buffer with the read command held open, so littlefs streaming through a file continues one read command instead of
+ * starting a new one per cache fill. The sync callback programs the staged page and releases the held read.
+ *
+ * The read, prog, erase and sync functions take block numbers and offsets like the littlefs callbacks and return 0 or a
+ * negative littlefs error code. Define EXT_FLASH_LFS with lfs.h on the include path to also build
+ * emb_ext_flash_lfs_config(), which fills a struct lfs_config with the callbacks, the geometry and static buffers.
+ */
+
+// Default block size, 4K, 32K or 64K. Small blocks suit littlefs best: every directory keeps a metadata pair of two
+// blocks and each file takes at least one, so 64K blocks fill a small part after a handful of files. A chip that lacks
+// this erase size gets the next larger one it has.
+#ifndef EXT_FLASH_LFS_BLOCK_SIZE
+#define EXT_FLASH_LFS_BLOCK_SIZE     EXT_FLASH_SECTOR_SIZE
+#endif
+
+// Read and program granularity reported to littlefs, small so metadata commits stay compact
+#ifndef EXT_FLASH_LFS_PROG_SIZE
+#define EXT_FLASH_LFS_PROG_SIZE      16
+#endif
+
+// Size of the read-ahead buffer given to the handle, 0 to leave read-ahead alone
+#ifndef EXT_FLASH_LFS_READ_AHEAD
+#define EXT_FLASH_LFS_READ_AHEAD     512
+#endif
+
+// Erase cycles before littlefs moves metadata to another block, -1 to disable wear leveling
+#ifndef EXT_FLASH_LFS_BLOCK_CYCLES
+#define EXT_FLASH_LFS_BLOCK_CYCLES   500
+#endif
+
+// Size of the lookahead bitmap buffer, enough for 512 blocks
+#ifndef EXT_FLASH_LFS_LOOKAHEAD_SIZE
+#define EXT_FLASH_LFS_LOOKAHEAD_SIZE 64
+#endif
+
+// Error codes, the same values as LFS_ERR_IO and LFS_ERR_INVAL
+#define EXT_FLASH_LFS_ERR_IO         -5
+#define EXT_FLASH_LFS_ERR_INVAL      -22
+
+/**
+ * @brief emb_ext_flash_lfs_t - adapter state. Treat the contents as private apart from the geometry and the statistics.
+ */
+typedef struct
+{
+   // Pointer to the interface handle.
+   emb_flash_intf_handle_t *p_intf;
+   // Address of the first block.
+   uint32_t base;
+   // Geometry reported to littlefs.
+   uint32_t read_size;
+   uint32_t prog_size;
+   uint32_t cache_size;
+   uint32_t lookahead_size;
+   uint32_t block_size;
+   uint32_t block_count;
+   // Address and length of the programs staged in the page buffer, len is 0 when nothing is staged.
+   uint32_t staged_addr;
+   uint16_t staged_len;
+   uint8_t page[EXT_FLASH_PAGE_SIZE];
+#if EXT_FLASH_LFS_READ_AHEAD
+   // Read-ahead buffer given to the handle.
+   uint8_t ra_buf[EXT_FLASH_LFS_READ_AHEAD];
+#endif
+   // Cache and lookahead buffers for emb_ext_flash_lfs_config().
+   uint8_t read_buf[EXT_FLASH_PAGE_SIZE];
+   uint8_t prog_buf[EXT_FLASH_PAGE_SIZE];
+   uint8_t lookahead_buf[EXT_FLASH_LFS_LOOKAHEAD_SIZE];
+   // Statistics: read, prog, erase and sync calls, and the page programs issued for the progs.
+   uint32_t stat_reads;
+   uint32_t stat_progs;
+   uint32_t stat_erases;
+   uint32_t stat_syncs;
+   uint32_t stat_programs;
+} emb_ext_flash_lfs_t;
+
+/**
+ * @brief emb_ext_flash_lfs_init set up the adapter on a region of the chip and work out the littlefs geometry.
+ *
+ * @param p_lfs - pointer to the adapter.
+ * @param p_intf - pointer to the interface handle, initialized.
+ * @param base - start address of the region, aligned to the block size.
+ * @param size - length of the region in bytes, 0 for the rest of a known chip.
+ * @param block_size - 4K, 32K or 64K and supported by the chip when it is known, 0 for EXT_FLASH_LFS_BLOCK_SIZE or the
+ * next larger size the chip can erase.
+ * @return int - 0 on success, EXT_FLASH_LFS_ERR_INVAL on bad arguments.
+ */
+int emb_ext_flash_lfs_init(emb_ext_flash_lfs_t *p_lfs, emb_flash_intf_handle_t *p_intf, uint32_t base, uint32_t size,
+                           uint32_t block_size);
+
+/**
+ * @brief emb_ext_flash_lfs_read read from a block, after programming any staged page.
+ *
+ * @param p_lfs - pointer to the adapter.
+ * @param block - block number.
+ * @param off - offset in the block.
+ * @param buf - pointer to receive the data.
+ * @param size - number of bytes.
+ * @return int - 0 on success, a negative littlefs error code on failure.
+ */
+int emb_ext_flash_lfs_read(emb_ext_flash_lfs_t *p_lfs, uint32_t block, uint32_t off, uint8_t *buf, uint32_t size);
+
+/**
+ * @brief emb_ext_flash_lfs_prog program erased flash in a block. Data is staged per page and may only reach the chip on a later
+ * call.
+ *
+ * @param p_lfs - pointer to the adapter.
+ * @param block - block number.
+ * @param off - offset in the block.
+ * @param buf - pointer to the data.
+ * @param size - number of bytes.
+ * @return int - 0 on success, a negative littlefs error code on failure.
+ */
+int emb_ext_flash_lfs_prog(emb_ext_flash_lfs_t *p_lfs, uint32_t block, uint32_t off, const uint8_t *buf, uint32_t size);
+
+/**
+ * @brief emb_ext_flash_lfs_erase erase a block.
+ *
+ * @param p_lfs - pointer to the adapter.
+ * @param block - block number.
+ * @return int - 0 on success, a negative littlefs error code on failure.
+ */
+int emb_ext_flash_lfs_erase(emb_ext_flash_lfs_t *p_lfs, uint32_t block);
+
+/**
+ * @brief emb_ext_flash_lfs_sync program the staged page and release a held read.
+ *
+ * @param p_lfs - pointer to the adapter.
+ * @return int - 0 on success, a negative littlefs error code on failure.
+ */
+int emb_ext_flash_lfs_sync(emb_ext_flash_lfs_t *p_lfs);
+
+#ifdef EXT_FLASH_LFS
+/**
+ * @brief emb_ext_flash_lfs_config fill a littlefs configuration for an adapter set up with emb_ext_flash_lfs_init(). The
+ * configuration refers to the adapter, so both have to stay in scope while the file system is mounted. Builds with
+ * LFS_THREADSAFE have to set lock and unlock afterwards.
+ *
+ * @param p_lfs - pointer to the adapter.
+ * @param p_cfg - pointer to the configuration to fill, every other field is zeroed.
+ * @return int - 0 on success, EXT_FLASH_LFS_ERR_INVAL on bad arguments.
+ */
+int emb_ext_flash_lfs_config(emb_ext_flash_lfs_t *p_lfs, struct lfs_config *p_cfg);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_LFS_H_ */
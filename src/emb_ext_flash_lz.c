@@ -0,0 +1,478 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_le.h"
+#include "emb_ext_flash_lz.h"
+
+// Marker for an empty hash table slot and an uncached frame
+#define EXT_FLASH_LZ_HASH_EMPTY    0xFFFF
+#define EXT_FLASH_LZ_NO_FRAME      0xFFFFFFFF
+
+// Raw bytes a frame is sure to take whatever the data. The compressor stops with at most one payload byte to spare and no
+// raw byte costs more than two payload bytes.
+#define EXT_FLASH_LZ_FRAME_RAW_MIN ((EXT_FLASH_LZ_FRAME_PAYLOAD_SIZE - 1) / 2)
+
+// Private functions
+static uint16_t emb_ext_flash_lz_hash(const uint8_t *p)
+{
+   uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+
+   return((v * 2654435761u) >> (32 - EXT_FLASH_LZ_HASH_BITS));
+}
+
+// Read a frame header, returns 0 if the frame holds data and -1 if it is erased, invalid or the read failed
+static int emb_ext_flash_lz_header(emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t frame, uint32_t *raw_offset, uint16_t *raw_len)
+{
+   uint8_t hdr[EXT_FLASH_LZ_FRAME_HEADER_SIZE];
+
+   if (emb_ext_flash_read(p_intf, start + frame * EXT_FLASH_PAGE_SIZE, hdr, sizeof(hdr)) != sizeof(hdr))
+   {
+      return(-1);
+   }
+
+   *raw_offset = emb_ext_flash_get_u32(hdr);
+   *raw_len    = emb_ext_flash_get_u16(&hdr[4]);
+
+   return((!*raw_len || *raw_len > EXT_FLASH_LZ_FRAME_RAW_MAX) ? -1 : 0);
+}
+
+// Compress the front of the raw buffer into one frame and program it
+static int emb_ext_flash_lz_emit(emb_ext_flash_lz_t *p_lz)
+{
+   uint32_t addr = p_lz->start + p_lz->frames * EXT_FLASH_PAGE_SIZE;
+
+   // Region full
+   if (addr >= p_lz->start + p_lz->len)
+   {
+      return(-1);
+   }
+
+   uint16_t consumed = 0;
+   int      clen     = emb_ext_flash_lz_compress(p_lz->hash, p_lz->raw, p_lz->fill, &p_lz->page[EXT_FLASH_LZ_FRAME_HEADER_SIZE],
+                                                 EXT_FLASH_LZ_FRAME_PAYLOAD_SIZE, &consumed);
+
+   emb_ext_flash_put_u32(p_lz->page, p_lz->raw_offset);
+   emb_ext_flash_put_u16(&p_lz->page[4], consumed);
+   emb_ext_flash_put_u16(&p_lz->page[6], (uint16_t)clen);
+
+   // Erase each sector as the stream enters it
+   if (!(addr % EXT_FLASH_SECTOR_SIZE))
+   {
+      if (emb_ext_flash_erase(p_lz->p_intf, addr, EXT_FLASH_SECTOR_SIZE) != 0)
+      {
+         return(-1);
+      }
+      p_lz->stat_erases++;
+   }
+
+   uint16_t w_len = EXT_FLASH_LZ_FRAME_HEADER_SIZE + clen;
+   if (emb_ext_flash_write(p_lz->p_intf, addr, p_lz->page, w_len) != w_len)
+   {
+      return(-1);
+   }
+
+   // Shift whatever did not fit down to the front of the raw buffer
+   p_lz->frames++;
+   p_lz->raw_offset       += consumed;
+   p_lz->fill             -= consumed;
+   p_lz->stat_flash_bytes += EXT_FLASH_PAGE_SIZE;
+   memmove(p_lz->raw, &p_lz->raw[consumed], p_lz->fill);
+
+   return(0);
+}
+
+// Raw bytes the frames left in the region are sure to hold, including what is already buffered
+static uint32_t emb_ext_flash_lz_room(emb_ext_flash_lz_t *p_lz)
+{
+   return((p_lz->len / EXT_FLASH_PAGE_SIZE - p_lz->frames) * EXT_FLASH_LZ_FRAME_RAW_MIN);
+}
+
+// Public functions
+int emb_ext_flash_lz_compress(uint16_t *hash, const uint8_t *src, uint16_t src_len, uint8_t *dst, uint16_t dst_cap, uint16_t *consumed)
+{
+   uint16_t ip      = 0;
+   uint16_t op      = 0;
+   uint16_t lit_pos = 0;
+   uint16_t lit_len = 0;
+
+   // Null check
+   if (!hash || !src || !dst || !consumed)
+   {
+      return(0);
+   }
+
+   memset(hash, 0xFF, EXT_FLASH_LZ_HASH_SIZE * sizeof(uint16_t));
+
+   while (ip < src_len)
+   {
+      // Look for a match at the current position
+      uint16_t m_len = 0;
+      uint16_t m_off = 0;
+      if (ip + EXT_FLASH_LZ_MIN_MATCH <= src_len)
+      {
+         uint16_t h    = emb_ext_flash_lz_hash(&src[ip]);
+         uint16_t cand = hash[h];
+         hash[h] = ip;
+
+         if (cand != EXT_FLASH_LZ_HASH_EMPTY && ip - cand <= EXT_FLASH_LZ_WINDOW)
+         {
+            while (m_len < EXT_FLASH_LZ_MAX_MATCH && ip + m_len < src_len && src[cand + m_len] == src[ip + m_len])
+            {
+               m_len++;
+            }
+            m_off = ip - cand;
+         }
+      }
+
+      if (m_len >= EXT_FLASH_LZ_MIN_MATCH)
+      {
+         // Emit a match token
+         if (op + 2 > dst_cap)
+         {
+            break;
+         }
+         dst[op++] = 0x80 | ((m_len - EXT_FLASH_LZ_MIN_MATCH) << 2) | ((m_off - 1) >> 8);
+         dst[op++] = (m_off - 1) & 0xFF;
+         lit_len   = 0;
+
+         // Index the positions covered by the match so later data can refer back to them
+         for (uint16_t i = 1; i < m_len && ip + i + EXT_FLASH_LZ_MIN_MATCH <= src_len; i++)
+         {
+            hash[emb_ext_flash_lz_hash(&src[ip + i])] = ip + i;
+         }
+         ip += m_len;
+      }
+      else
+      {
+         // Extend the current literal run or start a new one
+         uint16_t need = (!lit_len || lit_len == EXT_FLASH_LZ_MAX_LITERAL) ? 2 : 1;
+         if (op + need > dst_cap)
+         {
+            break;
+         }
+         if (need == 2)
+         {
+            lit_pos = op++;
+            lit_len = 0;
+         }
+         dst[op++]    = src[ip++];
+         dst[lit_pos] = lit_len++;
+      }
+   }
+
+   *consumed = ip;
+
+   return(op);
+}
+
+int emb_ext_flash_lz_decompress(const uint8_t *src, uint16_t src_len, uint8_t *dst, uint16_t dst_cap)
+{
+   uint16_t ip = 0;
+   uint16_t op = 0;
+
+   // Null check
+   if (!src || !dst)
+   {
+      return(-1);
+   }
+
+   while (ip < src_len)
+   {
+      uint8_t token = src[ip++];
+      if (!(token & 0x80))
+      {
+         // Literal run
+         uint16_t len = (token & 0x7F) + 1;
+         if (ip + len > src_len || op + len > dst_cap)
+         {
+            return(-1);
+         }
+         memcpy(&dst[op], &src[ip], len);
+         ip += len;
+         op += len;
+      }
+      else
+      {
+         // Match, copied a byte at a time since it may overlap itself
+         if (ip >= src_len)
+         {
+            return(-1);
+         }
+         uint16_t len = ((token >> 2) & 0x1F) + EXT_FLASH_LZ_MIN_MATCH;
+         uint16_t off = (((token & 0x03) << 8) | src[ip++]) + 1;
+         if (off > op || op + len > dst_cap)
+         {
+            return(-1);
+         }
+         for (uint16_t i = 0; i < len; i++, op++)
+         {
+            dst[op] = dst[op - off];
+         }
+      }
+   }
+
+   return(op);
+}
+
+int emb_ext_flash_lz_open(emb_ext_flash_lz_t *p_lz, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len)
+{
+   // Null check
+   if (!p_lz || !p_intf || !p_intf->initialized)
+   {
+      return(-1);
+   }
+
+   if ((start % EXT_FLASH_SECTOR_SIZE) || (len % EXT_FLASH_SECTOR_SIZE) || !len)
+   {
+      return(-1);
+   }
+
+   memset(p_lz, 0, sizeof(*p_lz));
+   p_lz->p_intf = p_intf;
+   p_lz->start  = start;
+   p_lz->len    = len;
+
+   // Frames are written in order, binary search for the first empty one
+   uint32_t lo = 0;
+   uint32_t hi = len / EXT_FLASH_PAGE_SIZE;
+   uint32_t raw_offset;
+   uint16_t raw_len;
+   while (lo < hi)
+   {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (emb_ext_flash_lz_header(p_intf, start, mid, &raw_offset, &raw_len) == 0)
+      {
+         lo = mid + 1;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+   p_lz->frames = lo;
+
+   // Continue the raw offsets from the last frame
+   if (p_lz->frames && emb_ext_flash_lz_header(p_intf, start, p_lz->frames - 1, &raw_offset, &raw_len) == 0)
+   {
+      p_lz->raw_offset = raw_offset + raw_len;
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_lz_write(emb_ext_flash_lz_t *p_lz, const uint8_t *data, uint32_t len)
+{
+   uint32_t accepted = 0;
+
+   // Null check
+   if (!p_lz || !p_lz->p_intf || !data)
+   {
+      return(0);
+   }
+
+   while (accepted < len)
+   {
+      // Compress and program a frame once the raw buffer is full
+      if (p_lz->fill == EXT_FLASH_LZ_FRAME_RAW_MAX)
+      {
+         if (emb_ext_flash_lz_emit(p_lz) != 0)
+         {
+            break;
+         }
+      }
+
+      // Only take bytes the region is sure to have room for, so a full region gives a short count instead of losing data.
+      // Near the end of the region the buffer goes out as a frame before it is full.
+      uint32_t room = emb_ext_flash_lz_room(p_lz);
+      if (room <= p_lz->fill)
+      {
+         if (!p_lz->fill || emb_ext_flash_lz_emit(p_lz) != 0)
+         {
+            break;
+         }
+         continue;
+      }
+      uint32_t chunk = EXT_FLASH_LZ_FRAME_RAW_MAX - p_lz->fill;
+      if (chunk > room - p_lz->fill)
+      {
+         chunk = room - p_lz->fill;
+      }
+      if (chunk > len - accepted)
+      {
+         chunk = len - accepted;
+      }
+      memcpy(&p_lz->raw[p_lz->fill], &data[accepted], chunk);
+      p_lz->fill           += chunk;
+      p_lz->stat_raw_bytes += chunk;
+      accepted             += chunk;
+   }
+
+   return(accepted);
+}
+
+int emb_ext_flash_lz_flush(emb_ext_flash_lz_t *p_lz)
+{
+   // Null check
+   if (!p_lz || !p_lz->p_intf)
+   {
+      return(-1);
+   }
+
+   while (p_lz->fill)
+   {
+      if (emb_ext_flash_lz_emit(p_lz) != 0)
+      {
+         return(-1);
+      }
+   }
+
+   return(0);
+}
+
+uint32_t emb_ext_flash_lz_size(emb_ext_flash_lz_t *p_lz)
+{
+   return(p_lz ? p_lz->raw_offset : 0);
+}
+
+int emb_ext_flash_lz_reader_open(emb_ext_flash_lz_reader_t *p_rd, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len)
+{
+   // Null check
+   if (!p_rd || !p_intf || !p_intf->initialized || (len % EXT_FLASH_PAGE_SIZE))
+   {
+      return(-1);
+   }
+
+   p_rd->p_intf     = p_intf;
+   p_rd->start      = start;
+   p_rd->len        = len;
+   p_rd->frame      = EXT_FLASH_LZ_NO_FRAME;
+   p_rd->raw_offset = 0;
+   p_rd->raw_len    = 0;
+
+   return(0);
+}
+
+int emb_ext_flash_lz_read_frame(emb_ext_flash_lz_reader_t *p_rd, uint32_t frame, uint32_t *raw_offset)
+{
+   // Null check
+   if (!p_rd || !p_rd->p_intf || frame >= p_rd->len / EXT_FLASH_PAGE_SIZE)
+   {
+      return(-1);
+   }
+
+   if (p_rd->frame != frame)
+   {
+      // Pull the whole frame in with a single read
+      p_rd->frame = EXT_FLASH_LZ_NO_FRAME;
+      if (emb_ext_flash_read(p_rd->p_intf, p_rd->start + frame * EXT_FLASH_PAGE_SIZE, p_rd->page, EXT_FLASH_PAGE_SIZE) != EXT_FLASH_PAGE_SIZE)
+      {
+         return(-1);
+      }
+
+      uint32_t offset = emb_ext_flash_get_u32(p_rd->page);
+      uint16_t r_len  = emb_ext_flash_get_u16(&p_rd->page[4]);
+      uint16_t c_len  = emb_ext_flash_get_u16(&p_rd->page[6]);
+      if (!r_len || r_len > EXT_FLASH_LZ_FRAME_RAW_MAX || c_len > EXT_FLASH_LZ_FRAME_PAYLOAD_SIZE)
+      {
+         return(-1);
+      }
+      if (emb_ext_flash_lz_decompress(&p_rd->page[EXT_FLASH_LZ_FRAME_HEADER_SIZE], c_len, p_rd->raw, EXT_FLASH_LZ_FRAME_RAW_MAX) != r_len)
+      {
+         return(-1);
+      }
+
+      p_rd->frame      = frame;
+      p_rd->raw_offset = offset;
+      p_rd->raw_len    = r_len;
+   }
+
+   if (raw_offset)
+   {
+      *raw_offset = p_rd->raw_offset;
+   }
+
+   return(p_rd->raw_len);
+}
+
+int emb_ext_flash_lz_read(emb_ext_flash_lz_reader_t *p_rd, uint32_t offset, uint8_t *data, uint32_t len)
+{
+   uint32_t done = 0;
+
+   // Null check
+   if (!p_rd || !p_rd->p_intf || !data)
+   {
+      return(0);
+   }
+
+   while (done < len)
+   {
+      uint32_t frame = p_rd->frame;
+
+      if (frame != EXT_FLASH_LZ_NO_FRAME && offset == p_rd->raw_offset + p_rd->raw_len)
+      {
+         // Sequential access, move on to the next frame
+         frame++;
+      }
+      else if (frame == EXT_FLASH_LZ_NO_FRAME || offset < p_rd->raw_offset || offset >= p_rd->raw_offset + p_rd->raw_len)
+      {
+         // Binary search for the last frame starting at or before the offset
+         uint32_t lo = 0;
+         uint32_t hi = p_rd->len / EXT_FLASH_PAGE_SIZE;
+         uint32_t f_offset;
+         uint16_t f_len;
+         while (lo < hi)
+         {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (emb_ext_flash_lz_header(p_rd->p_intf, p_rd->start, mid, &f_offset, &f_len) == 0 && f_offset <= offset)
+            {
+               lo = mid + 1;
+            }
+            else
+            {
+               hi = mid;
+            }
+         }
+         if (!lo)
+         {
+            break;
+         }
+         frame = lo - 1;
+      }
+
+      if (emb_ext_flash_lz_read_frame(p_rd, frame, NULL) < 0 || offset < p_rd->raw_offset ||
+          offset >= p_rd->raw_offset + p_rd->raw_len)
+      {
+         break;
+      }
+
+      // Copy out of the decoded frame
+      uint32_t pos   = offset - p_rd->raw_offset;
+      uint32_t chunk = p_rd->raw_len - pos;
+      if (chunk > len - done)
+      {
+         chunk = len - done;
+      }
+      memcpy(&data[done], &p_rd->raw[pos], chunk);
+      done   += chunk;
+      offset += chunk;
+   }
+
+   return(done);
+}
@@ -0,0 +1,210 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_LZ_H_
+#define EMB_EXT_FLASH_LZ_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Compressed stream layout. The region is a run of frames, one frame per page, so frame N lives at region start + N pages
+ * and can be located without any index. Each frame starts with a header, all fields little endian:
+ *
+ *   u32 raw offset of the first byte in the frame, u16 raw length, u16 compressed length, compressed payload
+ *
+ * A raw length of 0xFFFF marks an erased (unused) frame. The region must be erased, or hold a stream written by this module,
+ * before it is opened. Frames are compressed independently so any one can be decoded on
+ * its own. The payload is a sequence of tokens:
+ *
+ *   0LLLLLLL                   - literal run of L + 1 bytes follows
+ *   1LLLLLOO OOOOOOOO          - match of L + 3 bytes copied from O + 1 bytes back in the frame
+ */
+#define EXT_FLASH_LZ_FRAME_HEADER_SIZE    8
+#define EXT_FLASH_LZ_FRAME_PAYLOAD_SIZE   (EXT_FLASH_PAGE_SIZE - EXT_FLASH_LZ_FRAME_HEADER_SIZE)
+#define EXT_FLASH_LZ_MIN_MATCH            3
+#define EXT_FLASH_LZ_MAX_MATCH            34
+#define EXT_FLASH_LZ_MAX_LITERAL          128
+#define EXT_FLASH_LZ_WINDOW               1024
+
+// Maximum number of raw bytes gathered into one frame, this bounds the best case compression ratio
+#ifndef EXT_FLASH_LZ_FRAME_RAW_MAX
+#define EXT_FLASH_LZ_FRAME_RAW_MAX        2048
+#endif
+
+// Number of match finder hash table entries, as a power of two
+#ifndef EXT_FLASH_LZ_HASH_BITS
+#define EXT_FLASH_LZ_HASH_BITS            8
+#endif
+#define EXT_FLASH_LZ_HASH_SIZE            (1 << EXT_FLASH_LZ_HASH_BITS)
+
+/**
+ * @brief emb_ext_flash_lz_t - compressed stream writer. Memory use is fixed at one raw frame, one page and the match finder
+ * hash table. Treat the contents as private apart from the statistics.
+ */
+typedef struct
+{
+   // Pointer to the interface handle.
+   emb_flash_intf_handle_t *p_intf;
+   // Start address and length of the region, both sector aligned.
+   uint32_t start;
+   uint32_t len;
+   // Number of frames in the region.
+   uint32_t frames;
+   // Raw offset of the first byte held in the raw buffer.
+   uint32_t raw_offset;
+   // Number of raw bytes held in the raw buffer.
+   uint16_t fill;
+   // Statistics: raw bytes accepted, bytes of flash consumed and erases issued.
+   uint32_t stat_raw_bytes;
+   uint32_t stat_flash_bytes;
+   uint32_t stat_erases;
+   // Match finder hash table.
+   uint16_t hash[EXT_FLASH_LZ_HASH_SIZE];
+   // Raw frame buffer.
+   uint8_t raw[EXT_FLASH_LZ_FRAME_RAW_MAX];
+   // Page buffer for the frame being built.
+   uint8_t page[EXT_FLASH_PAGE_SIZE];
+} emb_ext_flash_lz_t;
+
+/**
+ * @brief emb_ext_flash_lz_reader_t - compressed stream reader, caches the most recently decoded frame so sequential reads only
+ * decode each frame once.
+ */
+typedef struct
+{
+   // Pointer to the interface handle.
+   emb_flash_intf_handle_t *p_intf;
+   // Start address and length of the region.
+   uint32_t start;
+   uint32_t len;
+   // Index, raw offset and raw length of the cached frame, the index is 0xFFFFFFFF when nothing is cached.
+   uint32_t frame;
+   uint32_t raw_offset;
+   uint16_t raw_len;
+   // Decoded frame.
+   uint8_t raw[EXT_FLASH_LZ_FRAME_RAW_MAX];
+   // Page buffer.
+   uint8_t page[EXT_FLASH_PAGE_SIZE];
+} emb_ext_flash_lz_reader_t;
+
+/**
+ * @brief emb_ext_flash_lz_compress compress as much of src as fits in dst.
+ *
+ * @param hash - match finder hash table of EXT_FLASH_LZ_HASH_SIZE entries, used as scratch.
+ * @param src - pointer to the raw data.
+ * @param src_len - the number of raw bytes.
+ * @param dst - pointer to the output buffer.
+ * @param dst_cap - size of the output buffer.
+ * @param consumed - receives the number of raw bytes that were compressed.
+ * @return int - number of compressed bytes written to dst.
+ */
+int emb_ext_flash_lz_compress(uint16_t *hash, const uint8_t *src, uint16_t src_len, uint8_t *dst, uint16_t dst_cap, uint16_t *consumed);
+
+/**
+ * @brief emb_ext_flash_lz_decompress decompress a payload produced by emb_ext_flash_lz_compress.
+ *
+ * @param src - pointer to the compressed data.
+ * @param src_len - the number of compressed bytes.
+ * @param dst - pointer to the output buffer.
+ * @param dst_cap - size of the output buffer.
+ * @return int - number of raw bytes produced, -1 if the payload is corrupt or does not fit.
+ */
+int emb_ext_flash_lz_decompress(const uint8_t *src, uint16_t src_len, uint8_t *dst, uint16_t dst_cap);
+
+/**
+ * @brief emb_ext_flash_lz_open open a compressed stream on a region, appending after any frames already present.
+ *
+ * @param p_lz - pointer to the stream.
+ * @param p_intf - pointer to the interface handle.
+ * @param start - start address of the region, must be sector aligned.
+ * @param len - length of the region, must be a multiple of the sector size.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_lz_open(emb_ext_flash_lz_t *p_lz, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_lz_write append raw data to the stream, full frames are compressed and programmed as they fill up.
+ *
+ * @param p_lz - pointer to the stream.
+ * @param data - pointer to the data.
+ * @param len - the number of bytes.
+ * @return int - number of bytes accepted, less than len when the region is full. Near the end of the region only as many
+ * bytes are accepted as the frames left are sure to hold if the data does not compress, so every accepted byte is stored.
+ */
+int emb_ext_flash_lz_write(emb_ext_flash_lz_t *p_lz, const uint8_t *data, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_lz_flush program the buffered raw data as a (possibly partially filled) frame.
+ *
+ * @param p_lz - pointer to the stream.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_lz_flush(emb_ext_flash_lz_t *p_lz);
+
+/**
+ * @brief emb_ext_flash_lz_size get the number of raw bytes stored in flash, not including data still buffered.
+ *
+ * @param p_lz - pointer to the stream.
+ * @return uint32_t - number of raw bytes.
+ */
+uint32_t emb_ext_flash_lz_size(emb_ext_flash_lz_t *p_lz);
+
+/**
+ * @brief emb_ext_flash_lz_reader_open open a reader on a compressed region.
+ *
+ * @param p_rd - pointer to the reader.
+ * @param p_intf - pointer to the interface handle.
+ * @param start - start address of the region.
+ * @param len - length of the region.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_lz_reader_open(emb_ext_flash_lz_reader_t *p_rd, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_lz_read_frame decode a single frame by index.
+ *
+ * @param p_rd - pointer to the reader.
+ * @param frame - index of the frame.
+ * @param raw_offset - optional pointer to receive the raw offset of the frame, may be NULL.
+ * @return int - number of raw bytes in the frame, they are available in p_rd->raw, -1 if the frame is empty or corrupt.
+ */
+int emb_ext_flash_lz_read_frame(emb_ext_flash_lz_reader_t *p_rd, uint32_t frame, uint32_t *raw_offset);
+
+/**
+ * @brief emb_ext_flash_lz_read read raw data at any raw offset. The frame holding the offset is found with a binary search
+ * over the frame headers, so random reads cost O(log n) header reads plus one frame decode.
+ *
+ * @param p_rd - pointer to the reader.
+ * @param offset - raw offset to read from.
+ * @param data - pointer to the output buffer.
+ * @param len - the number of bytes to read.
+ * @return int - number of bytes read, less than len at the end of the stream.
+ */
+int emb_ext_flash_lz_read(emb_ext_flash_lz_reader_t *p_rd, uint32_t offset, uint8_t *data, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_LZ_H_ */
@@ -0,0 +1,276 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_crc.h"
+#include "emb_ext_flash_le.h"
+#include "emb_ext_flash_mirror.h"
+
+// Private functions
+// Wait for a chip to finish what was started on it
+static int mirror_wait(emb_ext_flash_mirror_t *p_mirror, uint8_t c)
+{
+   if (p_mirror->busy[c])
+   {
+      int rtn = emb_ext_flash_wait_idle(p_mirror->p_intf[c], EXT_FLASH_MIRROR_WAIT_US);
+      if (rtn < 0)
+      {
+         return(rtn);
+      }
+      p_mirror->busy[c] = 0;
+   }
+
+   return(0);
+}
+
+// Whether a chip is idle, without waiting
+static uint8_t mirror_idle(emb_ext_flash_mirror_t *p_mirror, uint8_t c)
+{
+   if (p_mirror->busy[c] && !(emb_ext_flash_get_status(p_mirror->p_intf[c]) & EXT_FLASH_STATUS_REG_BUSY))
+   {
+      p_mirror->busy[c] = 0;
+   }
+
+   return(!p_mirror->busy[c]);
+}
+
+// Pick the chip to read from, the one whose turn it is when both are idle, otherwise the first one to become idle
+static int mirror_pick(emb_ext_flash_mirror_t *p_mirror)
+{
+   for (uint32_t waited = 0; waited <= EXT_FLASH_MIRROR_WAIT_US; waited += EXT_FLASH_MIN_POLL_US)
+   {
+      for (uint8_t k = 0; k < 2; k++)
+      {
+         uint8_t c = (p_mirror->next + k) & 1;
+         if (mirror_idle(p_mirror, c))
+         {
+            p_mirror->stat_busy_skips += k;
+            p_mirror->next             = c ^ 1;
+            return(c);
+         }
+      }
+      p_mirror->p_intf[0]->delay_us(EXT_FLASH_MIN_POLL_US);
+   }
+
+   return(-1);
+}
+
+// Read a record from one chip, returns 0 if its CRC matches
+static int mirror_read_copy(emb_ext_flash_mirror_t *p_mirror, uint8_t c, uint32_t address, uint8_t *data, uint16_t len)
+{
+   uint8_t crc[EXT_FLASH_MIRROR_OVERHEAD];
+
+   if (emb_ext_flash_read(p_mirror->p_intf[c], address, data, len) != len ||
+       emb_ext_flash_read(p_mirror->p_intf[c], address + len, crc, sizeof(crc)) != sizeof(crc))
+   {
+      return(-1);
+   }
+
+   return(emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, data, len) == emb_ext_flash_get_u32(crc) ? 0 : -1);
+}
+
+// Rewrite [address, address + len) on the bad chip from the good one. The rest of each sector keeps the bad chip's own
+// data, other records there may have their only good copy on it.
+static int mirror_repair(emb_ext_flash_mirror_t *p_mirror, uint8_t bad, uint32_t address, uint32_t len)
+{
+   emb_flash_intf_handle_t *p_bad  = p_mirror->p_intf[bad];
+   emb_flash_intf_handle_t *p_good = p_mirror->p_intf[bad ^ 1];
+   uint8_t                 *buf    = p_mirror->buf;
+   uint32_t                 end    = address + len;
+
+   if (mirror_wait(p_mirror, 0) < 0 || mirror_wait(p_mirror, 1) < 0)
+   {
+      return(-1);
+   }
+
+   for (uint32_t sector = address & ~(uint32_t)(EXT_FLASH_SECTOR_SIZE - 1); sector < end; sector += EXT_FLASH_SECTOR_SIZE)
+   {
+      // The bad chip's sector with the record overlaid from the good chip
+      uint32_t from = address > sector ? address : sector;
+      uint32_t to   = end < sector + EXT_FLASH_SECTOR_SIZE ? end : sector + EXT_FLASH_SECTOR_SIZE;
+      if (emb_ext_flash_read(p_bad, sector, buf, EXT_FLASH_SECTOR_SIZE) != EXT_FLASH_SECTOR_SIZE ||
+          emb_ext_flash_read(p_good, from, &buf[from - sector], (uint16_t)(to - from)) != (int)(to - from))
+      {
+         return(-1);
+      }
+
+      if (emb_ext_flash_erase_timeout(p_bad, sector, EXT_FLASH_SECTOR_SIZE, EXT_FLASH_MIRROR_WAIT_US) != 0)
+      {
+         return(-1);
+      }
+
+      // Program every page that holds anything
+      for (uint32_t off = 0; off < EXT_FLASH_SECTOR_SIZE; off += EXT_FLASH_PAGE_SIZE)
+      {
+         uint16_t i = 0;
+         while (i < EXT_FLASH_PAGE_SIZE && buf[off + i] == 0xFF)
+         {
+            i++;
+         }
+         if (i < EXT_FLASH_PAGE_SIZE &&
+             emb_ext_flash_write_timeout(p_bad, sector + off, &buf[off], EXT_FLASH_PAGE_SIZE, EXT_FLASH_MIRROR_WAIT_US) !=
+             EXT_FLASH_PAGE_SIZE)
+         {
+            return(-1);
+         }
+      }
+   }
+
+   p_mirror->stat_repairs++;
+
+   return(0);
+}
+
+// Pubic functions
+int emb_ext_flash_mirror_init(emb_ext_flash_mirror_t *p_mirror, emb_flash_intf_handle_t *p_a, emb_flash_intf_handle_t *p_b)
+{
+   // Null check
+   if (!p_mirror || !p_a || !p_b || p_a == p_b || !p_a->initialized || !p_b->initialized)
+   {
+      return(-1);
+   }
+
+   memset(p_mirror, 0, sizeof(*p_mirror));
+   p_mirror->p_intf[0] = p_a;
+   p_mirror->p_intf[1] = p_b;
+
+   // Nothing is known about what the chips are doing
+   p_mirror->busy[0] = 1;
+   p_mirror->busy[1] = 1;
+
+   return(0);
+}
+
+int emb_ext_flash_mirror_write(emb_ext_flash_mirror_t *p_mirror, uint32_t address, const uint8_t *data, uint16_t len)
+{
+   uint8_t  page[EXT_FLASH_PAGE_SIZE];
+   uint8_t  crc[EXT_FLASH_MIRROR_OVERHEAD];
+   uint32_t total = (uint32_t)len + sizeof(crc);
+
+   // Null check
+   if (!p_mirror || !data || !len)
+   {
+      return(-1);
+   }
+
+   emb_ext_flash_put_u32(crc, emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, data, len));
+
+   for (uint32_t off = 0; off < total; )
+   {
+      // Gather the next page of the record and its CRC
+      uint32_t addr = address + off;
+      uint16_t n    = (uint16_t)(EXT_FLASH_PAGE_SIZE - (addr & (EXT_FLASH_PAGE_SIZE - 1)));
+      if (n > total - off)
+      {
+         n = (uint16_t)(total - off);
+      }
+      for (uint16_t i = 0; i < n; i++)
+      {
+         page[i] = off + i < len ? data[off + i] : crc[off + i - len];
+      }
+
+      // Start it on each chip as soon as that chip is done with the previous one
+      for (uint8_t c = 0; c < 2; c++)
+      {
+         if (mirror_wait(p_mirror, c) < 0 || emb_ext_flash_program_begin(p_mirror->p_intf[c], addr, page, n) != n)
+         {
+            return(-1);
+         }
+         p_mirror->busy[c] = 1;
+      }
+      off += n;
+   }
+
+   return(len);
+}
+
+int emb_ext_flash_mirror_read(emb_ext_flash_mirror_t *p_mirror, uint32_t address, uint8_t *data, uint16_t len)
+{
+   // Null check
+   if (!p_mirror || !data || !len)
+   {
+      return(-1);
+   }
+
+   int c = mirror_pick(p_mirror);
+   if (c < 0)
+   {
+      return(-1);
+   }
+   if (mirror_read_copy(p_mirror, (uint8_t)c, address, data, len) == 0)
+   {
+      p_mirror->stat_reads[c]++;
+      return(len);
+   }
+
+   // Fall back to the other copy, and repair the bad one from it
+   uint8_t o = (uint8_t)c ^ 1;
+   p_mirror->stat_crc_errors++;
+   if (mirror_wait(p_mirror, o) < 0 || mirror_read_copy(p_mirror, o, address, data, len) != 0)
+   {
+      p_mirror->stat_lost++;
+      return(-1);
+   }
+   p_mirror->stat_reads[o]++;
+   mirror_repair(p_mirror, (uint8_t)c, address, (uint32_t)len + EXT_FLASH_MIRROR_OVERHEAD);
+
+   return(len);
+}
+
+int emb_ext_flash_mirror_erase(emb_ext_flash_mirror_t *p_mirror, uint32_t address, uint32_t len)
+{
+   // Null check
+   if (!p_mirror || !len)
+   {
+      return(-1);
+   }
+
+   uint32_t end = address + len;
+   for (uint32_t sector = address & ~(uint32_t)(EXT_FLASH_SECTOR_SIZE - 1); sector < end; sector += EXT_FLASH_SECTOR_SIZE)
+   {
+      // Start it on each chip as soon as that chip is done with the previous one
+      for (uint8_t c = 0; c < 2; c++)
+      {
+         if (mirror_wait(p_mirror, c) < 0 || emb_ext_flash_erase_begin(p_mirror->p_intf[c], sector) != 0)
+         {
+            return(-1);
+         }
+         p_mirror->busy[c] = 1;
+      }
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_mirror_sync(emb_ext_flash_mirror_t *p_mirror)
+{
+   // Null check
+   if (!p_mirror)
+   {
+      return(-1);
+   }
+
+   int rtn = mirror_wait(p_mirror, 0);
+   if (rtn < 0)
+   {
+      return(rtn);
+   }
+
+   return(mirror_wait(p_mirror, 1));
+}
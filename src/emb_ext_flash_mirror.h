@@ -0,0 +1,128 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_MIRROR_H_
+#define EMB_EXT_FLASH_MIRROR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Mirrored pair of chips (RAID-1) for data that has to survive the loss of one copy.
+ *
+ * Each record is written to both chips followed by its CRC-32. The pages are started on both chips one after the other, so
+ * the programs on the two chips run at the same time. Writes and erases return once the last program or erase has been
+ * started on both chips, and emb_ext_flash_mirror_sync() waits for them to finish. A read goes to a chip that is idle, taking
+ * turns when both are, so it does not wait behind a program or erase that is still running on the other chip. When the CRC
+ * of the copy read does not match, the other copy is read. If that one is good, the sectors holding the bad copy are
+ * rewritten with the record taken from the good chip and the rest of each sector kept as it was.
+ */
+
+// Limit of each wait for a chip to finish a program or erase in microseconds
+#ifndef EXT_FLASH_MIRROR_WAIT_US
+#define EXT_FLASH_MIRROR_WAIT_US    1000000
+#endif
+
+// Bytes each record takes in addition to its data, for the CRC-32
+#define EXT_FLASH_MIRROR_OVERHEAD   4
+
+/**
+ * @brief emb_ext_flash_mirror_t - mirror state. Treat the contents as private apart from the statistics.
+ */
+typedef struct
+{
+   // Pointers to the interface handles of the two chips.
+   emb_flash_intf_handle_t *p_intf[2];
+   // Flags to indicate a program or erase may still be running on each chip.
+   uint8_t busy[2];
+   // Chip the next read goes to when both are idle.
+   uint8_t next;
+   // Statistics: reads served by each chip, reads that went to the other chip because one was busy, copies that failed their
+   // CRC, copies repaired and records with no good copy left.
+   uint32_t stat_reads[2];
+   uint32_t stat_busy_skips;
+   uint32_t stat_crc_errors;
+   uint32_t stat_repairs;
+   uint32_t stat_lost;
+   // Sector buffer for repairs.
+   uint8_t buf[EXT_FLASH_SECTOR_SIZE];
+} emb_ext_flash_mirror_t;
+
+/**
+ * @brief emb_ext_flash_mirror_init set up a mirror over two chips, both holding the same layout.
+ *
+ * @param p_mirror - pointer to the mirror.
+ * @param p_a - pointer to the interface handle of the first chip, initialized.
+ * @param p_b - pointer to the interface handle of the second chip, initialized.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_mirror_init(emb_ext_flash_mirror_t *p_mirror, emb_flash_intf_handle_t *p_a, emb_flash_intf_handle_t *p_b);
+
+/**
+ * @brief emb_ext_flash_mirror_write write a record and its CRC to both chips, into erased flash. Returns once the last page has
+ * been started on both chips.
+ *
+ * @param p_mirror - pointer to the mirror.
+ * @param address - address of the record, the CRC follows the data.
+ * @param data - pointer to the data.
+ * @param len - number of bytes of data.
+ * @return int - len on success, -1 on failure.
+ */
+int emb_ext_flash_mirror_write(emb_ext_flash_mirror_t *p_mirror, uint32_t address, const uint8_t *data, uint16_t len);
+
+/**
+ * @brief emb_ext_flash_mirror_read read a record from whichever chip is idle, falling back to the other copy and repairing the
+ * first one when its CRC does not match.
+ *
+ * @param p_mirror - pointer to the mirror.
+ * @param address - address of the record.
+ * @param data - pointer to receive the data.
+ * @param len - number of bytes of data, as written.
+ * @return int - len on success, -1 on failure or when neither copy is good.
+ */
+int emb_ext_flash_mirror_read(emb_ext_flash_mirror_t *p_mirror, uint32_t address, uint8_t *data, uint16_t len);
+
+/**
+ * @brief emb_ext_flash_mirror_erase erase every 4K sector overlapping [address, address + len) on both chips. Returns once the
+ * last erase has been started on both chips.
+ *
+ * @param p_mirror - pointer to the mirror.
+ * @param address - start address.
+ * @param len - number of bytes.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_mirror_erase(emb_ext_flash_mirror_t *p_mirror, uint32_t address, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_mirror_sync wait for the programs and erases still running on both chips.
+ *
+ * @param p_mirror - pointer to the mirror.
+ * @return int - 0 on success, -1 on failure, EXT_FLASH_ERR_TIMEOUT if a chip does not finish.
+ */
+int emb_ext_flash_mirror_sync(emb_ext_flash_mirror_t *p_mirror);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_MIRROR_H_ */
@@ -0,0 +1,286 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_le.h"
+#include "emb_ext_flash_patch.h"
+
+// Decoder states
+enum
+{
+   EXT_FLASH_PATCH_STATE_HEADER,
+   EXT_FLASH_PATCH_STATE_OP,
+   EXT_FLASH_PATCH_STATE_COPY_OFFSET,
+   EXT_FLASH_PATCH_STATE_INSERT,
+   EXT_FLASH_PATCH_STATE_ERROR,
+};
+
+// Private functions
+// Accumulate a varint byte, returns 1 when the varint is complete, 0 when more bytes are needed and -1 on overflow. The
+// fifth byte may only carry the top 4 bits of a 32-bit value.
+static int emb_ext_flash_patch_varint(emb_ext_flash_patch_t *p_patch, uint8_t byte)
+{
+   if (p_patch->shift > 28 || (p_patch->shift == 28 && byte > 0x0F))
+   {
+      return(-1);
+   }
+
+   p_patch->varint |= (uint32_t)(byte & 0x7F) << p_patch->shift;
+   p_patch->shift  += 7;
+
+   return((byte & 0x80) ? 0 : 1);
+}
+
+static int emb_ext_flash_patch_copy(emb_ext_flash_patch_t *p_patch)
+{
+   // The copy must come entirely from inside the old image
+   if (p_patch->old_pos > p_patch->src_len || p_patch->op_len > p_patch->src_len - p_patch->old_pos)
+   {
+      return(-1);
+   }
+
+   while (p_patch->op_len)
+   {
+      uint16_t chunk = EXT_FLASH_PATCH_COPY_BUF_SIZE;
+      if (chunk > p_patch->op_len)
+      {
+         chunk = p_patch->op_len;
+      }
+
+      if (emb_ext_flash_read(p_patch->p_src, p_patch->src_addr + p_patch->old_pos, p_patch->buf, chunk) != chunk)
+      {
+         return(-1);
+      }
+      if (emb_ext_flash_writer_append(&p_patch->writer, p_patch->buf, chunk) != 0)
+      {
+         return(-1);
+      }
+
+      p_patch->old_pos += chunk;
+      p_patch->out_len += chunk;
+      p_patch->op_len  -= chunk;
+   }
+
+   return(0);
+}
+
+// Public functions
+int emb_ext_flash_patch_begin(emb_ext_flash_patch_t *p_patch, emb_flash_intf_handle_t *p_src, uint32_t src_addr, uint32_t src_len,
+                              emb_flash_intf_handle_t *p_dst, uint32_t dst_addr, uint32_t dst_slot_len)
+{
+   // Null check
+   if (!p_patch || !p_src || !p_src->initialized)
+   {
+      return(-1);
+   }
+
+   // The new image must not be written over the old one it is built from
+   if (p_src == p_dst && src_len && dst_slot_len && src_addr < dst_addr + dst_slot_len && dst_addr < src_addr + src_len)
+   {
+      return(-1);
+   }
+
+   // Open the writer on the target slot, this also validates the destination
+   if (emb_ext_flash_writer_open(&p_patch->writer, p_dst, dst_addr, dst_slot_len) != 0)
+   {
+      return(-1);
+   }
+
+   p_patch->p_src    = p_src;
+   p_patch->src_addr = src_addr;
+   p_patch->src_len  = src_len;
+   p_patch->old_pos  = 0;
+   p_patch->new_len  = 0;
+   p_patch->new_crc  = 0;
+   p_patch->out_len  = 0;
+   p_patch->varint   = 0;
+   p_patch->shift    = 0;
+   p_patch->op_len   = 0;
+   p_patch->hdr_len  = 0;
+   p_patch->state    = EXT_FLASH_PATCH_STATE_HEADER;
+
+   return(0);
+}
+
+int emb_ext_flash_patch_feed(emb_ext_flash_patch_t *p_patch, uint8_t *data, uint32_t len)
+{
+   // Null check
+   if (!p_patch || (!data && len) || p_patch->state == EXT_FLASH_PATCH_STATE_ERROR)
+   {
+      return(-1);
+   }
+
+   while (len)
+   {
+      switch (p_patch->state)
+      {
+      case EXT_FLASH_PATCH_STATE_HEADER:
+         p_patch->hdr[p_patch->hdr_len++] = *data++;
+         len--;
+         if (p_patch->hdr_len == EXT_FLASH_PATCH_HEADER_SIZE)
+         {
+            if (memcmp(p_patch->hdr, EXT_FLASH_PATCH_MAGIC, 4) != 0)
+            {
+               p_patch->state = EXT_FLASH_PATCH_STATE_ERROR;
+               return(-1);
+            }
+            p_patch->new_len = emb_ext_flash_get_u32(&p_patch->hdr[4]);
+            p_patch->new_crc = emb_ext_flash_get_u32(&p_patch->hdr[8]);
+            p_patch->state   = EXT_FLASH_PATCH_STATE_OP;
+         }
+         break;
+
+      case EXT_FLASH_PATCH_STATE_OP: {
+         int rtn = emb_ext_flash_patch_varint(p_patch, *data++);
+         len--;
+         if (rtn < 0)
+         {
+            p_patch->state = EXT_FLASH_PATCH_STATE_ERROR;
+            return(-1);
+         }
+         if (rtn == 0)
+         {
+            break;
+         }
+
+         // Decode the op, refusing anything that would grow the image beyond the header length
+         p_patch->op_len = p_patch->varint >> 1;
+         if (p_patch->op_len > p_patch->new_len - p_patch->out_len)
+         {
+            p_patch->state = EXT_FLASH_PATCH_STATE_ERROR;
+            return(-1);
+         }
+         p_patch->state  = (p_patch->varint & 1) ? EXT_FLASH_PATCH_STATE_INSERT : EXT_FLASH_PATCH_STATE_COPY_OFFSET;
+         p_patch->varint = 0;
+         p_patch->shift  = 0;
+         if (p_patch->state == EXT_FLASH_PATCH_STATE_INSERT && !p_patch->op_len)
+         {
+            p_patch->state = EXT_FLASH_PATCH_STATE_OP;
+         }
+      } break;
+
+      case EXT_FLASH_PATCH_STATE_COPY_OFFSET: {
+         int rtn = emb_ext_flash_patch_varint(p_patch, *data++);
+         len--;
+         if (rtn < 0)
+         {
+            p_patch->state = EXT_FLASH_PATCH_STATE_ERROR;
+            return(-1);
+         }
+         if (rtn == 0)
+         {
+            break;
+         }
+
+         // Zigzag decode the offset and move the old image cursor
+         int32_t offset = (int32_t)(p_patch->varint >> 1) ^ -(int32_t)(p_patch->varint & 1);
+         p_patch->old_pos += (uint32_t)offset;
+         p_patch->varint   = 0;
+         p_patch->shift    = 0;
+         p_patch->state    = EXT_FLASH_PATCH_STATE_OP;
+
+         if (emb_ext_flash_patch_copy(p_patch) != 0)
+         {
+            p_patch->state = EXT_FLASH_PATCH_STATE_ERROR;
+            return(-1);
+         }
+      } break;
+
+      case EXT_FLASH_PATCH_STATE_INSERT: {
+         // Literals go straight from the caller's buffer to the writer
+         uint32_t chunk = p_patch->op_len;
+         if (chunk > len)
+         {
+            chunk = len;
+         }
+         if (emb_ext_flash_writer_append(&p_patch->writer, data, chunk) != 0)
+         {
+            p_patch->state = EXT_FLASH_PATCH_STATE_ERROR;
+            return(-1);
+         }
+         data             += chunk;
+         len              -= chunk;
+         p_patch->out_len += chunk;
+         p_patch->op_len  -= chunk;
+         if (!p_patch->op_len)
+         {
+            p_patch->state = EXT_FLASH_PATCH_STATE_OP;
+         }
+      } break;
+
+      default:
+         return(-1);
+      }
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_patch_feed_from_flash(emb_ext_flash_patch_t *p_patch, emb_flash_intf_handle_t *p_intf, uint32_t address, uint32_t len)
+{
+   uint8_t chunk[EXT_FLASH_PATCH_COPY_BUF_SIZE];
+
+   while (len)
+   {
+      uint16_t r_len = sizeof(chunk);
+      if (r_len > len)
+      {
+         r_len = len;
+      }
+
+      if (emb_ext_flash_read(p_intf, address, chunk, r_len) != r_len)
+      {
+         return(-1);
+      }
+      if (emb_ext_flash_patch_feed(p_patch, chunk, r_len) != 0)
+      {
+         return(-1);
+      }
+
+      address += r_len;
+      len     -= r_len;
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_patch_finish(emb_ext_flash_patch_t *p_patch)
+{
+   // Null check
+   if (!p_patch)
+   {
+      return(-1);
+   }
+
+   // The patch must end on an op boundary having produced exactly the advertised image
+   if (p_patch->state != EXT_FLASH_PATCH_STATE_OP || p_patch->shift || p_patch->out_len != p_patch->new_len)
+   {
+      p_patch->state = EXT_FLASH_PATCH_STATE_ERROR;
+      return(-1);
+   }
+
+   uint32_t crc = 0;
+   if (emb_ext_flash_writer_close(&p_patch->writer, 0, &crc) < 0 || crc != p_patch->new_crc)
+   {
+      p_patch->state = EXT_FLASH_PATCH_STATE_ERROR;
+      return(-1);
+   }
+
+   return(p_patch->out_len);
+}
@@ -0,0 +1,138 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_PATCH_H_
+#define EMB_EXT_FLASH_PATCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+#include "emb_ext_flash_writer.h"
+
+/*
+ * Delta format, all multi byte fields are little endian:
+ *
+ *   header: 'E' 'F' 'P' '1', u32 new image length, u32 CRC-32 of the new image
+ *   ops:    varint v, the low bit of v selects the op and v >> 1 is the op length
+ *           v & 1 == 0: COPY   - followed by a zigzag varint offset that is added to the old image cursor before
+ *                                copying, the cursor then advances by the op length
+ *           v & 1 == 1: INSERT - followed by op length literal bytes
+ *
+ * Varints are LEB128 encoded (7 bits per byte, least significant group first) and at most 5 bytes long.
+ */
+#define EXT_FLASH_PATCH_MAGIC           "EFP1"
+#define EXT_FLASH_PATCH_HEADER_SIZE     12
+#define EXT_FLASH_PATCH_OP_COPY         0
+#define EXT_FLASH_PATCH_OP_INSERT       1
+
+// Size of the bounce buffer used to move COPY data from the old slot to the writer
+#ifndef EXT_FLASH_PATCH_COPY_BUF_SIZE
+#define EXT_FLASH_PATCH_COPY_BUF_SIZE   EXT_FLASH_PAGE_SIZE
+#endif
+
+/**
+ * @brief emb_ext_flash_patch_t - patch application state. The RAM footprint is fixed at one writer page plus the copy bounce
+ * buffer regardless of the image or patch size. Treat the contents as private.
+ */
+typedef struct
+{
+   // Writer streaming the new image into the target slot.
+   emb_ext_flash_writer_t writer;
+   // Pointer to the interface handle of the chip holding the old image.
+   emb_flash_intf_handle_t *p_src;
+   // Start address of the old image.
+   uint32_t src_addr;
+   // Length of the old image.
+   uint32_t src_len;
+   // Cursor into the old image.
+   uint32_t old_pos;
+   // Length and CRC-32 of the new image, taken from the header.
+   uint32_t new_len;
+   uint32_t new_crc;
+   // Number of new image bytes produced so far.
+   uint32_t out_len;
+   // Varint decoder accumulator and shift.
+   uint32_t varint;
+   uint8_t  shift;
+   // Remaining length of the current op.
+   uint32_t op_len;
+   // Decoder state.
+   uint8_t state;
+   // Header bytes received so far.
+   uint8_t hdr_len;
+   uint8_t hdr[EXT_FLASH_PATCH_HEADER_SIZE];
+   // Bounce buffer for COPY ops.
+   uint8_t buf[EXT_FLASH_PATCH_COPY_BUF_SIZE];
+} emb_ext_flash_patch_t;
+
+/**
+ * @brief emb_ext_flash_patch_begin start applying a patch. The old image is read through p_src and the new image is streamed
+ * into the target slot, which is erased ahead of the program address. The slots must not overlap, on the same chip this is
+ * checked.
+ *
+ * @param p_patch - pointer to the patch state.
+ * @param p_src - pointer to the interface handle of the chip holding the old image.
+ * @param src_addr - start address of the old image.
+ * @param src_len - length of the old image.
+ * @param p_dst - pointer to the interface handle of the chip receiving the new image, may be the same as p_src.
+ * @param dst_addr - start address of the target slot, must be sector aligned.
+ * @param dst_slot_len - length of the target slot, must be a multiple of the sector size.
+ * @return int - 0 on success, -1 on failure or overlapping slots.
+ */
+int emb_ext_flash_patch_begin(emb_ext_flash_patch_t *p_patch, emb_flash_intf_handle_t *p_src, uint32_t src_addr, uint32_t src_len,
+                              emb_flash_intf_handle_t *p_dst, uint32_t dst_addr, uint32_t dst_slot_len);
+
+/**
+ * @brief emb_ext_flash_patch_feed feed the next chunk of the patch stream. Chunks may be of any size and split anywhere, so
+ * packets can be passed straight in as they arrive.
+ *
+ * @param p_patch - pointer to the patch state.
+ * @param data - pointer to the patch bytes.
+ * @param len - the number of patch bytes.
+ * @return int - 0 on success, -1 if the patch is malformed or a flash operation failed.
+ */
+int emb_ext_flash_patch_feed(emb_ext_flash_patch_t *p_patch, uint8_t *data, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_patch_feed_from_flash feed a patch that has been staged in flash.
+ *
+ * @param p_patch - pointer to the patch state.
+ * @param p_intf - pointer to the interface handle of the chip holding the patch.
+ * @param address - start address of the patch.
+ * @param len - length of the patch.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_patch_feed_from_flash(emb_ext_flash_patch_t *p_patch, emb_flash_intf_handle_t *p_intf, uint32_t address, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_patch_finish flush the new image and check its length and CRC-32 against the patch header.
+ *
+ * @param p_patch - pointer to the patch state.
+ * @return int - length of the new image on success, -1 on failure.
+ */
+int emb_ext_flash_patch_finish(emb_ext_flash_patch_t *p_patch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_PATCH_H_ */
@@ -0,0 +1,375 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_pool.h"
+
+// Private functions
+static uint32_t pool_now(emb_ext_flash_pool_t *p_pool)
+{
+   return(p_pool->p_intf->get_time_us ? p_pool->p_intf->get_time_us() : 0);
+}
+
+static uint8_t pool_bit(const uint8_t *map, uint16_t i)
+{
+   return((map[i >> 3] >> (i & 7)) & 1);
+}
+
+static void pool_set(uint8_t *map, uint16_t i, uint8_t value)
+{
+   if (value)
+   {
+      map[i >> 3] |= (uint8_t)(1 << (i & 7));
+   }
+   else
+   {
+      map[i >> 3] &= (uint8_t)~(1 << (i & 7));
+   }
+}
+
+static uint32_t pool_addr(emb_ext_flash_pool_t *p_pool, uint16_t i)
+{
+   return(p_pool->base + (uint32_t)i * EXT_FLASH_SECTOR_SIZE);
+}
+
+// Sector indexes covering a range, -1 when the range is empty or leaves the pool
+static int pool_range(emb_ext_flash_pool_t *p_pool, uint32_t address, uint32_t len, uint16_t *p_first, uint16_t *p_last)
+{
+   uint32_t end = p_pool->base + (uint32_t)p_pool->sectors * EXT_FLASH_SECTOR_SIZE;
+
+   if (!len || address < p_pool->base || address >= end || len > end - address)
+   {
+      return(-1);
+   }
+
+   *p_first = (uint16_t)((address - p_pool->base) / EXT_FLASH_SECTOR_SIZE);
+   *p_last  = (uint16_t)((address + len - 1 - p_pool->base) / EXT_FLASH_SECTOR_SIZE);
+   return(0);
+}
+
+// Longest a sector erase may take on this chip
+static uint32_t pool_erase_max_us(emb_ext_flash_pool_t *p_pool)
+{
+   const emb_ext_flash_chip_t *p_chip = p_pool->p_intf->p_chip;
+
+   return((p_chip && p_chip->tse_max_ms ? p_chip->tse_max_ms : EXT_FLASH_DEFAULT_TSE_MAX_MS) * 1000);
+}
+
+static void pool_waited(emb_ext_flash_pool_t *p_pool, uint32_t start)
+{
+   uint32_t waited = pool_now(p_pool) - start;
+
+   p_pool->stat_erase_waits++;
+   p_pool->stat_wait_us += waited;
+   if (waited > p_pool->stat_wait_max_us)
+   {
+      p_pool->stat_wait_max_us = waited;
+   }
+}
+
+// The background erase has finished, its sector is clean
+static void pool_erased(emb_ext_flash_pool_t *p_pool)
+{
+   pool_set(p_pool->erased_map, p_pool->pending, 1);
+   p_pool->pending = EXT_FLASH_POOL_NONE;
+   p_pool->stat_erases_ahead++;
+}
+
+// Pubic functions
+int emb_ext_flash_pool_init(emb_ext_flash_pool_t *p_pool, emb_flash_intf_handle_t *p_intf, uint32_t base, uint16_t sectors,
+                            uint16_t ahead)
+{
+   // Null check
+   if (!p_pool || !p_intf || !p_intf->initialized || !sectors || sectors > EXT_FLASH_POOL_MAX_SECTORS ||
+       (base & (EXT_FLASH_SECTOR_SIZE - 1)))
+   {
+      return(-1);
+   }
+
+   memset(p_pool, 0, sizeof(*p_pool));
+   p_pool->p_intf  = p_intf;
+   p_pool->base    = base;
+   p_pool->sectors = sectors;
+   p_pool->ahead   = ahead;
+   p_pool->pending = EXT_FLASH_POOL_NONE;
+
+   // Everything is free, nothing is known to be erased
+   for (uint16_t i = 0; i < sectors; i++)
+   {
+      pool_set(p_pool->free_map, i, 1);
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_pool_mark_used(emb_ext_flash_pool_t *p_pool, uint32_t address, uint32_t len)
+{
+   uint16_t first = 0;
+   uint16_t last  = 0;
+
+   // Null check
+   if (!p_pool || pool_range(p_pool, address, len, &first, &last) != 0)
+   {
+      return(-1);
+   }
+
+   // A sector being erased cannot hold data, but finish the erase before taking it out
+   if (p_pool->pending >= first && p_pool->pending <= last && emb_ext_flash_pool_sync(p_pool) != 0)
+   {
+      return(-1);
+   }
+
+   for (uint16_t i = first; i <= last; i++)
+   {
+      pool_set(p_pool->free_map, i, 0);
+      pool_set(p_pool->erased_map, i, 0);
+   }
+   p_pool->cursor = (uint16_t)((last + 1) % p_pool->sectors);
+
+   return(0);
+}
+
+int emb_ext_flash_pool_scan(emb_ext_flash_pool_t *p_pool)
+{
+   uint8_t buf[64];
+   int     found = 0;
+
+   // Null check
+   if (!p_pool || emb_ext_flash_pool_sync(p_pool) != 0)
+   {
+      return(-1);
+   }
+
+   for (uint16_t i = 0; i < p_pool->sectors; i++)
+   {
+      if (!pool_bit(p_pool->free_map, i) || pool_bit(p_pool->erased_map, i))
+      {
+         continue;
+      }
+
+      // Blank check the sector, stopping at the first programmed byte
+      uint8_t blank = 1;
+      for (uint32_t off = 0; off < EXT_FLASH_SECTOR_SIZE && blank; off += sizeof(buf))
+      {
+         if (emb_ext_flash_read(p_pool->p_intf, pool_addr(p_pool, i) + off, buf, sizeof(buf)) != sizeof(buf))
+         {
+            return(-1);
+         }
+         for (uint16_t j = 0; j < sizeof(buf); j++)
+         {
+            blank &= buf[j] == 0xFF;
+         }
+      }
+
+      if (blank)
+      {
+         pool_set(p_pool->erased_map, i, 1);
+         found++;
+      }
+   }
+
+   return(found);
+}
+
+int emb_ext_flash_pool_idle(emb_ext_flash_pool_t *p_pool)
+{
+   // Null check
+   if (!p_pool || !p_pool->p_intf)
+   {
+      return(-1);
+   }
+
+   // Leave a background erase running until the chip reports it done
+   if (p_pool->pending != EXT_FLASH_POOL_NONE)
+   {
+      if (emb_ext_flash_get_status(p_pool->p_intf) & EXT_FLASH_STATUS_REG_BUSY)
+      {
+         return(1);
+      }
+      pool_erased(p_pool);
+   }
+
+   // Erase the first sector that is not clean among the next free sectors the writers will get
+   uint16_t seen = 0;
+   for (uint16_t k = 0; k < p_pool->sectors && seen < p_pool->ahead; k++)
+   {
+      uint16_t i = (uint16_t)((p_pool->cursor + k) % p_pool->sectors);
+      if (!pool_bit(p_pool->free_map, i))
+      {
+         continue;
+      }
+
+      seen++;
+      if (!pool_bit(p_pool->erased_map, i))
+      {
+         if (emb_ext_flash_erase_begin(p_pool->p_intf, pool_addr(p_pool, i)) != 0)
+         {
+            return(-1);
+         }
+         p_pool->pending = i;
+         return(1);
+      }
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_pool_alloc(emb_ext_flash_pool_t *p_pool, uint32_t *p_address)
+{
+   uint32_t waits = 0;
+   uint16_t i     = EXT_FLASH_POOL_NONE;
+
+   // Null check
+   if (!p_pool || !p_pool->p_intf || !p_address)
+   {
+      return(-1);
+   }
+
+   // Sectors go out in ring order
+   for (uint16_t k = 0; k < p_pool->sectors; k++)
+   {
+      uint16_t j = (uint16_t)((p_pool->cursor + k) % p_pool->sectors);
+      if (pool_bit(p_pool->free_map, j))
+      {
+         i = j;
+         break;
+      }
+   }
+   if (i == EXT_FLASH_POOL_NONE)
+   {
+      return(-1);
+   }
+
+   // Finish any background erase, then erase the sector here if the idle hook has not got to it
+   waits = p_pool->stat_erase_waits;
+   if (emb_ext_flash_pool_sync(p_pool) != 0)
+   {
+      return(-1);
+   }
+   if (!pool_bit(p_pool->erased_map, i))
+   {
+      uint32_t start = pool_now(p_pool);
+      if (emb_ext_flash_erase_timeout(p_pool->p_intf, pool_addr(p_pool, i), EXT_FLASH_SECTOR_SIZE, 0) != 0)
+      {
+         return(-1);
+      }
+      pool_waited(p_pool, start);
+      p_pool->stat_sync_erases++;
+   }
+   if (p_pool->stat_erase_waits == waits)
+   {
+      p_pool->stat_clean_allocs++;
+   }
+
+   // Hand it out
+   pool_set(p_pool->free_map, i, 0);
+   pool_set(p_pool->erased_map, i, 0);
+   p_pool->cursor = (uint16_t)((i + 1) % p_pool->sectors);
+   p_pool->stat_allocs++;
+   *p_address = pool_addr(p_pool, i);
+
+   return(0);
+}
+
+int emb_ext_flash_pool_release(emb_ext_flash_pool_t *p_pool, uint32_t address, uint32_t len)
+{
+   uint16_t first = 0;
+   uint16_t last  = 0;
+
+   // Null check
+   if (!p_pool || pool_range(p_pool, address, len, &first, &last) != 0)
+   {
+      return(-1);
+   }
+
+   for (uint16_t i = first; i <= last; i++)
+   {
+      pool_set(p_pool->free_map, i, 1);
+      if (i != p_pool->pending)
+      {
+         pool_set(p_pool->erased_map, i, 0);
+      }
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_pool_sync(emb_ext_flash_pool_t *p_pool)
+{
+   // Null check
+   if (!p_pool || !p_pool->p_intf)
+   {
+      return(-1);
+   }
+
+   if (p_pool->pending == EXT_FLASH_POOL_NONE)
+   {
+      return(0);
+   }
+
+   // Only count it as a wait when the erase is actually still running
+   if (emb_ext_flash_get_status(p_pool->p_intf) & EXT_FLASH_STATUS_REG_BUSY)
+   {
+      uint32_t start = pool_now(p_pool);
+      int      rtn   = emb_ext_flash_wait_idle(p_pool->p_intf, pool_erase_max_us(p_pool));
+      pool_waited(p_pool, start);
+      if (rtn != 0)
+      {
+         return(rtn);
+      }
+   }
+   pool_erased(p_pool);
+
+   return(0);
+}
+
+int emb_ext_flash_pool_write(emb_ext_flash_pool_t *p_pool, uint32_t address, uint8_t *data, uint16_t len)
+{
+   // Null check
+   if (!p_pool || !p_pool->p_intf)
+   {
+      return(-1);
+   }
+
+   int rtn = emb_ext_flash_pool_sync(p_pool);
+   if (rtn != 0)
+   {
+      return(rtn);
+   }
+
+   return(emb_ext_flash_write(p_pool->p_intf, address, data, len));
+}
+
+uint16_t emb_ext_flash_pool_clean(emb_ext_flash_pool_t *p_pool)
+{
+   uint16_t clean = 0;
+
+   // Null check
+   if (!p_pool)
+   {
+      return(0);
+   }
+
+   for (uint16_t i = 0; i < p_pool->sectors; i++)
+   {
+      clean += pool_bit(p_pool->free_map, i) && pool_bit(p_pool->erased_map, i);
+   }
+
+   return(clean);
+}
@@ -0,0 +1,175 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_POOL_H_
+#define EMB_EXT_FLASH_POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Pre-erase pool that takes sector erases off the write path.
+ *
+ * The pool manages a run of sectors handed out to writers one sector at a time, in ring order, and keeps two bitmaps: the
+ * sectors that are free (not holding live data) and the free sectors that are known to be erased. emb_ext_flash_pool_idle()
+ * is called from the idle loop or a timer and keeps the next few free sectors in ring order erased by starting one sector
+ * erase at a time and returning straight away, so the 40 - 400 ms erase runs while the system has nothing else to do.
+ * emb_ext_flash_pool_alloc() then only hands out clean sectors, and a write only ever waits for its page program. When the
+ * writers outrun the idle time the pool still works, it just has to wait for the erase, which the statistics count.
+ *
+ * While a background erase runs the chip only answers status reads, so every other access to the chip has to go through
+ * emb_ext_flash_pool_write() or be preceded by emb_ext_flash_pool_sync().
+ */
+#ifndef EXT_FLASH_POOL_MAX_SECTORS
+#define EXT_FLASH_POOL_MAX_SECTORS    256
+#endif
+
+// Marker for no sector
+#define EXT_FLASH_POOL_NONE    0xFFFF
+
+/**
+ * @brief emb_ext_flash_pool_t - pre-erase pool state. Treat the contents as private apart from the statistics. Wait times are
+ * measured with the handle's get_time_us and read as 0 without one.
+ */
+typedef struct
+{
+   // Pointer to the interface handle.
+   emb_flash_intf_handle_t *p_intf;
+   // Address of the first sector and number of sectors in the pool.
+   uint32_t base;
+   uint16_t sectors;
+   // Number of free sectors to keep erased ahead of the writers.
+   uint16_t ahead;
+   // Next sector to hand out and the sector being erased in the background, EXT_FLASH_POOL_NONE when idle.
+   uint16_t cursor;
+   uint16_t pending;
+   // Free and erased sector bitmaps.
+   uint8_t free_map[(EXT_FLASH_POOL_MAX_SECTORS + 7) / 8];
+   uint8_t erased_map[(EXT_FLASH_POOL_MAX_SECTORS + 7) / 8];
+   // Statistics: sectors handed out, background erases completed, sectors handed out that were already clean.
+   uint32_t stat_allocs;
+   uint32_t stat_erases_ahead;
+   uint32_t stat_clean_allocs;
+   // Statistics: times a writer had to wait on an erase, in the background or started for it, and the erases started for it.
+   uint32_t stat_erase_waits;
+   uint32_t stat_sync_erases;
+   // Statistics: total and longest time writers waited on erases.
+   uint64_t stat_wait_us;
+   uint32_t stat_wait_max_us;
+} emb_ext_flash_pool_t;
+
+/**
+ * @brief emb_ext_flash_pool_init set up a pool over a run of sectors. All sectors start out free and not known to be erased,
+ * use emb_ext_flash_pool_mark_used() for sectors that hold live data and emb_ext_flash_pool_scan() to pick up blank ones.
+ *
+ * @param p_pool - pointer to the pool.
+ * @param p_intf - pointer to the interface handle.
+ * @param base - sector aligned address of the first sector.
+ * @param sectors - number of sectors, at most EXT_FLASH_POOL_MAX_SECTORS.
+ * @param ahead - number of free sectors to keep erased ahead of the writers.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_pool_init(emb_ext_flash_pool_t *p_pool, emb_flash_intf_handle_t *p_intf, uint32_t base, uint16_t sectors,
+                            uint16_t ahead);
+
+/**
+ * @brief emb_ext_flash_pool_mark_used take the sectors covering a range out of the pool, for data found at start up. The next
+ * sector handed out is the one after the range.
+ *
+ * @param p_pool - pointer to the pool.
+ * @param address - start of the range.
+ * @param len - length of the range in bytes.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_pool_mark_used(emb_ext_flash_pool_t *p_pool, uint32_t address, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_pool_scan blank check the free sectors not known to be erased, so they need no erase.
+ *
+ * @param p_pool - pointer to the pool.
+ * @return int - number of blank sectors found, -1 on failure.
+ */
+int emb_ext_flash_pool_scan(emb_ext_flash_pool_t *p_pool);
+
+/**
+ * @brief emb_ext_flash_pool_idle idle hook, finishes the bookkeeping of a completed background erase and starts erasing the
+ * next free sector in ring order when fewer than the configured number of sectors ahead are clean. Never waits for an erase.
+ *
+ * @param p_pool - pointer to the pool.
+ * @return int - 1 while an erase is in progress, 0 when there is nothing to do, -1 on failure.
+ */
+int emb_ext_flash_pool_idle(emb_ext_flash_pool_t *p_pool);
+
+/**
+ * @brief emb_ext_flash_pool_alloc hand out the next free sector in ring order, erased and ready to program. Waits for the erase
+ * when the idle hook has not got to it yet.
+ *
+ * @param p_pool - pointer to the pool.
+ * @param p_address - pointer to receive the sector address.
+ * @return int - 0 on success, -1 on failure or when no sector is free.
+ */
+int emb_ext_flash_pool_alloc(emb_ext_flash_pool_t *p_pool, uint32_t *p_address);
+
+/**
+ * @brief emb_ext_flash_pool_release give the sectors covering a range back to the pool once their data is no longer needed.
+ *
+ * @param p_pool - pointer to the pool.
+ * @param address - start of the range.
+ * @param len - length of the range in bytes.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_pool_release(emb_ext_flash_pool_t *p_pool, uint32_t address, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_pool_sync wait for a background erase to finish, call before accessing the chip other than through
+ * the pool.
+ *
+ * @param p_pool - pointer to the pool.
+ * @return int - 0 on success, -1 on failure, EXT_FLASH_ERR_TIMEOUT if the erase does not finish in the chip's maximum time.
+ */
+int emb_ext_flash_pool_sync(emb_ext_flash_pool_t *p_pool);
+
+/**
+ * @brief emb_ext_flash_pool_write write to a sector handed out by the pool, waiting for a background erase first.
+ *
+ * @param p_pool - pointer to the pool.
+ * @param address - the address to write to.
+ * @param data - pointer to the data to be written.
+ * @param len - the number of bytes to be written.
+ * @return int - number of bytes successfully written, negative on failure.
+ */
+int emb_ext_flash_pool_write(emb_ext_flash_pool_t *p_pool, uint32_t address, uint8_t *data, uint16_t len);
+
+/**
+ * @brief emb_ext_flash_pool_clean get the number of free sectors that are erased and ready to hand out.
+ *
+ * @param p_pool - pointer to the pool.
+ * @return uint16_t - number of clean sectors.
+ */
+uint16_t emb_ext_flash_pool_clean(emb_ext_flash_pool_t *p_pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_POOL_H_ */
@@ -0,0 +1,478 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_queue.h"
+
+// Marker for operations that have not been folded into another one
+#define QUEUE_NO_OWNER    0xFF
+
+// Private functions
+static uint32_t queue_now(emb_ext_flash_queue_t *p_queue)
+{
+   return(p_queue->p_intf->get_time_us ? p_queue->p_intf->get_time_us() : 0);
+}
+
+static uint8_t queue_older(emb_ext_flash_queue_op_t *a, emb_ext_flash_queue_op_t *b)
+{
+   return((int32_t)(a->seq - b->seq) < 0);
+}
+
+static uint8_t queue_overlap(emb_ext_flash_queue_op_t *a, uint32_t addr, uint32_t end)
+{
+   return(a->addr < end && addr < a->end);
+}
+
+// An operation can run once no older operation it conflicts with is still pending
+static uint8_t queue_runnable(emb_ext_flash_queue_t *p_queue, emb_ext_flash_queue_op_t *p_op)
+{
+   for (int i = 0; i < EXT_FLASH_QUEUE_DEPTH; i++)
+   {
+      emb_ext_flash_queue_op_t *o = &p_queue->ops[i];
+      if (!o->in_use || o == p_op || o->owner != QUEUE_NO_OWNER || !queue_older(o, p_op))
+      {
+         continue;
+      }
+      if (p_op->type == EXT_FLASH_QUEUE_OP_SYNC)
+      {
+         return(0);
+      }
+      if (o->type == EXT_FLASH_QUEUE_OP_SYNC)
+      {
+         if (p_op->type != EXT_FLASH_QUEUE_OP_READ)
+         {
+            return(0);
+         }
+         continue;
+      }
+      if ((o->type != EXT_FLASH_QUEUE_OP_READ || p_op->type != EXT_FLASH_QUEUE_OP_READ) && queue_overlap(o, p_op->addr, p_op->end))
+      {
+         return(0);
+      }
+   }
+
+   return(1);
+}
+
+// Account for the wait of an operation the first time a step touches it
+static void queue_start(emb_ext_flash_queue_t *p_queue, emb_ext_flash_queue_op_t *p_op)
+{
+   if (p_op->started)
+   {
+      return;
+   }
+   p_op->started = 1;
+
+   uint32_t wait = queue_now(p_queue) - p_op->submit_us;
+   if (p_op->type == EXT_FLASH_QUEUE_OP_READ)
+   {
+      p_queue->stat_read_wait_us += wait;
+      p_queue->stat_reads++;
+      if (wait > p_queue->stat_read_wait_max_us)
+      {
+         p_queue->stat_read_wait_max_us = wait;
+      }
+   }
+   else
+   {
+      p_queue->stat_other_wait_us += wait;
+      p_queue->stat_others++;
+      if (wait > p_queue->stat_other_wait_max_us)
+      {
+         p_queue->stat_other_wait_max_us = wait;
+      }
+   }
+}
+
+// Free an operation's slot and run its callback, the slot can be reused from inside the callback
+static void queue_complete(emb_ext_flash_queue_t *p_queue, emb_ext_flash_queue_op_t *p_op, int result)
+{
+   emb_ext_flash_queue_cb_t cb  = p_op->cb;
+   void                    *ctx = p_op->ctx;
+
+   p_op->in_use = 0;
+   p_queue->depth--;
+   p_queue->stat_completed++;
+   if (cb)
+   {
+      cb(ctx, result);
+   }
+}
+
+// Complete an erase together with every erase that was folded into it. All of them are freed before any callback runs so
+// that new submissions from the callbacks cannot fold into an erase that is already finished.
+static void queue_complete_erase(emb_ext_flash_queue_t *p_queue, emb_ext_flash_queue_op_t *p_op, int result)
+{
+   emb_ext_flash_queue_cb_t cbs[EXT_FLASH_QUEUE_DEPTH];
+   void                    *ctxs[EXT_FLASH_QUEUE_DEPTH];
+   uint8_t                  slot  = p_op - p_queue->ops;
+   uint8_t                  count = 0;
+
+   for (int i = 0; i < EXT_FLASH_QUEUE_DEPTH; i++)
+   {
+      emb_ext_flash_queue_op_t *o = &p_queue->ops[i];
+      if (o->in_use && (o == p_op || o->owner == slot))
+      {
+         cbs[count]    = o->cb;
+         ctxs[count++] = o->ctx;
+         o->in_use     = 0;
+         o->owner      = QUEUE_NO_OWNER;
+         p_queue->depth--;
+         p_queue->stat_completed++;
+      }
+   }
+
+   for (uint8_t i = 0; i < count; i++)
+   {
+      if (cbs[i])
+      {
+         cbs[i](ctxs[i], result);
+      }
+   }
+}
+
+// Fold a new erase into a pending erase it touches, provided nothing submitted in between depends on the order
+static uint8_t queue_fold_erase(emb_ext_flash_queue_t *p_queue, emb_ext_flash_queue_op_t *p_new)
+{
+   for (int i = 0; i < EXT_FLASH_QUEUE_DEPTH; i++)
+   {
+      emb_ext_flash_queue_op_t *p = &p_queue->ops[i];
+      if (!p->in_use || p == p_new || p->type != EXT_FLASH_QUEUE_OP_ERASE || p->owner != QUEUE_NO_OWNER)
+      {
+         continue;
+      }
+      if (p->end != p_new->addr && (p_new->end != p->addr || p->started))
+      {
+         continue;
+      }
+
+      uint8_t clear = 1;
+      for (int j = 0; j < EXT_FLASH_QUEUE_DEPTH && clear; j++)
+      {
+         emb_ext_flash_queue_op_t *o = &p_queue->ops[j];
+         if (o->in_use && o != p_new && queue_older(p, o) &&
+             (o->type == EXT_FLASH_QUEUE_OP_SYNC || queue_overlap(o, p_new->addr, p_new->end)))
+         {
+            clear = 0;
+         }
+      }
+      if (!clear)
+      {
+         continue;
+      }
+
+      if (p->end == p_new->addr)
+      {
+         p->end = p_new->end;
+      }
+      else
+      {
+         p->addr = p_new->addr;
+      }
+      if (p_new->priority < p->priority)
+      {
+         p->priority = p_new->priority;
+      }
+      p_new->owner = i;
+      p_queue->stat_merged_erases++;
+      return(1);
+   }
+
+   return(0);
+}
+
+static int queue_step_read(emb_ext_flash_queue_t *p_queue, emb_ext_flash_queue_op_t *p_op)
+{
+   uint32_t len = p_op->end - p_op->addr;
+   if (len > EXT_FLASH_SECTOR_SIZE)
+   {
+      len = EXT_FLASH_SECTOR_SIZE;
+   }
+
+   if (emb_ext_flash_read(p_queue->p_intf, p_op->addr, &p_op->data[p_op->done], len) != (int)len)
+   {
+      queue_complete(p_queue, p_op, -1);
+      return(-1);
+   }
+
+   p_op->addr += len;
+   p_op->done += len;
+   if (p_op->addr == p_op->end)
+   {
+      queue_complete(p_queue, p_op, p_op->done);
+   }
+
+   return(1);
+}
+
+// Program up to the end of the page, picking up any pending writes that continue the same page
+static int queue_step_write(emb_ext_flash_queue_t *p_queue, emb_ext_flash_queue_op_t *p_op)
+{
+   emb_ext_flash_queue_op_t *riders[EXT_FLASH_QUEUE_DEPTH];
+   uint8_t                   page[EXT_FLASH_PAGE_SIZE];
+   uint8_t                   count    = 0;
+   uint32_t                  page_end = (p_op->addr & ~(uint32_t)(EXT_FLASH_PAGE_SIZE - 1)) + EXT_FLASH_PAGE_SIZE;
+   uint32_t                  start    = p_op->addr;
+   uint32_t                  fill     = (p_op->end < page_end ? p_op->end : page_end) - start;
+
+   riders[count++] = p_op;
+   for (uint8_t found = 1; found && start + fill < page_end; )
+   {
+      found = 0;
+      for (int i = 0; i < EXT_FLASH_QUEUE_DEPTH; i++)
+      {
+         emb_ext_flash_queue_op_t *o = &p_queue->ops[i];
+         if (o->in_use && o->type == EXT_FLASH_QUEUE_OP_WRITE && o->addr == start + fill && queue_runnable(p_queue, o))
+         {
+            if (count == 1)
+            {
+               memcpy(page, &p_op->data[p_op->done], fill);
+            }
+            uint32_t len = (o->end < page_end ? o->end : page_end) - o->addr;
+            memcpy(&page[fill], &o->data[o->done], len);
+            fill           += len;
+            riders[count++] = o;
+            found           = 1;
+            break;
+         }
+      }
+   }
+
+   // Program straight from the caller's buffer unless something rode along
+   uint8_t *src = count > 1 ? page : &p_op->data[p_op->done];
+   int      rtn = emb_ext_flash_write(p_queue->p_intf, start, src, fill) == (int)fill ? 1 : -1;
+   p_queue->stat_programs++;
+   p_queue->stat_merged_writes += count - 1;
+
+   // Advance everything that took part
+   for (uint8_t i = 0; i < count; i++)
+   {
+      emb_ext_flash_queue_op_t *o   = riders[i];
+      uint32_t                  len = (o->end < page_end ? o->end : page_end) - o->addr;
+      queue_start(p_queue, o);
+      o->addr += len;
+      o->done += len;
+      if (rtn < 0 || o->addr == o->end)
+      {
+         queue_complete(p_queue, o, rtn < 0 ? -1 : (int)o->done);
+      }
+   }
+
+   return(rtn);
+}
+
+// Erase with the largest command that is aligned and fits in what is left
+static int queue_step_erase(emb_ext_flash_queue_t *p_queue, emb_ext_flash_queue_op_t *p_op)
+{
+   uint8_t  slot = p_op - p_queue->ops;
+   uint32_t len  = EXT_FLASH_SECTOR_SIZE;
+
+   if (!(p_op->addr % EXT_FLASH_BLOCK_64K_SIZE) && p_op->end - p_op->addr >= EXT_FLASH_BLOCK_64K_SIZE)
+   {
+      len = EXT_FLASH_BLOCK_64K_SIZE;
+   }
+   else if (!(p_op->addr % EXT_FLASH_BLOCK_32K_SIZE) && p_op->end - p_op->addr >= EXT_FLASH_BLOCK_32K_SIZE)
+   {
+      len = EXT_FLASH_BLOCK_32K_SIZE;
+   }
+
+   queue_start(p_queue, p_op);
+   for (int i = 0; i < EXT_FLASH_QUEUE_DEPTH; i++)
+   {
+      if (p_queue->ops[i].in_use && p_queue->ops[i].owner == slot)
+      {
+         queue_start(p_queue, &p_queue->ops[i]);
+      }
+   }
+
+   p_queue->stat_erases++;
+   p_queue->stat_block_erases += len > EXT_FLASH_SECTOR_SIZE;
+   if (emb_ext_flash_erase(p_queue->p_intf, p_op->addr, len) != 0)
+   {
+      queue_complete_erase(p_queue, p_op, -1);
+      return(-1);
+   }
+
+   p_op->addr += len;
+   if (p_op->addr == p_op->end)
+   {
+      queue_complete_erase(p_queue, p_op, 0);
+   }
+
+   return(1);
+}
+
+// Public functions
+int emb_ext_flash_queue_init(emb_ext_flash_queue_t *p_queue, emb_flash_intf_handle_t *p_intf)
+{
+   // Null check
+   if (!p_queue || !p_intf || !p_intf->initialized)
+   {
+      return(-1);
+   }
+
+   memset(p_queue, 0, sizeof(*p_queue));
+   p_queue->p_intf = p_intf;
+
+   return(0);
+}
+
+int emb_ext_flash_queue_submit(emb_ext_flash_queue_t *p_queue, uint8_t type, uint8_t priority, uint32_t address, uint8_t *data,
+                               uint32_t len, emb_ext_flash_queue_cb_t cb, void *ctx)
+{
+   // Null check
+   if (!p_queue || !p_queue->p_intf || type > EXT_FLASH_QUEUE_OP_SYNC)
+   {
+      return(-1);
+   }
+
+   // Validate the arguments for the type
+   if (type == EXT_FLASH_QUEUE_OP_SYNC)
+   {
+      address = 0;
+      len     = 0;
+   }
+   else if (!len || (type != EXT_FLASH_QUEUE_OP_ERASE && !data) ||
+            (type == EXT_FLASH_QUEUE_OP_ERASE && ((address % EXT_FLASH_SECTOR_SIZE) || (len % EXT_FLASH_SECTOR_SIZE))))
+   {
+      return(-1);
+   }
+
+   // Find a free slot
+   emb_ext_flash_queue_op_t *p_op = NULL;
+   for (int i = 0; i < EXT_FLASH_QUEUE_DEPTH && !p_op; i++)
+   {
+      if (!p_queue->ops[i].in_use)
+      {
+         p_op = &p_queue->ops[i];
+      }
+   }
+   if (!p_op)
+   {
+      return(-1);
+   }
+
+   memset(p_op, 0, sizeof(*p_op));
+   p_op->cb        = cb;
+   p_op->ctx       = ctx;
+   p_op->data      = data;
+   p_op->addr      = address;
+   p_op->end       = address + len;
+   p_op->seq       = p_queue->seq++;
+   p_op->submit_us = queue_now(p_queue);
+   p_op->owner     = QUEUE_NO_OWNER;
+   p_op->type      = type;
+   p_op->priority  = priority;
+   p_op->in_use    = 1;
+
+   p_queue->depth++;
+   p_queue->stat_submitted++;
+   if (p_queue->depth > p_queue->stat_max_depth)
+   {
+      p_queue->stat_max_depth = p_queue->depth;
+   }
+
+   if (type == EXT_FLASH_QUEUE_OP_ERASE)
+   {
+      queue_fold_erase(p_queue, p_op);
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_queue_poll(emb_ext_flash_queue_t *p_queue)
+{
+   // Null check
+   if (!p_queue || !p_queue->p_intf)
+   {
+      return(-1);
+   }
+
+   // Pick the most urgent runnable operation, reads first within a priority and then the oldest
+   emb_ext_flash_queue_op_t *best = NULL;
+   for (int i = 0; i < EXT_FLASH_QUEUE_DEPTH; i++)
+   {
+      emb_ext_flash_queue_op_t *o = &p_queue->ops[i];
+      if (!o->in_use || o->owner != QUEUE_NO_OWNER || !queue_runnable(p_queue, o))
+      {
+         continue;
+      }
+      if (best)
+      {
+         uint8_t o_read    = o->type == EXT_FLASH_QUEUE_OP_READ;
+         uint8_t best_read = best->type == EXT_FLASH_QUEUE_OP_READ;
+         if (o->priority > best->priority || (o->priority == best->priority && (best_read > o_read ||
+                                                                                (best_read == o_read && !queue_older(o, best)))))
+         {
+            continue;
+         }
+      }
+      best = o;
+   }
+   if (!best)
+   {
+      return(0);
+   }
+
+   switch (best->type)
+   {
+   case EXT_FLASH_QUEUE_OP_READ:
+      queue_start(p_queue, best);
+      return(queue_step_read(p_queue, best));
+
+   case EXT_FLASH_QUEUE_OP_WRITE:
+      return(queue_step_write(p_queue, best));
+
+   case EXT_FLASH_QUEUE_OP_ERASE:
+      return(queue_step_erase(p_queue, best));
+
+   default:
+      queue_start(p_queue, best);
+      queue_complete(p_queue, best, 0);
+      return(1);
+   }
+}
+
+int emb_ext_flash_queue_run(emb_ext_flash_queue_t *p_queue)
+{
+   int rtn = 0;
+   int step;
+
+   // Null check
+   if (!p_queue || !p_queue->p_intf)
+   {
+      return(-1);
+   }
+
+   // Keep going after a failure so every callback still runs
+   while ((step = emb_ext_flash_queue_poll(p_queue)) != 0)
+   {
+      if (step < 0)
+      {
+         rtn = -1;
+      }
+   }
+
+   return(rtn);
+}
+
+uint8_t emb_ext_flash_queue_depth(emb_ext_flash_queue_t *p_queue)
+{
+   return(p_queue ? p_queue->depth : 0);
+}
@@ -0,0 +1,176 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_QUEUE_H_
+#define EMB_EXT_FLASH_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Prioritised operation queue for sharing one chip between several tasks.
+ *
+ * Operations are submitted with a priority and a completion callback and are carried out in small steps by
+ * emb_ext_flash_queue_poll(): a read of up to one sector, one page program or one erase command. Every step picks the most
+ * urgent runnable operation, lowest priority value first, reads ahead of programs and erases of the same priority, and
+ * oldest first after that. An operation is not runnable while an older operation it overlaps with is pending, unless both
+ * are reads, so reordering never changes what a read returns. A sync completes once every operation submitted before it
+ * has, and holds back younger programs and erases until then.
+ *
+ * Page programs pick up any other pending writes that continue the same page so the page is programmed once, and an erase
+ * submitted right next to a pending erase is folded into it so that aligned runs of sectors go out as 32K or 64K block
+ * erases. Folded operations complete together.
+ */
+#ifndef EXT_FLASH_QUEUE_DEPTH
+#define EXT_FLASH_QUEUE_DEPTH    16
+#endif
+
+// Operation types
+#define EXT_FLASH_QUEUE_OP_READ     0
+#define EXT_FLASH_QUEUE_OP_WRITE    1
+#define EXT_FLASH_QUEUE_OP_ERASE    2
+#define EXT_FLASH_QUEUE_OP_SYNC     3
+
+// Suggested priorities, any value can be used, lower values run first
+#define EXT_FLASH_QUEUE_PRIO_HIGH      0
+#define EXT_FLASH_QUEUE_PRIO_NORMAL    8
+#define EXT_FLASH_QUEUE_PRIO_LOW       15
+
+/**
+ * @brief emb_ext_flash_queue_cb_t - completion callback. The result is the number of bytes transferred for reads and writes,
+ * 0 for erases and syncs and -1 on failure.
+ */
+typedef void (*emb_ext_flash_queue_cb_t)(void *ctx, int result);
+
+/**
+ * @brief emb_ext_flash_queue_op_t - a queued operation. Treat the contents as private.
+ */
+typedef struct
+{
+   // Completion callback and its context.
+   emb_ext_flash_queue_cb_t cb;
+   void                    *ctx;
+   // Caller's buffer, next address to process and exclusive end address.
+   uint8_t *data;
+   uint32_t addr;
+   uint32_t end;
+   // Number of bytes transferred so far.
+   uint32_t done;
+   // Submission order, submission time and the slot of the operation this one was folded into.
+   uint32_t seq;
+   uint32_t submit_us;
+   uint8_t  owner;
+   // Type, priority and flags.
+   uint8_t type;
+   uint8_t priority;
+   uint8_t in_use;
+   uint8_t started;
+} emb_ext_flash_queue_op_t;
+
+/**
+ * @brief emb_ext_flash_queue_t - operation queue for one interface handle. Treat the contents as private apart from the
+ * statistics. Wait times are measured with the handle's get_time_us and read as 0 without one.
+ */
+typedef struct
+{
+   // Pointer to the interface handle.
+   emb_flash_intf_handle_t *p_intf;
+   // Next submission sequence and the number of pending operations.
+   uint32_t seq;
+   uint8_t  depth;
+   // Statistics: deepest the queue has been, operations submitted and completed, writes that rode along with another
+   // write's page program, erases folded into a neighbour, page programs and erase commands issued, block erases among them.
+   uint8_t  stat_max_depth;
+   uint32_t stat_submitted;
+   uint32_t stat_completed;
+   uint32_t stat_merged_writes;
+   uint32_t stat_merged_erases;
+   uint32_t stat_programs;
+   uint32_t stat_erases;
+   uint32_t stat_block_erases;
+   // Statistics: total and longest time from submission to the first step, for reads and for everything else.
+   uint64_t stat_read_wait_us;
+   uint32_t stat_read_wait_max_us;
+   uint32_t stat_reads;
+   uint64_t stat_other_wait_us;
+   uint32_t stat_other_wait_max_us;
+   uint32_t stat_others;
+   // Operation slots.
+   emb_ext_flash_queue_op_t ops[EXT_FLASH_QUEUE_DEPTH];
+} emb_ext_flash_queue_t;
+
+/**
+ * @brief emb_ext_flash_queue_init initialise an empty queue on an interface handle.
+ *
+ * @param p_queue - pointer to the queue.
+ * @param p_intf - pointer to the interface handle.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_queue_init(emb_ext_flash_queue_t *p_queue, emb_flash_intf_handle_t *p_intf);
+
+/**
+ * @brief emb_ext_flash_queue_submit submit an operation. The buffer must stay valid until the callback has run.
+ *
+ * @param p_queue - pointer to the queue.
+ * @param type - one of the EXT_FLASH_QUEUE_OP_* types.
+ * @param priority - priority, lower values run first.
+ * @param address - start address, ignored for syncs.
+ * @param data - buffer to read into or write from, ignored for erases and syncs.
+ * @param len - number of bytes, erases must be sector aligned, ignored for syncs.
+ * @param cb - completion callback, may be NULL.
+ * @param ctx - context passed to the callback.
+ * @return int - 0 on success, -1 on bad arguments or if the queue is full.
+ */
+int emb_ext_flash_queue_submit(emb_ext_flash_queue_t *p_queue, uint8_t type, uint8_t priority, uint32_t address, uint8_t *data,
+                               uint32_t len, emb_ext_flash_queue_cb_t cb, void *ctx);
+
+/**
+ * @brief emb_ext_flash_queue_poll carry out one step of the most urgent runnable operation, running the callbacks of any
+ * operations it completes.
+ *
+ * @param p_queue - pointer to the queue.
+ * @return int - 1 if a step was taken, 0 if the queue is empty, -1 on failure.
+ */
+int emb_ext_flash_queue_poll(emb_ext_flash_queue_t *p_queue);
+
+/**
+ * @brief emb_ext_flash_queue_run poll until the queue is empty.
+ *
+ * @param p_queue - pointer to the queue.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_queue_run(emb_ext_flash_queue_t *p_queue);
+
+/**
+ * @brief emb_ext_flash_queue_depth get the number of pending operations.
+ *
+ * @param p_queue - pointer to the queue.
+ * @return uint8_t - number of pending operations.
+ */
+uint8_t emb_ext_flash_queue_depth(emb_ext_flash_queue_t *p_queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_QUEUE_H_ */
@@ -0,0 +1,478 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_crc.h"
+#include "emb_ext_flash_le.h"
+#include "emb_ext_flash_ts.h"
+
+// Sector header layout, the second half is programmed when the sector is full
+#define TS_SECTOR_MAGIC    0x31535354 // "TSS1"
+#define TS_OPEN_SIZE       16
+#define TS_SEAL_OFFSET     16
+#define TS_SEAL_SIZE       12
+
+// Timestamp of a record slot that has not been written
+#define TS_UNWRITTEN       0xFFFFFFFF
+
+// Private functions
+static uint32_t ts_sector_addr(emb_ext_flash_ts_t *p_ts, uint16_t sector)
+{
+   return(p_ts->start + (uint32_t)sector * EXT_FLASH_SECTOR_SIZE);
+}
+
+static uint32_t ts_rec_addr(emb_ext_flash_ts_t *p_ts, uint16_t sector, uint16_t rec)
+{
+   return(ts_sector_addr(p_ts, sector) + EXT_FLASH_TS_HEADER_SIZE + (uint32_t)rec * p_ts->rec_size);
+}
+
+// Sector at a position in ring order from the oldest
+static uint16_t ts_sector_at(emb_ext_flash_ts_t *p_ts, uint16_t pos)
+{
+   return((uint16_t)((p_ts->oldest + pos) % p_ts->sectors));
+}
+
+// Number of records in the sector at a position, only the newest sector is not full
+static uint16_t ts_recs_at(emb_ext_flash_ts_t *p_ts, uint16_t pos)
+{
+   return(pos + 1 == p_ts->count ? p_ts->fill : p_ts->recs_per_sector);
+}
+
+// Check value of a record, over its timestamp and payload
+static uint16_t ts_check(const uint8_t *rec, uint16_t payload_len)
+{
+   uint32_t crc = emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, rec, 4);
+
+   return((uint16_t)emb_ext_flash_crc32(crc, rec + EXT_FLASH_TS_RECORD_HEADER, payload_len));
+}
+
+// Read just the timestamp of a record, for the binary searches
+static uint32_t ts_read_time(emb_ext_flash_ts_t *p_ts, uint16_t sector, uint16_t rec)
+{
+   uint8_t buf[4];
+
+   p_ts->stat_search_reads++;
+   if (emb_ext_flash_read(p_ts->p_intf, ts_rec_addr(p_ts, sector, rec), buf, sizeof(buf)) != sizeof(buf))
+   {
+      return(TS_UNWRITTEN);
+   }
+
+   return(emb_ext_flash_get_u32(buf));
+}
+
+// Read and check a sector header, returns 0 with its sequence number and first timestamp if it is valid
+static int ts_read_header(emb_ext_flash_ts_t *p_ts, uint16_t sector, uint32_t *p_seq, uint32_t *p_first)
+{
+   uint8_t hdr[TS_OPEN_SIZE];
+
+   if (emb_ext_flash_read(p_ts->p_intf, ts_sector_addr(p_ts, sector), hdr, sizeof(hdr)) != sizeof(hdr) ||
+       emb_ext_flash_get_u32(hdr) != TS_SECTOR_MAGIC || emb_ext_flash_get_u32(hdr + 12) != emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, hdr, 12))
+   {
+      return(-1);
+   }
+
+   *p_seq   = emb_ext_flash_get_u32(hdr + 4);
+   *p_first = emb_ext_flash_get_u32(hdr + 8);
+   return(0);
+}
+
+// Program the last timestamp and record count of the full newest sector into its header
+static int ts_seal(emb_ext_flash_ts_t *p_ts)
+{
+   uint8_t seal[TS_SEAL_SIZE];
+   uint8_t seq[4];
+
+   emb_ext_flash_put_u32(seq, p_ts->seq);
+   emb_ext_flash_put_u32(seal, p_ts->t_last);
+   emb_ext_flash_put_u32(seal + 4, p_ts->fill);
+   emb_ext_flash_put_u32(seal + 8, emb_ext_flash_crc32(emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, seq, 4), seal, 8));
+
+   return(emb_ext_flash_write(p_ts->p_intf, ts_sector_addr(p_ts, p_ts->newest) + TS_SEAL_OFFSET, seal, sizeof(seal)) ==
+          sizeof(seal) ? 0 : -1);
+}
+
+// Start the next sector in the ring, dropping the oldest one when the ring is full
+static int ts_open_sector(emb_ext_flash_ts_t *p_ts, uint32_t timestamp)
+{
+   uint16_t sector = (uint16_t)((p_ts->newest + 1) % p_ts->sectors);
+   uint8_t  hdr[TS_OPEN_SIZE];
+
+   if (p_ts->count == p_ts->sectors)
+   {
+      p_ts->oldest = (uint16_t)((p_ts->oldest + 1) % p_ts->sectors);
+      p_ts->count--;
+   }
+
+   // Sectors not used since the format are still erased
+   if (p_ts->fresh && sector == p_ts->sectors - p_ts->fresh)
+   {
+      p_ts->fresh--;
+   }
+   else
+   {
+      if (emb_ext_flash_erase(p_ts->p_intf, ts_sector_addr(p_ts, sector), EXT_FLASH_SECTOR_SIZE) != 0)
+      {
+         return(-1);
+      }
+      p_ts->stat_erases++;
+   }
+
+   emb_ext_flash_put_u32(hdr, TS_SECTOR_MAGIC);
+   emb_ext_flash_put_u32(hdr + 4, p_ts->seq + 1);
+   emb_ext_flash_put_u32(hdr + 8, timestamp);
+   emb_ext_flash_put_u32(hdr + 12, emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, hdr, 12));
+   if (emb_ext_flash_write(p_ts->p_intf, ts_sector_addr(p_ts, sector), hdr, sizeof(hdr)) != sizeof(hdr))
+   {
+      return(-1);
+   }
+
+   if (!p_ts->count)
+   {
+      p_ts->oldest = sector;
+   }
+   p_ts->newest          = sector;
+   p_ts->seq            += 1;
+   p_ts->count          += 1;
+   p_ts->fill            = 0;
+   p_ts->closed          = 0;
+   p_ts->t_first[sector] = timestamp;
+
+   return(0);
+}
+
+static int ts_layout(emb_ext_flash_ts_t *p_ts, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len,
+                     uint16_t payload_len)
+{
+   // Null check
+   if (!p_ts || !p_intf || !p_intf->initialized || (start % EXT_FLASH_SECTOR_SIZE) || (len % EXT_FLASH_SECTOR_SIZE) ||
+       len < 2 * EXT_FLASH_SECTOR_SIZE || len / EXT_FLASH_SECTOR_SIZE > EXT_FLASH_TS_MAX_SECTORS || !payload_len ||
+       payload_len > EXT_FLASH_TS_MAX_PAYLOAD)
+   {
+      return(-1);
+   }
+
+   memset(p_ts, 0, sizeof(*p_ts));
+   p_ts->p_intf          = p_intf;
+   p_ts->start           = start;
+   p_ts->sectors         = (uint16_t)(len / EXT_FLASH_SECTOR_SIZE);
+   p_ts->payload_len     = payload_len;
+   p_ts->rec_size        = EXT_FLASH_TS_RECORD_HEADER + payload_len;
+   p_ts->recs_per_sector = (EXT_FLASH_SECTOR_SIZE - EXT_FLASH_TS_HEADER_SIZE) / p_ts->rec_size;
+   p_ts->newest          = p_ts->sectors - 1;
+
+   return(0);
+}
+
+// Pubic functions
+int emb_ext_flash_ts_format(emb_ext_flash_ts_t *p_ts, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len,
+                            uint16_t payload_len)
+{
+   if (ts_layout(p_ts, p_intf, start, len, payload_len) != 0)
+   {
+      return(-1);
+   }
+
+   for (uint32_t addr = start; addr < start + len; addr += EXT_FLASH_SECTOR_SIZE)
+   {
+      if (emb_ext_flash_erase(p_intf, addr, EXT_FLASH_SECTOR_SIZE) != 0)
+      {
+         return(-1);
+      }
+   }
+
+   if (emb_ext_flash_ts_mount(p_ts, p_intf, start, len, payload_len) != 0)
+   {
+      return(-1);
+   }
+   p_ts->fresh = p_ts->sectors;
+
+   return(0);
+}
+
+int emb_ext_flash_ts_mount(emb_ext_flash_ts_t *p_ts, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len,
+                           uint16_t payload_len)
+{
+   uint32_t seq   = 0;
+   uint32_t first = 0;
+
+   if (ts_layout(p_ts, p_intf, start, len, payload_len) != 0)
+   {
+      return(-1);
+   }
+
+   // The newest sector has the highest sequence number
+   for (uint16_t s = 0; s < p_ts->sectors; s++)
+   {
+      if (ts_read_header(p_ts, s, &seq, &first) == 0)
+      {
+         p_ts->t_first[s] = first;
+         if (!p_ts->count || seq > p_ts->seq)
+         {
+            p_ts->seq    = seq;
+            p_ts->newest = s;
+            p_ts->count  = 1;
+         }
+      }
+   }
+   if (!p_ts->count)
+   {
+      return(0);
+   }
+
+   // The ring runs back from it for as long as the sequence numbers count down
+   while (p_ts->count < p_ts->sectors)
+   {
+      uint16_t prev = (uint16_t)((p_ts->newest + p_ts->sectors - p_ts->count) % p_ts->sectors);
+      if (ts_read_header(p_ts, prev, &seq, &first) != 0 || seq != p_ts->seq - p_ts->count)
+      {
+         break;
+      }
+      p_ts->count++;
+   }
+   p_ts->oldest = (uint16_t)((p_ts->newest + p_ts->sectors + 1 - p_ts->count) % p_ts->sectors);
+
+   // Records are written in order, so the written ones are followed by unwritten ones
+   uint16_t lo = 0;
+   uint16_t hi = p_ts->recs_per_sector;
+   while (lo < hi)
+   {
+      uint16_t mid = (uint16_t)((lo + hi) / 2);
+      if (ts_read_time(p_ts, p_ts->newest, mid) != TS_UNWRITTEN)
+      {
+         lo = mid + 1;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+   p_ts->fill   = lo;
+   p_ts->t_last = p_ts->t_first[p_ts->newest];
+
+   // A power loss can only have torn the last record, the newest timestamp is the one before it if so
+   if (lo)
+   {
+      uint8_t rec[EXT_FLASH_TS_RECORD_HEADER + EXT_FLASH_TS_MAX_PAYLOAD];
+      if (emb_ext_flash_read(p_intf, ts_rec_addr(p_ts, p_ts->newest, lo - 1), rec, p_ts->rec_size) != p_ts->rec_size)
+      {
+         return(-1);
+      }
+      if ((rec[4] | (rec[5] << 8)) == ts_check(rec, payload_len))
+      {
+         p_ts->t_last = emb_ext_flash_get_u32(rec);
+      }
+      else
+      {
+         p_ts->closed = 1;
+         if (lo > 1)
+         {
+            p_ts->t_last = ts_read_time(p_ts, p_ts->newest, lo - 2);
+         }
+      }
+   }
+
+   // Mounting is not part of any query
+   p_ts->stat_search_reads = 0;
+
+   return(0);
+}
+
+int emb_ext_flash_ts_append(emb_ext_flash_ts_t *p_ts, uint32_t timestamp, const uint8_t *payload)
+{
+   uint8_t rec[EXT_FLASH_TS_RECORD_HEADER + EXT_FLASH_TS_MAX_PAYLOAD];
+
+   // Null check, timestamps never go backwards
+   if (!p_ts || !p_ts->p_intf || !payload || timestamp == TS_UNWRITTEN || (p_ts->count && timestamp < p_ts->t_last))
+   {
+      return(-1);
+   }
+
+   // Move on to the next sector when the newest is full
+   if (!p_ts->count || p_ts->fill == p_ts->recs_per_sector || p_ts->closed)
+   {
+      if ((p_ts->count && ts_seal(p_ts) != 0) || ts_open_sector(p_ts, timestamp) != 0)
+      {
+         return(-1);
+      }
+   }
+
+   emb_ext_flash_put_u32(rec, timestamp);
+   memcpy(rec + EXT_FLASH_TS_RECORD_HEADER, payload, p_ts->payload_len);
+   uint16_t check = ts_check(rec, p_ts->payload_len);
+   rec[4] = check & 0xFF;
+   rec[5] = check >> 8;
+   if (emb_ext_flash_write(p_ts->p_intf, ts_rec_addr(p_ts, p_ts->newest, p_ts->fill), rec, p_ts->rec_size) != p_ts->rec_size)
+   {
+      return(-1);
+   }
+
+   p_ts->fill++;
+   p_ts->t_last = timestamp;
+   p_ts->stat_appends++;
+
+   return(0);
+}
+
+int emb_ext_flash_ts_query(emb_ext_flash_ts_t *p_ts, emb_ext_flash_ts_cursor_t *p_cur, uint32_t t_start, uint32_t t_end)
+{
+   // Null check
+   if (!p_ts || !p_ts->p_intf || !p_cur)
+   {
+      return(-1);
+   }
+
+   memset(p_cur, 0, sizeof(*p_cur));
+   p_cur->t_end      = t_end;
+   p_cur->oldest_seq = p_ts->seq + 1 - p_ts->count;
+   if (!p_ts->count || t_start > t_end || t_start > p_ts->t_last)
+   {
+      p_cur->done = 1;
+      return(0);
+   }
+
+   // The range starts in the sector before the first one that starts at or after t_start, found from the RAM index
+   uint16_t lo = 0;
+   uint16_t hi = p_ts->count;
+   while (lo < hi)
+   {
+      uint16_t mid = (uint16_t)((lo + hi) / 2);
+      if (p_ts->t_first[ts_sector_at(p_ts, mid)] < t_start)
+      {
+         lo = mid + 1;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+   p_cur->pos = lo ? lo - 1 : 0;
+
+   // Then the first record at or after t_start in that sector
+   uint16_t sector = ts_sector_at(p_ts, p_cur->pos);
+   lo = 0;
+   hi = ts_recs_at(p_ts, p_cur->pos);
+   while (lo < hi)
+   {
+      uint16_t mid = (uint16_t)((lo + hi) / 2);
+      if (ts_read_time(p_ts, sector, mid) < t_start)
+      {
+         lo = mid + 1;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+   p_cur->rec = lo;
+
+   return(0);
+}
+
+int emb_ext_flash_ts_next(emb_ext_flash_ts_t *p_ts, emb_ext_flash_ts_cursor_t *p_cur, uint32_t *p_timestamp, uint8_t *payload)
+{
+   // Null check
+   if (!p_ts || !p_ts->p_intf || !p_cur || !p_timestamp)
+   {
+      return(-1);
+   }
+
+   while (!p_cur->done)
+   {
+      // The sector the query is in has been erased
+      if (p_cur->oldest_seq != p_ts->seq + 1 - p_ts->count)
+      {
+         return(-1);
+      }
+
+      // Refill the buffer with as many records of the current sector as fit
+      if (p_cur->buf_next == p_cur->buf_recs)
+      {
+         if (p_cur->pos >= p_ts->count)
+         {
+            p_cur->done = 1;
+            break;
+         }
+         uint16_t recs = ts_recs_at(p_ts, p_cur->pos);
+         if (p_cur->rec >= recs)
+         {
+            // Only the newest sector can be short, nothing follows it
+            if (p_cur->pos + 1 == p_ts->count)
+            {
+               p_cur->done = 1;
+               break;
+            }
+            p_cur->pos++;
+            p_cur->rec = 0;
+            continue;
+         }
+
+         uint16_t n = (uint16_t)(EXT_FLASH_TS_STREAM_SIZE / p_ts->rec_size);
+         if (n > recs - p_cur->rec)
+         {
+            n = recs - p_cur->rec;
+         }
+         p_ts->stat_stream_reads++;
+         if (emb_ext_flash_read(p_ts->p_intf, ts_rec_addr(p_ts, ts_sector_at(p_ts, p_cur->pos), p_cur->rec), p_cur->buf,
+                                (uint16_t)(n * p_ts->rec_size)) != n * p_ts->rec_size)
+         {
+            return(-1);
+         }
+         p_cur->rec     += n;
+         p_cur->buf_recs = n;
+         p_cur->buf_next = 0;
+      }
+
+      const uint8_t *rec = p_cur->buf + (uint32_t)p_cur->buf_next++ * p_ts->rec_size;
+      uint32_t       t   = emb_ext_flash_get_u32(rec);
+
+      // Skip torn records
+      if ((rec[4] | (rec[5] << 8)) != ts_check(rec, p_ts->payload_len))
+      {
+         continue;
+      }
+      if (t > p_cur->t_end)
+      {
+         p_cur->done = 1;
+         break;
+      }
+
+      *p_timestamp = t;
+      if (payload)
+      {
+         memcpy(payload, rec + EXT_FLASH_TS_RECORD_HEADER, p_ts->payload_len);
+      }
+      return(1);
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_ts_span(emb_ext_flash_ts_t *p_ts, uint32_t *p_first, uint32_t *p_last)
+{
+   // Null check
+   if (!p_ts || !p_first || !p_last || !p_ts->count)
+   {
+      return(-1);
+   }
+
+   *p_first = p_ts->t_first[p_ts->oldest];
+   *p_last  = p_ts->t_last;
+
+   return(0);
+}
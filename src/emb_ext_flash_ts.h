@@ -0,0 +1,190 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_TS_H_
+#define EMB_EXT_FLASH_TS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Time-indexed record store for timestamped samples with fast range queries.
+ *
+ * The region is a ring of sectors written in order, and the oldest sector is erased when the ring is full. Each sector
+ * starts with a header carrying its sequence number and the timestamp of its first record. Once the sector is full, the
+ * timestamp of its last record and the record count are programmed into the header too. After the header the sector holds
+ * fixed size records of a timestamp, a check value and the payload. Timestamps never decrease, so the sectors in ring order
+ * and the records in each sector are sorted.
+ *
+ * Mount reads every sector header once and keeps the first timestamp of each sector in RAM, which is all the index there
+ * is. A range query binary searches that index for the first sector without any flash reads, binary searches the records of
+ * that sector with O(log n) small reads, then streams the matching records a buffer at a time. Records whose check value
+ * does not match, such as one torn by a power loss, are skipped. A torn record has some of its bits still set, so its timestamp
+ * can only read high. Mount therefore closes a sector that ends in a torn record and appending carries on in the next sector,
+ * which keeps every sector sorted.
+ */
+#ifndef EXT_FLASH_TS_MAX_SECTORS
+#define EXT_FLASH_TS_MAX_SECTORS     256
+#endif
+
+// Largest payload of a record, and the size of the buffer a query streams records through
+#ifndef EXT_FLASH_TS_MAX_PAYLOAD
+#define EXT_FLASH_TS_MAX_PAYLOAD     64
+#endif
+#ifndef EXT_FLASH_TS_STREAM_SIZE
+#define EXT_FLASH_TS_STREAM_SIZE     256
+#endif
+
+// Size of the sector header, and of the timestamp and check value in front of each payload
+#define EXT_FLASH_TS_HEADER_SIZE     32
+#define EXT_FLASH_TS_RECORD_HEADER   6
+
+/**
+ * @brief emb_ext_flash_ts_t - time-series store state. Treat the contents as private apart from the statistics.
+ */
+typedef struct
+{
+   // Pointer to the interface handle.
+   emb_flash_intf_handle_t *p_intf;
+   // Start address of the region and its number of sectors.
+   uint32_t start;
+   uint16_t sectors;
+   // Payload and record size, and the number of records in a sector.
+   uint16_t payload_len;
+   uint16_t rec_size;
+   uint16_t recs_per_sector;
+   // Oldest sector, newest sector and the number of sectors in use.
+   uint16_t oldest;
+   uint16_t newest;
+   uint16_t count;
+   // Sectors at the end of the ring that are erased and have never been used since the last format.
+   uint16_t fresh;
+   // Sequence number of the newest sector, its number of records and the newest timestamp.
+   uint32_t seq;
+   uint16_t fill;
+   uint32_t t_last;
+   // Set when the newest sector ends in a torn record, appends then go to the next sector.
+   uint8_t closed;
+   // First timestamp of each sector.
+   uint32_t t_first[EXT_FLASH_TS_MAX_SECTORS];
+   // Statistics: records appended, sectors erased, reads made to find the start of a query and to stream its records.
+   uint32_t stat_appends;
+   uint32_t stat_erases;
+   uint32_t stat_search_reads;
+   uint32_t stat_stream_reads;
+} emb_ext_flash_ts_t;
+
+/**
+ * @brief emb_ext_flash_ts_cursor_t - position of a range query. Treat the contents as private.
+ */
+typedef struct
+{
+   // Last timestamp of the range.
+   uint32_t t_end;
+   // Sector as a position in ring order from the oldest, and the record in it.
+   uint16_t pos;
+   uint16_t rec;
+   // Sequence number of the oldest sector when the query started.
+   uint32_t oldest_seq;
+   // Buffered records and the next one to return.
+   uint16_t buf_recs;
+   uint16_t buf_next;
+   uint8_t  done;
+   uint8_t  buf[EXT_FLASH_TS_STREAM_SIZE];
+} emb_ext_flash_ts_cursor_t;
+
+/**
+ * @brief emb_ext_flash_ts_format erase the region and mount an empty store.
+ *
+ * @param p_ts - pointer to the store.
+ * @param p_intf - pointer to the interface handle.
+ * @param start - sector aligned start address of the region.
+ * @param len - length of the region, a multiple of EXT_FLASH_SECTOR_SIZE of at least two sectors.
+ * @param payload_len - payload size of every record, up to EXT_FLASH_TS_MAX_PAYLOAD.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_ts_format(emb_ext_flash_ts_t *p_ts, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len,
+                            uint16_t payload_len);
+
+/**
+ * @brief emb_ext_flash_ts_mount mount a store, reading each sector header once to rebuild the index and finding the end of
+ * the newest sector by binary search.
+ *
+ * @param p_ts - pointer to the store.
+ * @param p_intf - pointer to the interface handle.
+ * @param start - start address of the region.
+ * @param len - length of the region.
+ * @param payload_len - payload size the store was formatted with.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_ts_mount(emb_ext_flash_ts_t *p_ts, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t len,
+                           uint16_t payload_len);
+
+/**
+ * @brief emb_ext_flash_ts_append append a record, erasing the oldest sector when the ring is full.
+ *
+ * @param p_ts - pointer to the store.
+ * @param timestamp - timestamp of the record, no older than the newest record, and not 0xFFFFFFFF.
+ * @param payload - pointer to payload_len bytes of payload.
+ * @return int - 0 on success, -1 on failure or if the timestamp goes backwards.
+ */
+int emb_ext_flash_ts_append(emb_ext_flash_ts_t *p_ts, uint32_t timestamp, const uint8_t *payload);
+
+/**
+ * @brief emb_ext_flash_ts_query start a query for the records with timestamps from t_start to t_end inclusive.
+ *
+ * @param p_ts - pointer to the store.
+ * @param p_cur - pointer to the cursor.
+ * @param t_start - first timestamp of the range.
+ * @param t_end - last timestamp of the range.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_ts_query(emb_ext_flash_ts_t *p_ts, emb_ext_flash_ts_cursor_t *p_cur, uint32_t t_start, uint32_t t_end);
+
+/**
+ * @brief emb_ext_flash_ts_next get the next record of a query, oldest first. Records appended during the query are
+ * returned when they fall in the range, but an append that erases the oldest sector invalidates the query.
+ *
+ * @param p_ts - pointer to the store.
+ * @param p_cur - pointer to the cursor.
+ * @param p_timestamp - pointer to receive the timestamp.
+ * @param payload - buffer to receive payload_len bytes of payload, may be NULL.
+ * @return int - 1 when a record was returned, 0 at the end of the range, -1 on failure or when the query was invalidated.
+ */
+int emb_ext_flash_ts_next(emb_ext_flash_ts_t *p_ts, emb_ext_flash_ts_cursor_t *p_cur, uint32_t *p_timestamp, uint8_t *payload);
+
+/**
+ * @brief emb_ext_flash_ts_span get the timestamps of the oldest and the newest retained records.
+ *
+ * @param p_ts - pointer to the store.
+ * @param p_first - pointer to receive the oldest timestamp.
+ * @param p_last - pointer to receive the newest timestamp.
+ * @return int - 0 on success, -1 if the store is empty.
+ */
+int emb_ext_flash_ts_span(emb_ext_flash_ts_t *p_ts, uint32_t *p_first, uint32_t *p_last);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_TS_H_ */
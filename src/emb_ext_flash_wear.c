@@ -0,0 +1,391 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_crc.h"
+#include "emb_ext_flash_le.h"
+#include "emb_ext_flash_wear.h"
+
+// Store sector layout, the header is programmed last and commits the snapshot
+#define WEAR_MAGIC          0x31524557 // "WER1"
+#define WEAR_HEADER_SIZE    16
+#define WEAR_LOG_EMPTY      0xFFFF
+
+// Counts and log entries moved per flash access
+#define WEAR_CHUNK_SIZE     64
+#define WEAR_CHUNK_COUNTS   ((uint16_t)(WEAR_CHUNK_SIZE / 4))
+#define WEAR_CHUNK_ENTRIES  ((uint16_t)(WEAR_CHUNK_SIZE / 2))
+
+// Private functions
+static uint32_t wear_store_addr(emb_ext_flash_wear_t *p_wear, uint8_t i)
+{
+   return(p_wear->store + (uint32_t)i * EXT_FLASH_SECTOR_SIZE);
+}
+
+// Offset of the log in a store sector and the number of entries it holds
+static uint32_t wear_log_offset(emb_ext_flash_wear_t *p_wear)
+{
+   return(WEAR_HEADER_SIZE + (uint32_t)p_wear->sectors * 4);
+}
+
+static uint16_t wear_log_size(emb_ext_flash_wear_t *p_wear)
+{
+   return((uint16_t)((EXT_FLASH_SECTOR_SIZE - wear_log_offset(p_wear)) / 2));
+}
+
+// Write every count to a store sector, the erase of the store sector is counted before the counts are written. The store
+// is written with bounded waits, so a stuck chip fails the snapshot rather than hanging the erase that triggered it.
+static int wear_write_snapshot(emb_ext_flash_wear_t *p_wear, uint8_t i)
+{
+   uint32_t addr = wear_store_addr(p_wear, i);
+   uint8_t  chunk[WEAR_CHUNK_SIZE];
+   uint8_t  hdr[WEAR_HEADER_SIZE];
+   uint32_t crc = EXT_FLASH_CRC32_INIT;
+
+   if (emb_ext_flash_erase_timeout(p_wear->p_intf, addr, EXT_FLASH_SECTOR_SIZE, 0) != 0)
+   {
+      return(-1);
+   }
+
+   for (uint16_t s = 0; s < p_wear->sectors; s += WEAR_CHUNK_COUNTS)
+   {
+      uint16_t n = (p_wear->sectors - s) < WEAR_CHUNK_COUNTS ? (p_wear->sectors - s) : WEAR_CHUNK_COUNTS;
+      for (uint16_t j = 0; j < n; j++)
+      {
+         emb_ext_flash_put_u32(&chunk[j * 4], p_wear->counts[s + j]);
+      }
+      crc = emb_ext_flash_crc32(crc, chunk, n * 4);
+      if (emb_ext_flash_write_timeout(p_wear->p_intf, addr + WEAR_HEADER_SIZE + s * 4, chunk, n * 4, 0) != n * 4)
+      {
+         return(-1);
+      }
+   }
+
+   emb_ext_flash_put_u32(hdr, WEAR_MAGIC);
+   emb_ext_flash_put_u32(&hdr[4], p_wear->seq + 1);
+   emb_ext_flash_put_u32(&hdr[8], p_wear->sectors);
+   emb_ext_flash_put_u32(&hdr[12], emb_ext_flash_crc32(crc, hdr, 12));
+
+   return(emb_ext_flash_write_timeout(p_wear->p_intf, addr, hdr, WEAR_HEADER_SIZE, 0) == WEAR_HEADER_SIZE ? 0 : -1);
+}
+
+// Write a snapshot to the other store sector and make it the active one, erases meanwhile are only counted
+static int wear_snapshot(emb_ext_flash_wear_t *p_wear)
+{
+   p_wear->busy = 1;
+   int rtn = wear_write_snapshot(p_wear, p_wear->active ^ 1);
+   p_wear->busy = 0;
+   if (rtn != 0)
+   {
+      return(-1);
+   }
+
+   p_wear->active  ^= 1;
+   p_wear->seq     += 1;
+   p_wear->log_next = 0;
+   p_wear->stat_snapshots++;
+
+   return(0);
+}
+
+// Load the snapshot of a store sector into the counts, returns 0 if it is intact
+static int wear_load(emb_ext_flash_wear_t *p_wear, uint8_t i, const uint8_t *hdr)
+{
+   uint8_t  chunk[WEAR_CHUNK_SIZE];
+   uint32_t addr = wear_store_addr(p_wear, i);
+   uint32_t crc  = EXT_FLASH_CRC32_INIT;
+
+   for (uint16_t s = 0; s < p_wear->sectors; s += WEAR_CHUNK_COUNTS)
+   {
+      uint16_t n = (p_wear->sectors - s) < WEAR_CHUNK_COUNTS ? (p_wear->sectors - s) : WEAR_CHUNK_COUNTS;
+      if (emb_ext_flash_read(p_wear->p_intf, addr + WEAR_HEADER_SIZE + s * 4, chunk, n * 4) != n * 4)
+      {
+         return(-1);
+      }
+      crc = emb_ext_flash_crc32(crc, chunk, n * 4);
+      for (uint16_t j = 0; j < n; j++)
+      {
+         p_wear->counts[s + j] = emb_ext_flash_get_u32(&chunk[j * 4]);
+      }
+   }
+
+   return(emb_ext_flash_crc32(crc, hdr, 12) == emb_ext_flash_get_u32(&hdr[12]) ? 0 : -1);
+}
+
+// Add the erases logged since the snapshot of the active store sector
+static int wear_replay(emb_ext_flash_wear_t *p_wear)
+{
+   uint8_t  chunk[WEAR_CHUNK_SIZE];
+   uint32_t addr = wear_store_addr(p_wear, p_wear->active) + wear_log_offset(p_wear);
+   uint16_t size = wear_log_size(p_wear);
+
+   while (p_wear->log_next < size)
+   {
+      uint16_t n = (size - p_wear->log_next) < WEAR_CHUNK_ENTRIES ? (size - p_wear->log_next) : WEAR_CHUNK_ENTRIES;
+      if (emb_ext_flash_read(p_wear->p_intf, addr + p_wear->log_next * 2, chunk, n * 2) != n * 2)
+      {
+         return(-1);
+      }
+      for (uint16_t j = 0; j < n; j++)
+      {
+         uint16_t e = chunk[j * 2] | (chunk[j * 2 + 1] << 8);
+         if (e == WEAR_LOG_EMPTY)
+         {
+            return(0);
+         }
+         // An entry torn by a power loss names no tracked sector, it still takes up its slot
+         if (e < p_wear->sectors)
+         {
+            p_wear->counts[e]++;
+         }
+         p_wear->log_next++;
+      }
+   }
+
+   return(0);
+}
+
+// Erase hook, counts the tracked sectors an erase covers and logs them ahead of the erase. The erase goes ahead whatever
+// happens to the log, so a failed write only shows up in the statistics.
+static void wear_hook(void *p_ctx, uint32_t address, uint32_t len)
+{
+   emb_ext_flash_wear_t *p_wear = (emb_ext_flash_wear_t *)p_ctx;
+   uint64_t              end    = (uint64_t)p_wear->base + (uint64_t)p_wear->sectors * EXT_FLASH_SECTOR_SIZE;
+   uint64_t              last   = (uint64_t)address + len;
+   uint32_t              first  = address & ~(uint32_t)(EXT_FLASH_SECTOR_SIZE - 1);
+   uint8_t               log[32];
+   uint16_t              n = 0;
+
+   if (first < p_wear->base)
+   {
+      first = p_wear->base;
+   }
+   if (last > end)
+   {
+      last = end;
+   }
+
+   for (uint64_t addr = first; addr < last; addr += EXT_FLASH_SECTOR_SIZE)
+   {
+      uint16_t s = (uint16_t)((addr - p_wear->base) / EXT_FLASH_SECTOR_SIZE);
+      p_wear->counts[s]++;
+      if (p_wear->store == EXT_FLASH_WEAR_NO_STORE || p_wear->busy)
+      {
+         continue;
+      }
+
+      log[n * 2]     = s & 0xFF;
+      log[n * 2 + 1] = s >> 8;
+      n++;
+
+      // Write the entries out a buffer at a time, or take a snapshot that already holds them once the log is full
+      if (n == sizeof(log) / 2 || addr + EXT_FLASH_SECTOR_SIZE >= last)
+      {
+         if (p_wear->log_next + n > wear_log_size(p_wear))
+         {
+            p_wear->stat_failures += wear_snapshot(p_wear) != 0;
+         }
+         else
+         {
+            uint32_t at = wear_store_addr(p_wear, p_wear->active) + wear_log_offset(p_wear) + p_wear->log_next * 2;
+            p_wear->stat_failures   += emb_ext_flash_write_timeout(p_wear->p_intf, at, log, n * 2, 0) != n * 2;
+            p_wear->log_next        += n;
+            p_wear->stat_log_entries += n;
+         }
+         n = 0;
+      }
+   }
+}
+
+// Pubic functions
+int emb_ext_flash_wear_attach(emb_ext_flash_wear_t *p_wear, emb_flash_intf_handle_t *p_intf, uint32_t base, uint16_t sectors,
+                              uint32_t store)
+{
+   uint8_t hdr[2][WEAR_HEADER_SIZE];
+   int     order[2];
+
+   // Null check, and leave a hook someone else installed alone
+   if (!p_wear || !p_intf || !p_intf->initialized || (base % EXT_FLASH_SECTOR_SIZE) || !sectors ||
+       sectors > EXT_FLASH_WEAR_MAX_SECTORS || (store != EXT_FLASH_WEAR_NO_STORE && (store % EXT_FLASH_SECTOR_SIZE)) ||
+       (p_intf->erase_hook && p_intf->p_erase_ctx != p_wear))
+   {
+      return(-1);
+   }
+
+   memset(p_wear, 0, sizeof(*p_wear));
+   p_wear->p_intf  = p_intf;
+   p_wear->base    = base;
+   p_wear->sectors = sectors;
+   p_wear->store   = store;
+   p_wear->active  = 1;
+
+   if (store != EXT_FLASH_WEAR_NO_STORE)
+   {
+      // Try the newer snapshot first and fall back to the older one
+      for (uint8_t i = 0; i < 2; i++)
+      {
+         if (emb_ext_flash_read(p_intf, wear_store_addr(p_wear, i), hdr[i], WEAR_HEADER_SIZE) != WEAR_HEADER_SIZE)
+         {
+            return(-1);
+         }
+         order[i] = emb_ext_flash_get_u32(hdr[i]) == WEAR_MAGIC && emb_ext_flash_get_u32(&hdr[i][8]) == sectors;
+      }
+      int first = (order[0] && order[1]) ? (emb_ext_flash_get_u32(&hdr[1][4]) > emb_ext_flash_get_u32(&hdr[0][4])) : order[1] ? 1 : 0;
+      int found = 0;
+      for (int k = 0; k < 2 && !found; k++)
+      {
+         uint8_t i = (uint8_t)(k ? first ^ 1 : first);
+         if (order[i] && wear_load(p_wear, i, hdr[i]) == 0)
+         {
+            p_wear->active = i;
+            p_wear->seq    = emb_ext_flash_get_u32(&hdr[i][4]);
+            found          = 1;
+         }
+      }
+
+      if (found)
+      {
+         if (wear_replay(p_wear) != 0)
+         {
+            return(-1);
+         }
+      }
+      else
+      {
+         memset(p_wear->counts, 0, sizeof(p_wear->counts));
+      }
+   }
+
+   p_intf->erase_hook  = wear_hook;
+   p_intf->p_erase_ctx = p_wear;
+
+   // A new store starts with a snapshot of nothing but its own erase
+   if (store != EXT_FLASH_WEAR_NO_STORE && !p_wear->seq)
+   {
+      return(wear_snapshot(p_wear));
+   }
+
+   return(0);
+}
+
+void emb_ext_flash_wear_detach(emb_ext_flash_wear_t *p_wear)
+{
+   // Null check
+   if (!p_wear || !p_wear->p_intf)
+   {
+      return;
+   }
+
+   if (p_wear->p_intf->p_erase_ctx == p_wear)
+   {
+      p_wear->p_intf->erase_hook  = NULL;
+      p_wear->p_intf->p_erase_ctx = NULL;
+   }
+}
+
+int emb_ext_flash_wear_sync(emb_ext_flash_wear_t *p_wear)
+{
+   // Null check
+   if (!p_wear || !p_wear->p_intf || p_wear->store == EXT_FLASH_WEAR_NO_STORE)
+   {
+      return(-1);
+   }
+
+   return(wear_snapshot(p_wear));
+}
+
+uint32_t emb_ext_flash_wear_count(emb_ext_flash_wear_t *p_wear, uint32_t address)
+{
+   // Null check
+   if (!p_wear || address < p_wear->base || (address - p_wear->base) / EXT_FLASH_SECTOR_SIZE >= p_wear->sectors)
+   {
+      return(0);
+   }
+
+   return(p_wear->counts[(address - p_wear->base) / EXT_FLASH_SECTOR_SIZE]);
+}
+
+int emb_ext_flash_wear_summary(emb_ext_flash_wear_t *p_wear, uint32_t *p_min, uint32_t *p_max, uint32_t *p_total)
+{
+   // Null check
+   if (!p_wear || !p_wear->sectors || !p_min || !p_max || !p_total)
+   {
+      return(-1);
+   }
+
+   *p_min   = p_wear->counts[0];
+   *p_max   = p_wear->counts[0];
+   *p_total = 0;
+   for (uint16_t s = 0; s < p_wear->sectors; s++)
+   {
+      *p_min    = p_wear->counts[s] < *p_min ? p_wear->counts[s] : *p_min;
+      *p_max    = p_wear->counts[s] > *p_max ? p_wear->counts[s] : *p_max;
+      *p_total += p_wear->counts[s];
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_wear_histogram(emb_ext_flash_wear_t *p_wear, uint32_t bin_width, uint16_t *bins, uint16_t nbins)
+{
+   // Null check
+   if (!p_wear || !bin_width || !bins || !nbins)
+   {
+      return(-1);
+   }
+
+   memset(bins, 0, nbins * sizeof(*bins));
+   for (uint16_t s = 0; s < p_wear->sectors; s++)
+   {
+      uint32_t bin = p_wear->counts[s] / bin_width;
+      bins[bin < nbins ? bin : nbins - 1u]++;
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_wear_least_worn(emb_ext_flash_wear_t *p_wear, const uint8_t *free_map, uint32_t *p_address)
+{
+   uint16_t pick = 0xFFFF;
+
+   // Null check
+   if (!p_wear || !p_address)
+   {
+      return(-1);
+   }
+
+   for (uint16_t s = 0; s < p_wear->sectors; s++)
+   {
+      if (free_map && !((free_map[s >> 3] >> (s & 7)) & 1))
+      {
+         continue;
+      }
+      if (pick == 0xFFFF || p_wear->counts[s] < p_wear->counts[pick])
+      {
+         pick = s;
+      }
+   }
+   if (pick == 0xFFFF)
+   {
+      return(-1);
+   }
+
+   *p_address = p_wear->base + (uint32_t)pick * EXT_FLASH_SECTOR_SIZE;
+   return(0);
+}
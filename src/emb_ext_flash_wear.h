@@ -0,0 +1,155 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_WEAR_H_
+#define EMB_EXT_FLASH_WEAR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/*
+ * Per-sector erase counting through the erase hook of the interface handle.
+ *
+ * Once attached, every erase the driver issues through emb_ext_flash_erase(), emb_ext_flash_chip_erase(),
+ * emb_ext_flash_erase_begin() or a batch is counted against the 4K sectors it covers, as long as they fall in the tracked
+ * region. The counts always live in RAM. They can optionally be persisted to a store of two sectors. Each store sector holds
+ * a snapshot of every count followed by a log with one 2 byte entry per erased sector. The hook runs before the erase
+ * command is sent, so a log entry is written ahead of its erase and a power loss can only make a count high. When the log
+ * fills up, a new snapshot is written to the other store sector. The erases of the store itself are counted when the store
+ * lies in the tracked region.
+ *
+ * emb_ext_flash_wear_least_worn() picks the free sector with the fewest erases, for allocators that want to level wear,
+ * and the summary and histogram functions show how the erases are spread.
+ */
+#ifndef EXT_FLASH_WEAR_MAX_SECTORS
+#define EXT_FLASH_WEAR_MAX_SECTORS    256
+#endif
+
+// Store address for counts kept in RAM only
+#define EXT_FLASH_WEAR_NO_STORE       0xFFFFFFFF
+
+/**
+ * @brief emb_ext_flash_wear_t - erase counter state. Treat the contents as private apart from the counts and the statistics.
+ */
+typedef struct
+{
+   // Pointer to the interface handle.
+   emb_flash_intf_handle_t *p_intf;
+   // Address of the first tracked sector and the number of tracked sectors.
+   uint32_t base;
+   uint16_t sectors;
+   // Address of the two store sectors, EXT_FLASH_WEAR_NO_STORE when the counts are not persisted.
+   uint32_t store;
+   // Store sector holding the newest snapshot, its sequence number and the next free log entry in it.
+   uint8_t  active;
+   uint32_t seq;
+   uint16_t log_next;
+   // Set while a snapshot is written, erases are then only counted in RAM.
+   uint8_t busy;
+   // Statistics: log entries and snapshots written, and log writes or snapshots of the erase hook that failed. After a
+   // failure the counts in RAM are still right but the store may be missing erases until the next successful snapshot.
+   uint32_t stat_log_entries;
+   uint32_t stat_snapshots;
+   uint32_t stat_failures;
+   // Erase count of each tracked sector.
+   uint32_t counts[EXT_FLASH_WEAR_MAX_SECTORS];
+} emb_ext_flash_wear_t;
+
+/**
+ * @brief emb_ext_flash_wear_attach start counting the erases of a region, loading the persisted counts if there are any.
+ *
+ * @param p_wear - pointer to the erase counter.
+ * @param p_intf - pointer to the interface handle, its erase hook is taken over and must not be in use by anything else.
+ * @param base - sector aligned address of the first tracked sector.
+ * @param sectors - number of tracked sectors, up to EXT_FLASH_WEAR_MAX_SECTORS.
+ * @param store - sector aligned address of the two store sectors, or EXT_FLASH_WEAR_NO_STORE.
+ * @return int - 0 on success, -1 on failure or if another erase hook is installed.
+ */
+int emb_ext_flash_wear_attach(emb_ext_flash_wear_t *p_wear, emb_flash_intf_handle_t *p_intf, uint32_t base, uint16_t sectors,
+                              uint32_t store);
+
+/**
+ * @brief emb_ext_flash_wear_detach stop counting erases.
+ *
+ * @param p_wear - pointer to the erase counter.
+ */
+void emb_ext_flash_wear_detach(emb_ext_flash_wear_t *p_wear);
+
+/**
+ * @brief emb_ext_flash_wear_sync write a fresh snapshot of the counts, emptying the log. Only needed to bound the log replay
+ * of the next attach.
+ *
+ * @param p_wear - pointer to the erase counter.
+ * @return int - 0 on success, -1 on failure or without a store.
+ */
+int emb_ext_flash_wear_sync(emb_ext_flash_wear_t *p_wear);
+
+/**
+ * @brief emb_ext_flash_wear_count get the erase count of the sector holding an address.
+ *
+ * @param p_wear - pointer to the erase counter.
+ * @param address - an address in the tracked region.
+ * @return uint32_t - erase count, 0 outside the tracked region.
+ */
+uint32_t emb_ext_flash_wear_count(emb_ext_flash_wear_t *p_wear, uint32_t address);
+
+/**
+ * @brief emb_ext_flash_wear_summary get the lowest, highest and total erase count of the tracked sectors. The wear ratio is
+ * the highest count over the mean, max * sectors / total.
+ *
+ * @param p_wear - pointer to the erase counter.
+ * @param p_min - pointer to receive the lowest count.
+ * @param p_max - pointer to receive the highest count.
+ * @param p_total - pointer to receive the total count.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_wear_summary(emb_ext_flash_wear_t *p_wear, uint32_t *p_min, uint32_t *p_max, uint32_t *p_total);
+
+/**
+ * @brief emb_ext_flash_wear_histogram count the tracked sectors by erase count. Bin i counts the sectors with from
+ * i * bin_width to (i + 1) * bin_width - 1 erases, and the last bin also counts every sector above it.
+ *
+ * @param p_wear - pointer to the erase counter.
+ * @param bin_width - erase counts per bin.
+ * @param bins - array to receive the bins.
+ * @param nbins - number of bins.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_wear_histogram(emb_ext_flash_wear_t *p_wear, uint32_t bin_width, uint16_t *bins, uint16_t nbins);
+
+/**
+ * @brief emb_ext_flash_wear_least_worn find the free sector with the fewest erases, the first one on a tie.
+ *
+ * @param p_wear - pointer to the erase counter.
+ * @param free_map - bitmap of the free tracked sectors, bit i of byte i / 8 for sector i, or NULL when all are free. The
+ * free_map of a pre-erase pool over the same region can be passed directly.
+ * @param p_address - pointer to receive the address of the sector.
+ * @return int - 0 on success, -1 if no sector is free.
+ */
+int emb_ext_flash_wear_least_worn(emb_ext_flash_wear_t *p_wear, const uint8_t *free_map, uint32_t *p_address);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_WEAR_H_ */
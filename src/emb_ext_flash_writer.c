@@ -0,0 +1,188 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_writer.h"
+#include "emb_ext_flash_crc.h"
+
+// Private functions
+static int emb_ext_flash_writer_erase_ahead(emb_ext_flash_writer_t *p_writer, uint32_t end)
+{
+   // Erase until the range up to end is clean, picking the largest aligned erase that stays inside the slot
+   while (p_writer->erased_end < end)
+   {
+      uint32_t remaining = p_writer->limit - p_writer->erased_end;
+      uint32_t len       = EXT_FLASH_SECTOR_SIZE;
+      if (!(p_writer->erased_end % EXT_FLASH_BLOCK_64K_SIZE) && remaining >= EXT_FLASH_BLOCK_64K_SIZE)
+      {
+         len = EXT_FLASH_BLOCK_64K_SIZE;
+      }
+      else if (!(p_writer->erased_end % EXT_FLASH_BLOCK_32K_SIZE) && remaining >= EXT_FLASH_BLOCK_32K_SIZE)
+      {
+         len = EXT_FLASH_BLOCK_32K_SIZE;
+      }
+
+      if (emb_ext_flash_erase(p_writer->p_intf, p_writer->erased_end, len) != 0)
+      {
+         return(-1);
+      }
+      p_writer->erased_end += len;
+   }
+
+   return(0);
+}
+
+static int emb_ext_flash_writer_program(emb_ext_flash_writer_t *p_writer, uint8_t *data, uint16_t len)
+{
+   // Make sure the page is erased before programming it
+   if (emb_ext_flash_writer_erase_ahead(p_writer, p_writer->addr + len) != 0)
+   {
+      return(-1);
+   }
+
+   if (emb_ext_flash_write(p_writer->p_intf, p_writer->addr, data, len) != len)
+   {
+      return(-1);
+   }
+   p_writer->addr += len;
+
+   return(0);
+}
+
+// Public functions
+int emb_ext_flash_writer_open(emb_ext_flash_writer_t *p_writer, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t slot_len)
+{
+   // Null check
+   if (!p_writer || !p_intf || !p_intf->initialized)
+   {
+      return(-1);
+   }
+
+   // The erase ahead logic relies on the slot being made up of whole sectors
+   if ((start % EXT_FLASH_SECTOR_SIZE) || (slot_len % EXT_FLASH_SECTOR_SIZE) || !slot_len)
+   {
+      return(-1);
+   }
+
+   p_writer->p_intf     = p_intf;
+   p_writer->start      = start;
+   p_writer->limit      = start + slot_len;
+   p_writer->addr       = start;
+   p_writer->erased_end = start;
+   p_writer->crc        = EXT_FLASH_CRC32_INIT;
+   p_writer->fill       = 0;
+   p_writer->open       = 1;
+
+   return(0);
+}
+
+int emb_ext_flash_writer_append(emb_ext_flash_writer_t *p_writer, uint8_t *data, uint32_t len)
+{
+   // Null check
+   if (!p_writer || !p_writer->open || (!data && len))
+   {
+      return(-1);
+   }
+
+   // Reject data that would run off the end of the slot
+   if (len > p_writer->limit - p_writer->addr - p_writer->fill)
+   {
+      return(-1);
+   }
+
+   p_writer->crc = emb_ext_flash_crc32(p_writer->crc, data, len);
+
+   while (len)
+   {
+      // Program whole pages directly from the caller's buffer when nothing is staged
+      if (!p_writer->fill && len >= EXT_FLASH_PAGE_SIZE)
+      {
+         if (emb_ext_flash_writer_program(p_writer, data, EXT_FLASH_PAGE_SIZE) != 0)
+         {
+            return(-1);
+         }
+         data += EXT_FLASH_PAGE_SIZE;
+         len  -= EXT_FLASH_PAGE_SIZE;
+         continue;
+      }
+
+      // Otherwise top up the page buffer
+      uint32_t chunk = EXT_FLASH_PAGE_SIZE - p_writer->fill;
+      if (chunk > len)
+      {
+         chunk = len;
+      }
+      memcpy(&p_writer->page[p_writer->fill], data, chunk);
+      p_writer->fill += chunk;
+      data           += chunk;
+      len            -= chunk;
+
+      // Program the page as soon as it is complete
+      if (p_writer->fill == EXT_FLASH_PAGE_SIZE)
+      {
+         if (emb_ext_flash_writer_program(p_writer, p_writer->page, EXT_FLASH_PAGE_SIZE) != 0)
+         {
+            return(-1);
+         }
+         p_writer->fill = 0;
+      }
+   }
+
+   return(0);
+}
+
+int emb_ext_flash_writer_close(emb_ext_flash_writer_t *p_writer, uint8_t append_crc, uint32_t *crc)
+{
+   // Null check
+   if (!p_writer || !p_writer->open)
+   {
+      return(-1);
+   }
+
+   uint32_t image_crc = p_writer->crc;
+
+   // Append the CRC as a trailer, this goes through the normal path so it may span a page boundary
+   if (append_crc)
+   {
+      uint8_t trailer[4] = { image_crc & 0xFF, (image_crc >> 8) & 0xFF, (image_crc >> 16) & 0xFF, (image_crc >> 24) & 0xFF };
+      if (emb_ext_flash_writer_append(p_writer, trailer, sizeof(trailer)) != 0)
+      {
+         return(-1);
+      }
+   }
+
+   // Flush the partial tail page
+   if (p_writer->fill)
+   {
+      if (emb_ext_flash_writer_program(p_writer, p_writer->page, p_writer->fill) != 0)
+      {
+         return(-1);
+      }
+      p_writer->fill = 0;
+   }
+
+   p_writer->open = 0;
+   if (crc)
+   {
+      *crc = image_crc;
+   }
+
+   // Return the total number of bytes written to the slot
+   return(p_writer->addr - p_writer->start);
+}
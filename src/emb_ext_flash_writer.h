@@ -0,0 +1,94 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_WRITER_H_
+#define EMB_EXT_FLASH_WRITER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "emb_ext_flash.h"
+
+/**
+ * @brief emb_ext_flash_writer_t - streaming sequential writer state. The writer owns a single page of RAM, full pages are
+ * programmed as soon as they are complete and the slot is erased just ahead of the program address using the largest erase
+ * command that is aligned and still fits inside the slot. Treat the contents as private.
+ */
+typedef struct
+{
+   // Pointer to the interface handle the writer programs through.
+   emb_flash_intf_handle_t *p_intf;
+   // Exclusive end address of the slot the writer is allowed to touch.
+   uint32_t limit;
+   // Start address of the image.
+   uint32_t start;
+   // Address the page buffer will be programmed to.
+   uint32_t addr;
+   // First address in the slot that has not been erased yet.
+   uint32_t erased_end;
+   // Running CRC-32 of every byte appended so far.
+   uint32_t crc;
+   // Number of bytes currently held in the page buffer.
+   uint16_t fill;
+   // Flag to indicate the writer is open.
+   uint8_t open;
+   // Page buffer.
+   uint8_t page[EXT_FLASH_PAGE_SIZE];
+} emb_ext_flash_writer_t;
+
+/**
+ * @brief emb_ext_flash_writer_open open a writer on a slot. Nothing is erased until the first page needs to be programmed.
+ *
+ * @param p_writer - pointer to the writer.
+ * @param p_intf - pointer to the interface handle.
+ * @param start - start address of the slot, must be aligned to EXT_FLASH_SECTOR_SIZE.
+ * @param slot_len - length of the slot in bytes, must be a multiple of EXT_FLASH_SECTOR_SIZE.
+ * @return int - 0 on success, -1 on failure.
+ */
+int emb_ext_flash_writer_open(emb_ext_flash_writer_t *p_writer, emb_flash_intf_handle_t *p_intf, uint32_t start, uint32_t slot_len);
+
+/**
+ * @brief emb_ext_flash_writer_append append data of any length to the image. Whole pages are programmed straight from the
+ * caller's buffer when the page buffer is empty, otherwise data is staged in the page buffer first.
+ *
+ * @param p_writer - pointer to the writer.
+ * @param data - pointer to the data to be appended.
+ * @param len - the number of bytes to be appended.
+ * @return int - 0 on success, -1 on failure or if the data does not fit in the slot.
+ */
+int emb_ext_flash_writer_append(emb_ext_flash_writer_t *p_writer, uint8_t *data, uint32_t len);
+
+/**
+ * @brief emb_ext_flash_writer_close program the partial tail page, optionally followed by the CRC-32 of the image, and close
+ * the writer.
+ *
+ * @param p_writer - pointer to the writer.
+ * @param append_crc - if non-zero the little endian CRC-32 of the image is appended after the image.
+ * @param crc - optional pointer to receive the CRC-32 of the image, may be NULL.
+ * @return int - total number of bytes written to the slot on success, -1 on failure.
+ */
+int emb_ext_flash_writer_close(emb_ext_flash_writer_t *p_writer, uint8_t append_crc, uint32_t *crc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMB_EXT_FLASH_WRITER_H_ */
@@ -0,0 +1,60 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+// Stand in bus for the code size comparison, both builds link against the same functions.
+
+#include <stdint.h>
+
+volatile uint8_t codesize_bus_reg;
+
+void codesize_select()
+{
+   codesize_bus_reg = 1;
+}
+
+void codesize_deselect()
+{
+   codesize_bus_reg = 0;
+}
+
+int codesize_write(uint8_t *data, uint16_t len)
+{
+   for (uint16_t i = 0; i < len; i++)
+   {
+      codesize_bus_reg = data[i];
+   }
+   return(0);
+}
+
+int codesize_read(uint8_t *data, uint16_t len)
+{
+   for (uint16_t i = 0; i < len; i++)
+   {
+      data[i] = codesize_bus_reg;
+   }
+   return(0);
+}
+
+void codesize_delay_us(uint32_t duration)
+{
+   while (duration--)
+   {
+      codesize_bus_reg;
+   }
+}
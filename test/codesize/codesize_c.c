@@ -0,0 +1,47 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+// Code size workload for the function pointer driver, see the codesize target in ../CMakeLists.txt.
+
+#include <emb_ext_flash.h>
+#include "codesize_bus.h"
+
+static emb_flash_intf_handle_t intf = {
+   0,
+   codesize_select,
+   codesize_deselect,
+   codesize_write,
+   codesize_read,
+   codesize_delay_us };
+
+int main(int argc, char **argv)
+{
+   uint8_t  buf[EXT_FLASH_PAGE_SIZE] = { 0 };
+   uint8_t  id[3];
+   uint32_t address = argc * EXT_FLASH_SECTOR_SIZE;
+
+   emb_ext_flash_init_intf(&intf);
+   emb_ext_flash_get_jedec_id(&intf, &id[0], &id[1], &id[2]);
+   emb_ext_flash_erase(&intf, address, EXT_FLASH_SECTOR_SIZE);
+   emb_ext_flash_write(&intf, address, buf, sizeof(buf));
+   emb_ext_flash_read(&intf, address, buf, sizeof(buf));
+   emb_ext_flash_chip_erase(&intf);
+
+   return(buf[0]);
+}
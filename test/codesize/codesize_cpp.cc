@@ -0,0 +1,68 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+// Code size workload for the ExtFlash front end, see the codesize target in ../CMakeLists.txt.
+
+#include <emb_ext_flash.hpp>
+#include "codesize_bus.h"
+
+struct codesize_bus_policy
+{
+   static void select()
+   {
+      codesize_select();
+   }
+
+   static void deselect()
+   {
+      codesize_deselect();
+   }
+
+   static int write(uint8_t *data, uint16_t len)
+   {
+      return(codesize_write(data, len));
+   }
+
+   static int read(uint8_t *data, uint16_t len)
+   {
+      return(codesize_read(data, len));
+   }
+
+   static void delay_us(uint32_t duration)
+   {
+      codesize_delay_us(duration);
+   }
+};
+
+typedef emb_ext_flash::ExtFlash <codesize_bus_policy> flash;
+
+int main(int argc, char **argv)
+{
+   uint8_t  buf[EXT_FLASH_PAGE_SIZE] = { 0 };
+   uint8_t  id[3];
+   uint32_t address = argc * EXT_FLASH_SECTOR_SIZE;
+
+   flash::jedec_id(&id[0], &id[1], &id[2]);
+   flash::erase(address, EXT_FLASH_SECTOR_SIZE);
+   flash::write(address, buf, sizeof(buf));
+   flash::read(address, buf, sizeof(buf));
+   flash::chip_erase();
+
+   return(buf[0]);
+}
@@ -0,0 +1,317 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_bits.h>
+#include "emb_ext_flash_sim.h"
+
+// The two sectors of each primitive
+#define BITS_AREA_A    0x10000
+#define BITS_AREA_B    0x11000
+
+// Increments per sector of a counter
+#define BITS_RUN       ((EXT_FLASH_SECTOR_SIZE - EXT_FLASH_BITS_HEADER_SIZE) * 8)
+
+// Class for facilitating counter and flag tests
+class emb_ext_flash_bits_test : public ::testing::Test
+{
+public:
+   emb_ext_flash_bits_t _bits;
+
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   void TearDown() { flash_sim_reset(0xFF); }
+
+   // Clear the first used bits of a counter's run straight in the simulator, as if it had been incremented that far
+   void fast_forward(uint32_t used)
+   {
+      uint32_t run = _bits.area[_bits.cur] + EXT_FLASH_BITS_HEADER_SIZE;
+      memset(&_flash_sim_mem[run], 0x00, used / 8);
+      if (used & 7)
+      {
+         _flash_sim_mem[run + used / 8] = (uint8_t)(0xFF << (used & 7));
+      }
+   }
+};
+
+TEST_F(emb_ext_flash_bits_test, counter_counts_and_persists)
+{
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+   ASSERT_EQ(emb_ext_flash_counter_value(&_bits), 0u);
+   ASSERT_EQ(_flash_sim_stats.erases, 1u);
+
+   // One single byte program per increment
+   uint32_t programs = _flash_sim_stats.programs;
+   for (uint32_t i = 1; i <= 1000; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_counter_increment(&_bits), 0);
+      ASSERT_EQ(emb_ext_flash_counter_value(&_bits), i);
+   }
+   ASSERT_EQ(_flash_sim_stats.programs - programs, 1000u);
+   ASSERT_EQ(_flash_sim_stats.erases, 1u);
+
+   // Reopening finds the value with a binary search
+   for (uint32_t i = 0; i < 13; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+      ASSERT_EQ(emb_ext_flash_counter_value(&_bits), 1000u + i);
+      ASSERT_LE(_bits.stat_probes, 14u);
+      ASSERT_EQ(emb_ext_flash_counter_increment(&_bits), 0);
+   }
+
+   // Bad arguments
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_A), -1);
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A + 1, BITS_AREA_B), -1);
+   ASSERT_EQ(emb_ext_flash_counter_increment(NULL), -1);
+}
+
+TEST_F(emb_ext_flash_bits_test, counter_ping_pong)
+{
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+
+   // Each run is used up before the other sector is erased
+   for (uint32_t i = 1; i <= 2 * BITS_RUN + 10; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_counter_increment(&_bits), 0);
+      if (i == BITS_RUN || i == BITS_RUN + 1 || i == 2 * BITS_RUN + 1)
+      {
+         ASSERT_EQ(emb_ext_flash_counter_value(&_bits), i);
+         ASSERT_EQ(_flash_sim_stats.erases, 1u + (i > BITS_RUN) + (i > 2 * BITS_RUN));
+      }
+   }
+   ASSERT_EQ(_bits.cur, 0);
+   ASSERT_EQ(_flash_sim_sector_erases[BITS_AREA_A / EXT_FLASH_SECTOR_SIZE], 2u);
+   ASSERT_EQ(_flash_sim_sector_erases[BITS_AREA_B / EXT_FLASH_SECTOR_SIZE], 1u);
+
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+   ASSERT_EQ(emb_ext_flash_counter_value(&_bits), 2u * BITS_RUN + 10);
+
+   // A full run reopens as full, and rolls over on the next increment
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, 0x20000, 0x21000), 0);
+   fast_forward(BITS_RUN);
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, 0x20000, 0x21000), 0);
+   ASSERT_EQ(emb_ext_flash_counter_value(&_bits), (uint32_t)BITS_RUN);
+   ASSERT_EQ(emb_ext_flash_counter_increment(&_bits), 0);
+   ASSERT_EQ(emb_ext_flash_counter_value(&_bits), BITS_RUN + 1u);
+   ASSERT_EQ(_bits.cur, 1);
+}
+
+TEST_F(emb_ext_flash_bits_test, corrupt_base_fails_open)
+{
+   // Move the counter to the second sector, so the first one holds an older, valid header
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+   fast_forward(BITS_RUN);
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+   ASSERT_EQ(emb_ext_flash_counter_increment(&_bits), 0);
+   ASSERT_EQ(_bits.cur, 1);
+
+   // Clearing a bit of the current base alone, which the magic does not cover, fails the open instead of going back
+   uint32_t erases = _flash_sim_stats.erases;
+   _flash_sim_mem[BITS_AREA_B + 4] &= 0xDF;
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), -1);
+   ASSERT_EQ(emb_ext_flash_flags_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B, 8), -1);
+   ASSERT_EQ(_flash_sim_stats.erases, erases);
+
+   // And so does the inverted copy
+   _flash_sim_mem[BITS_AREA_B + 4] |= 0x20;
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+   ASSERT_EQ(emb_ext_flash_counter_value(&_bits), BITS_RUN + 1u);
+   _flash_sim_mem[BITS_AREA_B + 8] ^= 0x80;
+   ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), -1);
+}
+
+TEST_F(emb_ext_flash_bits_test, flags)
+{
+   ASSERT_EQ(emb_ext_flash_flags_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B, 20), 0);
+   for (uint16_t f = 0; f < 20; f++)
+   {
+      ASSERT_EQ(emb_ext_flash_flags_get(&_bits, f), 0);
+   }
+
+   // Setting a flag programs once, setting it again does nothing
+   uint32_t programs = _flash_sim_stats.programs;
+   ASSERT_EQ(emb_ext_flash_flags_set(&_bits, 3), 0);
+   ASSERT_EQ(emb_ext_flash_flags_set(&_bits, 19), 0);
+   ASSERT_EQ(emb_ext_flash_flags_set(&_bits, 3), 0);
+   ASSERT_EQ(_flash_sim_stats.programs - programs, 2u);
+
+   ASSERT_EQ(emb_ext_flash_flags_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B, 20), 0);
+   ASSERT_EQ(emb_ext_flash_flags_get(&_bits, 3), 1);
+   ASSERT_EQ(emb_ext_flash_flags_get(&_bits, 4), 0);
+   ASSERT_EQ(emb_ext_flash_flags_get(&_bits, 19), 1);
+
+   // A reset is one program, and survives a reopen
+   programs = _flash_sim_stats.programs;
+   ASSERT_EQ(emb_ext_flash_flags_reset(&_bits), 0);
+   ASSERT_EQ(_flash_sim_stats.programs - programs, 1u);
+   ASSERT_EQ(emb_ext_flash_flags_get(&_bits, 3), 0);
+   ASSERT_EQ(emb_ext_flash_flags_set(&_bits, 5), 0);
+   ASSERT_EQ(emb_ext_flash_flags_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B, 20), 0);
+   ASSERT_EQ(emb_ext_flash_flags_get(&_bits, 3), 0);
+   ASSERT_EQ(emb_ext_flash_flags_get(&_bits, 5), 1);
+
+   // Using up the slots moves to the other sector
+   uint32_t slots = _bits.capacity;
+   for (uint32_t i = 0; i < slots + 5; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_flags_set(&_bits, (uint16_t)(i % 20)), 0);
+      ASSERT_EQ(emb_ext_flash_flags_reset(&_bits), 0);
+   }
+   ASSERT_EQ(_flash_sim_stats.erases, 2u);
+   ASSERT_EQ(emb_ext_flash_flags_set(&_bits, 7), 0);
+   ASSERT_EQ(emb_ext_flash_flags_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B, 20), 0);
+   ASSERT_EQ(_bits.cur, 1);
+   for (uint16_t f = 0; f < 20; f++)
+   {
+      ASSERT_EQ(emb_ext_flash_flags_get(&_bits, f), f == 7 ? 1 : 0);
+   }
+
+   // Bad arguments
+   ASSERT_EQ(emb_ext_flash_flags_set(&_bits, 20), -1);
+   ASSERT_EQ(emb_ext_flash_flags_get(&_bits, 20), -1);
+   ASSERT_EQ(emb_ext_flash_counter_increment(&_bits), -1);
+   ASSERT_EQ(emb_ext_flash_flags_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B, 0), -1);
+   ASSERT_EQ(emb_ext_flash_flags_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B, EXT_FLASH_BITS_MAX_FLAGS + 1), -1);
+}
+
+// Power lost at a random point while incrementing, around the rollover too: the counter never goes back and only the
+// increment in flight may be lost
+TEST_F(emb_ext_flash_bits_test, counter_power_loss)
+{
+   uint32_t torn = 0;
+
+   srand(48);
+   for (uint32_t trial = 0; trial < 600; trial++)
+   {
+      flash_sim_reset(0xFF);
+      flash_sim_fault_seed(trial + 1);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+
+      // Start close to the end of a run every other trial
+      if (trial & 1)
+      {
+         fast_forward(BITS_RUN - rand() % 8);
+         ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+      }
+      if (trial % 3 == 0)
+      {
+         flash_sim_cut_power_after(1 + rand() % 60);
+      }
+      else if (trial % 3 == 1)
+      {
+         flash_sim_cut_power_in_op(1 + rand() % 12);
+      }
+      else
+      {
+         flash_sim_cut_power_in_erase(1);
+      }
+
+      uint32_t acked = emb_ext_flash_counter_value(&_bits);
+      for (uint32_t i = 0; !flash_sim_power_lost() && i < 20; i++)
+      {
+         int rtn = emb_ext_flash_counter_increment(&_bits);
+         if (!flash_sim_power_lost())
+         {
+            ASSERT_EQ(rtn, 0);
+            acked = emb_ext_flash_counter_value(&_bits);
+         }
+      }
+      torn += _flash_sim_stats.torn_programs + _flash_sim_stats.torn_erases;
+
+      // Reboot
+      flash_sim_restore_power();
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0) << "trial " << trial;
+      uint32_t value = emb_ext_flash_counter_value(&_bits);
+      ASSERT_TRUE(value == acked || value == acked + 1) << "trial " << trial << " " << value << " " << acked;
+
+      // It carries on counting from there
+      for (uint32_t i = 0; i < 10; i++)
+      {
+         ASSERT_EQ(emb_ext_flash_counter_increment(&_bits), 0);
+      }
+      ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+      ASSERT_EQ(emb_ext_flash_counter_value(&_bits), value + 10) << "trial " << trial;
+   }
+   ASSERT_GT(torn, 100u);
+}
+
+// A boot counter kept as a 32 bit value rewritten in place, against the bit counter
+TEST_F(emb_ext_flash_bits_test, bench_boot_counter)
+{
+   const uint32_t n = 2000;
+   double         us[2];
+   uint32_t       wear[2];
+
+   for (int mode = 0; mode < 2; mode++)
+   {
+      SetUp();
+      if (mode == 0)
+      {
+         uint8_t v[4] = { 0, 0, 0, 0 };
+         ASSERT_EQ(emb_ext_flash_erase(&_intf, BITS_AREA_A, EXT_FLASH_SECTOR_SIZE), 0);
+         ASSERT_EQ(emb_ext_flash_write(&_intf, BITS_AREA_A, v, sizeof(v)), (int)sizeof(v));
+      }
+      else
+      {
+         ASSERT_EQ(emb_ext_flash_counter_open(&_bits, &_intf, BITS_AREA_A, BITS_AREA_B), 0);
+      }
+
+      double start = flash_sim_model_time_us();
+      for (uint32_t i = 0; i < n; i++)
+      {
+         if (mode == 0)
+         {
+            // Read, erase and write back
+            uint8_t v[4];
+            ASSERT_EQ(emb_ext_flash_read(&_intf, BITS_AREA_A, v, sizeof(v)), (int)sizeof(v));
+            uint32_t value = (v[0] | (v[1] << 8) | (v[2] << 16) | ((uint32_t)v[3] << 24)) + 1;
+            v[0] = value & 0xFF;
+            v[1] = (value >> 8) & 0xFF;
+            v[2] = (value >> 16) & 0xFF;
+            v[3] = (value >> 24) & 0xFF;
+            ASSERT_EQ(emb_ext_flash_erase(&_intf, BITS_AREA_A, EXT_FLASH_SECTOR_SIZE), 0);
+            ASSERT_EQ(emb_ext_flash_write(&_intf, BITS_AREA_A, v, sizeof(v)), (int)sizeof(v));
+         }
+         else
+         {
+            ASSERT_EQ(emb_ext_flash_counter_increment(&_bits), 0);
+         }
+      }
+      us[mode]   = (flash_sim_model_time_us() - start) / n;
+      wear[mode] = _flash_sim_sector_erases[BITS_AREA_A / EXT_FLASH_SECTOR_SIZE] +
+                   _flash_sim_sector_erases[BITS_AREA_B / EXT_FLASH_SECTOR_SIZE];
+   }
+
+   printf("%u increments      modeled us each   sector erases\n", (unsigned)n);
+   printf("rewrite in place %17.1f %15u\n", us[0], (unsigned)wear[0]);
+   printf("bit counter      %17.1f %15u\n", us[1], (unsigned)wear[1]);
+   EXPECT_LT(us[1] * 50, us[0]);
+   EXPECT_LT(wear[1] * 1000, wear[0]);
+}
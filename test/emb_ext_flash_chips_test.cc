@@ -0,0 +1,183 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_chips.h>
+#include "emb_ext_flash_sim.h"
+
+// Class for facilitating chip table tests
+class emb_ext_flash_chips_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      _intf.deselect();
+   }
+
+   void TearDown()
+   {
+      _intf.p_chip = NULL;
+   }
+};
+
+TEST_F(emb_ext_flash_chips_test, table_consistent)
+{
+   uint32_t count = emb_ext_flash_chip_count();
+
+   ASSERT_GT(count, 20u);
+   ASSERT_EQ(emb_ext_flash_chip_get(count), (const emb_ext_flash_chip_t *)NULL);
+   for (uint32_t i = 0; i < count; i++)
+   {
+      const emb_ext_flash_chip_t *c = emb_ext_flash_chip_get(i);
+
+      // Sorted for the lookup and every entry can be found
+      if (i)
+      {
+         ASSERT_LT(emb_ext_flash_chip_get(i - 1)->jedec_id, c->jedec_id);
+      }
+      ASSERT_EQ(emb_ext_flash_chip_lookup(c->jedec_id), c);
+
+      // Everyone but Adesto encodes the capacity as a power of two in the last byte
+      if ((c->jedec_id >> 16) != 0x1F)
+      {
+         ASSERT_EQ(c->jedec_id & 0xFF, c->capacity_log2) << std::hex << c->jedec_id;
+      }
+      ASSERT_EQ(!!(c->flags & EXT_FLASH_CHIP_FLAG_4BYTE_ADDR), c->capacity_log2 > 24);
+      ASSERT_TRUE(c->erase_sizes & EXT_FLASH_CHIP_ERASE_4K);
+      ASSERT_LE(c->tpp_typ_us, c->tpp_max_us);
+      ASSERT_LE(c->tse_typ_ms, c->tse_max_ms);
+      ASSERT_GT(c->t_res1_us, 0);
+   }
+
+   ASSERT_EQ(emb_ext_flash_chip_lookup(0xEF4017)->capacity_log2, 23);
+   ASSERT_EQ(emb_ext_flash_chip_lookup(0x123456), (const emb_ext_flash_chip_t *)NULL);
+}
+
+TEST_F(emb_ext_flash_chips_test, init_applies_entry)
+{
+   uint8_t data[64];
+
+   ASSERT_EQ(emb_ext_flash_chip_init(&_intf), 0);
+   ASSERT_NE(_intf.p_chip, (const emb_ext_flash_chip_t *)NULL);
+   ASSERT_EQ(_intf.p_chip->jedec_id, (uint32_t)FLASH_SIM_JEDEC_ID);
+
+   // Reads switch to fast read
+   for (int i = 0; i < (int)sizeof(data); i++)
+   {
+      _flash_sim_mem[0x100 + i] = i;
+   }
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0x100, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_EQ(_flash_sim_stats.fast_reads, 1u);
+   for (int i = 0; i < (int)sizeof(data); i++)
+   {
+      ASSERT_EQ(data[i], i);
+   }
+
+   // The wake from deep power-down waits out the chip's tRES1 rather than the generic one
+   ASSERT_EQ(emb_ext_flash_sleep(&_intf), 0);
+   uint32_t t0 = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0x100, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_EQ(_flash_sim_time_us - t0, (uint32_t)_intf.p_chip->t_res1_us);
+   ASSERT_EQ(data[10], 10);
+}
+
+TEST_F(emb_ext_flash_chips_test, polling_follows_typical_times)
+{
+   uint8_t data[EXT_FLASH_PAGE_SIZE];
+
+   memset(data, 0x55, sizeof(data));
+
+   // A generic part is polled back to back
+   ASSERT_EQ(emb_ext_flash_init_intf(&_intf), 0);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_EQ(_flash_sim_time_us, 0u);
+
+   // A known part sleeps through half of tPP before the first poll
+   ASSERT_EQ(emb_ext_flash_chip_detect(&_intf), 0);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0x1000, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_EQ(_flash_sim_time_us, (uint32_t)_intf.p_chip->tpp_typ_us / EXT_FLASH_FIRST_POLL_DIVISOR);
+
+   uint32_t t0 = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, 0x10000, EXT_FLASH_BLOCK_64K_SIZE), 0);
+   ASSERT_EQ(_flash_sim_time_us - t0, _intf.p_chip->tse_typ_ms * 1000u * 3 / EXT_FLASH_FIRST_POLL_DIVISOR);
+}
+
+TEST_F(emb_ext_flash_chips_test, erase_sizes_respected)
+{
+   emb_ext_flash_chip_t chip = *emb_ext_flash_chip_lookup(FLASH_SIM_JEDEC_ID);
+
+   ASSERT_EQ(emb_ext_flash_init_intf(&_intf), 0);
+
+   // No 32K block erase, a 32K erase goes out as eight sector erases
+   chip.erase_sizes = EXT_FLASH_CHIP_ERASE_4K | EXT_FLASH_CHIP_ERASE_64K;
+   ASSERT_EQ(emb_ext_flash_set_chip(&_intf, &chip), 0);
+   memset(_flash_sim_mem, 0x00, FLASH_SIM_MEM_SIZE);
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, 0x8000, EXT_FLASH_BLOCK_32K_SIZE), 0);
+   ASSERT_EQ(_flash_sim_stats.erases, 8u);
+   ASSERT_EQ(_flash_sim_stats.erased_bytes, (uint32_t)EXT_FLASH_BLOCK_32K_SIZE);
+   ASSERT_EQ(_flash_sim_mem[0x7FFF], 0x00);
+   ASSERT_EQ(_flash_sim_mem[0x8000], 0xFF);
+   ASSERT_EQ(_flash_sim_mem[0xFFFF], 0xFF);
+   ASSERT_EQ(_flash_sim_mem[0x10000], 0x00);
+
+   // No 64K block erase, a 64K erase goes out as two 32K block erases
+   chip.erase_sizes = EXT_FLASH_CHIP_ERASE_4K | EXT_FLASH_CHIP_ERASE_32K;
+   memset(&_flash_sim_stats, 0, sizeof(_flash_sim_stats));
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, 0x20000, EXT_FLASH_BLOCK_64K_SIZE), 0);
+   ASSERT_EQ(_flash_sim_stats.erases, 2u);
+   ASSERT_EQ(_flash_sim_mem[0x2FFFF], 0xFF);
+   ASSERT_EQ(_flash_sim_mem[0x30000], 0x00);
+}
+
+TEST_F(emb_ext_flash_chips_test, four_byte_addressing)
+{
+   uint8_t data[EXT_FLASH_PAGE_SIZE];
+   uint8_t back[EXT_FLASH_PAGE_SIZE];
+
+   // Near the top of a 32 MiB part, the simulator repeats every FLASH_SIM_MEM_SIZE bytes
+   const uint32_t address = 0x1FF3000;
+
+   for (int i = 0; i < (int)sizeof(data); i++)
+   {
+      data[i] = (uint8_t)(i * 7);
+   }
+   ASSERT_EQ(emb_ext_flash_init_intf(&_intf), 0);
+   ASSERT_EQ(emb_ext_flash_set_chip(&_intf, emb_ext_flash_chip_lookup(0xEF4019)), 0);
+
+   // Programs, reads and erases all go out in their 4-byte address form
+   ASSERT_EQ(emb_ext_flash_write(&_intf, address, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_EQ(memcmp(&_flash_sim_mem[address % FLASH_SIM_MEM_SIZE], data, sizeof(data)), 0);
+   ASSERT_EQ(emb_ext_flash_read(&_intf, address, back, sizeof(back)), (int)sizeof(back));
+   ASSERT_EQ(memcmp(back, data, sizeof(data)), 0);
+   ASSERT_EQ(_flash_sim_stats.fast_reads, 1u);
+
+   // The part has no 4-byte 32K block erase, so a 32K erase goes out as eight sector erases
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, address & ~(uint32_t)(EXT_FLASH_BLOCK_32K_SIZE - 1), EXT_FLASH_BLOCK_32K_SIZE), 0);
+   ASSERT_EQ(_flash_sim_stats.erases, 8u);
+   ASSERT_EQ(_flash_sim_mem[address % FLASH_SIM_MEM_SIZE], 0xFF);
+   ASSERT_EQ(_flash_sim_stats.addr4_cmds, 10u);
+
+   // A part of 16 MiB or less keeps the 3-byte commands
+   ASSERT_EQ(emb_ext_flash_set_chip(&_intf, emb_ext_flash_chip_lookup(FLASH_SIM_JEDEC_ID)), 0);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0x100, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0x100, back, sizeof(back)), (int)sizeof(back));
+   ASSERT_EQ(_flash_sim_stats.addr4_cmds, 10u);
+}
@@ -0,0 +1,211 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_co.hpp>
+#include "emb_ext_flash_sim.h"
+#include "emb_ext_flash_fake.h"
+
+using namespace emb_ext_flash;
+
+// Virtual clock program and sector erase times of the chips
+#define CO_PROGRAM_US    FLASH_FAKE_PROGRAM_US
+#define CO_ERASE_US      FLASH_FAKE_ERASE_US
+
+
+// Class for facilitating coroutine front end tests, on the simulator with BUSY timed on its virtual clock
+class emb_ext_flash_co_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      _intf.get_time_us = _get_time_us;
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      _flash_sim_program_us = CO_PROGRAM_US;
+      _flash_sim_erase_us   = CO_ERASE_US;
+   }
+
+   void TearDown()
+   {
+      flash_sim_reset(0xFF);
+      _intf.get_time_us = NULL;
+      emb_ext_flash_init_intf(&_intf);
+   }
+
+   // Run the loop until every task is done, sleeping on the virtual clock while nothing is ready
+   static void run(Loop &loop, Task *tasks, int count)
+   {
+      for (int i = 0; i < count; i++)
+      {
+         tasks[i].start();
+      }
+      for (int guard = 0; guard < 100000; guard++)
+      {
+         bool done = true;
+         for (int i = 0; i < count; i++)
+         {
+            done = done && tasks[i].done();
+         }
+         if (done)
+         {
+            return;
+         }
+         if (!loop.poll())
+         {
+            flash_sim_advance(loop.next_due_us() - loop.now());
+         }
+      }
+      FAIL() << "tasks did not complete";
+   }
+};
+
+// Size of the record each job writes
+#define CO_RECORD_SIZE    1000
+
+// Erase two sectors, write a record across several pages and read it back, completes with 0 when it matched. The record lives
+// outside the frame, which has to fit in a pooled frame.
+static Task co_job(CoFlash &flash, uint32_t address, uint8_t *tx)
+{
+   uint8_t rx[64];
+
+   if (co_await flash.erase(address, 2 * EXT_FLASH_SECTOR_SIZE) != 0 ||
+       co_await flash.write(address + 0x10, tx, CO_RECORD_SIZE) != CO_RECORD_SIZE)
+   {
+      co_return(-1);
+   }
+   for (uint32_t off = 0; off < CO_RECORD_SIZE; off += sizeof(rx))
+   {
+      uint16_t n = CO_RECORD_SIZE - off < sizeof(rx) ? CO_RECORD_SIZE - off : sizeof(rx);
+      if (co_await flash.read(address + 0x10 + off, rx, n) != n || memcmp(rx, &tx[off], n) != 0)
+      {
+         co_return(-1);
+      }
+   }
+   co_return(0);
+}
+
+TEST_F(emb_ext_flash_co_test, many_chips_one_thread)
+{
+   emb_flash_intf_handle_t fake[3] = { fake_bus<0>::handle(), fake_bus<1>::handle(), fake_bus<2>::handle() };
+   Loop                    loop(_get_time_us);
+   CoFlash                 sim(&_intf, loop);
+   CoFlash                 chip0(&fake[0], loop);
+   CoFlash                 chip1(&fake[1], loop);
+   CoFlash                 chip2(&fake[2], loop);
+   uint32_t                failures = FramePool::failures();
+   static uint8_t          tx[5][CO_RECORD_SIZE];
+
+   for (int j = 0; j < 5; j++)
+   {
+      for (int i = 0; i < CO_RECORD_SIZE; i++)
+      {
+         tx[j][i] = (uint8_t)(j + 1 + i * 13);
+      }
+   }
+
+   // One chip on its own
+   uint32_t t0 = _flash_sim_time_us;
+   {
+      Task one[1] = { co_job(sim, 0x4000, tx[0]) };
+      run(loop, one, 1);
+      ASSERT_EQ(one[0].result(), 0);
+   }
+   uint32_t alone = _flash_sim_time_us - t0;
+
+   // Four chips on the same thread
+   t0 = _flash_sim_time_us;
+   uint32_t polls = loop.stat_polls;
+   {
+      Task all[4] = { co_job(sim, 0x8000, tx[1]), co_job(chip0, 0x2000, tx[2]), co_job(chip1, 0x4000, tx[3]),
+                      co_job(chip2, 0x6000, tx[4]) };
+      run(loop, all, 4);
+      for (int i = 0; i < 4; i++)
+      {
+         ASSERT_EQ(all[i].result(), 0) << "chip " << i;
+      }
+   }
+   uint32_t together = _flash_sim_time_us - t0;
+
+   printf("erase, write and read back: %u us on one chip, %u us on four chips side by side, %u status polls, %u frames at most\n",
+          (unsigned)alone, (unsigned)together, (unsigned)(loop.stat_polls - polls), (unsigned)FramePool::high_water());
+
+   // The chips were busy at the same time, and every frame went back to the pool
+   ASSERT_EQ(_flash_sim_mem[0x8010], 2);
+   ASSERT_EQ(fake_bus<2>::chip.mem[0x6010], 5);
+   ASSERT_GE(alone, 2u * CO_ERASE_US + 4u * CO_PROGRAM_US);
+   ASSERT_LT(together, alone + alone / 4);
+   ASSERT_EQ(FramePool::in_use(), 0);
+   ASSERT_EQ(FramePool::failures(), failures);
+   ASSERT_FALSE(loop.pending());
+}
+
+TEST_F(emb_ext_flash_co_test, one_chip_in_order)
+{
+   Loop    loop(_get_time_us);
+   CoFlash flash(&_intf, loop, 50);
+   uint8_t a[300], b[300], rx[300];
+
+   memset(a, 0xA1, sizeof(a));
+   memset(b, 0xB2, sizeof(b));
+
+   // Operations started together on one chip take turns, a read started last sees both writes
+   Task ops[4] = { flash.erase(0x1000, EXT_FLASH_SECTOR_SIZE), flash.write(0x1000, a, sizeof(a)),
+                   flash.write(0x1000 + sizeof(a), b, sizeof(b)), flash.read(0x1000 + sizeof(a) - 4, rx, 8) };
+   run(loop, ops, 4);
+   ASSERT_EQ(ops[0].result(), 0);
+   ASSERT_EQ(ops[1].result(), (int)sizeof(a));
+   ASSERT_EQ(ops[2].result(), (int)sizeof(b));
+   ASSERT_EQ(ops[3].result(), 8);
+   ASSERT_EQ(rx[3], 0xA1);
+   ASSERT_EQ(rx[4], 0xB2);
+   ASSERT_EQ(_flash_sim_stats.ignored_cmds, 0u);
+   ASSERT_GE(_flash_sim_time_us, (uint32_t)CO_ERASE_US + 4 * CO_PROGRAM_US);
+}
+
+TEST_F(emb_ext_flash_co_test, frame_pool_exhausted)
+{
+   Loop     loop(_get_time_us);
+   CoFlash  flash(&_intf, loop);
+   uint8_t  rx[4];
+   uint32_t failures = FramePool::failures();
+
+   // Tasks keep their frames until they are destroyed, once the pool is empty the next one fails straight away
+   {
+      Task held[EXT_FLASH_CO_FRAMES];
+      for (int i = 0; i < EXT_FLASH_CO_FRAMES; i++)
+      {
+         held[i] = flash.read(0, rx, sizeof(rx));
+         ASSERT_FALSE(held[i].done());
+      }
+      ASSERT_EQ(FramePool::in_use(), EXT_FLASH_CO_FRAMES);
+      Task extra = flash.read(0, rx, sizeof(rx));
+      ASSERT_TRUE(extra.done());
+      ASSERT_EQ(extra.result(), -1);
+      ASSERT_EQ(FramePool::failures(), failures + 1);
+   }
+   ASSERT_EQ(FramePool::in_use(), 0);
+
+   // And the pool is there again
+   Task again[1] = { flash.read(0, rx, sizeof(rx)) };
+   run(loop, again, 1);
+   ASSERT_EQ(again[0].result(), (int)sizeof(rx));
+}
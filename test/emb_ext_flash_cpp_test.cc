@@ -0,0 +1,247 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash.hpp>
+#include "emb_ext_flash_sim.h"
+
+using emb_ext_flash::ExtFlash;
+using emb_ext_flash::GenericGeometry;
+
+// Bus policy backed by the flash simulation
+struct sim_bus
+{
+   static void select()
+   {
+      _select();
+   }
+
+   static void deselect()
+   {
+      _deselect();
+   }
+
+   static int write(uint8_t *data, uint16_t len)
+   {
+      return(_write(data, len));
+   }
+
+   static int read(uint8_t *data, uint16_t len)
+   {
+      return(_read(data, len));
+   }
+
+   static void delay_us(uint32_t duration)
+   {
+      _delay_us(duration);
+   }
+};
+
+// Geometry of the simulated chip
+struct sim_geometry : GenericGeometry
+{
+   static constexpr uint32_t capacity = FLASH_SIM_MEM_SIZE;
+};
+
+typedef ExtFlash <sim_bus, sim_geometry> sim_flash;
+
+// Bus policy that only counts bytes, the status register always reads back WEL set and not busy. Used to measure the cost of
+// the driver itself rather than the simulator.
+static volatile uint32_t null_bus_bytes = 0;
+struct null_bus
+{
+   static void select()
+   {
+   }
+
+   static void deselect()
+   {
+   }
+
+   static int write(uint8_t *data, uint16_t len)
+   {
+      null_bus_bytes = null_bus_bytes + len + data[0];
+      return(0);
+   }
+
+   static int read(uint8_t *data, uint16_t len)
+   {
+      null_bus_bytes = null_bus_bytes + len;
+      data[0]         = EXT_FLASH_STATUS_REG_WEL;
+      return(0);
+   }
+
+   static void delay_us(uint32_t duration)
+   {
+   }
+};
+
+typedef ExtFlash <null_bus, GenericGeometry> null_flash;
+
+// Bus policy that rejects every transfer longer than one byte, so single byte commands and status reads work but no command
+// with an address gets out. The status register reads back WEL set and not busy.
+struct broken_bus : null_bus
+{
+   static int write(uint8_t *data, uint16_t len)
+   {
+      return(len > 1 ? -1 : 0);
+   }
+
+   static int read(uint8_t *data, uint16_t len)
+   {
+      memset(data, EXT_FLASH_STATUS_REG_WEL, len);
+      return(0);
+   }
+};
+
+typedef ExtFlash <broken_bus, GenericGeometry> broken_flash;
+
+// Everything the geometry decides is available at compile time
+static_assert(sim_flash::page_remaining(0x1FF) == 1, "page split");
+static_assert(sim_flash::erase_step(0x10000, 0x10000) == EXT_FLASH_BLOCK_64K_SIZE, "64K erase");
+static_assert(sim_flash::erase_step(0x18000, 0x10000) == EXT_FLASH_BLOCK_32K_SIZE, "32K erase");
+static_assert(sim_flash::erase_step(0x10000, 0xF000) == EXT_FLASH_BLOCK_32K_SIZE, "32K erase");
+static_assert(sim_flash::erase_step(0x11000, 0x10000) == EXT_FLASH_SECTOR_SIZE, "sector erase");
+static_assert(sim_flash::erase_cmd(EXT_FLASH_BLOCK_64K_SIZE) == EXT_FLASH_CMD_BLOCK_ERASE_64K, "64K command");
+
+// Class for facilitating C++ front end tests
+class emb_ext_flash_cpp_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0x00);
+      _deselect();
+   }
+};
+
+TEST_F(emb_ext_flash_cpp_test, jedec_id)
+{
+   uint8_t manufacturer_id = 0;
+   uint8_t memory_type     = 0;
+   uint8_t capacity        = 0;
+
+   ASSERT_EQ(sim_flash::jedec_id(NULL, &memory_type, &capacity), -1);
+   ASSERT_EQ(sim_flash::jedec_id(&manufacturer_id, &memory_type, &capacity), 0);
+   ASSERT_EQ(manufacturer_id, FLASH_SIM_JEDEC_ID >> 16);
+   ASSERT_EQ(memory_type, (FLASH_SIM_JEDEC_ID >> 8) & 0xFF);
+   ASSERT_EQ(capacity, FLASH_SIM_JEDEC_ID & 0xFF);
+}
+
+TEST_F(emb_ext_flash_cpp_test, compile_time_erase_plan)
+{
+   // 0x1000 - 0x21000 is seven sectors, a 32K block, a 64K block and one more sector
+   int rtn = sim_flash::erase <0x1000, 0x20000>();
+   ASSERT_EQ(rtn, 0);
+   ASSERT_EQ(_flash_sim_stats.erases, 10);
+   ASSERT_EQ(_flash_sim_stats.erased_bytes, 0x20000);
+   ASSERT_EQ(_flash_sim_mem[0x0FFF], 0x00);
+   ASSERT_EQ(_flash_sim_mem[0x1000], 0xFF);
+   ASSERT_EQ(_flash_sim_mem[0x20FFF], 0xFF);
+   ASSERT_EQ(_flash_sim_mem[0x21000], 0x00);
+
+   // The run time plan makes the same choices
+   flash_sim_reset(0x00);
+   ASSERT_EQ(sim_flash::erase(0x1000, 0x20000), 0);
+   ASSERT_EQ(_flash_sim_stats.erases, 10);
+   ASSERT_EQ(_flash_sim_stats.erased_bytes, 0x20000);
+
+   // An empty range erases nothing, even from an unaligned address
+   ASSERT_EQ(sim_flash::erase(0x30010, 0), -1);
+   ASSERT_EQ(_flash_sim_stats.erases, 10);
+   ASSERT_EQ(_flash_sim_mem[0x30010], 0x00);
+}
+
+TEST_F(emb_ext_flash_cpp_test, interop_with_c_api)
+{
+   static uint8_t          tx[1000];
+   static uint8_t          rx[1000];
+   emb_flash_intf_handle_t intf = sim_flash::handle();
+
+   for (int i = 0; i < 1000; i++)
+   {
+      tx[i] = i * 3;
+   }
+
+   // Program from C++ across several page boundaries, read back through the C API
+   ASSERT_TRUE(intf.initialized);
+   ASSERT_EQ(sim_flash::erase(0x3000, 0x1000), 0);
+   ASSERT_EQ(sim_flash::write(0x3080, tx, sizeof(tx)), (int)sizeof(tx));
+   ASSERT_EQ(_flash_sim_stats.programs, 5);
+   ASSERT_EQ(emb_ext_flash_read(&intf, 0x3080, rx, sizeof(rx)), (int)sizeof(rx));
+   ASSERT_EQ(memcmp(tx, rx, sizeof(tx)), 0);
+
+   // And the other way around
+   memset(rx, 0, sizeof(rx));
+   ASSERT_EQ(emb_ext_flash_erase(&intf, 0x5000, 0x1000), 0);
+   ASSERT_EQ(emb_ext_flash_write(&intf, 0x5000, tx, sizeof(tx)), (int)sizeof(tx));
+   ASSERT_EQ(sim_flash::read(0x5000, rx, sizeof(rx)), (int)sizeof(rx));
+   ASSERT_EQ(memcmp(tx, rx, sizeof(tx)), 0);
+
+   // Chip erase
+   ASSERT_EQ(sim_flash::chip_erase(), 0);
+   ASSERT_EQ(_flash_sim_mem[0x5000], 0xFF);
+}
+
+TEST_F(emb_ext_flash_cpp_test, failed_command_stops_transfer)
+{
+   uint8_t buf[16];
+
+   // Reads and writes whose command does not get out report nothing done rather than data that was never read
+   memset(buf, 0x5A, sizeof(buf));
+   ASSERT_EQ(broken_flash::read(0x100, buf, sizeof(buf)), 0);
+   ASSERT_EQ(buf[0], 0x5A);
+   ASSERT_EQ(broken_flash::write(0x100, buf, sizeof(buf)), 0);
+   ASSERT_EQ(broken_flash::erase(0x1000, 0x1000), -1);
+}
+
+TEST_F(emb_ext_flash_cpp_test, bench_cpp_vs_function_pointers)
+{
+   static uint8_t          buf[EXT_FLASH_SECTOR_SIZE] = { 1 };
+   emb_flash_intf_handle_t intf                       = null_flash::handle();
+   const int               loops                      = 2000;
+
+   // Time a write and a read of a sector through each path, the bus does nothing so only the driver cost is measured
+   auto run = [&](bool cpp) {
+      auto t0 = std::chrono::steady_clock::now();
+      for (int i = 0; i < loops; i++)
+      {
+         if (cpp)
+         {
+            null_flash::write(i * sizeof(buf), buf, sizeof(buf));
+            null_flash::read(i * sizeof(buf), buf, sizeof(buf));
+         }
+         else
+         {
+            emb_ext_flash_write(&intf, i * sizeof(buf), buf, sizeof(buf));
+            emb_ext_flash_read(&intf, i * sizeof(buf), buf, sizeof(buf));
+         }
+      }
+      auto t1 = std::chrono::steady_clock::now();
+      return(std::chrono::duration <double, std::nano>(t1 - t0).count() / (2.0 * loops * sizeof(buf)));
+   };
+
+   double c_ns   = run(false);
+   double cpp_ns = run(true);
+   printf("driver overhead per byte: function pointer path %.3f ns, ExtFlash path %.3f ns\n", c_ns, cpp_ns);
+   printf("build the codesize target for a code size comparison\n");
+   ASSERT_GT(null_bus_bytes, 0);
+}
@@ -0,0 +1,163 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_FAKE_H_
+#define EMB_EXT_FLASH_FAKE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <emb_ext_flash.h>
+#include "emb_ext_flash_sim.h"
+
+// Virtual clock program and sector erase times of the fake chips
+#define FLASH_FAKE_PROGRAM_US    700
+#define FLASH_FAKE_ERASE_US      45000
+
+// A minimal chip with read, status, write enable, page program and sector erase, so tests can run more chips next to the
+// simulator on its virtual clock. The bus functions take no context, so each chip gets its own instance of the bus.
+struct fake_chip_t
+{
+   uint8_t  mem[0x10000];
+   uint8_t  cmd;
+   uint16_t n;
+   uint32_t addr;
+   bool     wel;
+   bool     busy;
+   uint32_t busy_until;
+   // Number of read commands.
+   uint32_t reads;
+   // Program and sector erase times on the virtual clock.
+   uint32_t program_us;
+   uint32_t erase_us;
+};
+
+template <int N>
+struct fake_bus
+{
+   static fake_chip_t chip;
+
+   static uint8_t sm(uint8_t b)
+   {
+      if (chip.busy && (int32_t)(_flash_sim_time_us - chip.busy_until) >= 0)
+      {
+         chip.busy = false;
+      }
+
+      // The first byte is the command, a busy chip only answers status reads
+      if (chip.n++ == 0)
+      {
+         chip.cmd    = (chip.busy && b != EXT_FLASH_CMD_READ_STATUS_REG) ? 0 : b;
+         chip.addr   = 0;
+         chip.wel    = chip.wel || chip.cmd == EXT_FLASH_CMD_WRITE_ENABLE;
+         chip.reads += chip.cmd == EXT_FLASH_CMD_READ_DATA;
+         return(0xFF);
+      }
+      if (chip.cmd == EXT_FLASH_CMD_READ_STATUS_REG)
+      {
+         return((chip.busy ? EXT_FLASH_STATUS_REG_BUSY : 0) | (chip.wel ? EXT_FLASH_STATUS_REG_WEL : 0));
+      }
+      if (chip.n <= 4)
+      {
+         chip.addr = (chip.addr << 8) | b;
+         return(0xFF);
+      }
+      if (chip.cmd == EXT_FLASH_CMD_READ_DATA)
+      {
+         return(chip.mem[chip.addr++ % sizeof(chip.mem)]);
+      }
+      if (chip.cmd == EXT_FLASH_CMD_PAGE_PROGRAM && chip.wel)
+      {
+         chip.mem[chip.addr++ % sizeof(chip.mem)] &= b;
+      }
+      return(0xFF);
+   }
+
+   static void select()
+   {
+      chip.n = 0;
+   }
+
+   static void deselect()
+   {
+      // Programs and erases start when chip select is released
+      uint32_t busy_us = 0;
+      if (chip.wel && chip.cmd == EXT_FLASH_CMD_PAGE_PROGRAM && chip.n > 4)
+      {
+         busy_us = chip.program_us;
+      }
+      if (chip.wel && chip.cmd == EXT_FLASH_CMD_SECTOR_ERASE && chip.n >= 4)
+      {
+         memset(&chip.mem[(chip.addr % sizeof(chip.mem)) & ~(EXT_FLASH_SECTOR_SIZE - 1)], 0xFF, EXT_FLASH_SECTOR_SIZE);
+         busy_us = chip.erase_us;
+      }
+      if (busy_us)
+      {
+         chip.wel        = false;
+         chip.busy       = true;
+         chip.busy_until = _flash_sim_time_us + busy_us;
+      }
+      chip.n   = 0;
+      chip.cmd = 0;
+   }
+
+   static int write(uint8_t *data, uint16_t len)
+   {
+      for (uint16_t i = 0; i < len; i++)
+      {
+         sm(data[i]);
+      }
+      return(0);
+   }
+
+   static int read(uint8_t *data, uint16_t len)
+   {
+      for (uint16_t i = 0; i < len; i++)
+      {
+         data[i] = sm(0xFF);
+      }
+      return(0);
+   }
+
+   static emb_flash_intf_handle_t handle()
+   {
+      emb_flash_intf_handle_t intf = {};
+
+      memset(&chip, 0xFF, sizeof(chip.mem));
+      chip.n           = 0;
+      chip.wel         = false;
+      chip.busy        = false;
+      chip.reads       = 0;
+      chip.program_us  = FLASH_FAKE_PROGRAM_US;
+      chip.erase_us    = FLASH_FAKE_ERASE_US;
+      intf.select      = select;
+      intf.deselect    = deselect;
+      intf.write       = write;
+      intf.read        = read;
+      intf.delay_us    = _delay_us;
+      intf.get_time_us = _get_time_us;
+      emb_ext_flash_init_intf(&intf);
+
+      return(intf);
+   }
+};
+
+template <int N>
+fake_chip_t fake_bus<N>::chip;
+
+#endif /* EMB_EXT_FLASH_FAKE_H_ */
@@ -0,0 +1,265 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <vector>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_ftl.h>
+#include "emb_ext_flash_sim.h"
+
+// Region used by the translation layer tests
+#define FTL_REGION_START    0x10000
+#define FTL_REGION_SIZE     0x30000
+
+// Fill a block with a pattern derived from the block number and a generation count
+static void fill_block(uint8_t *data, uint32_t block, uint32_t gen)
+{
+   for (uint32_t i = 0; i < EXT_FLASH_FTL_BLOCK_SIZE; i++)
+   {
+      data[i] = (uint8_t)(block * 31 + gen * 7 + i);
+   }
+}
+
+// Class for facilitating translation layer tests
+class emb_ext_flash_ftl_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   // Check every block against the generation it was last written with, 0 meaning never written or trimmed
+   void verify(emb_ext_flash_ftl_t *p_ftl, std::vector <uint32_t> &gens)
+   {
+      uint8_t expected[EXT_FLASH_FTL_BLOCK_SIZE];
+      uint8_t actual[EXT_FLASH_FTL_BLOCK_SIZE];
+
+      for (uint32_t b = 0; b < gens.size(); b++)
+      {
+         if (gens[b])
+         {
+            fill_block(expected, b, gens[b]);
+         }
+         else
+         {
+            memset(expected, 0xFF, sizeof(expected));
+         }
+         ASSERT_EQ(emb_ext_flash_ftl_block_read(p_ftl, b, actual), 0);
+         ASSERT_EQ(memcmp(expected, actual, sizeof(actual)), 0) << "block " << b;
+      }
+   }
+};
+
+TEST_F(emb_ext_flash_ftl_test, format_write_read)
+{
+   static emb_ext_flash_ftl_t ftl;
+   uint8_t                    data[EXT_FLASH_FTL_BLOCK_SIZE];
+
+   ASSERT_EQ(emb_ext_flash_ftl_format(&ftl, &_intf, FTL_REGION_START, FTL_REGION_SIZE), 0);
+   uint32_t count = emb_ext_flash_ftl_block_count(&ftl);
+   ASSERT_EQ(count, (uint32_t)(FTL_REGION_SIZE / EXT_FLASH_SECTOR_SIZE - 2 - EXT_FLASH_FTL_SPARE_SECTORS) * EXT_FLASH_FTL_SLOTS_PER_SECTOR);
+
+   std::vector <uint32_t> gens(count, 0);
+   verify(&ftl, gens);
+
+   for (uint32_t b = 0; b < count; b += 3)
+   {
+      fill_block(data, b, 1);
+      ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, b, data), 0);
+      gens[b] = 1;
+   }
+   verify(&ftl, gens);
+
+   // Overwrites land out of place and the newest copy wins
+   fill_block(data, 3, 2);
+   ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, 3, data), 0);
+   gens[3] = 2;
+   verify(&ftl, gens);
+
+   // Out of range and null arguments
+   ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, count, data), -1);
+   ASSERT_EQ(emb_ext_flash_ftl_block_read(&ftl, count, data), -1);
+   ASSERT_EQ(emb_ext_flash_ftl_block_write(NULL, 0, data), -1);
+   ASSERT_EQ(emb_ext_flash_ftl_block_read(&ftl, 0, NULL), -1);
+   ASSERT_EQ(emb_ext_flash_ftl_format(&ftl, &_intf, FTL_REGION_START + 1, FTL_REGION_SIZE), -1);
+}
+
+TEST_F(emb_ext_flash_ftl_test, trim)
+{
+   static emb_ext_flash_ftl_t ftl;
+   uint8_t                    data[EXT_FLASH_FTL_BLOCK_SIZE];
+
+   ASSERT_EQ(emb_ext_flash_ftl_format(&ftl, &_intf, FTL_REGION_START, FTL_REGION_SIZE), 0);
+   std::vector <uint32_t> gens(emb_ext_flash_ftl_block_count(&ftl), 0);
+   for (uint32_t b = 0; b < 20; b++)
+   {
+      fill_block(data, b, 1);
+      ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, b, data), 0);
+      gens[b] = 1;
+   }
+
+   ASSERT_EQ(emb_ext_flash_ftl_trim(&ftl, 5, 10), 0);
+   for (uint32_t b = 5; b < 15; b++)
+   {
+      gens[b] = 0;
+   }
+   verify(&ftl, gens);
+   ASSERT_EQ(emb_ext_flash_ftl_trim(&ftl, 0, gens.size() + 1), -1);
+
+   // Trims survive a remount once synced
+   ASSERT_EQ(emb_ext_flash_ftl_sync(&ftl), 0);
+   ASSERT_EQ(emb_ext_flash_ftl_mount(&ftl, &_intf, FTL_REGION_START, FTL_REGION_SIZE), 0);
+   verify(&ftl, gens);
+}
+
+TEST_F(emb_ext_flash_ftl_test, remount)
+{
+   static emb_ext_flash_ftl_t ftl;
+   uint8_t                    data[EXT_FLASH_FTL_BLOCK_SIZE];
+   uint32_t                   seed = 3;
+
+   ASSERT_EQ(emb_ext_flash_ftl_format(&ftl, &_intf, FTL_REGION_START, FTL_REGION_SIZE), 0);
+   std::vector <uint32_t> gens(emb_ext_flash_ftl_block_count(&ftl), 0);
+
+   for (int round = 0; round < 6; round++)
+   {
+      // Enough random writes to keep the garbage collector busy
+      for (int i = 0; i < 400; i++)
+      {
+         seed = seed * 1103515245 + 12345;
+         uint32_t b = (seed >> 16) % gens.size();
+         gens[b]++;
+         fill_block(data, b, gens[b]);
+         ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, b, data), 0);
+      }
+
+      // Alternate between remounting from the summaries alone and from a checkpoint plus the summaries written since
+      if (round & 1)
+      {
+         ASSERT_EQ(emb_ext_flash_ftl_sync(&ftl), 0);
+         for (int i = 0; i < 30; i++)
+         {
+            uint32_t b = (i * 7) % gens.size();
+            gens[b]++;
+            fill_block(data, b, gens[b]);
+            ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, b, data), 0);
+         }
+      }
+
+      uint32_t reads = _flash_sim_stats.transactions;
+      ASSERT_EQ(emb_ext_flash_ftl_mount(&ftl, &_intf, FTL_REGION_START, FTL_REGION_SIZE), 0);
+      printf("round %d mount: %u transactions\n", round, (unsigned)(_flash_sim_stats.transactions - reads));
+      verify(&ftl, gens);
+   }
+}
+
+TEST_F(emb_ext_flash_ftl_test, torn_write)
+{
+   static emb_ext_flash_ftl_t ftl;
+   uint8_t                    data[EXT_FLASH_FTL_BLOCK_SIZE];
+
+   ASSERT_EQ(emb_ext_flash_ftl_format(&ftl, &_intf, FTL_REGION_START, FTL_REGION_SIZE), 0);
+   fill_block(data, 9, 1);
+   ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, 9, data), 0);
+   fill_block(data, 9, 2);
+   ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, 9, data), 0);
+
+   // Wipe the summary entry of the second write as if power failed before it was programmed
+   uint32_t entry = ftl.data_start + ftl.active * EXT_FLASH_SECTOR_SIZE + 16 + 1 * 12;
+   memset(&_flash_sim_mem[entry], 0xFF, 12);
+
+   ASSERT_EQ(emb_ext_flash_ftl_mount(&ftl, &_intf, FTL_REGION_START, FTL_REGION_SIZE), 0);
+   std::vector <uint32_t> gens(emb_ext_flash_ftl_block_count(&ftl), 0);
+   gens[9] = 1;
+   verify(&ftl, gens);
+
+   // The abandoned slots are not reused and new writes still land
+   fill_block(data, 9, 3);
+   ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, 9, data), 0);
+   gens[9] = 3;
+   verify(&ftl, gens);
+}
+
+TEST_F(emb_ext_flash_ftl_test, bench_random_writes)
+{
+   static emb_ext_flash_ftl_t ftl;
+   static uint8_t             sector[EXT_FLASH_SECTOR_SIZE];
+   uint8_t                    data[EXT_FLASH_FTL_BLOCK_SIZE];
+   const uint32_t             writes = 4000;
+
+   ASSERT_EQ(emb_ext_flash_ftl_format(&ftl, &_intf, FTL_REGION_START, FTL_REGION_SIZE), 0);
+   uint32_t               count = emb_ext_flash_ftl_block_count(&ftl);
+   std::vector <uint32_t> gens(count, 0);
+
+   // Fill the logical space once so garbage collection has to copy, then measure steady state random writes
+   for (uint32_t b = 0; b < count; b++)
+   {
+      gens[b] = 1;
+      fill_block(data, b, 1);
+      ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, b, data), 0);
+   }
+   memset(&_flash_sim_stats, 0, sizeof(_flash_sim_stats));
+   memset(_flash_sim_sector_erases, 0, sizeof(_flash_sim_sector_erases));
+   uint32_t host   = ftl.stat_host_writes;
+   uint32_t slots  = ftl.stat_slot_writes;
+   uint32_t seed   = 11;
+   for (uint32_t i = 0; i < writes; i++)
+   {
+      seed = seed * 1103515245 + 12345;
+      uint32_t b = (seed >> 16) % count;
+      gens[b]++;
+      fill_block(data, b, gens[b]);
+      ASSERT_EQ(emb_ext_flash_ftl_block_write(&ftl, b, data), 0);
+   }
+   double   ftl_us     = flash_sim_model_time_us();
+   uint32_t ftl_erases = _flash_sim_stats.erases;
+   double   ftl_wa     = (double)(ftl.stat_slot_writes - slots) / (ftl.stat_host_writes - host);
+   double   ftl_wear   = flash_sim_wear_ratio(FTL_REGION_START, FTL_REGION_SIZE);
+   verify(&ftl, gens);
+
+   // Naive mapping, read modify erase write of the 4K sector holding the block
+   memset(&_flash_sim_stats, 0, sizeof(_flash_sim_stats));
+   memset(_flash_sim_sector_erases, 0, sizeof(_flash_sim_sector_erases));
+   seed = 11;
+   for (uint32_t i = 0; i < writes; i++)
+   {
+      seed = seed * 1103515245 + 12345;
+      uint32_t b    = (seed >> 16) % count;
+      uint32_t addr = FTL_REGION_START + (b / 8) * EXT_FLASH_SECTOR_SIZE;
+      ASSERT_EQ(emb_ext_flash_read(&_intf, addr, sector, sizeof(sector)), (int)sizeof(sector));
+      fill_block(&sector[(b % 8) * EXT_FLASH_FTL_BLOCK_SIZE], b, i);
+      ASSERT_EQ(emb_ext_flash_erase(&_intf, addr, sizeof(sector)), 0);
+      ASSERT_EQ(emb_ext_flash_write(&_intf, addr, sector, sizeof(sector)), (int)sizeof(sector));
+   }
+   double   naive_us     = flash_sim_model_time_us();
+   uint32_t naive_erases = _flash_sim_stats.erases;
+   double   naive_wear   = flash_sim_wear_ratio(FTL_REGION_START, FTL_REGION_SIZE);
+
+   printf("ftl:   %u blocks, write amplification %.2f, %u erases, %.0f random 512B writes/s, wear max/mean %.2f\n",
+          (unsigned)count, ftl_wa, (unsigned)ftl_erases, writes / (ftl_us / 1e6), ftl_wear);
+   printf("naive: write amplification %.2f, %u erases, %.0f random 512B writes/s, wear max/mean %.2f\n",
+          (double)EXT_FLASH_SECTOR_SIZE / EXT_FLASH_FTL_BLOCK_SIZE, (unsigned)naive_erases, writes / (naive_us / 1e6), naive_wear);
+
+   ASSERT_LT(ftl_wa, (double)EXT_FLASH_SECTOR_SIZE / EXT_FLASH_FTL_BLOCK_SIZE);
+   ASSERT_LT(ftl_erases, naive_erases);
+   ASSERT_LT(ftl_us, naive_us);
+}
@@ -0,0 +1,183 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_crc.h>
+#include <emb_ext_flash_prog.h>
+
+// Size of the emulated devices
+#define HOST_DEV_SIZE    0x40000
+
+// Build an image of random pages with every fifth page left blank
+static std::vector <uint8_t> make_image(uint32_t len)
+{
+   std::vector <uint8_t> image(len);
+   uint32_t              seed = 5;
+
+   for (uint32_t i = 0; i < len; i++)
+   {
+      seed     = seed * 1103515245 + 12345;
+      image[i] = ((i / EXT_FLASH_PAGE_SIZE) % 5 == 4) ? 0xFF : (seed >> 16) & 0xFF;
+   }
+
+   return(image);
+}
+
+static double wall_ms()
+{
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC, &t);
+
+   return(t.tv_sec * 1e3 + t.tv_nsec / 1e6);
+}
+
+// Class for facilitating host programmer tests
+class emb_ext_flash_host_prog_test : public ::testing::Test
+{
+public:
+   emb_ext_flash_host_dev_t devs[8];
+   emb_flash_intf_handle_t  intfs[8];
+   emb_ext_flash_prog_job_t jobs[8];
+   uint32_t                 opened = 0;
+
+   // Open RAM backed devices without any simulated delays
+   void open_ram(uint32_t count, double scale)
+   {
+      for (uint32_t i = 0; i < count; i++)
+      {
+         ASSERT_EQ(emb_ext_flash_host_dev_open_ram(&devs[i], HOST_DEV_SIZE), 0);
+         ASSERT_EQ(emb_ext_flash_prog_job_host_dev(&jobs[i], &intfs[i], &devs[i]), 0);
+         devs[i].time_scale = scale;
+      }
+      opened = count;
+   }
+
+   void TearDown()
+   {
+      for (uint32_t i = 0; i < opened; i++)
+      {
+         emb_ext_flash_host_dev_close(&devs[i]);
+      }
+   }
+};
+
+TEST_F(emb_ext_flash_host_prog_test, program_and_verify)
+{
+   std::vector <uint8_t>     image = make_image(100000);
+   emb_ext_flash_prog_opts_t opts  = { 0x1000, HOST_DEV_SIZE, 1, 1 };
+
+   open_ram(4, 0.0);
+   ASSERT_EQ(emb_ext_flash_prog_run(jobs, 4, image.data(), image.size(), &opts), 0);
+
+   for (uint32_t i = 0; i < 4; i++)
+   {
+      ASSERT_EQ(jobs[i].result, EXT_FLASH_PROG_OK);
+      ASSERT_EQ(memcmp(&devs[i].mem[0x1000], image.data(), image.size()), 0);
+      ASSERT_EQ(jobs[i].crc, emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, image.data(), image.size()));
+
+      // Blank devices need no erases and blank pages are never sent
+      ASSERT_EQ(jobs[i].erases, 0u);
+      ASSERT_GT(jobs[i].erases_skipped, 0u);
+      ASSERT_EQ(jobs[i].pages_skipped, (uint32_t)(image.size() / EXT_FLASH_PAGE_SIZE / 5));
+      ASSERT_EQ(devs[i].stat_programs, jobs[i].pages_programmed);
+   }
+}
+
+TEST_F(emb_ext_flash_host_prog_test, erase_plan)
+{
+   std::vector <uint8_t>     image = make_image(0x21000 - 0x7000);
+   emb_ext_flash_prog_opts_t opts  = { 0x7000, HOST_DEV_SIZE, 1, 1 };
+
+   open_ram(1, 0.0);
+   memset(devs[0].mem, 0x00, HOST_DEV_SIZE);
+   ASSERT_EQ(emb_ext_flash_prog_run(jobs, 1, image.data(), image.size(), &opts), 0);
+
+   // 4K at 0x7000, 32K at 0x8000, 64K at 0x10000 and 4K at 0x20000, nothing outside the range
+   ASSERT_EQ(jobs[0].erases, 4u);
+   ASSERT_EQ(devs[0].mem[0x6FFF], 0x00);
+   ASSERT_EQ(devs[0].mem[0x21000], 0x00);
+   ASSERT_EQ(memcmp(&devs[0].mem[0x7000], image.data(), image.size()), 0);
+
+   // An image spanning the whole part gets a single chip erase
+   image = make_image(HOST_DEV_SIZE);
+   opts.address = 0;
+   memset(devs[0].mem, 0x00, HOST_DEV_SIZE);
+   ASSERT_EQ(emb_ext_flash_prog_run(jobs, 1, image.data(), image.size(), &opts), 0);
+   ASSERT_EQ(jobs[0].erases, 1u);
+   ASSERT_EQ(memcmp(devs[0].mem, image.data(), image.size()), 0);
+}
+
+TEST_F(emb_ext_flash_host_prog_test, image_file_backend)
+{
+   std::vector <uint8_t>     image = make_image(50000);
+   emb_ext_flash_prog_opts_t opts  = { 0, HOST_DEV_SIZE, 1, 1 };
+   char                      path[] = "/tmp/emb_ext_flash_host_prog_XXXXXX";
+
+   int fd = mkstemp(path);
+   ASSERT_GE(fd, 0);
+   close(fd);
+
+   ASSERT_EQ(emb_ext_flash_host_dev_open_file(&devs[0], path, HOST_DEV_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_prog_job_host_dev(&jobs[0], &intfs[0], &devs[0]), 0);
+   devs[0].time_scale = 0.0;
+   ASSERT_EQ(emb_ext_flash_prog_run(jobs, 1, image.data(), image.size(), &opts), 0);
+   emb_ext_flash_host_dev_close(&devs[0]);
+
+   // The file holds the image followed by erased bytes
+   std::vector <uint8_t> back(HOST_DEV_SIZE);
+   FILE                 *f = fopen(path, "rb");
+   ASSERT_NE(f, (FILE *)NULL);
+   ASSERT_EQ(fread(back.data(), 1, back.size(), f), back.size());
+   fclose(f);
+   unlink(path);
+   ASSERT_EQ(memcmp(back.data(), image.data(), image.size()), 0);
+   ASSERT_EQ(back[image.size()], 0xFF);
+   ASSERT_EQ(back[HOST_DEV_SIZE - 1], 0xFF);
+}
+
+TEST_F(emb_ext_flash_host_prog_test, bench_parallel_scaling)
+{
+   std::vector <uint8_t>     image = make_image(0x10000);
+   emb_ext_flash_prog_opts_t opts  = { 0, HOST_DEV_SIZE, 0, 1 };
+   double                    single = 0.0;
+
+   // Simulated timings at a twentieth of real time, blank check off so every device erases
+   for (uint32_t count = 1; count <= 8; count *= 2)
+   {
+      open_ram(count, 0.05);
+      double t0 = wall_ms();
+      ASSERT_EQ(emb_ext_flash_prog_run(jobs, count, image.data(), image.size(), &opts), 0);
+      double ms = wall_ms() - t0;
+      TearDown();
+
+      single = count == 1 ? ms : single;
+      printf("%u devices: %.1f ms wall, %.1f ms per device, %.0f KiB/s aggregate (%.2fx of one device)\n", (unsigned)count, ms,
+             jobs[0].total_us / 1e3, image.size() * count / 1024.0 / (ms / 1e3), single * count / ms);
+      if (count == 4)
+      {
+         ASSERT_LT(ms, single * 2);
+      }
+   }
+   opened = 0;
+}
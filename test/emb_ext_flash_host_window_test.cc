@@ -0,0 +1,160 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <vector>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_window.h>
+#include "emb_ext_flash_sim.h"
+
+// Size of the emulated image device and of the image in it
+#define WINDOW_DEV_SIZE      0x40000
+#define WINDOW_IMAGE_SIZE    0x30800
+
+// Size of the window over the simulator, deliberately not a whole number of pages
+#define WINDOW_SIM_SIZE      (FLASH_SIM_MEM_SIZE - 100)
+
+// Pattern with a different value in every byte position of a page
+static uint8_t pattern(uint32_t i)
+{
+   return((uint8_t)(i * 7 + (i >> 12) * 13));
+}
+
+// Class for facilitating memory window tests
+class emb_ext_flash_host_window_test : public ::testing::Test
+{
+public:
+   emb_ext_flash_window_t win;
+   uint32_t               page;
+
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      page = (uint32_t)sysconf(_SC_PAGESIZE);
+      memset(&win, 0, sizeof(win));
+   }
+
+   void TearDown()
+   {
+      emb_ext_flash_window_close(&win);
+      flash_sim_reset(0xFF);
+   }
+};
+
+TEST_F(emb_ext_flash_host_window_test, simulator_demand_paging)
+{
+   for (uint32_t i = 0; i < FLASH_SIM_MEM_SIZE; i++)
+   {
+      _flash_sim_mem[i] = pattern(i);
+   }
+
+   // The window needs userfaultfd, which a sandbox may not allow
+   if (emb_ext_flash_window_open(&win, &_intf, NULL, NULL, WINDOW_SIM_SIZE, 4, 8) != 0)
+   {
+      GTEST_SKIP() << "userfaultfd not available";
+   }
+   ASSERT_EQ(win.stat_faults, 0u);
+   ASSERT_EQ(_flash_sim_stats.bytes, 0u);
+
+   // One touch fetches the page and three more
+   ASSERT_EQ(win.mem[10 * page + 5], pattern(10 * page + 5));
+   ASSERT_EQ(win.stat_faults, 1u);
+   ASSERT_EQ(win.stat_pages_fetched, 4u);
+   ASSERT_EQ(win.stat_readahead_pages, 3u);
+   ASSERT_EQ(win.mem[13 * page + 9], pattern(13 * page + 9));
+   ASSERT_EQ(win.stat_faults, 1u);
+
+   // Read-ahead stops at a resident page
+   ASSERT_EQ(win.mem[8 * page], pattern(8 * page));
+   ASSERT_EQ(win.stat_faults, 2u);
+   ASSERT_EQ(win.stat_pages_fetched, 6u);
+
+   // Only the touched pages went over the bus
+   ASSERT_LT(_flash_sim_stats.bytes, 6 * page + 6 * 64);
+
+   // Walking the whole window keeps to the resident limit and reads every byte back right, the part page at the end is blank
+   for (uint32_t i = 0; i < WINDOW_SIM_SIZE; i += 61)
+   {
+      ASSERT_EQ(win.mem[i], pattern(i));
+   }
+   ASSERT_EQ(win.mem[WINDOW_SIM_SIZE - 1], pattern(WINDOW_SIM_SIZE - 1));
+   ASSERT_EQ(win.mem[WINDOW_SIM_SIZE], 0xFF);
+   ASSERT_LE(emb_ext_flash_window_resident(&win), 8u);
+   ASSERT_GT(win.stat_evictions, 0u);
+   ASSERT_EQ(win.stat_read_errors, 0u);
+
+   // Dropped pages fault back in
+   uint32_t faults = win.stat_faults;
+   ASSERT_EQ(win.mem[5], pattern(5));
+   ASSERT_EQ(win.stat_faults, faults + 1);
+
+   // After a change to the flash the window is dropped and reads the new data
+   uint8_t data[4] = { 1, 2, 3, 4 };
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, 0, EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0, data, sizeof(data)), 4);
+   ASSERT_EQ(win.mem[1], pattern(1));
+   ASSERT_EQ(emb_ext_flash_window_drop(&win), 0);
+   ASSERT_EQ(emb_ext_flash_window_resident(&win), 0u);
+   ASSERT_EQ(memcmp(win.mem, data, sizeof(data)), 0);
+   ASSERT_EQ(win.mem[5], 0xFF);
+}
+
+TEST_F(emb_ext_flash_host_window_test, image_file_backend)
+{
+   emb_ext_flash_host_dev_t dev;
+   emb_flash_intf_handle_t  intf;
+   std::vector <uint8_t>    image(WINDOW_IMAGE_SIZE);
+   char                     path[] = "/tmp/emb_ext_flash_host_window_XXXXXX";
+
+   for (uint32_t i = 0; i < WINDOW_IMAGE_SIZE; i++)
+   {
+      image[i] = pattern(i);
+   }
+   int fd = mkstemp(path);
+   ASSERT_GE(fd, 0);
+   ASSERT_EQ(write(fd, image.data(), image.size()), (ssize_t)image.size());
+   close(fd);
+
+   ASSERT_EQ(emb_ext_flash_host_dev_open_file(&dev, path, WINDOW_DEV_SIZE), 0);
+   dev.time_scale = 0.0;
+   if (emb_ext_flash_window_open_host_dev(&win, &intf, &dev, 0, 16) != 0)
+   {
+      emb_ext_flash_host_dev_close(&dev);
+      unlink(path);
+      GTEST_SKIP() << "userfaultfd not available";
+   }
+
+   // Pointer access to the image and the erased space after it
+   ASSERT_EQ(memcmp(win.mem, image.data(), image.size()), 0);
+   ASSERT_EQ(win.mem[WINDOW_IMAGE_SIZE], 0xFF);
+   ASSERT_EQ(win.mem[WINDOW_DEV_SIZE - 1], 0xFF);
+   // Every fault read ahead in full apart from the one on the last page
+   ASSERT_EQ(win.stat_pages_fetched, win.stat_faults * EXT_FLASH_WINDOW_READAHEAD - (EXT_FLASH_WINDOW_READAHEAD - 1));
+   ASSERT_LE(emb_ext_flash_window_resident(&win), 16u);
+   printf("window over a %u byte image: %u faults, %u pages fetched, %u by read-ahead, %u dropped\n", WINDOW_IMAGE_SIZE,
+          (unsigned)win.stat_faults, (unsigned)win.stat_pages_fetched, (unsigned)win.stat_readahead_pages,
+          (unsigned)win.stat_evictions);
+
+   emb_ext_flash_window_close(&win);
+   emb_ext_flash_host_dev_close(&dev);
+   unlink(path);
+}
@@ -0,0 +1,688 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <vector>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_journal.h>
+#include "emb_ext_flash_sim.h"
+
+// Journal, its ring and backup sectors, and the two record tables each transaction writes to
+#define JRNL_START      0x10000
+#define JRNL_SECTORS    4
+#define JRNL_LEN(ring)  (((ring) + EXT_FLASH_JOURNAL_MAX_REWRITES) * EXT_FLASH_SECTOR_SIZE)
+#define JRNL_TABLE_A    0x20000
+#define JRNL_TABLE_B    0x28000
+#define JRNL_TABLE_LEN  0x8000
+#define JRNL_REC_SIZE   32
+
+// Size in the journal of a group with a payload of n bytes
+#define JRNL_GROUP(n)   (EXT_FLASH_JOURNAL_HEADER_SIZE + EXT_FLASH_JOURNAL_MAX_REWRITES * EXT_FLASH_JOURNAL_REWRITE_SIZE + (n) + \
+                         EXT_FLASH_JOURNAL_COMMIT_SIZE)
+
+// Class for facilitating journal tests
+class emb_ext_flash_journal_test : public ::testing::Test
+{
+public:
+   emb_ext_flash_journal_t _jrnl;
+
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   void TearDown() { flash_sim_reset(0xFF); }
+
+   // Record i of a table, its bytes all derived from i and the table
+   static void record(uint32_t i, uint32_t table, uint8_t *rec)
+   {
+      for (uint32_t j = 0; j < JRNL_REC_SIZE; j++)
+      {
+         rec[j] = (uint8_t)(i * 7 + j + (table >> 12));
+      }
+   }
+
+   // Stage a transaction that writes record i to both tables
+   static void stage(emb_ext_flash_journal_txn_t *p_txn, uint32_t i)
+   {
+      uint8_t rec[JRNL_REC_SIZE];
+
+      emb_ext_flash_journal_begin(p_txn);
+      record(i, JRNL_TABLE_A, rec);
+      ASSERT_EQ(emb_ext_flash_journal_write(p_txn, JRNL_TABLE_A + i * JRNL_REC_SIZE, rec, JRNL_REC_SIZE), 0);
+      record(i, JRNL_TABLE_B, rec);
+      ASSERT_EQ(emb_ext_flash_journal_write(p_txn, JRNL_TABLE_B + i * JRNL_REC_SIZE, rec, JRNL_REC_SIZE), 0);
+   }
+
+   // Stage a transaction that writes record i to a slot of both tables
+   static void stage_slot(emb_ext_flash_journal_txn_t *p_txn, uint32_t i, uint32_t slot)
+   {
+      uint8_t rec[JRNL_REC_SIZE];
+
+      emb_ext_flash_journal_begin(p_txn);
+      record(i, JRNL_TABLE_A, rec);
+      ASSERT_EQ(emb_ext_flash_journal_write(p_txn, JRNL_TABLE_A + slot * JRNL_REC_SIZE, rec, JRNL_REC_SIZE), 0);
+      record(i, JRNL_TABLE_B, rec);
+      ASSERT_EQ(emb_ext_flash_journal_write(p_txn, JRNL_TABLE_B + slot * JRNL_REC_SIZE, rec, JRNL_REC_SIZE), 0);
+   }
+
+   // 1 if a slot of a table holds record i, 0 if it is erased, -1 for anything else
+   static int holds(uint32_t table, uint32_t slot, uint32_t i)
+   {
+      uint8_t rec[JRNL_REC_SIZE];
+      uint8_t erased[JRNL_REC_SIZE];
+
+      record(i, table, rec);
+      memset(erased, 0xFF, sizeof(erased));
+      if (!memcmp(&_flash_sim_mem[table + slot * JRNL_REC_SIZE], rec, JRNL_REC_SIZE))
+      {
+         return(1);
+      }
+      return(memcmp(&_flash_sim_mem[table + slot * JRNL_REC_SIZE], erased, JRNL_REC_SIZE) ? -1 : 0);
+   }
+
+   // 1 if record i is in its own slot of a table, 0 if the slot is erased, -1 for anything else
+   static int present(uint32_t i, uint32_t table) { return(holds(table, i, i)); }
+
+   static void count_cb(void *ctx, int result)
+   {
+      if (result == 0)
+      {
+         (*(uint32_t *)ctx)++;
+      }
+   }
+
+   static void fail_cb(void *ctx, int result)
+   {
+      if (result != 0)
+      {
+         (*(uint32_t *)ctx)++;
+      }
+   }
+
+   // Lock that checks it is never taken twice, and a task that commits while a sync runs
+   static int                          _lock_depth;
+   static uint32_t                     _locks;
+   static emb_ext_flash_journal_txn_t *_late_txn;
+   static int                          _late_sync;
+
+   static void lock(void *ctx)
+   {
+      ASSERT_EQ(_lock_depth, 0);
+      _lock_depth++;
+      _locks++;
+   }
+
+   static void unlock(void *ctx) { _lock_depth--; }
+
+   static void late_cb(void *ctx, int result)
+   {
+      emb_ext_flash_journal_t *p_jrnl = (emb_ext_flash_journal_t *)ctx;
+      ASSERT_EQ(result, 0);
+      ASSERT_EQ(emb_ext_flash_journal_commit(p_jrnl, _late_txn, NULL, NULL), 0);
+      _late_sync = emb_ext_flash_journal_sync(p_jrnl);
+   }
+};
+
+int                          emb_ext_flash_journal_test::_lock_depth = 0;
+uint32_t                     emb_ext_flash_journal_test::_locks      = 0;
+emb_ext_flash_journal_txn_t *emb_ext_flash_journal_test::_late_txn   = NULL;
+int                          emb_ext_flash_journal_test::_late_sync  = -1;
+
+TEST_F(emb_ext_flash_journal_test, commit_applies_and_persists)
+{
+   emb_ext_flash_journal_txn_t txn;
+   uint32_t                    done = 0;
+   uint8_t                     rec[JRNL_REC_SIZE];
+
+   ASSERT_EQ(emb_ext_flash_journal_format(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+
+   // Nothing reaches flash before the sync
+   stage(&txn, 0);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn, count_cb, &done), 0);
+   ASSERT_EQ(present(0, JRNL_TABLE_A), 0);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 1);
+   ASSERT_EQ(done, 1u);
+   ASSERT_EQ(present(0, JRNL_TABLE_A), 1);
+   ASSERT_EQ(present(0, JRNL_TABLE_B), 1);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 0);
+
+   // A clean mount has nothing to replay or roll back and appends after the last group
+   ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+   ASSERT_EQ(_jrnl.stat_replays, 0u);
+   ASSERT_EQ(_jrnl.stat_rollbacks, 0u);
+   ASSERT_EQ(_jrnl.cur, 0);
+   ASSERT_EQ(_jrnl.off, (uint32_t)JRNL_GROUP(2 * (EXT_FLASH_JOURNAL_WRITE_SIZE + JRNL_REC_SIZE)));
+   ASSERT_EQ(_jrnl.seq, 2u);
+   stage(&txn, 1);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn, count_cb, &done), 0);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 1);
+   ASSERT_EQ(present(1, JRNL_TABLE_A), 1);
+   ASSERT_EQ(present(1, JRNL_TABLE_B), 1);
+
+   // Bad arguments
+   ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START + 1, 2 * EXT_FLASH_SECTOR_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, JRNL_LEN(1)), -1);
+   ASSERT_EQ(emb_ext_flash_journal_format(NULL, &_intf, JRNL_START, JRNL_LEN(2)), -1);
+   emb_ext_flash_journal_begin(&txn);
+   for (uint32_t i = 0; i < EXT_FLASH_JOURNAL_TXN_SIZE / (EXT_FLASH_JOURNAL_WRITE_SIZE + JRNL_REC_SIZE); i++)
+   {
+      ASSERT_EQ(emb_ext_flash_journal_write(&txn, JRNL_TABLE_A, rec, sizeof(rec)), 0);
+   }
+   ASSERT_EQ(emb_ext_flash_journal_write(&txn, JRNL_TABLE_A, rec, sizeof(rec)), -1);
+}
+
+TEST_F(emb_ext_flash_journal_test, group_commit_merges_programs)
+{
+   emb_ext_flash_journal_txn_t txn[8];
+   uint32_t                    done = 0;
+
+   ASSERT_EQ(emb_ext_flash_journal_format(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+
+   // Eight tasks commit before anyone syncs
+   for (uint32_t i = 0; i < 8; i++)
+   {
+      stage(&txn[i], i);
+      ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[i], count_cb, &done), 0);
+   }
+   uint32_t programs = _flash_sim_stats.programs;
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 8);
+   ASSERT_EQ(done, 8u);
+   ASSERT_EQ(_jrnl.stat_groups, 1u);
+   for (uint32_t i = 0; i < 8; i++)
+   {
+      ASSERT_EQ(present(i, JRNL_TABLE_A), 1);
+      ASSERT_EQ(present(i, JRNL_TABLE_B), 1);
+   }
+
+   // Three pages of journal, one page of each table and the applied marker
+   uint32_t group = JRNL_GROUP(8 * 2 * (EXT_FLASH_JOURNAL_WRITE_SIZE + JRNL_REC_SIZE));
+   ASSERT_EQ(_flash_sim_stats.programs - programs, (group + EXT_FLASH_PAGE_SIZE - 1) / EXT_FLASH_PAGE_SIZE + 2 + 1);
+
+   // More pending than fit in a sector go out as several groups
+   emb_ext_flash_journal_txn_t big[EXT_FLASH_JOURNAL_MAX_PENDING];
+   for (uint32_t i = 0; i < EXT_FLASH_JOURNAL_MAX_PENDING; i++)
+   {
+      uint8_t rec[EXT_FLASH_JOURNAL_TXN_SIZE - EXT_FLASH_JOURNAL_WRITE_SIZE];
+      memset(rec, (uint8_t)i, sizeof(rec));
+      emb_ext_flash_journal_begin(&big[i]);
+      ASSERT_EQ(emb_ext_flash_journal_write(&big[i], JRNL_TABLE_A + 0x1000 + i * sizeof(rec), rec, sizeof(rec)), 0);
+      ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &big[i], count_cb, &done), 0);
+   }
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[0], count_cb, &done), -1);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), EXT_FLASH_JOURNAL_MAX_PENDING);
+   ASSERT_EQ(_jrnl.stat_groups, 1u + (EXT_FLASH_JOURNAL_MAX_PENDING + 6) / 7);
+   for (uint32_t i = 0; i < EXT_FLASH_JOURNAL_MAX_PENDING; i++)
+   {
+      ASSERT_EQ(_flash_sim_mem[JRNL_TABLE_A + 0x1000 + i * (EXT_FLASH_JOURNAL_TXN_SIZE - EXT_FLASH_JOURNAL_WRITE_SIZE)], i);
+   }
+}
+
+TEST_F(emb_ext_flash_journal_test, ring_wraps)
+{
+   emb_ext_flash_journal_txn_t txn;
+   uint32_t                    done = 0;
+
+   ASSERT_EQ(emb_ext_flash_journal_format(&_jrnl, &_intf, JRNL_START, JRNL_LEN(2)), 0);
+
+   // The two sectors are reused several times over
+   uint32_t group = JRNL_GROUP(2 * (EXT_FLASH_JOURNAL_WRITE_SIZE + JRNL_REC_SIZE));
+   for (uint32_t i = 0; i < 200; i++)
+   {
+      stage(&txn, i);
+      ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn, count_cb, &done), 0);
+      ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 1);
+      if (i % 37 == 0)
+      {
+         uint16_t cur = _jrnl.cur;
+         uint32_t off = _jrnl.off;
+         uint32_t seq = _jrnl.seq;
+         ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, JRNL_LEN(2)), 0);
+         ASSERT_EQ(_jrnl.cur, cur);
+         ASSERT_EQ(_jrnl.off, off);
+         ASSERT_EQ(_jrnl.seq, seq);
+      }
+   }
+   ASSERT_EQ(done, 200u);
+   ASSERT_EQ(_flash_sim_sector_erases[JRNL_START / EXT_FLASH_SECTOR_SIZE] +
+             _flash_sim_sector_erases[JRNL_START / EXT_FLASH_SECTOR_SIZE + 1], 2 + 199u / (EXT_FLASH_SECTOR_SIZE / group));
+   for (uint32_t i = 0; i < 200; i++)
+   {
+      ASSERT_EQ(present(i, JRNL_TABLE_A), 1);
+      ASSERT_EQ(present(i, JRNL_TABLE_B), 1);
+   }
+}
+
+TEST_F(emb_ext_flash_journal_test, mount_replays_and_rolls_back)
+{
+   emb_ext_flash_journal_txn_t txn[4];
+   uint32_t                    done = 0;
+
+   // Power lost in the first program of a table: the group is committed, so mount finishes it
+   ASSERT_EQ(emb_ext_flash_journal_format(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+   for (uint32_t i = 0; i < 4; i++)
+   {
+      stage(&txn[i], i);
+      ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[i], count_cb, &done), 0);
+   }
+   flash_sim_fault_seed(1);
+   flash_sim_cut_power_in_op(3);
+   emb_ext_flash_journal_sync(&_jrnl);
+   ASSERT_TRUE(flash_sim_power_lost());
+   flash_sim_restore_power();
+   emb_ext_flash_init_intf(&_intf);
+   _intf.deselect();
+   ASSERT_EQ(present(3, JRNL_TABLE_B), 0);
+   ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+   ASSERT_EQ(_jrnl.stat_replays, 1u);
+   for (uint32_t i = 0; i < 4; i++)
+   {
+      ASSERT_EQ(present(i, JRNL_TABLE_A), 1);
+      ASSERT_EQ(present(i, JRNL_TABLE_B), 1);
+   }
+   ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+   ASSERT_EQ(_jrnl.stat_replays, 0u);
+
+   // Power lost just before the commit record: nothing is applied and the group is rolled back
+   for (uint32_t i = 0; i < 4; i++)
+   {
+      stage(&txn[i], 4 + i);
+      ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[i], count_cb, &done), 0);
+   }
+   flash_sim_cut_power_after(1);
+   emb_ext_flash_journal_sync(&_jrnl);
+   ASSERT_TRUE(flash_sim_power_lost());
+   flash_sim_restore_power();
+   emb_ext_flash_init_intf(&_intf);
+   _intf.deselect();
+   ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+   ASSERT_EQ(_jrnl.stat_replays, 0u);
+   for (uint32_t i = 4; i < 8; i++)
+   {
+      ASSERT_EQ(present(i, JRNL_TABLE_A), 0);
+      ASSERT_EQ(present(i, JRNL_TABLE_B), 0);
+   }
+
+   // The journal carries on after either
+   stage(&txn[0], 4);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[0], count_cb, &done), 0);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 1);
+   ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+   ASSERT_EQ(present(4, JRNL_TABLE_A), 1);
+   ASSERT_EQ(present(4, JRNL_TABLE_B), 1);
+}
+
+TEST_F(emb_ext_flash_journal_test, replace_existing_records)
+{
+   emb_ext_flash_journal_txn_t txn[2];
+   uint32_t                    done = 0, failed = 0;
+   uint8_t                     rec[JRNL_REC_SIZE];
+
+   ASSERT_EQ(emb_ext_flash_journal_format(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+   for (uint32_t k = 0x800; k < EXT_FLASH_SECTOR_SIZE; k++)
+   {
+      _flash_sim_mem[JRNL_TABLE_A + k] = (uint8_t)(k * 3);
+      _flash_sim_mem[JRNL_TABLE_A + EXT_FLASH_SECTOR_SIZE + k] = 0x00;
+   }
+
+   // A fresh slot is programmed in place
+   stage_slot(&txn[0], 0, 0);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[0], count_cb, &done), 0);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 1);
+   ASSERT_EQ(_jrnl.stat_rewrites, 0u);
+
+   // Replacing it rewrites both table sectors and keeps the rest of them
+   stage_slot(&txn[0], 1, 0);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[0], count_cb, &done), 0);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 1);
+   ASSERT_EQ(_jrnl.stat_rewrites, 2u);
+   ASSERT_EQ(holds(JRNL_TABLE_A, 0, 1), 1);
+   ASSERT_EQ(holds(JRNL_TABLE_B, 0, 1), 1);
+   for (uint32_t k = 0x800; k < EXT_FLASH_SECTOR_SIZE; k++)
+   {
+      ASSERT_EQ(_flash_sim_mem[JRNL_TABLE_A + k], (uint8_t)(k * 3));
+   }
+
+   // New contents that only clear bits stay in place
+   record(1, JRNL_TABLE_A, rec);
+   rec[0] &= 0xF0;
+   emb_ext_flash_journal_begin(&txn[0]);
+   ASSERT_EQ(emb_ext_flash_journal_write(&txn[0], JRNL_TABLE_A, rec, sizeof(rec)), 0);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[0], count_cb, &done), 0);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 1);
+   ASSERT_EQ(_jrnl.stat_rewrites, 2u);
+   ASSERT_EQ(memcmp(&_flash_sim_mem[JRNL_TABLE_A], rec, sizeof(rec)), 0);
+
+   // Transactions that rewrite too many sectors together go out as separate groups
+   uint32_t groups = _jrnl.stat_groups;
+   stage_slot(&txn[0], 2, 0);
+   memset(rec, 0x5A, sizeof(rec));
+   emb_ext_flash_journal_begin(&txn[1]);
+   ASSERT_EQ(emb_ext_flash_journal_write(&txn[1], JRNL_TABLE_A + EXT_FLASH_SECTOR_SIZE + 0x800, rec, sizeof(rec)), 0);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[0], count_cb, &done), 0);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[1], count_cb, &done), 0);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 2);
+   ASSERT_EQ(_jrnl.stat_groups, groups + 2);
+   ASSERT_EQ(holds(JRNL_TABLE_A, 0, 2), 1);
+   ASSERT_EQ(holds(JRNL_TABLE_B, 0, 2), 1);
+   ASSERT_EQ(memcmp(&_flash_sim_mem[JRNL_TABLE_A + EXT_FLASH_SECTOR_SIZE + 0x800], rec, sizeof(rec)), 0);
+   ASSERT_EQ(done, 5u);
+
+   // One that does on its own fails and changes nothing, and so does one that writes into the journal
+   const uint8_t erased = 0xFF;
+   stage_slot(&txn[0], 3, 0);
+   ASSERT_EQ(emb_ext_flash_journal_write(&txn[0], JRNL_TABLE_A + EXT_FLASH_SECTOR_SIZE + 0x800, &erased, 1), 0);
+   emb_ext_flash_journal_begin(&txn[1]);
+   ASSERT_EQ(emb_ext_flash_journal_write(&txn[1], JRNL_START + 0x100, rec, 1), 0);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[0], fail_cb, &failed), 0);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[1], fail_cb, &failed), 0);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 0);
+   ASSERT_EQ(failed, 2u);
+   ASSERT_EQ(holds(JRNL_TABLE_A, 0, 2), 1);
+   ASSERT_EQ(holds(JRNL_TABLE_B, 0, 2), 1);
+
+   // All of it survives a remount
+   ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+   ASSERT_EQ(_jrnl.stat_replays, 0u);
+   ASSERT_EQ(holds(JRNL_TABLE_A, 0, 2), 1);
+}
+
+TEST_F(emb_ext_flash_journal_test, lock_and_late_commits)
+{
+   emb_ext_flash_journal_txn_t txn[2];
+
+   ASSERT_EQ(emb_ext_flash_journal_format(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+   ASSERT_EQ(emb_ext_flash_journal_set_lock(&_jrnl, lock, NULL, NULL), -1);
+   ASSERT_EQ(emb_ext_flash_journal_set_lock(&_jrnl, lock, unlock, NULL), 0);
+   _lock_depth = 0;
+   _locks      = 0;
+   _late_sync  = -1;
+   _late_txn   = &txn[1];
+
+   // Another task commits and syncs while the first sync runs, the running sync writes its transaction out
+   stage(&txn[0], 0);
+   stage(&txn[1], 1);
+   ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[0], late_cb, &_jrnl), 0);
+   ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 2);
+   ASSERT_EQ(_late_sync, 0);
+   ASSERT_EQ(_jrnl.stat_groups, 2u);
+   ASSERT_EQ(present(0, JRNL_TABLE_A), 1);
+   ASSERT_EQ(present(1, JRNL_TABLE_B), 1);
+   ASSERT_EQ(_lock_depth, 0);
+   ASSERT_GE(_locks, 5u);
+}
+
+// Transactions of two records in different tables, committed in groups of one to four, with the power cut at random.
+// Every transaction acknowledged before the loss survives, the group in flight lands as a whole or not at all, and no
+// record is ever torn.
+TEST_F(emb_ext_flash_journal_test, power_loss_atomicity)
+{
+   const uint32_t              len = JRNL_LEN(2);
+   emb_ext_flash_journal_txn_t txn[4];
+   uint32_t                    torn = 0, replays = 0, rollbacks = 0;
+
+   srand(49);
+   for (uint32_t trial = 0; trial < 600; trial++)
+   {
+      flash_sim_reset(0xFF);
+      flash_sim_fault_seed(trial + 1);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      ASSERT_EQ(emb_ext_flash_journal_format(&_jrnl, &_intf, JRNL_START, len), 0);
+
+      if (trial % 3 == 0)
+      {
+         flash_sim_cut_power_after(1 + rand() % 400);
+      }
+      else if (trial % 3 == 1)
+      {
+         flash_sim_cut_power_in_op(1 + rand() % 60);
+      }
+      else
+      {
+         flash_sim_cut_power_in_erase(1);
+      }
+
+      // Commit until the power goes, the ring wraps after about twenty groups
+      uint32_t acked = 0, next = 0, in_flight = 0;
+      while (!flash_sim_power_lost() && next < 64)
+      {
+         uint32_t done = 0;
+         uint32_t n    = 1 + rand() % 4;
+         for (uint32_t i = 0; i < n; i++)
+         {
+            stage(&txn[i], next + i);
+            ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[i], count_cb, &done), 0);
+         }
+         int rtn = emb_ext_flash_journal_sync(&_jrnl);
+         if (flash_sim_power_lost())
+         {
+            in_flight = n;
+         }
+         else
+         {
+            ASSERT_EQ(rtn, (int)n);
+            ASSERT_EQ(done, n);
+            acked += n;
+         }
+         next += n;
+      }
+      torn += _flash_sim_stats.torn_programs + _flash_sim_stats.torn_erases;
+
+      // Reboot
+      flash_sim_restore_power();
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, len), 0) << "trial " << trial;
+      replays   += _jrnl.stat_replays;
+      rollbacks += _jrnl.stat_rollbacks;
+
+      int landed = present(acked, JRNL_TABLE_A);
+      for (uint32_t i = 0; i < next; i++)
+      {
+         int expect = i < acked ? 1 : (i < acked + in_flight ? landed : 0);
+         ASSERT_EQ(present(i, JRNL_TABLE_A), expect) << "trial " << trial << " txn " << i;
+         ASSERT_EQ(present(i, JRNL_TABLE_B), expect) << "trial " << trial << " txn " << i;
+      }
+
+      // The journal carries on from there
+      stage(&txn[0], next);
+      ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[0], NULL, NULL), 0);
+      ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 1);
+      ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, len), 0);
+      ASSERT_EQ(present(next, JRNL_TABLE_A), 1) << "trial " << trial;
+      ASSERT_EQ(present(next, JRNL_TABLE_B), 1) << "trial " << trial;
+   }
+   printf("torn %u replays %u rollbacks %u\n", (unsigned)torn, (unsigned)replays, (unsigned)rollbacks);
+   ASSERT_GT(torn, 100u);
+   ASSERT_GT(replays, 20u);
+   ASSERT_GT(rollbacks, 20u);
+}
+
+// Transactions that replace the records in eight slots of both tables over and over, so that every group rewrites both
+// table sectors from their backups. Each slot holds the record of the last transaction that landed, the rest of the sectors
+// is kept, and the group in flight lands as a whole or not at all.
+TEST_F(emb_ext_flash_journal_test, power_loss_replace)
+{
+   const uint32_t              len   = JRNL_LEN(2);
+   const uint32_t              slots = 8;
+   emb_ext_flash_journal_txn_t txn[4];
+   uint32_t                    torn = 0, replays = 0, rollbacks = 0;
+
+   srand(4949);
+   for (uint32_t trial = 0; trial < 400; trial++)
+   {
+      flash_sim_reset(0xFF);
+      flash_sim_fault_seed(trial + 1);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      for (uint32_t k = 0x800; k < EXT_FLASH_SECTOR_SIZE; k++)
+      {
+         _flash_sim_mem[JRNL_TABLE_A + k] = (uint8_t)(k * 3);
+      }
+      ASSERT_EQ(emb_ext_flash_journal_format(&_jrnl, &_intf, JRNL_START, len), 0);
+
+      if (trial % 3 == 0)
+      {
+         flash_sim_cut_power_after(1 + rand() % 1500);
+      }
+      else if (trial % 3 == 1)
+      {
+         flash_sim_cut_power_in_op(1 + rand() % 200);
+      }
+      else
+      {
+         flash_sim_cut_power_in_erase(1 + rand() % 24);
+      }
+
+      uint32_t acked = 0, next = 0, in_flight = 0;
+      while (!flash_sim_power_lost() && next < 40)
+      {
+         uint32_t done = 0;
+         uint32_t n    = 1 + rand() % 4;
+         for (uint32_t i = 0; i < n; i++)
+         {
+            stage_slot(&txn[i], next + i, (next + i) % slots);
+            ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[i], count_cb, &done), 0);
+         }
+         int rtn = emb_ext_flash_journal_sync(&_jrnl);
+         if (flash_sim_power_lost())
+         {
+            in_flight = n;
+         }
+         else
+         {
+            ASSERT_EQ(rtn, (int)n);
+            ASSERT_EQ(done, n);
+            acked += n;
+         }
+         next += n;
+      }
+      torn += _flash_sim_stats.torn_programs + _flash_sim_stats.torn_erases;
+
+      // Reboot
+      flash_sim_restore_power();
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, len), 0) << "trial " << trial;
+      replays   += _jrnl.stat_replays;
+      rollbacks += _jrnl.stat_rollbacks;
+
+      // Either every transaction up to the acknowledged ones landed or the group in flight did too
+      bool matches[2] = { true, true };
+      for (uint32_t landed = 0; landed < 2; landed++)
+      {
+         uint32_t count = acked + (landed ? in_flight : 0);
+         for (uint32_t slot = 0; slot < slots; slot++)
+         {
+            int last = -1;
+            for (uint32_t i = slot; i < count; i += slots)
+            {
+               last = (int)i;
+            }
+            for (uint32_t table = JRNL_TABLE_A; table <= JRNL_TABLE_B; table += JRNL_TABLE_B - JRNL_TABLE_A)
+            {
+               if (last < 0 ? holds(table, slot, 0) != 0 : holds(table, slot, (uint32_t)last) != 1)
+               {
+                  matches[landed] = false;
+               }
+            }
+         }
+      }
+      ASSERT_TRUE(matches[0] || (in_flight && matches[1])) << "trial " << trial << " acked " << acked << " in flight " << in_flight;
+      for (uint32_t k = 0x800; k < EXT_FLASH_SECTOR_SIZE; k++)
+      {
+         ASSERT_EQ(_flash_sim_mem[JRNL_TABLE_A + k], (uint8_t)(k * 3)) << "trial " << trial;
+      }
+
+      // The journal carries on from there
+      stage_slot(&txn[0], next, 0);
+      ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[0], NULL, NULL), 0);
+      ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), 1);
+      ASSERT_EQ(emb_ext_flash_journal_mount(&_jrnl, &_intf, JRNL_START, len), 0);
+      ASSERT_EQ(holds(JRNL_TABLE_A, 0, next), 1) << "trial " << trial;
+      ASSERT_EQ(holds(JRNL_TABLE_B, 0, next), 1) << "trial " << trial;
+   }
+   printf("torn %u replays %u rollbacks %u\n", (unsigned)torn, (unsigned)replays, (unsigned)rollbacks);
+   ASSERT_GT(torn, 100u);
+   ASSERT_GT(replays, 20u);
+   ASSERT_GT(rollbacks, 5u);
+}
+
+// Transactions of two 32 byte records, written straight with emb_ext_flash_write() and through the journal with group
+// commits of several sizes
+TEST_F(emb_ext_flash_journal_test, bench_group_commit)
+{
+   const uint32_t              n         = 256;
+   const uint32_t              batches[] = { 1, 2, 4, 8, 16 };
+   emb_ext_flash_journal_txn_t txn[16];
+   double                      rate[6];
+
+   for (uint32_t mode = 0; mode < 6; mode++)
+   {
+      SetUp();
+      ASSERT_EQ(emb_ext_flash_journal_format(&_jrnl, &_intf, JRNL_START, JRNL_LEN(JRNL_SECTORS)), 0);
+
+      double start = flash_sim_model_time_us();
+      for (uint32_t i = 0; i < n;)
+      {
+         if (mode == 0)
+         {
+            // Two programs per transaction and no atomicity
+            uint8_t rec[JRNL_REC_SIZE];
+            record(i, JRNL_TABLE_A, rec);
+            ASSERT_EQ(emb_ext_flash_write(&_intf, JRNL_TABLE_A + i * JRNL_REC_SIZE, rec, JRNL_REC_SIZE), JRNL_REC_SIZE);
+            record(i, JRNL_TABLE_B, rec);
+            ASSERT_EQ(emb_ext_flash_write(&_intf, JRNL_TABLE_B + i * JRNL_REC_SIZE, rec, JRNL_REC_SIZE), JRNL_REC_SIZE);
+            i++;
+            continue;
+         }
+
+         uint32_t batch = batches[mode - 1];
+         for (uint32_t j = 0; j < batch; j++)
+         {
+            stage(&txn[j], i + j);
+            ASSERT_EQ(emb_ext_flash_journal_commit(&_jrnl, &txn[j], NULL, NULL), 0);
+         }
+         ASSERT_EQ(emb_ext_flash_journal_sync(&_jrnl), (int)batch);
+         i += batch;
+      }
+      rate[mode] = n * 1e6 / (flash_sim_model_time_us() - start);
+      for (uint32_t i = 0; i < n; i++)
+      {
+         ASSERT_EQ(present(i, JRNL_TABLE_A), 1);
+         ASSERT_EQ(present(i, JRNL_TABLE_B), 1);
+      }
+   }
+
+   printf("%u transactions       commits per second\n", (unsigned)n);
+   printf("direct, not atomic %20.0f\n", rate[0]);
+   for (uint32_t mode = 1; mode < 6; mode++)
+   {
+      printf("journal, batch %-2u %21.0f\n", (unsigned)batches[mode - 1], rate[mode]);
+   }
+   for (uint32_t mode = 2; mode < 6; mode++)
+   {
+      EXPECT_GT(rate[mode], rate[mode - 1]);
+   }
+   EXPECT_GT(rate[5], rate[1] * 2.5);
+}
@@ -0,0 +1,281 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_lfs.h>
+#include "emb_ext_flash_sim.h"
+
+static emb_ext_flash_lfs_t _lfs;
+
+// Class for facilitating littlefs adapter tests
+class emb_ext_flash_lfs_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   void TearDown()
+   {
+      emb_ext_flash_release(&_intf);
+      emb_ext_flash_set_read_ahead(&_intf, NULL, 0, 0);
+      flash_sim_reset(0xFF);
+   }
+};
+
+TEST_F(emb_ext_flash_lfs_test, geometry)
+{
+   ASSERT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0, FLASH_SIM_MEM_SIZE, 0), 0);
+   EXPECT_EQ(_lfs.block_size, (uint32_t)EXT_FLASH_SECTOR_SIZE);
+   EXPECT_EQ(_lfs.block_count, (uint32_t)(FLASH_SIM_MEM_SIZE / EXT_FLASH_SECTOR_SIZE));
+   EXPECT_EQ(_lfs.cache_size, (uint32_t)EXT_FLASH_PAGE_SIZE);
+   EXPECT_EQ(_lfs.prog_size, (uint32_t)EXT_FLASH_LFS_PROG_SIZE);
+   EXPECT_EQ(_intf.ra.size, EXT_FLASH_LFS_READ_AHEAD);
+   EXPECT_EQ(_intf.ra.hold, 1);
+
+   ASSERT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0x10000, 0x20000, EXT_FLASH_BLOCK_64K_SIZE), 0);
+   EXPECT_EQ(_lfs.block_count, 2u);
+
+   // Sizes without an erase command, misaligned regions, regions too small and unknown capacity
+   EXPECT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0, FLASH_SIM_MEM_SIZE, 8192), EXT_FLASH_LFS_ERR_INVAL);
+   EXPECT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0x1000, FLASH_SIM_MEM_SIZE, EXT_FLASH_BLOCK_32K_SIZE), EXT_FLASH_LFS_ERR_INVAL);
+   EXPECT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0, EXT_FLASH_SECTOR_SIZE, 0), EXT_FLASH_LFS_ERR_INVAL);
+   EXPECT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0, 0, 0), EXT_FLASH_LFS_ERR_INVAL);
+
+   // A known chip without 4K erase defaults to the next size it has and refuses sizes it cannot erase
+   emb_ext_flash_chip_t chip = { 0, 18, EXT_FLASH_CHIP_ERASE_32K | EXT_FLASH_CHIP_ERASE_64K, 0, 0, 0, 0, 0, 0, 0 };
+   _intf.p_chip              = &chip;
+   ASSERT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0, 0, 0), 0);
+   EXPECT_EQ(_lfs.block_size, (uint32_t)EXT_FLASH_BLOCK_32K_SIZE);
+   EXPECT_EQ(_lfs.block_count, (uint32_t)(FLASH_SIM_MEM_SIZE / EXT_FLASH_BLOCK_32K_SIZE));
+   EXPECT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0, 0, EXT_FLASH_SECTOR_SIZE), EXT_FLASH_LFS_ERR_INVAL);
+   _intf.p_chip = NULL;
+
+   // Out of range blocks
+   ASSERT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0, 0x4000, 0), 0);
+   uint8_t buf[16];
+   EXPECT_EQ(emb_ext_flash_lfs_read(&_lfs, 4, 0, buf, sizeof(buf)), EXT_FLASH_LFS_ERR_INVAL);
+   EXPECT_EQ(emb_ext_flash_lfs_prog(&_lfs, 0, EXT_FLASH_SECTOR_SIZE - 8, buf, sizeof(buf)), EXT_FLASH_LFS_ERR_INVAL);
+   EXPECT_EQ(emb_ext_flash_lfs_erase(&_lfs, 4), EXT_FLASH_LFS_ERR_INVAL);
+}
+
+TEST_F(emb_ext_flash_lfs_test, progs_joined_per_page)
+{
+   uint8_t data[528], back[528];
+
+   for (uint16_t i = 0; i < sizeof(data); i++)
+   {
+      data[i] = (uint8_t)(i * 13 + 1);
+   }
+   ASSERT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0, FLASH_SIM_MEM_SIZE, 0), 0);
+
+   // A pointer then two cache flushes, each straddling a page boundary
+   ASSERT_EQ(emb_ext_flash_lfs_prog(&_lfs, 1, 0, data, 16), 0);
+   ASSERT_EQ(emb_ext_flash_lfs_prog(&_lfs, 1, 16, &data[16], 256), 0);
+   ASSERT_EQ(emb_ext_flash_lfs_prog(&_lfs, 1, 272, &data[272], 256), 0);
+   EXPECT_EQ(_flash_sim_stats.programs, 2u);
+   EXPECT_EQ(_lfs.staged_len, 16);
+
+   // Reading programs the staged tail first
+   ASSERT_EQ(emb_ext_flash_lfs_read(&_lfs, 1, 0, back, sizeof(back)), 0);
+   EXPECT_EQ(memcmp(data, back, sizeof(data)), 0);
+   EXPECT_EQ(_flash_sim_stats.programs, 3u);
+   EXPECT_EQ(_lfs.stat_programs, 3u);
+
+   // A prog elsewhere in the same page is not joined to the staged one
+   ASSERT_EQ(emb_ext_flash_lfs_prog(&_lfs, 2, 0, data, 16), 0);
+   ASSERT_EQ(emb_ext_flash_lfs_prog(&_lfs, 2, 64, &data[64], 16), 0);
+   EXPECT_EQ(_flash_sim_stats.programs, 4u);
+   ASSERT_EQ(emb_ext_flash_lfs_sync(&_lfs), 0);
+   EXPECT_EQ(_flash_sim_stats.programs, 5u);
+   EXPECT_EQ(memcmp(&_flash_sim_mem[2 * EXT_FLASH_SECTOR_SIZE + 64], &data[64], 16), 0);
+   EXPECT_EQ(_flash_sim_mem[2 * EXT_FLASH_SECTOR_SIZE + 16], 0xFF);
+}
+
+TEST_F(emb_ext_flash_lfs_test, erase_and_sync)
+{
+   uint8_t buf[64];
+
+   memset(_flash_sim_mem, 0x00, FLASH_SIM_MEM_SIZE);
+   ASSERT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0, FLASH_SIM_MEM_SIZE, EXT_FLASH_BLOCK_32K_SIZE), 0);
+
+   // One block erase per block
+   ASSERT_EQ(emb_ext_flash_lfs_erase(&_lfs, 1), 0);
+   EXPECT_EQ(_flash_sim_stats.erases, 1u);
+   EXPECT_EQ(_flash_sim_stats.erased_bytes, (uint32_t)EXT_FLASH_BLOCK_32K_SIZE);
+   EXPECT_EQ(_flash_sim_mem[0x7FFF], 0x00);
+   EXPECT_EQ(_flash_sim_mem[0x8000], 0xFF);
+   EXPECT_EQ(_flash_sim_mem[0xFFFF], 0xFF);
+   EXPECT_EQ(_flash_sim_mem[0x10000], 0x00);
+
+   // Sequential reads hold the bus until sync
+   ASSERT_EQ(emb_ext_flash_lfs_read(&_lfs, 1, 0, buf, sizeof(buf)), 0);
+   ASSERT_EQ(emb_ext_flash_lfs_read(&_lfs, 1, sizeof(buf), buf, sizeof(buf)), 0);
+   EXPECT_EQ(_intf.ra.open, 1);
+   ASSERT_EQ(emb_ext_flash_lfs_sync(&_lfs), 0);
+   EXPECT_EQ(_intf.ra.open, 0);
+   EXPECT_EQ(_lfs.stat_syncs, 1u);
+}
+
+// Block device calls of a littlefs file system, for replaying its access pattern on either adapter
+struct lfs_bd_t
+{
+   int ( *read )(uint32_t block, uint32_t off, uint8_t *buf, uint32_t size);
+   int ( *prog )(uint32_t block, uint32_t off, const uint8_t *buf, uint32_t size);
+   int ( *erase )(uint32_t block);
+   int ( *sync )();
+   uint32_t prog_size;
+   uint32_t cache_size;
+};
+
+// Typical glue, every call straight to the driver with 16 byte caches
+static int naive_read(uint32_t block, uint32_t off, uint8_t *buf, uint32_t size)
+{
+   return(emb_ext_flash_read(&_intf, block * EXT_FLASH_SECTOR_SIZE + off, buf, (uint16_t)size) == (int)size ? 0 : -5);
+}
+
+static int naive_prog(uint32_t block, uint32_t off, const uint8_t *buf, uint32_t size)
+{
+   return(emb_ext_flash_write(&_intf, block * EXT_FLASH_SECTOR_SIZE + off, (uint8_t *)buf, (uint16_t)size) == (int)size ? 0 : -5);
+}
+
+static int naive_erase(uint32_t block)
+{
+   return(emb_ext_flash_erase(&_intf, block * EXT_FLASH_SECTOR_SIZE, EXT_FLASH_SECTOR_SIZE));
+}
+
+static int naive_sync()
+{
+   return(0);
+}
+
+static int adapter_read(uint32_t block, uint32_t off, uint8_t *buf, uint32_t size)
+{
+   return(emb_ext_flash_lfs_read(&_lfs, block, off, buf, size));
+}
+
+static int adapter_prog(uint32_t block, uint32_t off, const uint8_t *buf, uint32_t size)
+{
+   return(emb_ext_flash_lfs_prog(&_lfs, block, off, buf, size));
+}
+
+static int adapter_erase(uint32_t block)
+{
+   return(emb_ext_flash_lfs_erase(&_lfs, block));
+}
+
+static int adapter_sync()
+{
+   return(emb_ext_flash_lfs_sync(&_lfs));
+}
+
+// Write a file the way littlefs lays it out: each data block starts with its skip-list pointer, data goes out one cache at a
+// time, and closing the file commits to the metadata pair and syncs
+static void lfs_like_write(const lfs_bd_t &bd, uint32_t blocks)
+{
+   uint8_t buf[EXT_FLASH_PAGE_SIZE];
+
+   memset(buf, 0x5A, sizeof(buf));
+   for (uint32_t b = 2; b < 2 + blocks; b++)
+   {
+      ASSERT_EQ(bd.erase(b), 0);
+      ASSERT_EQ(bd.prog(b, 0, buf, bd.prog_size), 0);
+      for (uint32_t off = bd.prog_size; off < EXT_FLASH_SECTOR_SIZE; off += bd.cache_size)
+      {
+         uint32_t n = EXT_FLASH_SECTOR_SIZE - off < bd.cache_size ? EXT_FLASH_SECTOR_SIZE - off : bd.cache_size;
+         ASSERT_EQ(bd.prog(b, off, buf, n), 0);
+      }
+   }
+   ASSERT_EQ(bd.prog(0, 0, buf, 4 * bd.prog_size), 0);
+   ASSERT_EQ(bd.sync(), 0);
+}
+
+// Read the file back one cache at a time
+static void lfs_like_read(const lfs_bd_t &bd, uint32_t blocks)
+{
+   uint8_t buf[EXT_FLASH_PAGE_SIZE];
+
+   for (uint32_t b = 2; b < 2 + blocks; b++)
+   {
+      for (uint32_t off = 0; off < EXT_FLASH_SECTOR_SIZE; off += bd.cache_size)
+      {
+         ASSERT_EQ(bd.read(b, off, buf, bd.cache_size), 0);
+      }
+   }
+   ASSERT_EQ(bd.sync(), 0);
+}
+
+// Mount: compare the revision counts of the superblock pair, then walk the commits of the newer block
+static void lfs_like_mount(const lfs_bd_t &bd)
+{
+   uint8_t buf[EXT_FLASH_PAGE_SIZE];
+
+   ASSERT_EQ(bd.read(0, 0, buf, 4), 0);
+   ASSERT_EQ(bd.read(1, 0, buf, 4), 0);
+   for (uint32_t off = 0; off < 1024; off += bd.cache_size)
+   {
+      ASSERT_EQ(bd.read(0, off, buf, bd.cache_size), 0);
+   }
+   ASSERT_EQ(bd.sync(), 0);
+}
+
+TEST_F(emb_ext_flash_lfs_test, bench_against_naive_glue)
+{
+   const lfs_bd_t bds[2] = {
+      { naive_read, naive_prog, naive_erase, naive_sync, 16, 16 },
+      { adapter_read, adapter_prog, adapter_erase, adapter_sync, EXT_FLASH_LFS_PROG_SIZE, EXT_FLASH_PAGE_SIZE },
+   };
+   const char    *names[2] = { "naive", "adapter" };
+   uint32_t       cycles[2][3];
+
+   printf("32K file     write: cycles programs    read: cycles     mount: cycles\n");
+   for (int i = 0; i < 2; i++)
+   {
+      SetUp();
+      ASSERT_EQ(emb_ext_flash_lfs_init(&_lfs, &_intf, 0, FLASH_SIM_MEM_SIZE, 0), 0);
+      if (i == 0)
+      {
+         emb_ext_flash_set_read_ahead(&_intf, NULL, 0, 0);
+      }
+
+      uint32_t start = _flash_sim_stats.transactions;
+      lfs_like_write(bds[i], 8);
+      cycles[i][0]       = _flash_sim_stats.transactions - start;
+      uint32_t programs  = _flash_sim_stats.programs;
+      start              = _flash_sim_stats.transactions;
+      lfs_like_read(bds[i], 8);
+      cycles[i][1]       = _flash_sim_stats.transactions - start;
+      start              = _flash_sim_stats.transactions;
+      lfs_like_mount(bds[i]);
+      cycles[i][2]       = _flash_sim_stats.transactions - start;
+
+      printf("%-8s %14u %9u %15u %15u\n", names[i], (unsigned)cycles[i][0], (unsigned)programs, (unsigned)cycles[i][1],
+             (unsigned)cycles[i][2]);
+      TearDown();
+   }
+
+   for (int k = 0; k < 3; k++)
+   {
+      EXPECT_LT(cycles[1][k] * 4, cycles[0][k]);
+   }
+}
@@ -0,0 +1,232 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <vector>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_lz.h>
+#include <emb_ext_flash_writer.h>
+#include "emb_ext_flash_sim.h"
+
+// Region used by the compressed stream tests
+#define LZ_REGION_START    0x10000
+#define LZ_REGION_SIZE     0x20000
+
+// Build a synthetic telemetry stream, 32 byte records with slowly moving sensor values and one noisy channel
+static std::vector < uint8_t > make_telemetry(uint32_t records)
+{
+   std::vector < uint8_t > out;
+   uint32_t                seed = 1;
+
+   for (uint32_t r = 0; r < records; r++)
+   {
+      uint8_t rec[32] = { 0 };
+      uint32_t ts = 1700000000 + r * 10;
+      memcpy(rec, &ts, 4);
+      rec[4] = 0xA5;
+      rec[5] = r & 0x01;
+      for (int s = 0; s < 8; s++)
+      {
+         seed = seed * 1103515245 + 12345;
+         int16_t v = 1000 * s + (int16_t)((r / (16 << s)) % 64) + (s == 0 ? ((seed >> 16) & 0x3) : 0);
+         memcpy(&rec[8 + s * 2], &v, 2);
+      }
+      out.insert(out.end(), rec, rec + sizeof(rec));
+   }
+
+   return(out);
+}
+
+// Class for facilitating compressed stream tests
+class emb_ext_flash_lz_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+};
+
+TEST_F(emb_ext_flash_lz_test, codec_round_trip)
+{
+   static uint16_t hash[EXT_FLASH_LZ_HASH_SIZE];
+   static uint8_t  src[EXT_FLASH_LZ_FRAME_RAW_MAX];
+   static uint8_t  dst[EXT_FLASH_LZ_FRAME_RAW_MAX * 2];
+   static uint8_t  out[EXT_FLASH_LZ_FRAME_RAW_MAX];
+   uint16_t        consumed;
+
+   // Runs, repeating text and noise
+   for (int pattern = 0; pattern < 3; pattern++)
+   {
+      uint32_t seed = 7;
+      for (int i = 0; i < EXT_FLASH_LZ_FRAME_RAW_MAX; i++)
+      {
+         seed   = seed * 1103515245 + 12345;
+         src[i] = pattern == 0 ? 0x55 : pattern == 1 ? "flash telemetry "[i % 16] : (seed >> 16);
+      }
+
+      int clen = emb_ext_flash_lz_compress(hash, src, sizeof(src), dst, sizeof(dst), &consumed);
+      ASSERT_EQ(consumed, sizeof(src));
+      ASSERT_EQ(emb_ext_flash_lz_decompress(dst, clen, out, sizeof(out)), (int)sizeof(src));
+      ASSERT_EQ(memcmp(src, out, sizeof(src)), 0);
+
+      // Compressing into a small buffer consumes a prefix that still round trips
+      clen = emb_ext_flash_lz_compress(hash, src, sizeof(src), dst, 100, &consumed);
+      ASSERT_LE(clen, 100);
+      ASSERT_GT(consumed, 0);
+      ASSERT_EQ(emb_ext_flash_lz_decompress(dst, clen, out, sizeof(out)), consumed);
+      ASSERT_EQ(memcmp(src, out, consumed), 0);
+   }
+
+   // Corrupt input is rejected rather than overrunning
+   uint8_t bad[] = { 0x80, 0x10 };
+   ASSERT_EQ(emb_ext_flash_lz_decompress(bad, sizeof(bad), out, sizeof(out)), -1);
+   uint8_t short_lit[] = { 0x05, 0x01 };
+   ASSERT_EQ(emb_ext_flash_lz_decompress(short_lit, sizeof(short_lit), out, sizeof(out)), -1);
+}
+
+TEST_F(emb_ext_flash_lz_test, stream_round_trip)
+{
+   std::vector < uint8_t >   data = make_telemetry(2000);
+   std::vector < uint8_t >   rx(data.size());
+   static emb_ext_flash_lz_t lz;
+
+   ASSERT_EQ(emb_ext_flash_lz_open(&lz, &_intf, LZ_REGION_START + 1, LZ_REGION_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_lz_open(&lz, &_intf, LZ_REGION_START, LZ_REGION_SIZE), 0);
+
+   // Write half, reopen to make sure the stream resumes where it left off, then write the rest
+   ASSERT_EQ(emb_ext_flash_lz_write(&lz, data.data(), data.size() / 2), (int)data.size() / 2);
+   ASSERT_EQ(emb_ext_flash_lz_flush(&lz), 0);
+   uint32_t frames = lz.frames;
+   ASSERT_EQ(emb_ext_flash_lz_open(&lz, &_intf, LZ_REGION_START, LZ_REGION_SIZE), 0);
+   ASSERT_EQ(lz.frames, frames);
+   ASSERT_EQ(emb_ext_flash_lz_size(&lz), data.size() / 2);
+   ASSERT_EQ(emb_ext_flash_lz_write(&lz, &data[data.size() / 2], data.size() / 2), (int)data.size() / 2);
+   ASSERT_EQ(emb_ext_flash_lz_flush(&lz), 0);
+   ASSERT_EQ(emb_ext_flash_lz_size(&lz), data.size());
+
+   // Sequential streaming read in odd sized chunks
+   static emb_ext_flash_lz_reader_t rd;
+   ASSERT_EQ(emb_ext_flash_lz_reader_open(&rd, &_intf, LZ_REGION_START, LZ_REGION_SIZE), 0);
+   for (uint32_t off = 0; off < data.size(); off += 77)
+   {
+      uint32_t len = data.size() - off < 77 ? data.size() - off : 77;
+      ASSERT_EQ(emb_ext_flash_lz_read(&rd, off, &rx[off], len), (int)len);
+   }
+   ASSERT_EQ(rx, data);
+
+   // Random access
+   uint32_t offsets[] = { 60000, 5, 31999, 40000, 0, (uint32_t)data.size() - 10 };
+   for (uint32_t off : offsets)
+   {
+      uint8_t buf[10];
+      ASSERT_EQ(emb_ext_flash_lz_read(&rd, off, buf, sizeof(buf)), 10);
+      ASSERT_EQ(memcmp(buf, &data[off], sizeof(buf)), 0);
+   }
+
+   // Reads past the end are short
+   uint8_t tail[20];
+   ASSERT_EQ(emb_ext_flash_lz_read(&rd, data.size() - 10, tail, sizeof(tail)), 10);
+
+   // Random access by frame
+   uint32_t raw_offset = 0;
+   int      raw_len    = emb_ext_flash_lz_read_frame(&rd, 3, &raw_offset);
+   ASSERT_GT(raw_len, 0);
+   ASSERT_EQ(memcmp(rd.raw, &data[raw_offset], raw_len), 0);
+   ASSERT_EQ(emb_ext_flash_lz_read_frame(&rd, lz.frames, NULL), -1);
+}
+
+TEST_F(emb_ext_flash_lz_test, region_full)
+{
+   std::vector < uint8_t >   noise(3 * EXT_FLASH_SECTOR_SIZE);
+   static emb_ext_flash_lz_t lz;
+   uint32_t                  seed = 3;
+
+   for (auto &b : noise)
+   {
+      seed = seed * 1103515245 + 12345;
+      b    = seed >> 16;
+   }
+
+   // Mark the sector after the region so stray erases show up
+   _flash_sim_mem[LZ_REGION_START + EXT_FLASH_SECTOR_SIZE] = 0x00;
+
+   // Incompressible data cannot fit in a single sector region, writes go on until a short count says every frame is used
+   ASSERT_EQ(emb_ext_flash_lz_open(&lz, &_intf, LZ_REGION_START, EXT_FLASH_SECTOR_SIZE), 0);
+   uint32_t accepted = 0;
+   int      n;
+   do
+   {
+      n         = emb_ext_flash_lz_write(&lz, &noise[accepted], 100);
+      accepted += n;
+   } while (n == 100);
+   ASSERT_LT(accepted, noise.size());
+   ASSERT_EQ(lz.frames, EXT_FLASH_SECTOR_SIZE / EXT_FLASH_PAGE_SIZE);
+   ASSERT_EQ(emb_ext_flash_lz_write(&lz, &noise[accepted], 100), 0);
+
+   // Every byte taken is stored
+   ASSERT_EQ(emb_ext_flash_lz_flush(&lz), 0);
+   ASSERT_EQ(emb_ext_flash_lz_size(&lz), accepted);
+
+   static emb_ext_flash_lz_reader_t rd;
+   std::vector < uint8_t >          rx(accepted);
+   ASSERT_EQ(emb_ext_flash_lz_reader_open(&rd, &_intf, LZ_REGION_START, EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_lz_read(&rd, 0, rx.data(), accepted), (int)accepted);
+   ASSERT_EQ(memcmp(rx.data(), noise.data(), accepted), 0);
+
+   // Nothing beyond the region was touched
+   ASSERT_EQ(_flash_sim_mem[LZ_REGION_START + EXT_FLASH_SECTOR_SIZE], 0x00);
+}
+
+TEST_F(emb_ext_flash_lz_test, bench_compressed_vs_raw)
+{
+   std::vector < uint8_t >   data = make_telemetry(4000);
+   static emb_ext_flash_lz_t lz;
+
+   // Raw path through the streaming writer
+   flash_sim_reset(0x00);
+   emb_ext_flash_writer_t w;
+   ASSERT_EQ(emb_ext_flash_writer_open(&w, &_intf, LZ_REGION_START, LZ_REGION_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_writer_append(&w, data.data(), data.size()), 0);
+   ASSERT_EQ(emb_ext_flash_writer_close(&w, 0, NULL), (int)data.size());
+   double   raw_us     = flash_sim_model_time_us();
+   uint32_t raw_erased = _flash_sim_stats.erased_bytes;
+
+   // Compressed path
+   flash_sim_reset(0xFF);
+   ASSERT_EQ(emb_ext_flash_lz_open(&lz, &_intf, LZ_REGION_START, LZ_REGION_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_lz_write(&lz, data.data(), data.size()), (int)data.size());
+   ASSERT_EQ(emb_ext_flash_lz_flush(&lz), 0);
+   double   lz_us     = flash_sim_model_time_us();
+   uint32_t lz_erased = _flash_sim_stats.erased_bytes;
+
+   // Sector erase cycles needed to store the stream either way
+   double raw_sectors = (double)raw_erased / EXT_FLASH_SECTOR_SIZE;
+   double lz_sectors  = (double)lz_erased / EXT_FLASH_SECTOR_SIZE;
+
+   printf("raw:        %u bytes, %.0f B/s effective, %.0f sector erases\n", (unsigned)data.size(), data.size() / (raw_us / 1e6), raw_sectors);
+   printf("compressed: %u bytes in %u frames (%.2fx), %.0f B/s effective, %.0f sector erases (%.0f saved)\n", (unsigned)data.size(),
+          (unsigned)lz.frames, (double)data.size() / lz.stat_flash_bytes, data.size() / (lz_us / 1e6), lz_sectors, raw_sectors - lz_sectors);
+
+   ASSERT_LT(lz.stat_flash_bytes, data.size() / 2);
+   ASSERT_LT(lz_erased, raw_erased);
+   ASSERT_LT(lz_us, raw_us);
+}
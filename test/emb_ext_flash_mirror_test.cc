@@ -0,0 +1,228 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_mirror.h>
+#include "emb_ext_flash_sim.h"
+#include "emb_ext_flash_fake.h"
+
+// Class for facilitating mirror tests, the simulator and a fake chip with BUSY timed on the virtual clock
+class emb_ext_flash_mirror_test : public ::testing::Test
+{
+public:
+   emb_flash_intf_handle_t _b;
+   emb_ext_flash_mirror_t  _mirror;
+
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      _intf.get_time_us = _get_time_us;
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      _flash_sim_program_us = FLASH_FAKE_PROGRAM_US;
+      _flash_sim_erase_us   = FLASH_FAKE_ERASE_US;
+      _b                    = fake_bus<0>::handle();
+      ASSERT_EQ(emb_ext_flash_mirror_init(&_mirror, &_intf, &_b), 0);
+   }
+
+   void TearDown()
+   {
+      flash_sim_reset(0xFF);
+      _intf.get_time_us = NULL;
+      emb_ext_flash_init_intf(&_intf);
+   }
+
+   static void fill(uint8_t *data, uint16_t len, uint8_t seed)
+   {
+      for (uint16_t i = 0; i < len; i++)
+      {
+         data[i] = (uint8_t)(seed + i * 7);
+      }
+   }
+};
+
+TEST_F(emb_ext_flash_mirror_test, copies_match_and_reads_alternate)
+{
+   uint8_t data[300], back[300];
+
+   ASSERT_EQ(emb_ext_flash_mirror_erase(&_mirror, 0, 0x2000), 0);
+   for (int i = 0; i < 8; i++)
+   {
+      fill(data, sizeof(data), (uint8_t)i);
+      ASSERT_EQ(emb_ext_flash_mirror_write(&_mirror, i * 0x200, data, sizeof(data)), (int)sizeof(data));
+   }
+   ASSERT_EQ(emb_ext_flash_mirror_sync(&_mirror), 0);
+   EXPECT_EQ(memcmp(_flash_sim_mem, fake_bus<0>::chip.mem, 0x2000), 0);
+
+   for (int i = 0; i < 8; i++)
+   {
+      fill(data, sizeof(data), (uint8_t)i);
+      ASSERT_EQ(emb_ext_flash_mirror_read(&_mirror, i * 0x200, back, sizeof(back)), (int)sizeof(back));
+      EXPECT_EQ(memcmp(data, back, sizeof(data)), 0);
+   }
+   EXPECT_EQ(_mirror.stat_reads[0], 4u);
+   EXPECT_EQ(_mirror.stat_reads[1], 4u);
+   EXPECT_EQ(_mirror.stat_crc_errors, 0u);
+
+   // Bad arguments
+   EXPECT_EQ(emb_ext_flash_mirror_init(&_mirror, &_intf, &_intf), -1);
+   EXPECT_EQ(emb_ext_flash_mirror_write(NULL, 0, data, 1), -1);
+   EXPECT_EQ(emb_ext_flash_mirror_read(&_mirror, 0, back, 0), -1);
+}
+
+TEST_F(emb_ext_flash_mirror_test, bad_copy_repaired)
+{
+   uint8_t a[100], b[300], back[300];
+
+   // Two records in the same sector, the second one crossing pages
+   fill(a, sizeof(a), 1);
+   fill(b, sizeof(b), 2);
+   ASSERT_EQ(emb_ext_flash_mirror_write(&_mirror, 0x1000, a, sizeof(a)), (int)sizeof(a));
+   ASSERT_EQ(emb_ext_flash_mirror_write(&_mirror, 0x1080, b, sizeof(b)), (int)sizeof(b));
+   ASSERT_EQ(emb_ext_flash_mirror_sync(&_mirror), 0);
+
+   // Damage the copy on the simulator and read it from there first
+   _flash_sim_mem[0x1080 + 5] ^= 0x5A;
+   _mirror.next = 0;
+   ASSERT_EQ(emb_ext_flash_mirror_read(&_mirror, 0x1080, back, sizeof(b)), (int)sizeof(b));
+   EXPECT_EQ(memcmp(b, back, sizeof(b)), 0);
+   EXPECT_EQ(_mirror.stat_crc_errors, 1u);
+   EXPECT_EQ(_mirror.stat_repairs, 1u);
+   EXPECT_EQ(_mirror.stat_reads[1], 1u);
+   EXPECT_EQ(memcmp(&_flash_sim_mem[0x1000], &fake_bus<0>::chip.mem[0x1000], EXT_FLASH_SECTOR_SIZE), 0);
+
+   // The repaired copy reads back, and so does its neighbour
+   _mirror.next = 0;
+   ASSERT_EQ(emb_ext_flash_mirror_read(&_mirror, 0x1080, back, sizeof(b)), (int)sizeof(b));
+   EXPECT_EQ(_mirror.stat_reads[0], 1u);
+   ASSERT_EQ(emb_ext_flash_mirror_read(&_mirror, 0x1000, back, sizeof(a)), (int)sizeof(a));
+   EXPECT_EQ(memcmp(a, back, sizeof(a)), 0);
+
+   // With both copies damaged the record is lost
+   _flash_sim_mem[0x1000] ^= 0x01;
+   fake_bus<0>::chip.mem[0x1001] ^= 0x01;
+   EXPECT_EQ(emb_ext_flash_mirror_read(&_mirror, 0x1000, back, sizeof(a)), -1);
+   EXPECT_EQ(_mirror.stat_lost, 1u);
+   EXPECT_EQ(_mirror.stat_repairs, 1u);
+}
+
+TEST_F(emb_ext_flash_mirror_test, repair_keeps_neighbours)
+{
+   uint8_t a[100], b[100], back[100];
+
+   // Two records in the same sector, each damaged on a different chip
+   fill(a, sizeof(a), 3);
+   fill(b, sizeof(b), 4);
+   ASSERT_EQ(emb_ext_flash_mirror_write(&_mirror, 0x2000, a, sizeof(a)), (int)sizeof(a));
+   ASSERT_EQ(emb_ext_flash_mirror_write(&_mirror, 0x2400, b, sizeof(b)), (int)sizeof(b));
+   ASSERT_EQ(emb_ext_flash_mirror_sync(&_mirror), 0);
+   _flash_sim_mem[0x2000 + 7]        ^= 0x10;
+   fake_bus<0>::chip.mem[0x2400 + 9] ^= 0x10;
+
+   // Repairing A on the simulator must not bring in the bad copy of B from the fake chip
+   _mirror.next = 0;
+   ASSERT_EQ(emb_ext_flash_mirror_read(&_mirror, 0x2000, back, sizeof(a)), (int)sizeof(a));
+   EXPECT_EQ(memcmp(a, back, sizeof(a)), 0);
+   _mirror.next = 0;
+   ASSERT_EQ(emb_ext_flash_mirror_read(&_mirror, 0x2400, back, sizeof(b)), (int)sizeof(b));
+   EXPECT_EQ(memcmp(b, back, sizeof(b)), 0);
+   EXPECT_EQ(_mirror.stat_repairs, 1u);
+   EXPECT_EQ(_mirror.stat_lost, 0u);
+
+   // Repairing B on the fake chip leaves both chips whole
+   _mirror.next = 1;
+   ASSERT_EQ(emb_ext_flash_mirror_read(&_mirror, 0x2400, back, sizeof(b)), (int)sizeof(b));
+   EXPECT_EQ(memcmp(b, back, sizeof(b)), 0);
+   EXPECT_EQ(_mirror.stat_repairs, 2u);
+   EXPECT_EQ(memcmp(&_flash_sim_mem[0x2000], &fake_bus<0>::chip.mem[0x2000], EXT_FLASH_SECTOR_SIZE), 0);
+}
+
+TEST_F(emb_ext_flash_mirror_test, reads_skip_busy_chip)
+{
+   uint8_t data[64], back[64];
+
+   fill(data, sizeof(data), 3);
+   ASSERT_EQ(emb_ext_flash_mirror_write(&_mirror, 0x3000, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_EQ(emb_ext_flash_mirror_sync(&_mirror), 0);
+
+   // Erase elsewhere, the fake chip takes much longer than the simulator
+   fake_bus<0>::chip.erase_us = 4 * FLASH_FAKE_ERASE_US;
+   ASSERT_EQ(emb_ext_flash_mirror_erase(&_mirror, 0x8000, EXT_FLASH_SECTOR_SIZE), 0);
+   flash_sim_advance(2 * FLASH_FAKE_ERASE_US);
+
+   // Whoever's turn it is, reads go to the idle simulator without waiting
+   uint32_t start = _flash_sim_time_us;
+   for (int i = 0; i < 4; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_mirror_read(&_mirror, 0x3000, back, sizeof(back)), (int)sizeof(back));
+      EXPECT_EQ(memcmp(data, back, sizeof(data)), 0);
+   }
+   EXPECT_EQ(_flash_sim_time_us, start);
+   EXPECT_EQ(_mirror.stat_reads[0], 4u);
+   EXPECT_EQ(_mirror.stat_busy_skips, 3u);
+   EXPECT_EQ(_mirror.busy[1], 1);
+   ASSERT_EQ(emb_ext_flash_mirror_sync(&_mirror), 0);
+}
+
+// Log records appended to both chips while a config record is read back, by hand on two handles and through the mirror
+TEST_F(emb_ext_flash_mirror_test, bench_log_and_read)
+{
+   uint8_t log[200 + EXT_FLASH_MIRROR_OVERHEAD], cfg[64], back[64];
+   uint16_t len = 200;
+
+   printf("second chip program   naive us   mirror us   speedup\n");
+   for (uint32_t program_us = FLASH_FAKE_PROGRAM_US; program_us <= 2 * FLASH_FAKE_PROGRAM_US; program_us *= 2)
+   {
+      uint32_t elapsed[2];
+      for (int mode = 0; mode < 2; mode++)
+      {
+         SetUp();
+         fake_bus<0>::chip.program_us = program_us;
+         fill(cfg, sizeof(cfg), 9);
+         ASSERT_EQ(emb_ext_flash_mirror_write(&_mirror, 0, cfg, sizeof(cfg)), (int)sizeof(cfg));
+         ASSERT_EQ(emb_ext_flash_mirror_sync(&_mirror), 0);
+
+         uint32_t start = _flash_sim_time_us;
+         for (int i = 0; i < 32; i++)
+         {
+            uint32_t addr = 0x1000 + i * 0x100;
+            fill(log, len, (uint8_t)i);
+            if (mode == 0)
+            {
+               // Each copy of the record and its CRC written and waited for in turn, reads from the first chip
+               ASSERT_EQ(emb_ext_flash_write_timeout(&_intf, addr, log, sizeof(log), EXT_FLASH_MIRROR_WAIT_US), (int)sizeof(log));
+               ASSERT_EQ(emb_ext_flash_write_timeout(&_b, addr, log, sizeof(log), EXT_FLASH_MIRROR_WAIT_US), (int)sizeof(log));
+               ASSERT_EQ(emb_ext_flash_read(&_intf, 0, back, sizeof(back)), (int)sizeof(back));
+            }
+            else
+            {
+               ASSERT_EQ(emb_ext_flash_mirror_write(&_mirror, addr, log, len), (int)len);
+               ASSERT_EQ(emb_ext_flash_mirror_read(&_mirror, 0, back, sizeof(back)), (int)sizeof(back));
+            }
+            ASSERT_EQ(memcmp(cfg, back, sizeof(cfg)), 0);
+         }
+         ASSERT_EQ(emb_ext_flash_mirror_sync(&_mirror), 0);
+         elapsed[mode] = _flash_sim_time_us - start;
+      }
+      printf("%13u us %10u %11u %9.2f\n", (unsigned)program_us, (unsigned)elapsed[0], (unsigned)elapsed[1],
+             (double)elapsed[0] / elapsed[1]);
+      EXPECT_GT(elapsed[0], 2 * elapsed[1] * program_us / (program_us + FLASH_FAKE_PROGRAM_US));
+   }
+}
@@ -0,0 +1,227 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <vector>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_crc.h>
+#include <emb_ext_flash_patch.h>
+#include "emb_ext_flash_sim.h"
+
+// Slot layout used by the tests
+#define OLD_SLOT      0x00000
+#define NEW_SLOT      0x10000
+#define PATCH_SLOT    0x30000
+#define SLOT_SIZE     0x10000
+
+// Minimal patch encoder for building test vectors
+class patch_encoder
+{
+public:
+   std::vector < uint8_t > out;
+
+   patch_encoder(const std::vector < uint8_t > &image)
+   {
+      uint32_t crc = emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, image.data(), image.size());
+
+      out.insert(out.end(), EXT_FLASH_PATCH_MAGIC, EXT_FLASH_PATCH_MAGIC + 4);
+      put_u32(image.size());
+      put_u32(crc);
+   }
+
+   void copy(int32_t offset, uint32_t len)
+   {
+      put_varint((len << 1) | EXT_FLASH_PATCH_OP_COPY);
+      put_varint(((uint32_t)offset << 1) ^ (uint32_t)(offset >> 31));
+   }
+
+   void insert(const uint8_t *data, uint32_t len)
+   {
+      put_varint((len << 1) | EXT_FLASH_PATCH_OP_INSERT);
+      out.insert(out.end(), data, data + len);
+   }
+
+private:
+   void put_u32(uint32_t v)
+   {
+      for (int i = 0; i < 4; i++)
+      {
+         out.push_back(v >> (8 * i));
+      }
+   }
+
+   void put_varint(uint32_t v)
+   {
+      while (v >= 0x80)
+      {
+         out.push_back((v & 0x7F) | 0x80);
+         v >>= 7;
+      }
+      out.push_back(v);
+   }
+};
+
+// Class for facilitating patch application tests
+class emb_ext_flash_patch_test : public ::testing::Test
+{
+public:
+   std::vector < uint8_t > old_image;
+   std::vector < uint8_t > new_image;
+
+   void SetUp()
+   {
+      flash_sim_reset(0x00);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+
+      // Old image in flash
+      old_image.resize(20000);
+      for (size_t i = 0; i < old_image.size(); i++)
+      {
+         old_image[i] = (uint8_t)((i * 131) ^ (i >> 7));
+      }
+      memcpy(&_flash_sim_mem[OLD_SLOT], old_image.data(), old_image.size());
+   }
+
+   // Build a new image from the old one along with the matching patch
+   patch_encoder build_patch()
+   {
+      uint8_t lit[100];
+
+      for (int i = 0; i < 100; i++)
+      {
+         lit[i] = 0xA0 + i;
+      }
+
+      // Keep the first 5000 bytes, insert 100, skip 50, keep 8000, replace 10, keep the rest
+      new_image.clear();
+      new_image.insert(new_image.end(), old_image.begin(), old_image.begin() + 5000);
+      new_image.insert(new_image.end(), lit, lit + 100);
+      new_image.insert(new_image.end(), old_image.begin() + 5050, old_image.begin() + 13050);
+      new_image.insert(new_image.end(), lit, lit + 10);
+      new_image.insert(new_image.end(), old_image.begin() + 13060, old_image.end());
+
+      patch_encoder enc(new_image);
+      enc.copy(0, 5000);
+      enc.insert(lit, 100);
+      enc.copy(50, 8000);
+      enc.insert(lit, 10);
+      enc.copy(10, old_image.size() - 13060);
+      return(enc);
+   }
+
+   void check_new_image()
+   {
+      ASSERT_EQ(memcmp(&_flash_sim_mem[NEW_SLOT], new_image.data(), new_image.size()), 0);
+   }
+};
+
+TEST_F(emb_ext_flash_patch_test, begin_checks)
+{
+   emb_ext_flash_patch_t p;
+
+   ASSERT_EQ(emb_ext_flash_patch_begin(NULL, &_intf, OLD_SLOT, 1, &_intf, NEW_SLOT, SLOT_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, NULL, OLD_SLOT, 1, &_intf, NEW_SLOT, SLOT_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, 1, NULL, NEW_SLOT, SLOT_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, 1, &_intf, NEW_SLOT + 1, SLOT_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, NEW_SLOT + 0x100, 1, &_intf, NEW_SLOT, SLOT_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, NEW_SLOT + 1, &_intf, NEW_SLOT, SLOT_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, NEW_SLOT, &_intf, NEW_SLOT, SLOT_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_patch_feed(NULL, NULL, 0), -1);
+   ASSERT_EQ(emb_ext_flash_patch_finish(NULL), -1);
+}
+
+TEST_F(emb_ext_flash_patch_test, apply_in_small_chunks)
+{
+   patch_encoder         enc = build_patch();
+   emb_ext_flash_patch_t p;
+
+   // The patch is a small fraction of the image
+   ASSERT_LT(enc.out.size(), new_image.size() / 50);
+
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, old_image.size(), &_intf, NEW_SLOT, SLOT_SIZE), 0);
+
+   // Feed in awkward chunk sizes so every decoder state gets split
+   size_t off = 0;
+   for (uint32_t i = 1; off < enc.out.size(); i = (i % 7) + 1)
+   {
+      size_t len = i < enc.out.size() - off ? i : enc.out.size() - off;
+      ASSERT_EQ(emb_ext_flash_patch_feed(&p, &enc.out[off], len), 0);
+      off += len;
+   }
+
+   ASSERT_EQ(emb_ext_flash_patch_finish(&p), (int)new_image.size());
+   check_new_image();
+
+   // The old image is untouched
+   ASSERT_EQ(memcmp(&_flash_sim_mem[OLD_SLOT], old_image.data(), old_image.size()), 0);
+}
+
+TEST_F(emb_ext_flash_patch_test, apply_from_flash)
+{
+   patch_encoder         enc = build_patch();
+   emb_ext_flash_patch_t p;
+
+   // Stage the patch in flash
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, PATCH_SLOT, EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, PATCH_SLOT, enc.out.data(), enc.out.size()), (int)enc.out.size());
+
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, old_image.size(), &_intf, NEW_SLOT, SLOT_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_patch_feed_from_flash(&p, &_intf, PATCH_SLOT, enc.out.size()), 0);
+   ASSERT_EQ(emb_ext_flash_patch_finish(&p), (int)new_image.size());
+   check_new_image();
+}
+
+TEST_F(emb_ext_flash_patch_test, malformed_patches)
+{
+   emb_ext_flash_patch_t p;
+
+   // Bad magic
+   patch_encoder bad_magic = build_patch();
+   bad_magic.out[0] = 'X';
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, old_image.size(), &_intf, NEW_SLOT, SLOT_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_patch_feed(&p, bad_magic.out.data(), bad_magic.out.size()), -1);
+   ASSERT_EQ(emb_ext_flash_patch_feed(&p, bad_magic.out.data(), 1), -1);
+
+   // Copy from outside of the old image
+   patch_encoder out_of_range = build_patch();
+   out_of_range.copy(1, 1);
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, old_image.size(), &_intf, NEW_SLOT, SLOT_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_patch_feed(&p, out_of_range.out.data(), out_of_range.out.size()), -1);
+
+   // Op varint with bits above bit 31, dropping them would leave a valid one byte copy
+   patch_encoder too_wide(old_image);
+   const uint8_t wide[] = { 0x82, 0x80, 0x80, 0x80, 0x10, 0x00 };
+   too_wide.out.insert(too_wide.out.end(), wide, wide + sizeof(wide));
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, old_image.size(), &_intf, NEW_SLOT, SLOT_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_patch_feed(&p, too_wide.out.data(), too_wide.out.size()), -1);
+
+   // Truncated patch
+   patch_encoder truncated = build_patch();
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, old_image.size(), &_intf, NEW_SLOT, SLOT_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_patch_feed(&p, truncated.out.data(), truncated.out.size() - 3), 0);
+   ASSERT_EQ(emb_ext_flash_patch_finish(&p), -1);
+
+   // CRC mismatch, flip a literal byte
+   patch_encoder bad_crc = build_patch();
+   bad_crc.out[EXT_FLASH_PATCH_HEADER_SIZE + 6] ^= 0xFF;
+   ASSERT_EQ(emb_ext_flash_patch_begin(&p, &_intf, OLD_SLOT, old_image.size(), &_intf, NEW_SLOT, SLOT_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_patch_feed(&p, bad_crc.out.data(), bad_crc.out.size()), 0);
+   ASSERT_EQ(emb_ext_flash_patch_finish(&p), -1);
+}
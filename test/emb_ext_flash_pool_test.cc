@@ -0,0 +1,239 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_pool.h>
+#include "emb_ext_flash_sim.h"
+
+// Region used by the pool tests
+#define POOL_REGION_START    0x20000
+#define POOL_SECTORS         32
+
+// Clock for the wait time statistics, the modelled time of everything the simulator has done so far
+static uint32_t model_time_us()
+{
+   return((uint32_t)flash_sim_model_time_us());
+}
+
+// Class for facilitating pre-erase pool tests
+class emb_ext_flash_pool_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   void TearDown()
+   {
+      flash_sim_reset(0xFF);
+      _intf.get_time_us = NULL;
+   }
+
+   // Run the idle hook until it has nothing left to do
+   void idle(emb_ext_flash_pool_t *p_pool)
+   {
+      int rtn;
+      while ((rtn = emb_ext_flash_pool_idle(p_pool)) == 1)
+      {
+         ;
+      }
+      ASSERT_EQ(rtn, 0);
+   }
+};
+
+TEST_F(emb_ext_flash_pool_test, hands_out_clean_sectors)
+{
+   emb_ext_flash_pool_t pool;
+   uint8_t              page[256];
+   uint32_t             addr = 0;
+
+   // Argument checks
+   ASSERT_EQ(emb_ext_flash_pool_init(&pool, &_intf, POOL_REGION_START + 1, POOL_SECTORS, 2), -1);
+   ASSERT_EQ(emb_ext_flash_pool_init(&pool, &_intf, POOL_REGION_START, EXT_FLASH_POOL_MAX_SECTORS + 1, 2), -1);
+   ASSERT_EQ(emb_ext_flash_pool_init(&pool, &_intf, POOL_REGION_START, POOL_SECTORS, 2), 0);
+   ASSERT_EQ(emb_ext_flash_pool_release(&pool, POOL_REGION_START - 1, 2), -1);
+
+   // Dirty the first sectors, the idle hook erases the next two ahead
+   memset(page, 0x00, sizeof(page));
+   ASSERT_EQ(emb_ext_flash_write(&_intf, POOL_REGION_START, page, sizeof(page)), (int)sizeof(page));
+   ASSERT_EQ(emb_ext_flash_write(&_intf, POOL_REGION_START + EXT_FLASH_SECTOR_SIZE, page, sizeof(page)), (int)sizeof(page));
+   idle(&pool);
+   ASSERT_EQ(emb_ext_flash_pool_clean(&pool), 2);
+   ASSERT_EQ(pool.stat_erases_ahead, 2u);
+   ASSERT_EQ(_flash_sim_mem[POOL_REGION_START], 0xFF);
+   ASSERT_EQ(_flash_sim_mem[POOL_REGION_START + EXT_FLASH_SECTOR_SIZE], 0xFF);
+
+   // Handing out the clean sectors needs no erase
+   uint32_t erases = _flash_sim_stats.erases;
+   for (int i = 0; i < 2; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_pool_alloc(&pool, &addr), 0);
+      ASSERT_EQ(addr, POOL_REGION_START + i * EXT_FLASH_SECTOR_SIZE);
+      ASSERT_EQ(emb_ext_flash_pool_write(&pool, addr, page, sizeof(page)), (int)sizeof(page));
+   }
+   ASSERT_EQ(_flash_sim_stats.erases, erases);
+   ASSERT_EQ(pool.stat_clean_allocs, 2u);
+   ASSERT_EQ(pool.stat_erase_waits, 0u);
+
+   // Outrunning the idle hook makes the writer wait for an erase
+   ASSERT_EQ(emb_ext_flash_pool_alloc(&pool, &addr), 0);
+   ASSERT_EQ(addr, POOL_REGION_START + 2 * EXT_FLASH_SECTOR_SIZE);
+   ASSERT_EQ(pool.stat_sync_erases, 1u);
+   ASSERT_EQ(pool.stat_erase_waits, 1u);
+}
+
+TEST_F(emb_ext_flash_pool_test, scan_mark_used_and_wrap)
+{
+   emb_ext_flash_pool_t pool;
+   uint8_t              page[16];
+   uint32_t             addr = 0;
+
+   // Sectors 0 and 1 hold data from before the reset, sector 3 is dirty, the rest is blank
+   memset(page, 0x11, sizeof(page));
+   for (int s : { 0, 1, 3 })
+   {
+      ASSERT_EQ(emb_ext_flash_write(&_intf, POOL_REGION_START + s * EXT_FLASH_SECTOR_SIZE + 100, page, sizeof(page)),
+                (int)sizeof(page));
+   }
+   ASSERT_EQ(emb_ext_flash_pool_init(&pool, &_intf, POOL_REGION_START, 4, 1), 0);
+   ASSERT_EQ(emb_ext_flash_pool_mark_used(&pool, POOL_REGION_START, 2 * EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_pool_scan(&pool), 1);
+   ASSERT_EQ(emb_ext_flash_pool_clean(&pool), 1);
+
+   // Allocation carries on after the live data and the blank sector needs no erase
+   uint32_t erases = _flash_sim_stats.erases;
+   ASSERT_EQ(emb_ext_flash_pool_alloc(&pool, &addr), 0);
+   ASSERT_EQ(addr, POOL_REGION_START + 2 * EXT_FLASH_SECTOR_SIZE);
+   ASSERT_EQ(_flash_sim_stats.erases, erases);
+
+   // The idle hook gets sector 3 ready, then the pool is empty until the oldest sector is released
+   idle(&pool);
+   ASSERT_EQ(emb_ext_flash_pool_alloc(&pool, &addr), 0);
+   ASSERT_EQ(addr, POOL_REGION_START + 3 * EXT_FLASH_SECTOR_SIZE);
+   ASSERT_EQ(_flash_sim_mem[POOL_REGION_START + 3 * EXT_FLASH_SECTOR_SIZE + 100], 0xFF);
+   ASSERT_EQ(emb_ext_flash_pool_alloc(&pool, &addr), -1);
+   ASSERT_EQ(emb_ext_flash_pool_release(&pool, POOL_REGION_START, EXT_FLASH_SECTOR_SIZE), 0);
+   idle(&pool);
+   ASSERT_EQ(emb_ext_flash_pool_alloc(&pool, &addr), 0);
+   ASSERT_EQ(addr, POOL_REGION_START);
+   ASSERT_EQ(_flash_sim_mem[POOL_REGION_START + 100], 0xFF);
+   ASSERT_EQ(pool.stat_erase_waits, 0u);
+}
+
+TEST_F(emb_ext_flash_pool_test, write_waits_for_background_erase)
+{
+   emb_ext_flash_pool_t pool;
+   uint8_t              page[16] = { 0 };
+   uint8_t              rx[16];
+   uint32_t             addr     = 0;
+
+   _intf.get_time_us = _get_time_us;
+   ASSERT_EQ(emb_ext_flash_pool_init(&pool, &_intf, POOL_REGION_START, POOL_SECTORS, 2), 0);
+   idle(&pool);
+   ASSERT_EQ(emb_ext_flash_pool_alloc(&pool, &addr), 0);
+
+   // The chip takes a while over the next erase, the idle hook only starts it
+   _flash_sim_busy_cycles = 40;
+   ASSERT_EQ(emb_ext_flash_pool_idle(&pool), 1);
+   ASSERT_EQ(emb_ext_flash_pool_idle(&pool), 1);
+   ASSERT_NE(pool.pending, EXT_FLASH_POOL_NONE);
+
+   // A write arriving now waits for it, then programs normally
+   ASSERT_EQ(emb_ext_flash_pool_write(&pool, addr, page, sizeof(page)), (int)sizeof(page));
+   ASSERT_EQ(pool.pending, EXT_FLASH_POOL_NONE);
+   ASSERT_EQ(pool.stat_erase_waits, 1u);
+   ASSERT_GT(pool.stat_wait_us, 0u);
+   ASSERT_EQ(emb_ext_flash_read(&_intf, addr, rx, sizeof(rx)), (int)sizeof(rx));
+   ASSERT_EQ(memcmp(page, rx, sizeof(rx)), 0);
+   ASSERT_EQ(emb_ext_flash_pool_clean(&pool), 2);
+}
+
+TEST_F(emb_ext_flash_pool_test, bench_log_tail_latency)
+{
+   static uint8_t       record[256];
+   emb_ext_flash_pool_t pool;
+   std::vector <double> plain;
+   std::vector <double> pooled;
+   const int            records  = 2048;
+   const int            per_sect = EXT_FLASH_SECTOR_SIZE / sizeof(record);
+   uint32_t             addr     = 0;
+
+   _intf.get_time_us = model_time_us;
+   memset(record, 0xA5, sizeof(record));
+
+   // Plain logging erases each sector as the log reaches it, in line with the write that crosses into it
+   for (int i = 0; i < records; i++)
+   {
+      uint32_t at = POOL_REGION_START + (i % (POOL_SECTORS * per_sect)) * sizeof(record);
+      double   t0 = flash_sim_model_time_us();
+      if (at % EXT_FLASH_SECTOR_SIZE == 0)
+      {
+         ASSERT_EQ(emb_ext_flash_erase(&_intf, at, EXT_FLASH_SECTOR_SIZE), 0);
+      }
+      ASSERT_EQ(emb_ext_flash_write(&_intf, at, record, sizeof(record)), (int)sizeof(record));
+      plain.push_back(flash_sim_model_time_us() - t0);
+   }
+
+   double plain_wear = flash_sim_wear_ratio(POOL_REGION_START, POOL_SECTORS * EXT_FLASH_SECTOR_SIZE);
+
+   // Through the pool the erases happen in the idle time between records and the oldest sector is recycled
+   flash_sim_reset(0xFF);
+   ASSERT_EQ(emb_ext_flash_pool_init(&pool, &_intf, POOL_REGION_START, POOL_SECTORS, 2), 0);
+   idle(&pool);
+   for (int i = 0; i < records; i++)
+   {
+      double t0 = flash_sim_model_time_us();
+      if (i % per_sect == 0)
+      {
+         // Retention keeps all but two sectors, so the sector two ahead of the writer is given back in time to be erased
+         int n = i / per_sect;
+         if (n >= POOL_SECTORS - 2)
+         {
+            uint32_t oldest = POOL_REGION_START + ((n + 2) % POOL_SECTORS) * EXT_FLASH_SECTOR_SIZE;
+            ASSERT_EQ(emb_ext_flash_pool_release(&pool, oldest, EXT_FLASH_SECTOR_SIZE), 0);
+         }
+         ASSERT_EQ(emb_ext_flash_pool_alloc(&pool, &addr), 0);
+      }
+      ASSERT_EQ(emb_ext_flash_pool_write(&pool, addr + (i % per_sect) * sizeof(record), record, sizeof(record)),
+                (int)sizeof(record));
+      pooled.push_back(flash_sim_model_time_us() - t0);
+      ASSERT_GE(emb_ext_flash_pool_idle(&pool), 0);
+      ASSERT_GE(emb_ext_flash_pool_idle(&pool), 0);
+   }
+
+   std::sort(plain.begin(), plain.end());
+   std::sort(pooled.begin(), pooled.end());
+   double p99_plain  = plain[records * 99 / 100];
+   double p99_pooled = pooled[records * 99 / 100];
+   printf("record write latency: p99 %.0f us max %.0f us plain, p99 %.0f us max %.0f us through the pool "
+          "(%u erases ahead, %u writer waits)\n",
+          p99_plain, plain.back(), p99_pooled, pooled.back(), (unsigned)pool.stat_erases_ahead, (unsigned)pool.stat_erase_waits);
+   printf("wear max/mean: %.2f plain, %.2f through the pool\n", plain_wear,
+          flash_sim_wear_ratio(POOL_REGION_START, POOL_SECTORS * EXT_FLASH_SECTOR_SIZE));
+
+   ASSERT_EQ(pool.stat_erase_waits, 0u);
+   ASSERT_LT(pooled.back(), FLASH_SIM_MODEL_TPP_US * 2);
+   ASSERT_GT(plain.back(), FLASH_SIM_MODEL_ERASE_US);
+}
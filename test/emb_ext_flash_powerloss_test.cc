@@ -0,0 +1,394 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_ftl.h>
+#include <emb_ext_flash_ts.h>
+#include "emb_ext_flash_sim.h"
+
+// Regions used by the power loss workloads
+#define PL_TS_START      0x10000
+#define PL_TS_SECTORS    6
+#define PL_TS_PAYLOAD    48
+#define PL_FTL_START     0x20000
+#define PL_FTL_SIZE      0x10000
+
+// Records per sector of the time-series workload
+#define PL_TS_RECS       ((EXT_FLASH_SECTOR_SIZE - EXT_FLASH_TS_HEADER_SIZE) / (EXT_FLASH_TS_RECORD_HEADER + PL_TS_PAYLOAD))
+
+// Number of trials of each workload
+#define PL_TRIALS        1000
+
+// Workload run into a power loss: set up a fresh store, run one operation, remount after the loss and check what survived.
+// An operation counts as acknowledged once it returned with the power still on, the one the power was lost in may or may
+// not have landed.
+class powerloss_workload
+{
+public:
+   virtual ~powerloss_workload() {}
+   virtual void format() = 0;
+   virtual void step()   = 0;
+   virtual int  mount()  = 0;
+   virtual void check()  = 0;
+};
+
+// Appends records with rising timestamps to a time-series store
+class ts_workload : public powerloss_workload
+{
+public:
+   void format()
+   {
+      acked.clear();
+      next    = 1;
+      pending = 0;
+      ASSERT_EQ(emb_ext_flash_ts_format(&ts, &_intf, PL_TS_START, PL_TS_SECTORS * EXT_FLASH_SECTOR_SIZE, PL_TS_PAYLOAD), 0);
+   }
+
+   void step()
+   {
+      uint8_t p[PL_TS_PAYLOAD];
+
+      payload(next, p);
+      int rtn = emb_ext_flash_ts_append(&ts, next, p);
+      if (flash_sim_power_lost())
+      {
+         pending = next;
+      }
+      else
+      {
+         ASSERT_EQ(rtn, 0);
+         acked.push_back(next);
+      }
+      next++;
+   }
+
+   int mount()
+   {
+      return(emb_ext_flash_ts_mount(&ts, &_intf, PL_TS_START, PL_TS_SECTORS * EXT_FLASH_SECTOR_SIZE, PL_TS_PAYLOAD));
+   }
+
+   // Everything returned was appended, in order and intact, and no acknowledged record newer than the oldest one returned
+   // is missing. Apart from the sector being erased when the power went, and a sector closed early by a torn record,
+   // the ring still holds its full retention
+   void check()
+   {
+      emb_ext_flash_ts_cursor_t cur;
+      std::vector <uint32_t>    got;
+      uint8_t                   p[PL_TS_PAYLOAD], want[PL_TS_PAYLOAD];
+      uint32_t                  t;
+      int                       rtn;
+
+      ASSERT_EQ(emb_ext_flash_ts_query(&ts, &cur, 0, 0xFFFFFFFE), 0);
+      while ((rtn = emb_ext_flash_ts_next(&ts, &cur, &t, p)) == 1)
+      {
+         payload(t, want);
+         ASSERT_EQ(memcmp(p, want, PL_TS_PAYLOAD), 0) << t;
+         ASSERT_TRUE(got.empty() || t > got.back()) << t;
+         ASSERT_TRUE(t == pending || std::binary_search(acked.begin(), acked.end(), t)) << t;
+         got.push_back(t);
+      }
+      ASSERT_EQ(rtn, 0);
+
+      size_t landed = (pending && !got.empty() && got.back() == pending) ? 1 : 0;
+      if (landed)
+      {
+         acked.push_back(pending);
+      }
+      pending = 0;
+      if (!got.empty())
+      {
+         ASSERT_EQ((size_t)(acked.end() - std::lower_bound(acked.begin(), acked.end(), got.front())), got.size());
+      }
+      ASSERT_GE(got.size(), std::min(acked.size(), (size_t)(PL_TS_SECTORS - 3) * PL_TS_RECS));
+
+      // Short ranges find their start by binary search, which needs every sector to stay sorted
+      for (int i = 0; i < 8 && !got.empty(); i++)
+      {
+         uint32_t a = got.front() + rand() % (got.back() - got.front() + 1);
+         std::vector <uint32_t> want, part;
+         for (uint32_t g : got)
+         {
+            if (g >= a && g <= a + 20)
+            {
+               want.push_back(g);
+            }
+         }
+         ASSERT_EQ(emb_ext_flash_ts_query(&ts, &cur, a, a + 20), 0);
+         while ((rtn = emb_ext_flash_ts_next(&ts, &cur, &t, NULL)) == 1)
+         {
+            part.push_back(t);
+         }
+         ASSERT_EQ(rtn, 0);
+         ASSERT_EQ(part, want) << a;
+      }
+   }
+
+private:
+   static void payload(uint32_t t, uint8_t *p)
+   {
+      for (int i = 0; i < PL_TS_PAYLOAD; i++)
+      {
+         p[i] = (uint8_t)(t * 13 + i);
+      }
+   }
+
+   emb_ext_flash_ts_t     ts;
+   std::vector <uint32_t> acked;
+   uint32_t               next;
+   uint32_t               pending;
+};
+
+// Overwrites a small set of hot blocks through the translation layer so that garbage collection runs, with a checkpoint
+// now and then
+class ftl_workload : public powerloss_workload
+{
+public:
+   void format()
+   {
+      ASSERT_EQ(emb_ext_flash_ftl_format(&ftl, &_intf, PL_FTL_START, PL_FTL_SIZE), 0);
+      gens.assign(emb_ext_flash_ftl_block_count(&ftl), 0);
+      gen     = 0;
+      steps   = 0;
+      pending = false;
+   }
+
+   void step()
+   {
+      uint8_t data[EXT_FLASH_FTL_BLOCK_SIZE];
+      int     rtn;
+
+      if (++steps % 50 == 0)
+      {
+         rtn = emb_ext_flash_ftl_sync(&ftl);
+         ASSERT_TRUE(rtn == 0 || flash_sim_power_lost());
+         return;
+      }
+
+      uint32_t block = (rand() % 4) ? rand() % 8 : rand() % gens.size();
+      fill(data, block, ++gen);
+      rtn = emb_ext_flash_ftl_block_write(&ftl, block, data);
+      if (flash_sim_power_lost())
+      {
+         pending       = true;
+         pending_block = block;
+         pending_gen   = gen;
+      }
+      else
+      {
+         ASSERT_EQ(rtn, 0);
+         gens[block] = gen;
+      }
+   }
+
+   int mount()
+   {
+      return(emb_ext_flash_ftl_mount(&ftl, &_intf, PL_FTL_START, PL_FTL_SIZE));
+   }
+
+   // Every block reads back as its last acknowledged write, the block written when the power went may read as either
+   void check()
+   {
+      uint8_t expected[EXT_FLASH_FTL_BLOCK_SIZE];
+      uint8_t actual[EXT_FLASH_FTL_BLOCK_SIZE];
+
+      for (uint32_t b = 0; b < gens.size(); b++)
+      {
+         ASSERT_EQ(emb_ext_flash_ftl_block_read(&ftl, b, actual), 0);
+         fill(expected, b, gens[b]);
+         if (pending && b == pending_block && memcmp(expected, actual, sizeof(actual)) != 0)
+         {
+            fill(expected, b, pending_gen);
+            gens[b] = pending_gen;
+         }
+         ASSERT_EQ(memcmp(expected, actual, sizeof(actual)), 0) << "block " << b;
+      }
+      pending = false;
+   }
+
+private:
+   // Blocks never written read as 0xFF
+   static void fill(uint8_t *data, uint32_t block, uint32_t gen)
+   {
+      for (uint32_t i = 0; i < EXT_FLASH_FTL_BLOCK_SIZE; i++)
+      {
+         data[i] = gen ? (uint8_t)(block * 31 + gen * 7 + i) : 0xFF;
+      }
+   }
+
+   emb_ext_flash_ftl_t    ftl;
+   std::vector <uint32_t> gens;
+   uint32_t               gen;
+   uint32_t               steps;
+   bool                   pending;
+   uint32_t               pending_block;
+   uint32_t               pending_gen;
+};
+
+// Class for facilitating power loss tests
+class emb_ext_flash_powerloss_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   void TearDown() { flash_sim_reset(0xFF); }
+
+   // Run the workload into a power loss over and over, taking turns between a loss at a random chip select cycle, one part
+   // way through a random program or erase and one part way through an erase. Every trial remounts, checks, runs on a little and checks again. Mount time
+   // is the modelled bus and array time of the driver init and the mount.
+   void run(powerloss_workload &w, const char *name, uint32_t warm_max)
+   {
+      std::vector <double> mount_us;
+      uint32_t             torn_programs = 0, torn_erases = 0, mount_cycles = 0;
+
+      srand(40);
+      for (uint32_t trial = 0; trial < PL_TRIALS; trial++)
+      {
+         flash_sim_reset(0xFF);
+         flash_sim_fault_seed(trial + 1);
+         emb_ext_flash_init_intf(&_intf);
+         _intf.deselect();
+         ASSERT_NO_FATAL_FAILURE(w.format());
+
+         uint32_t warm = rand() % warm_max;
+         for (uint32_t i = 0; i < warm; i++)
+         {
+            ASSERT_NO_FATAL_FAILURE(w.step());
+         }
+         if (trial % 3 == 0)
+         {
+            flash_sim_cut_power_after(1 + rand() % 400);
+         }
+         else if (trial % 3 == 1)
+         {
+            flash_sim_cut_power_in_op(1 + rand() % 40);
+         }
+         else
+         {
+            flash_sim_cut_power_in_erase(1 + rand() % 3);
+         }
+         for (uint32_t i = 0; !flash_sim_power_lost(); i++)
+         {
+            ASSERT_LT(i, 10000u);
+            ASSERT_NO_FATAL_FAILURE(w.step());
+         }
+         torn_programs += _flash_sim_stats.torn_programs;
+         torn_erases   += _flash_sim_stats.torn_erases;
+
+         // Reboot
+         flash_sim_restore_power();
+         double   start_us = flash_sim_model_time_us();
+         uint32_t cycles   = _flash_sim_stats.transactions;
+         emb_ext_flash_init_intf(&_intf);
+         _intf.deselect();
+         ASSERT_EQ(w.mount(), 0) << "trial " << trial;
+         mount_us.push_back(flash_sim_model_time_us() - start_us);
+         mount_cycles += _flash_sim_stats.transactions - cycles;
+
+         ASSERT_NO_FATAL_FAILURE(w.check()) << "trial " << trial;
+         for (uint32_t i = 0; i < 20; i++)
+         {
+            ASSERT_NO_FATAL_FAILURE(w.step());
+         }
+         ASSERT_NO_FATAL_FAILURE(w.check()) << "trial " << trial;
+      }
+
+      std::sort(mount_us.begin(), mount_us.end());
+      double sum = 0;
+      for (double us : mount_us)
+      {
+         sum += us;
+      }
+      printf("%s: %u trials, %u torn programs, %u torn erases, %.0f transactions per mount\n", name, PL_TRIALS,
+             torn_programs, torn_erases, (double)mount_cycles / PL_TRIALS);
+      printf("%s: mount time min %.0f us, mean %.0f us, p99 %.0f us, max %.0f us\n", name, mount_us.front(),
+             sum / mount_us.size(), mount_us[mount_us.size() * 99 / 100], mount_us.back());
+   }
+};
+
+TEST_F(emb_ext_flash_powerloss_test, injection)
+{
+   uint8_t data[256], back[256];
+
+   // A loss at a chip select cycle stops everything after it reaching the array
+   memset(data, 0x00, sizeof(data));
+   flash_sim_cut_power_after(1);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0x1000, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_TRUE(flash_sim_power_lost());
+   ASSERT_EQ(_flash_sim_stats.power_cuts, 1u);
+   flash_sim_restore_power();
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0x1000, back, sizeof(back)), (int)sizeof(back));
+   for (int i = 0; i < 256; i++)
+   {
+      ASSERT_EQ(back[i], 0xFF);
+   }
+
+   // A program cut short leaves a programmed prefix, one partly programmed byte and the rest untouched
+   flash_sim_fault_seed(7);
+   flash_sim_cut_power_in_op(1);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0x1000, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_TRUE(flash_sim_power_lost());
+   ASSERT_EQ(_flash_sim_stats.torn_programs, 1u);
+   flash_sim_restore_power();
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0x1000, back, sizeof(back)), (int)sizeof(back));
+   int done = 0;
+   while (done < 256 && back[done] == 0x00)
+   {
+      done++;
+   }
+   for (int i = done + 1; i < 256; i++)
+   {
+      ASSERT_EQ(back[i], 0xFF);
+   }
+   ASSERT_LT(done, 256);
+
+   // An erase cut short leaves an erased prefix and the rest of the sector as it was, programs do not count towards it
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0x1F00, data, sizeof(data)), (int)sizeof(data));
+   flash_sim_cut_power_in_erase(1);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0x2000, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_FALSE(flash_sim_power_lost());
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, 0x1000, EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_TRUE(flash_sim_power_lost());
+   ASSERT_EQ(_flash_sim_stats.torn_erases, 1u);
+   ASSERT_EQ(_flash_sim_stats.power_cuts, 3u);
+   flash_sim_restore_power();
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0x1000, back, 1), 1);
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0x1F00, data, 1), 1);
+   ASSERT_TRUE(back[0] == 0xFF || data[0] != 0xFF);
+}
+
+TEST_F(emb_ext_flash_powerloss_test, bench_ts_recovery)
+{
+   static ts_workload w;
+   run(w, "ts", (PL_TS_SECTORS + 1) * PL_TS_RECS);
+}
+
+TEST_F(emb_ext_flash_powerloss_test, bench_ftl_recovery)
+{
+   static ftl_workload w;
+   run(w, "ftl", 200);
+}
@@ -0,0 +1,287 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <vector>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_queue.h>
+#include "emb_ext_flash_sim.h"
+
+// Region used by the queue tests
+#define QUEUE_REGION_START    0x10000
+
+// Completion record shared by the test callbacks
+typedef struct
+{
+   int id;
+   int result;
+} completion_t;
+
+static std::vector <completion_t> _completions;
+
+static void record(void *ctx, int result)
+{
+   _completions.push_back({ (int)(intptr_t)ctx, result });
+}
+
+// Clock for the wait time statistics, the modelled time of everything the simulator has done so far
+static uint32_t model_time_us()
+{
+   return((uint32_t)flash_sim_model_time_us());
+}
+
+// Class for facilitating queue tests
+class emb_ext_flash_queue_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      _completions.clear();
+   }
+
+   void TearDown()
+   {
+      _intf.get_time_us = NULL;
+   }
+
+   // Position of an operation in the completion order
+   int completed_at(int id)
+   {
+      for (size_t i = 0; i < _completions.size(); i++)
+      {
+         if (_completions[i].id == id)
+         {
+            return(i);
+         }
+      }
+      return(-1);
+   }
+};
+
+TEST_F(emb_ext_flash_queue_test, read_overtakes_programs)
+{
+   static emb_ext_flash_queue_t q;
+   static uint8_t               log_data[4][1024];
+   uint8_t                      cfg[16];
+
+   memset(&_flash_sim_mem[QUEUE_REGION_START + 0x8000], 0x5A, sizeof(cfg));
+   ASSERT_EQ(emb_ext_flash_queue_init(&q, &_intf), 0);
+
+   // A burst of log writes followed by a config read elsewhere
+   for (int i = 0; i < 4; i++)
+   {
+      memset(log_data[i], i, sizeof(log_data[i]));
+      ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_WRITE, EXT_FLASH_QUEUE_PRIO_LOW, QUEUE_REGION_START + i * 1024,
+                                           log_data[i], sizeof(log_data[i]), record, (void *)(intptr_t)i), 0);
+   }
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_READ, EXT_FLASH_QUEUE_PRIO_HIGH, QUEUE_REGION_START + 0x8000, cfg,
+                                        sizeof(cfg), record, (void *)10), 0);
+   ASSERT_EQ(emb_ext_flash_queue_depth(&q), 5);
+
+   // The read goes first and does not wait for a single page program
+   ASSERT_EQ(emb_ext_flash_queue_poll(&q), 1);
+   ASSERT_EQ(_flash_sim_stats.programs, 0u);
+   ASSERT_EQ(completed_at(10), 0);
+   ASSERT_EQ(_completions[0].result, (int)sizeof(cfg));
+   for (int i = 0; i < (int)sizeof(cfg); i++)
+   {
+      ASSERT_EQ(cfg[i], 0x5A);
+   }
+
+   ASSERT_EQ(emb_ext_flash_queue_run(&q), 0);
+   ASSERT_EQ(emb_ext_flash_queue_depth(&q), 0);
+   for (int i = 0; i < 4; i++)
+   {
+      ASSERT_EQ(completed_at(i), i + 1);
+      ASSERT_EQ(memcmp(&_flash_sim_mem[QUEUE_REGION_START + i * 1024], log_data[i], sizeof(log_data[i])), 0);
+   }
+   ASSERT_EQ(q.stat_max_depth, 5);
+}
+
+TEST_F(emb_ext_flash_queue_test, read_after_write_is_ordered)
+{
+   static emb_ext_flash_queue_t q;
+   uint8_t                      wr[300];
+   uint8_t                      rd[300];
+
+   for (int i = 0; i < (int)sizeof(wr); i++)
+   {
+      wr[i] = i * 3;
+   }
+   ASSERT_EQ(emb_ext_flash_queue_init(&q, &_intf), 0);
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_WRITE, EXT_FLASH_QUEUE_PRIO_LOW, QUEUE_REGION_START + 100, wr,
+                                        sizeof(wr), record, (void *)1), 0);
+
+   // An urgent read of the same range still sees the write
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_READ, EXT_FLASH_QUEUE_PRIO_HIGH, QUEUE_REGION_START + 100, rd,
+                                        sizeof(rd), record, (void *)2), 0);
+   ASSERT_EQ(emb_ext_flash_queue_run(&q), 0);
+   ASSERT_LT(completed_at(1), completed_at(2));
+   ASSERT_EQ(memcmp(wr, rd, sizeof(wr)), 0);
+}
+
+TEST_F(emb_ext_flash_queue_test, merge_writes_in_page)
+{
+   static emb_ext_flash_queue_t q;
+   uint8_t                      recs[8][32];
+
+   ASSERT_EQ(emb_ext_flash_queue_init(&q, &_intf), 0);
+   for (int i = 0; i < 8; i++)
+   {
+      memset(recs[i], 0x10 + i, sizeof(recs[i]));
+      ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_WRITE, EXT_FLASH_QUEUE_PRIO_NORMAL, QUEUE_REGION_START + 0x200 + i * 32,
+                                           recs[i], sizeof(recs[i]), record, (void *)(intptr_t)i), 0);
+   }
+   ASSERT_EQ(emb_ext_flash_queue_run(&q), 0);
+
+   // One page program carries all eight records
+   ASSERT_EQ(_flash_sim_stats.programs, 1u);
+   ASSERT_EQ(q.stat_merged_writes, 7u);
+   ASSERT_EQ(_completions.size(), 8u);
+   for (int i = 0; i < 8; i++)
+   {
+      ASSERT_EQ(_completions[i].result, 32);
+      ASSERT_EQ(memcmp(&_flash_sim_mem[QUEUE_REGION_START + 0x200 + i * 32], recs[i], sizeof(recs[i])), 0);
+   }
+}
+
+TEST_F(emb_ext_flash_queue_test, merge_sector_erases)
+{
+   static emb_ext_flash_queue_t q;
+
+   memset(&_flash_sim_mem[QUEUE_REGION_START], 0x00, 0x10000);
+   ASSERT_EQ(emb_ext_flash_queue_init(&q, &_intf), 0);
+
+   // Eight sectors submitted out of order make up one 32K block, the ninth needs its own sector erase
+   int order[9] = { 3, 4, 2, 5, 1, 6, 0, 7, 8 };
+   for (int i = 0; i < 9; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_ERASE, EXT_FLASH_QUEUE_PRIO_NORMAL,
+                                           QUEUE_REGION_START + order[i] * EXT_FLASH_SECTOR_SIZE, NULL, EXT_FLASH_SECTOR_SIZE, record,
+                                           (void *)(intptr_t)order[i]), 0);
+   }
+   ASSERT_EQ(emb_ext_flash_queue_run(&q), 0);
+
+   ASSERT_EQ(_flash_sim_stats.erases, 2u);
+   ASSERT_EQ(q.stat_block_erases, 1u);
+   ASSERT_EQ(q.stat_merged_erases, 8u);
+   ASSERT_EQ(_completions.size(), 9u);
+   for (uint32_t i = 0; i < 9 * EXT_FLASH_SECTOR_SIZE; i++)
+   {
+      ASSERT_EQ(_flash_sim_mem[QUEUE_REGION_START + i], 0xFF);
+   }
+   ASSERT_EQ(_flash_sim_mem[QUEUE_REGION_START + 9 * EXT_FLASH_SECTOR_SIZE], 0x00);
+}
+
+TEST_F(emb_ext_flash_queue_test, erase_not_folded_across_dependency)
+{
+   static emb_ext_flash_queue_t q;
+   uint8_t                      wr[16];
+   uint8_t                      rd[16];
+
+   memset(wr, 0x42, sizeof(wr));
+   ASSERT_EQ(emb_ext_flash_queue_init(&q, &_intf), 0);
+
+   // Erase, write into the next sector, then erase that sector: the second erase must stay behind the write
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_ERASE, EXT_FLASH_QUEUE_PRIO_NORMAL, QUEUE_REGION_START, NULL,
+                                        EXT_FLASH_SECTOR_SIZE, record, (void *)1), 0);
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_WRITE, EXT_FLASH_QUEUE_PRIO_NORMAL, QUEUE_REGION_START + EXT_FLASH_SECTOR_SIZE,
+                                        wr, sizeof(wr), record, (void *)2), 0);
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_ERASE, EXT_FLASH_QUEUE_PRIO_NORMAL, QUEUE_REGION_START + EXT_FLASH_SECTOR_SIZE,
+                                        NULL, EXT_FLASH_SECTOR_SIZE, record, (void *)3), 0);
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_READ, EXT_FLASH_QUEUE_PRIO_NORMAL, QUEUE_REGION_START + EXT_FLASH_SECTOR_SIZE,
+                                        rd, sizeof(rd), record, (void *)4), 0);
+   ASSERT_EQ(emb_ext_flash_queue_run(&q), 0);
+
+   ASSERT_EQ(q.stat_merged_erases, 0u);
+   ASSERT_LT(completed_at(2), completed_at(3));
+   ASSERT_LT(completed_at(3), completed_at(4));
+   for (int i = 0; i < (int)sizeof(rd); i++)
+   {
+      ASSERT_EQ(rd[i], 0xFF);
+   }
+}
+
+TEST_F(emb_ext_flash_queue_test, sync_and_limits)
+{
+   static emb_ext_flash_queue_t q;
+   uint8_t                      buf[8] = { 0 };
+
+   ASSERT_EQ(emb_ext_flash_queue_init(&q, &_intf), 0);
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_WRITE, EXT_FLASH_QUEUE_PRIO_LOW, QUEUE_REGION_START, buf, sizeof(buf),
+                                        record, (void *)1), 0);
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_SYNC, EXT_FLASH_QUEUE_PRIO_HIGH, 0, NULL, 0, record, (void *)2), 0);
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_WRITE, EXT_FLASH_QUEUE_PRIO_HIGH, QUEUE_REGION_START + 0x1000, buf,
+                                        sizeof(buf), record, (void *)3), 0);
+   ASSERT_EQ(emb_ext_flash_queue_run(&q), 0);
+   ASSERT_EQ(completed_at(1), 0);
+   ASSERT_EQ(completed_at(2), 1);
+   ASSERT_EQ(completed_at(3), 2);
+
+   // Bad arguments and a full queue
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_ERASE, 0, QUEUE_REGION_START + 1, NULL, EXT_FLASH_SECTOR_SIZE, NULL, NULL), -1);
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_READ, 0, QUEUE_REGION_START, NULL, 4, NULL, NULL), -1);
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, 9, 0, QUEUE_REGION_START, buf, 4, NULL, NULL), -1);
+   for (int i = 0; i < EXT_FLASH_QUEUE_DEPTH; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_READ, 0, QUEUE_REGION_START, buf, 4, NULL, NULL), 0);
+   }
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_READ, 0, QUEUE_REGION_START, buf, 4, NULL, NULL), -1);
+   ASSERT_EQ(emb_ext_flash_queue_run(&q), 0);
+   ASSERT_EQ(emb_ext_flash_queue_poll(&q), 0);
+}
+
+TEST_F(emb_ext_flash_queue_test, bench_read_latency)
+{
+   static emb_ext_flash_queue_t q;
+   static uint8_t               log_data[12][512];
+   uint8_t                      cfg[32];
+
+   _intf.get_time_us = model_time_us;
+
+   // Without the queue a config read issued behind a 12 x 512 byte log burst waits for all of it
+   double burst_start = flash_sim_model_time_us();
+   for (int i = 0; i < 12; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_write(&_intf, QUEUE_REGION_START + i * 512, log_data[i], 512), 512);
+   }
+   double fifo_wait = flash_sim_model_time_us() - burst_start;
+
+   // With the queue the read waits for at most the page program in flight, submitted after the first one has started
+   flash_sim_reset(0xFF);
+   ASSERT_EQ(emb_ext_flash_queue_init(&q, &_intf), 0);
+   for (int i = 0; i < 12; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_WRITE, EXT_FLASH_QUEUE_PRIO_LOW, QUEUE_REGION_START + i * 512,
+                                           log_data[i], 512, NULL, NULL), 0);
+   }
+   ASSERT_EQ(emb_ext_flash_queue_poll(&q), 1);
+   ASSERT_EQ(emb_ext_flash_queue_submit(&q, EXT_FLASH_QUEUE_OP_READ, EXT_FLASH_QUEUE_PRIO_HIGH, QUEUE_REGION_START + 0x8000, cfg,
+                                        sizeof(cfg), NULL, NULL), 0);
+   ASSERT_EQ(emb_ext_flash_queue_run(&q), 0);
+
+   printf("config read wait: %.0f us behind a plain write burst, %u us through the queue (max depth %u, mean write wait %.0f us)\n",
+          fifo_wait, (unsigned)q.stat_read_wait_max_us, (unsigned)q.stat_max_depth, (double)q.stat_other_wait_us / q.stat_others);
+
+   ASSERT_EQ(q.stat_reads, 1u);
+   ASSERT_LT(q.stat_read_wait_max_us, fifo_wait / 8);
+}
@@ -0,0 +1,821 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <string.h>
+#include "emb_ext_flash_sim.h"
+
+// Flash sim memory bank, default to 0xFF
+uint8_t _flash_sim_mem[FLASH_SIM_MEM_SIZE] = { 0xFF };
+
+// Flash simulation state enumaration
+enum flash_sim_state
+{
+   FLASH_SIM_STATE_IDLE,
+   FLASH_SIM_SET_ADDR,
+   FLASH_SIM_STATE_READ,
+   FLASH_SIM_STATE_WRITE,
+   FLASH_SIM_STATUS_REG_READ,
+   FLASH_SIM_STATUS_REG_WRITE,
+   FLASH_SIM_ERASE,
+   FLASH_SIM_GET_JEDEC_ID,
+   FLASH_SIM_STATE_IGNORE,
+   FLASH_SIM_STATE_DUMMY,
+   FLASH_SIM_SET_WRAP,
+};
+
+// Flash simulation state
+int _flash_sim_state = FLASH_SIM_STATE_IDLE;
+
+// Flash simulation current address
+uint32_t _flash_sim_addr = 0;
+// Address bytes of the current command, 4 for the 4-byte address forms
+static uint8_t _flash_sim_addr_len = 3;
+
+// Flash simulation write enable latch
+bool _flash_sim_wel = false;
+
+// Flash simulation status register
+uint8_t _flash_sim_status_reg = 0;
+
+// Flash simulation erase length setting
+uint32_t _flash_sim_erase_len = 0;
+
+// Flash simulation fast read in progress, the address is followed by a dummy byte
+bool _flash_sim_fast_read = false;
+
+// Flash simulation burst wrap length, reads wrap round inside aligned lines of this many bytes when set
+uint8_t _flash_sim_wrap      = 0;
+uint8_t _flash_sim_wrap_byte = 0;
+
+// Flash simulation models a part that wraps READ and FAST_READ too. Winbond and GigaDevice parts only wrap quad I/O reads,
+// which the simulation does not model, so by default the wrap setting is taken but reads stay linear.
+bool _flash_sim_wrap_reads = false;
+
+// Flash simulation activity counters
+flash_sim_stats_t _flash_sim_stats = { 0 };
+
+// Flash simulation virtual clock in microseconds
+uint32_t _flash_sim_time_us = 0;
+
+// Flash simulation erase count of each sector
+uint32_t _flash_sim_sector_erases[FLASH_SIM_MEM_SIZE / EXT_FLASH_SECTOR_SIZE] = { 0 };
+
+// Flash simulation chip select cycles BUSY stays set after a program or erase is committed, and the cycles left of the
+// program or erase in progress
+uint32_t _flash_sim_busy_cycles = 0;
+uint32_t _flash_sim_busy_left   = 0;
+bool     _flash_sim_busy_start  = false;
+
+// Flash simulation virtual clock time BUSY stays set after a program and after an erase, the time of the program or erase
+// just committed, and the time the one in progress finishes
+uint32_t _flash_sim_program_us = 0;
+uint32_t _flash_sim_erase_us   = 0;
+uint32_t _flash_sim_busy_for   = 0;
+bool     _flash_sim_busy_timed = false;
+uint32_t _flash_sim_busy_until = 0;
+
+// Flash simulation flag to indicate a status byte has been clocked out in the current chip select cycle
+bool _flash_sim_status_clocked = false;
+
+// Flash simulation deep power-down state, and release from power-down in progress
+bool     _flash_sim_powered_down = false;
+bool     _flash_sim_releasing    = false;
+uint32_t _flash_sim_release_us   = 0;
+
+// Flash simulation power loss injection: the chip select cycle or the number of programs and erases left until the power
+// is cut, 0 when not armed, an operation torn in the current cycle, the power state and the random state of the tears
+uint32_t _flash_sim_cut_at     = 0;
+uint32_t _flash_sim_cut_ops    = 0;
+uint32_t _flash_sim_cut_erases = 0;
+bool     _flash_sim_cut_now    = false;
+bool     _flash_sim_power_off  = false;
+uint32_t _flash_sim_fault_rand = 1;
+
+// Address, length and previous contents of the program in progress, so that a power loss can tear it
+uint32_t _flash_sim_prog_addr = 0;
+uint16_t _flash_sim_prog_len  = 0;
+uint8_t  _flash_sim_prog_old[256];
+
+// Next pseudo random number for the power loss injection
+static uint32_t flash_sim_rand()
+{
+   _flash_sim_fault_rand ^= _flash_sim_fault_rand << 13;
+   _flash_sim_fault_rand ^= _flash_sim_fault_rand >> 17;
+   _flash_sim_fault_rand ^= _flash_sim_fault_rand << 5;
+   return(_flash_sim_fault_rand);
+}
+
+// Whether the program or erase being committed is the one the power is cut in
+static bool flash_sim_op_doomed(bool erase)
+{
+   if (erase && _flash_sim_cut_erases && --_flash_sim_cut_erases == 0)
+   {
+      return(true);
+   }
+   if (_flash_sim_cut_ops && --_flash_sim_cut_ops == 0)
+   {
+      return(true);
+   }
+   return(_flash_sim_cut_at && _flash_sim_stats.transactions == _flash_sim_cut_at);
+}
+
+// Erase a range of the array, or part of it if the power is cut during the erase
+static void flash_sim_erase(uint32_t addr, uint32_t len)
+{
+   uint32_t end = len;
+
+   _flash_sim_stats.erases++;
+   _flash_sim_stats.erased_bytes += len;
+   for (uint32_t off = 0; off < len; off += EXT_FLASH_SECTOR_SIZE)
+   {
+      _flash_sim_sector_erases[((addr + off) % FLASH_SIM_MEM_SIZE) / EXT_FLASH_SECTOR_SIZE]++;
+   }
+   if (flash_sim_op_doomed(true))
+   {
+      end = flash_sim_rand() % len;
+      for (uint32_t i = end; i < end + 64 && i < len; i++)
+      {
+         _flash_sim_mem[(addr + i) % FLASH_SIM_MEM_SIZE] |= (uint8_t)flash_sim_rand();
+      }
+      _flash_sim_stats.torn_erases++;
+      _flash_sim_cut_now = true;
+   }
+   for (uint32_t i = 0; i < end; i++)
+   {
+      _flash_sim_mem[(addr + i) % FLASH_SIM_MEM_SIZE] = 0xFF;
+   }
+}
+
+// Commit the program in progress, or put back the bytes it did not get to if the power is cut during the program
+static void flash_sim_program()
+{
+   _flash_sim_stats.programs++;
+   if (flash_sim_op_doomed(false))
+   {
+      uint16_t done = (uint16_t)(flash_sim_rand() % (_flash_sim_prog_len + 1));
+      for (uint16_t i = done; i < _flash_sim_prog_len; i++)
+      {
+         uint8_t *p = &_flash_sim_mem[(_flash_sim_prog_addr + i) % FLASH_SIM_MEM_SIZE];
+         // The first byte not done has some of its bits cleared
+         *p = (i == done) ? (uint8_t)(_flash_sim_prog_old[i] & (*p | flash_sim_rand())) : _flash_sim_prog_old[i];
+      }
+      _flash_sim_stats.torn_programs++;
+      _flash_sim_cut_now = true;
+   }
+}
+
+// Finish a program or erase timed on the virtual clock once its time is up
+void flash_sim_busy_expire()
+{
+   if (_flash_sim_busy_timed && (int32_t)(_flash_sim_time_us - _flash_sim_busy_until) >= 0)
+   {
+      _flash_sim_busy_timed  = false;
+      _flash_sim_busy_left   = 0;
+      _flash_sim_status_reg &= ~EXT_FLASH_STATUS_REG_BUSY;
+   }
+}
+
+// Parse the command, return 0 if successful, -1 if not.
+int flash_sim_parse_cmd(uint8_t cmd)
+{
+   flash_sim_busy_expire();
+
+   // Once tRES1 has passed after a release the chip is fully awake
+   if (_flash_sim_releasing && _flash_sim_time_us - _flash_sim_release_us >= FLASH_SIM_TRES1_US)
+   {
+      _flash_sim_releasing = false;
+   }
+
+   // While powered down, or still releasing, the chip ignores everything but a release from power-down
+   if ((_flash_sim_powered_down || _flash_sim_releasing) && cmd != EXT_FLASH_CMD_RELEASE_POWER_DOWN)
+   {
+      _flash_sim_stats.ignored_cmds++;
+      _flash_sim_state = FLASH_SIM_STATE_IGNORE;
+      return(-1);
+   }
+
+   // While a program or erase is in progress the chip only answers status reads
+   if ((_flash_sim_status_reg & EXT_FLASH_STATUS_REG_BUSY) && cmd != EXT_FLASH_CMD_READ_STATUS_REG)
+   {
+      _flash_sim_stats.ignored_cmds++;
+      _flash_sim_state = FLASH_SIM_STATE_IGNORE;
+      return(-1);
+   }
+
+   // The 4-byte address forms work like their 3-byte counterparts after a longer address
+   _flash_sim_addr_len = 4;
+   switch (cmd)
+   {
+   case EXT_FLASH_CMD_READ_DATA_4B:
+      cmd = EXT_FLASH_CMD_READ_DATA;
+      break;
+   case EXT_FLASH_CMD_FAST_READ_4B:
+      cmd = EXT_FLASH_CMD_FAST_READ;
+      break;
+   case EXT_FLASH_CMD_PAGE_PROGRAM_4B:
+      cmd = EXT_FLASH_CMD_PAGE_PROGRAM;
+      break;
+   case EXT_FLASH_CMD_SECTOR_ERASE_4B:
+      cmd = EXT_FLASH_CMD_SECTOR_ERASE;
+      break;
+   case EXT_FLASH_CMD_BLOCK_ERASE_32K_4B:
+      cmd = EXT_FLASH_CMD_BLOCK_ERASE_32K;
+      break;
+   case EXT_FLASH_CMD_BLOCK_ERASE_64K_4B:
+      cmd = EXT_FLASH_CMD_BLOCK_ERASE_64K;
+      break;
+   default:
+      _flash_sim_addr_len = 3;
+      break;
+   }
+   _flash_sim_stats.addr4_cmds += _flash_sim_addr_len == 4;
+
+   // Switch based on the command
+   switch (cmd)
+   {
+   case EXT_FLASH_CMD_WRITE_ENABLE:
+      // Set the write enable latch
+      _flash_sim_wel = true;
+      // Set the state to address setting
+      _flash_sim_state = FLASH_SIM_SET_ADDR;
+      // Set the status register to EXT_FLASH_STATUS_REG_WEL
+      _flash_sim_status_reg |= EXT_FLASH_STATUS_REG_WEL;
+      break;
+
+   case EXT_FLASH_CMD_WRITE_DISABLE:
+      // Clear the write enable latch
+      _flash_sim_wel = false;
+      break;
+
+   case EXT_FLASH_CMD_READ_STATUS_REG:
+      // Set the state to read the status register
+      _flash_sim_state = FLASH_SIM_STATUS_REG_READ;
+      break;
+
+   case EXT_FLASH_CMD_WRITE_STATUS_REG:
+      // Set the state to write the status register
+      _flash_sim_state = FLASH_SIM_STATUS_REG_WRITE;
+      break;
+
+   case EXT_FLASH_CMD_READ_DATA:
+      // Set the state to address setting
+      _flash_sim_state = FLASH_SIM_SET_ADDR;
+      break;
+
+   case EXT_FLASH_CMD_FAST_READ:
+      // Set the state to address setting, remembering to skip the dummy byte
+      _flash_sim_state     = FLASH_SIM_SET_ADDR;
+      _flash_sim_fast_read = true;
+      _flash_sim_stats.fast_reads++;
+      break;
+
+   case EXT_FLASH_CMD_PAGE_PROGRAM:
+      // If write enable latch is set, set the state to address setting, otherwise just ignore the command
+      if (_flash_sim_wel)
+      {
+         _flash_sim_state = FLASH_SIM_SET_ADDR;
+      }
+      else
+      {
+         _flash_sim_state = FLASH_SIM_STATE_IDLE;
+      }
+      break;
+
+   case EXT_FLASH_CMD_SECTOR_ERASE:
+      // If write enable latch is set, set the state to address setting, otherwise just ignore the command
+      if (_flash_sim_wel)
+      {
+         _flash_sim_state     = FLASH_SIM_SET_ADDR;
+         _flash_sim_erase_len = 4096;
+      }
+      else
+      {
+         _flash_sim_state     = FLASH_SIM_STATE_IDLE;
+         _flash_sim_erase_len = 0;
+      }
+      break;
+
+   case EXT_FLASH_CMD_BLOCK_ERASE_32K:
+      // If write enable latch is set, set the state to address setting, otherwise just ignore the command
+      if (_flash_sim_wel)
+      {
+         _flash_sim_state     = FLASH_SIM_SET_ADDR;
+         _flash_sim_erase_len = 32768;
+      }
+      else
+      {
+         _flash_sim_state     = FLASH_SIM_STATE_IDLE;
+         _flash_sim_erase_len = 0;
+      }
+      break;
+
+   case EXT_FLASH_CMD_BLOCK_ERASE_64K:
+      // If write enable latch is set, set the state to address setting, otherwise just ignore the command
+      if (_flash_sim_wel)
+      {
+         _flash_sim_state     = FLASH_SIM_SET_ADDR;
+         _flash_sim_erase_len = 65536;
+      }
+      else
+      {
+         _flash_sim_state     = FLASH_SIM_STATE_IDLE;
+         _flash_sim_erase_len = 0;
+      }
+      break;
+
+   case EXT_FLASH_CMD_CHIP_ERASE:
+      // If write enable latch is set, set the state to address setting, otherwise just ignore the command
+      if (_flash_sim_wel)
+      {
+         _flash_sim_erase_len = FLASH_SIM_MEM_SIZE;
+         if (!_flash_sim_power_off)
+         {
+            flash_sim_erase(0, FLASH_SIM_MEM_SIZE);
+         }
+         _flash_sim_status_reg         |= EXT_FLASH_STATUS_REG_BUSY;
+         _flash_sim_status_reg         &= ~EXT_FLASH_STATUS_REG_WEL;
+         _flash_sim_wel                 = false;
+         _flash_sim_busy_start          = true;
+         _flash_sim_busy_for            = _flash_sim_erase_us;
+      }
+      else
+      {
+         _flash_sim_state     = FLASH_SIM_STATE_IDLE;
+         _flash_sim_erase_len = 0;
+      }
+      break;
+
+   case EXT_FLASH_CMD_POWER_DOWN:
+      // Enter deep power-down
+      _flash_sim_powered_down = true;
+      _flash_sim_stats.power_downs++;
+      break;
+
+   case EXT_FLASH_CMD_RELEASE_POWER_DOWN:
+      // Start the release from deep power-down, the chip is usable after tRES1
+      if (_flash_sim_powered_down)
+      {
+         _flash_sim_powered_down = false;
+         _flash_sim_releasing    = true;
+         _flash_sim_release_us   = _flash_sim_time_us;
+      }
+      break;
+
+   case EXT_FLASH_CMD_JEDEC_ID:
+      // Set the state to get the JEDEC ID
+      _flash_sim_state = FLASH_SIM_GET_JEDEC_ID;
+      break;
+
+   case EXT_FLASH_CMD_SET_BURST_WRAP:
+      // Set the state to take the three dummy bytes and the wrap bits
+      _flash_sim_state     = FLASH_SIM_SET_WRAP;
+      _flash_sim_wrap_byte = 0;
+      break;
+
+   default:
+      // Unknown command, set to IDLE
+      _flash_sim_state = FLASH_SIM_STATE_IDLE;
+      // Return an error
+      return(-1);
+   }
+   // Return success
+   return(0);
+}
+
+// Flash simulation address setter
+int flash_sim_set_addr(uint8_t next_byte)
+{
+   // Each address is 3 or 4 bytes long, passed in a byte at a time. The first byte is the most significant byte.
+   // The address is stored in the flash_sim_addr variable.
+   // Shift the address left by 8 bits and add the next byte, if its the first byte, clear the address first.
+   static uint8_t addr_byte = 0;
+
+   if (addr_byte == 0)
+   {
+      _flash_sim_addr = 0;
+   }
+   _flash_sim_addr = (_flash_sim_addr << 8) | next_byte;
+   addr_byte++;
+
+   // Once the address is complete, return success
+   if (addr_byte == _flash_sim_addr_len)
+   {
+      addr_byte = 0;
+      // Make sure the address is within the flash memory range by modulating it
+      _flash_sim_addr %= FLASH_SIM_MEM_SIZE;
+      return(0);
+   }
+
+   // Otherwise return failure
+   return(-1);
+}
+
+// Flash simulation jedec id getter
+uint8_t flash_sim_get_jedec_id(void)
+{
+   // The jedec id is a 3 byte value. Return the next byte in the sequence, and reset the state when done.
+   static uint8_t jedec_id_byte = 0;
+   uint8_t        ret           = FLASH_SIM_JEDEC_ID >> (8 * (2 - jedec_id_byte++));
+
+   if (jedec_id_byte == 3)
+   {
+      jedec_id_byte = 0;
+   }
+   return(ret);
+}
+
+// Flash simulation state machine
+uint8_t flash_sim_sm(uint8_t next_byte)
+{
+   // Switch based on the state
+   switch (_flash_sim_state)
+   {
+   case FLASH_SIM_STATE_IDLE:
+      // Parse the command, regardless of the result return 0xFF
+      flash_sim_parse_cmd(next_byte);
+      return(0xFF);
+
+      break;
+
+   case FLASH_SIM_SET_ADDR:
+      // Parse the address, if its successful set the state to read or write depending on the WEL, return 0xFF regardless
+      if (flash_sim_set_addr(next_byte) == 0)
+      {
+         if (_flash_sim_wel && _flash_sim_erase_len == 0)
+         {
+            _flash_sim_state     = FLASH_SIM_STATE_WRITE;
+            _flash_sim_prog_addr = _flash_sim_addr;
+            _flash_sim_prog_len  = 0;
+         }
+         else if (_flash_sim_wel && _flash_sim_erase_len > 0)
+         {
+            // Erase the address space specified by the current address and the erase length
+            if (!_flash_sim_power_off)
+            {
+               flash_sim_erase(_flash_sim_addr, _flash_sim_erase_len);
+            }
+            _flash_sim_busy_start = true;
+            _flash_sim_busy_for   = _flash_sim_erase_us;
+            // Set the status register to busy
+            _flash_sim_status_reg |= EXT_FLASH_STATUS_REG_BUSY;
+            // Clear the WEL in the status register
+            _flash_sim_status_reg &= ~EXT_FLASH_STATUS_REG_WEL;
+            _flash_sim_wel         = false;
+         }
+         else
+         {
+            _flash_sim_state = _flash_sim_fast_read ? FLASH_SIM_STATE_DUMMY : FLASH_SIM_STATE_READ;
+         }
+      }
+      return(0xFF);
+
+      break;
+
+   case FLASH_SIM_STATE_READ: {
+      // Return the next byte of the read
+      uint8_t ret = _flash_sim_mem[_flash_sim_addr];
+      // Increment the address, wrapping inside the line when burst wrap is set and applies, protect against overflow
+      if (_flash_sim_wrap && _flash_sim_wrap_reads)
+      {
+         _flash_sim_addr = (_flash_sim_addr & ~(uint32_t)(_flash_sim_wrap - 1)) | ((_flash_sim_addr + 1) & (_flash_sim_wrap - 1));
+      }
+      else
+      {
+         _flash_sim_addr = (_flash_sim_addr + 1) % FLASH_SIM_MEM_SIZE;
+      }
+      return(ret);
+   } break;
+
+   case FLASH_SIM_STATE_WRITE:
+      // Write the next byte to the memory by AND'ing it with the byte, remembering what it replaced
+      if (!_flash_sim_power_off)
+      {
+         if (_flash_sim_prog_len < sizeof(_flash_sim_prog_old))
+         {
+            _flash_sim_prog_old[_flash_sim_prog_len++] = _flash_sim_mem[_flash_sim_addr];
+         }
+         _flash_sim_mem[_flash_sim_addr] &= next_byte;
+      }
+      // Increment the address, protect against overflow
+      _flash_sim_addr = (_flash_sim_addr + 1) % FLASH_SIM_MEM_SIZE;
+      // Make sure the status byte is set to write in progress
+      _flash_sim_status_reg |= EXT_FLASH_STATUS_REG_BUSY;
+      // Clear the WEL in the status register
+      _flash_sim_status_reg &= ~EXT_FLASH_STATUS_REG_WEL;
+      _flash_sim_wel         = false;
+      return(0xFF);
+
+      break;
+
+   case FLASH_SIM_STATUS_REG_READ:
+      _flash_sim_stats.status_reads++;
+      flash_sim_busy_expire();
+      // Every byte after the first of a continuous status read is another poll, a program or erase in progress counts down
+      if (_flash_sim_status_clocked && _flash_sim_busy_left && _flash_sim_busy_left != FLASH_SIM_BUSY_FOREVER &&
+          --_flash_sim_busy_left == 0)
+      {
+         _flash_sim_status_reg &= ~EXT_FLASH_STATUS_REG_BUSY;
+      }
+      _flash_sim_status_clocked = true;
+      // Return the status register
+      return(_flash_sim_status_reg);
+
+      break;
+
+   case FLASH_SIM_STATUS_REG_WRITE:
+      // Write the next byte to the status register
+      _flash_sim_status_reg = next_byte;
+      break;
+
+   case FLASH_SIM_GET_JEDEC_ID:
+      // Return the next byte of the JEDEC ID
+      return(flash_sim_get_jedec_id());
+
+      break;
+
+   case FLASH_SIM_STATE_DUMMY:
+      // The dummy byte of a fast read, data follows
+      _flash_sim_state = FLASH_SIM_STATE_READ;
+      return(0xFF);
+
+      break;
+
+   case FLASH_SIM_SET_WRAP:
+      // After three dummy bytes, W4 set turns wrapping off, otherwise W6-W5 select 8, 16, 32 or 64 bytes
+      if (++_flash_sim_wrap_byte == 4)
+      {
+         _flash_sim_wrap  = (next_byte & 0x10) ? 0 : (uint8_t)(8 << ((next_byte >> 5) & 0x03));
+         _flash_sim_state = FLASH_SIM_STATE_IGNORE;
+      }
+      return(0xFF);
+
+      break;
+
+   case FLASH_SIM_STATE_IGNORE:
+      // The chip is not listening, the output floats high
+      return(0xFF);
+
+      break;
+
+   default:
+      // Unknown state, set to IDLE
+      _flash_sim_state = FLASH_SIM_STATE_IDLE;
+      break;
+   }
+
+   // Return the next byte to send
+   return(0xFF);
+}
+
+// Reset the flash simulation
+void flash_sim_reset(uint8_t fill)
+{
+   memset(_flash_sim_mem, fill, FLASH_SIM_MEM_SIZE);
+   _flash_sim_state      = FLASH_SIM_STATE_IDLE;
+   _flash_sim_addr       = 0;
+   _flash_sim_wel        = false;
+   _flash_sim_status_reg = 0;
+   _flash_sim_erase_len  = 0;
+   _flash_sim_fast_read  = false;
+   _flash_sim_wrap       = 0;
+   _flash_sim_wrap_reads = false;
+   memset(&_flash_sim_stats, 0, sizeof(_flash_sim_stats));
+   memset(_flash_sim_sector_erases, 0, sizeof(_flash_sim_sector_erases));
+   _flash_sim_time_us        = 0;
+   _flash_sim_powered_down   = false;
+   _flash_sim_releasing      = false;
+   _flash_sim_busy_cycles    = 0;
+   _flash_sim_busy_left      = 0;
+   _flash_sim_busy_start     = false;
+   _flash_sim_status_clocked = false;
+   _flash_sim_program_us     = 0;
+   _flash_sim_erase_us       = 0;
+   _flash_sim_busy_for       = 0;
+   _flash_sim_busy_timed     = false;
+   _flash_sim_cut_at         = 0;
+   _flash_sim_cut_ops        = 0;
+   _flash_sim_cut_erases     = 0;
+   _flash_sim_cut_now        = false;
+   _flash_sim_power_off      = false;
+}
+
+// Cut power at the end of the given chip select cycle from now
+void flash_sim_cut_power_after(uint32_t transactions)
+{
+   _flash_sim_cut_at = _flash_sim_stats.transactions + transactions;
+}
+
+// Cut power part way through the given program or erase from now
+void flash_sim_cut_power_in_op(uint32_t ops)
+{
+   _flash_sim_cut_ops = ops;
+}
+
+// Cut power part way through the given erase from now
+void flash_sim_cut_power_in_erase(uint32_t erases)
+{
+   _flash_sim_cut_erases = erases;
+}
+
+// Seed the power loss injection, xorshift needs a non-zero state
+void flash_sim_fault_seed(uint32_t seed)
+{
+   _flash_sim_fault_rand = seed ? seed : 1;
+}
+
+// Whether an injected power loss has happened
+bool flash_sim_power_lost()
+{
+   return(_flash_sim_power_off);
+}
+
+// Power the chip up again, everything but the array starts from reset
+void flash_sim_restore_power()
+{
+   _flash_sim_state          = FLASH_SIM_STATE_IDLE;
+   _flash_sim_addr           = 0;
+   _flash_sim_wel            = false;
+   _flash_sim_status_reg     = 0;
+   _flash_sim_erase_len      = 0;
+   _flash_sim_fast_read      = false;
+   _flash_sim_wrap           = 0;
+   _flash_sim_powered_down   = false;
+   _flash_sim_releasing      = false;
+   _flash_sim_busy_left      = 0;
+   _flash_sim_busy_start     = false;
+   _flash_sim_status_clocked = false;
+   _flash_sim_busy_timed     = false;
+   _flash_sim_power_off      = false;
+}
+
+// Make the chip busy for the given number of chip select cycles, FLASH_SIM_BUSY_FOREVER for a chip that never finishes
+void flash_sim_hold_busy(uint32_t cycles)
+{
+   _flash_sim_status_reg |= EXT_FLASH_STATUS_REG_BUSY;
+   _flash_sim_busy_left   = cycles;
+}
+
+// Modeled time of the simulator activity since the last reset
+double flash_sim_model_time_us()
+{
+   return(_flash_sim_stats.bytes * FLASH_SIM_MODEL_BYTE_US + _flash_sim_stats.programs * FLASH_SIM_MODEL_TPP_US +
+          _flash_sim_stats.erases * FLASH_SIM_MODEL_ERASE_US + _flash_sim_stats.erased_bytes * FLASH_SIM_MODEL_ERASE_BYTE_US);
+}
+
+// Chip select cycles per page program
+double flash_sim_transactions_per_page()
+{
+   return(_flash_sim_stats.programs ? (double)_flash_sim_stats.transactions / _flash_sim_stats.programs : 0);
+}
+
+// Wear ratio of a region, the most erased sector over the mean
+double flash_sim_wear_ratio(uint32_t start, uint32_t len)
+{
+   uint32_t max   = 0;
+   uint64_t total = 0;
+   uint32_t count = 0;
+
+   for (uint32_t addr = start; addr < start + len; addr += EXT_FLASH_SECTOR_SIZE, count++)
+   {
+      uint32_t n = _flash_sim_sector_erases[(addr % FLASH_SIM_MEM_SIZE) / EXT_FLASH_SECTOR_SIZE];
+      max    = n > max ? n : max;
+      total += n;
+   }
+
+   return(total ? (double)max * count / total : 0);
+}
+
+// Advance the flash simulation virtual clock
+void flash_sim_advance(uint32_t us)
+{
+   _flash_sim_time_us += us;
+}
+
+// Interface "selected" flag
+bool _is_selected = false;
+
+// Interface select method
+void _select()
+{
+   _is_selected = true;
+   _flash_sim_stats.transactions++;
+}
+
+// Interface deselect method
+void _deselect()
+{
+   _is_selected = false;
+   // A program is committed when chip select is released
+   if (_flash_sim_state == FLASH_SIM_STATE_WRITE)
+   {
+      if (!_flash_sim_power_off)
+      {
+         flash_sim_program();
+      }
+      _flash_sim_busy_start = true;
+      _flash_sim_busy_for   = _flash_sim_program_us;
+   }
+   // Cut the power once the cycle it was armed for, or the operation it was armed for, is over
+   if (_flash_sim_cut_now || (_flash_sim_cut_at && _flash_sim_stats.transactions == _flash_sim_cut_at))
+   {
+      _flash_sim_power_off = true;
+      _flash_sim_cut_now   = false;
+      _flash_sim_cut_at     = 0;
+      _flash_sim_cut_ops    = 0;
+      _flash_sim_cut_erases = 0;
+      _flash_sim_stats.power_cuts++;
+   }
+   // A program or erase just committed stays busy for the configured cycles, one in progress counts down
+   if (_flash_sim_busy_start && _flash_sim_busy_for)
+   {
+      _flash_sim_busy_left  = FLASH_SIM_BUSY_FOREVER;
+      _flash_sim_busy_timed = true;
+      _flash_sim_busy_until = _flash_sim_time_us + _flash_sim_busy_for;
+      _flash_sim_busy_start = false;
+   }
+   else if (_flash_sim_busy_start)
+   {
+      _flash_sim_busy_left  = _flash_sim_busy_cycles;
+      _flash_sim_busy_start = false;
+   }
+   else if (_flash_sim_busy_left && _flash_sim_busy_left != FLASH_SIM_BUSY_FOREVER)
+   {
+      _flash_sim_busy_left--;
+   }
+   // Set the state to idle
+   _flash_sim_state = FLASH_SIM_STATE_IDLE;
+   // Set the erase length to 0
+   _flash_sim_erase_len      = 0;
+   _flash_sim_fast_read      = false;
+   _flash_sim_status_clocked = false;
+   flash_sim_busy_expire();
+   // Clear the busy bit in the status register once the program or erase has run its course
+   if (!_flash_sim_busy_left)
+   {
+      _flash_sim_status_reg &= ~EXT_FLASH_STATUS_REG_BUSY;
+   }
+   // Set the address to 0
+   _flash_sim_addr = 0;
+}
+
+// Interface buffer write method, returns 0 if successful, -1 if not.
+int _write(uint8_t *data, uint16_t len)
+{
+   _flash_sim_stats.bytes += len;
+   // Run the flash simulation state machine for each byte in the buffer
+   for (uint16_t i = 0; i < len; i++)
+   {
+      flash_sim_sm(data[i]);
+   }
+   return(0);
+}
+
+// Interface buffer read method, returns 0 if successful, -1 if not.
+int _read(uint8_t *data, uint16_t len)
+{
+   _flash_sim_stats.bytes += len;
+   // Run the flash simulation state machine for each byte in the buffer
+   for (uint16_t i = 0; i < len; i++)
+   {
+      data[i] = flash_sim_sm(0xFF);
+   }
+   return(0);
+}
+
+// Interface delay method for a specified duration in microseconds.
+void _delay_us(uint32_t duration)
+{
+   // Only the virtual clock moves
+   flash_sim_advance(duration);
+}
+
+// Interface time base method, returns the virtual clock in microseconds.
+uint32_t _get_time_us()
+{
+   return(_flash_sim_time_us);
+}
+
+// Make a global interface struct
+emb_flash_intf_handle_t _intf = {
+   false,
+   _select,
+   _deselect,
+   _write,
+   _read,
+   _delay_us };
@@ -0,0 +1,162 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#ifndef EMB_EXT_FLASH_SIM_H_
+#define EMB_EXT_FLASH_SIM_H_
+
+#include <stdint.h>
+#include <emb_ext_flash.h>
+
+// Flash simulation JEDEC ID
+#define FLASH_SIM_JEDEC_ID    0x1F4401
+
+// Flash simulation memory size
+#define FLASH_SIM_MEM_SIZE    0x40000
+
+// Flash simulation release from deep power-down time (tRES1) in microseconds
+#define FLASH_SIM_TRES1_US    20
+
+// Flash sim memory bank
+extern uint8_t _flash_sim_mem[FLASH_SIM_MEM_SIZE];
+
+// Flash simulation write enable latch
+extern bool _flash_sim_wel;
+
+// Flash simulation status register
+extern uint8_t _flash_sim_status_reg;
+
+// Flash simulation bus and array activity counters
+typedef struct
+{
+   // Number of chip select cycles.
+   uint32_t transactions;
+   // Number of bytes clocked over the bus in either direction.
+   uint32_t bytes;
+   // Number of page programs committed.
+   uint32_t programs;
+   // Number of erase operations committed, and the number of bytes they covered.
+   uint32_t erases;
+   uint32_t erased_bytes;
+   // Number of deep power-down entries.
+   uint32_t power_downs;
+   // Number of commands ignored because the chip was powered down or still inside tRES1.
+   uint32_t ignored_cmds;
+   // Number of fast read commands.
+   uint32_t fast_reads;
+   // Number of commands sent in their 4-byte address form.
+   uint32_t addr4_cmds;
+   // Number of injected power losses, and the programs and erases they cut short.
+   uint32_t power_cuts;
+   uint32_t torn_programs;
+   uint32_t torn_erases;
+   // Number of status register bytes clocked out.
+   uint32_t status_reads;
+} flash_sim_stats_t;
+
+extern flash_sim_stats_t _flash_sim_stats;
+
+// Bus and array timing model used to turn simulator activity into time, 8 MHz SPI, typical tPP and an erase time that
+// grows with the erase size (roughly 47 ms for 4K, 96 ms for 32K and 151 ms for 64K)
+#define FLASH_SIM_MODEL_BYTE_US          1.0
+#define FLASH_SIM_MODEL_TPP_US           700.0
+#define FLASH_SIM_MODEL_ERASE_US         40000.0
+#define FLASH_SIM_MODEL_ERASE_BYTE_US    1.7
+
+// Modeled time of the simulator activity since the last reset, in microseconds
+double flash_sim_model_time_us();
+
+// Chip select cycles per page program since the last reset, 0 when nothing was programmed
+double flash_sim_transactions_per_page();
+
+// Number of times each 4K sector has been erased since the last reset
+extern uint32_t _flash_sim_sector_erases[FLASH_SIM_MEM_SIZE / EXT_FLASH_SECTOR_SIZE];
+
+// Wear ratio of a region, the erase count of its most erased sector over the mean, 0 when nothing in it was erased
+double flash_sim_wear_ratio(uint32_t start, uint32_t len);
+
+// Flash simulation virtual clock in microseconds, advanced by _delay_us() and flash_sim_advance()
+extern uint32_t _flash_sim_time_us;
+
+// Flash simulation deep power-down state
+extern bool _flash_sim_powered_down;
+
+// Flash simulation burst wrap length set with Set Burst with Wrap, 0 for linear reads
+extern uint8_t _flash_sim_wrap;
+
+// Flash simulation wraps READ and FAST_READ after Set Burst with Wrap, off after a reset as on most real parts
+extern bool _flash_sim_wrap_reads;
+
+// Flash simulation current address, during a read the address of the next byte out
+extern uint32_t _flash_sim_addr;
+
+// Advance the flash simulation virtual clock
+void flash_sim_advance(uint32_t us);
+
+// Chip select cycles BUSY stays set after each program or erase, 0 to clear it as soon as the command is committed. Within a
+// continuous status read every status byte after the first counts as a cycle too
+extern uint32_t _flash_sim_busy_cycles;
+
+// Virtual clock time BUSY stays set after each program and each erase, 0 to count chip select cycles instead
+extern uint32_t _flash_sim_program_us;
+extern uint32_t _flash_sim_erase_us;
+
+// Busy cycles of a chip that never finishes
+#define FLASH_SIM_BUSY_FOREVER    0xFFFFFFFF
+
+// Make the chip busy for the given number of chip select cycles, as if a program or erase had just been started
+void flash_sim_hold_busy(uint32_t cycles);
+
+// Power loss injection. A program cut short leaves a prefix of its bytes programmed, one byte with only some of its bits
+// cleared and the rest untouched. An erase cut short leaves a prefix erased, a short run of bytes with only some of their
+// bits set and the rest untouched. Once power is lost nothing more reaches the array, but the chip keeps answering so that
+// the driver call in progress returns, and the workload stops when flash_sim_power_lost() reports the loss.
+
+// Cut power at the end of the given chip select cycle from now, tearing the program or erase it starts
+void flash_sim_cut_power_after(uint32_t transactions);
+
+// Cut power part way through the given program or erase from now
+void flash_sim_cut_power_in_op(uint32_t ops);
+
+// Cut power part way through the given erase from now
+void flash_sim_cut_power_in_erase(uint32_t erases);
+
+// Seed the random choice of how far an interrupted program or erase got
+void flash_sim_fault_seed(uint32_t seed);
+
+// Whether an injected power loss has happened
+bool flash_sim_power_lost();
+
+// Power the chip up again after a loss, the array keeps its contents and everything else starts from reset
+void flash_sim_restore_power();
+
+// Reset the flash simulation, filling the memory bank with the given value and clearing all state
+void flash_sim_reset(uint8_t fill);
+
+// Interface methods backed by the flash simulation
+void _select();
+void _deselect();
+int _write(uint8_t *data, uint16_t len);
+int _read(uint8_t *data, uint16_t len);
+void _delay_us(uint32_t duration);
+uint32_t _get_time_us();
+
+// Global interface struct wired to the flash simulation
+extern emb_flash_intf_handle_t _intf;
+
+#endif /* EMB_EXT_FLASH_SIM_H_ */
@@ -19,368 +19,8 @@
 
 #include <gtest/gtest.h>
 #include <emb_ext_flash.h>
-
-// Flash simulation JEDEC ID
-#define FLASH_SIM_JEDEC_ID    0x1F4401
-
-// Flash simulation memory size
-#define FLASH_SIM_MEM_SIZE    0x40000
-
-// Flash sim memory bank, default to 0xFF
-uint8_t _flash_sim_mem[FLASH_SIM_MEM_SIZE] = { 0xFF };
-
-// Flash simulation state enumaration
-enum flash_sim_state
-{
-   FLASH_SIM_STATE_IDLE,
-   FLASH_SIM_SET_ADDR,
-   FLASH_SIM_STATE_READ,
-   FLASH_SIM_STATE_WRITE,
-   FLASH_SIM_STATUS_REG_READ,
-   FLASH_SIM_STATUS_REG_WRITE,
-   FLASH_SIM_ERASE,
-   FLASH_SIM_GET_JEDEC_ID,
-};
-
-// Flash simulation state
-int _flash_sim_state = FLASH_SIM_STATE_IDLE;
-
-// Flash simulation current address
-uint32_t _flash_sim_addr = 0;
-
-// Flash simulation write enable latch
-bool _flash_sim_wel = false;
-
-// Flash simulation status register
-uint8_t _flash_sim_status_reg = 0;
-
-// Flash simulation erase length setting
-uint32_t _flash_sim_erase_len = 0;
-
-// Parse the command, return 0 if successful, -1 if not.
-int flash_sim_parse_cmd(uint8_t cmd)
-{
-   // Switch based on the command
-   switch (cmd)
-   {
-   case EXT_FLASH_CMD_WRITE_ENABLE:
-      // Set the write enable latch
-      _flash_sim_wel = true;
-      // Set the state to address setting
-      _flash_sim_state = FLASH_SIM_SET_ADDR;
-      // Set the status register to EXT_FLASH_STATUS_REG_WEL
-      _flash_sim_status_reg |= EXT_FLASH_STATUS_REG_WEL;
-      break;
-
-   case EXT_FLASH_CMD_WRITE_DISABLE:
-      // Clear the write enable latch
-      _flash_sim_wel = false;
-      break;
-
-   case EXT_FLASH_CMD_READ_STATUS_REG:
-      // Set the state to read the status register
-      _flash_sim_state = FLASH_SIM_STATUS_REG_READ;
-      break;
-
-   case EXT_FLASH_CMD_WRITE_STATUS_REG:
-      // Set the state to write the status register
-      _flash_sim_state = FLASH_SIM_STATUS_REG_WRITE;
-      break;
-
-   case EXT_FLASH_CMD_READ_DATA:
-      // Set the state to address setting
-      _flash_sim_state = FLASH_SIM_SET_ADDR;
-      break;
-
-   case EXT_FLASH_CMD_FAST_READ:
-      // Set the state to address setting
-      _flash_sim_state = FLASH_SIM_SET_ADDR;
-      break;
-
-   case EXT_FLASH_CMD_PAGE_PROGRAM:
-      // If write enable latch is set, set the state to address setting, otherwise just ignore the command
-      if (_flash_sim_wel)
-      {
-         _flash_sim_state = FLASH_SIM_SET_ADDR;
-      }
-      else
-      {
-         _flash_sim_state = FLASH_SIM_STATE_IDLE;
-      }
-      break;
-
-   case EXT_FLASH_CMD_SECTOR_ERASE:
-      // If write enable latch is set, set the state to address setting, otherwise just ignore the command
-      if (_flash_sim_wel)
-      {
-         _flash_sim_state     = FLASH_SIM_SET_ADDR;
-         _flash_sim_erase_len = 4096;
-      }
-      else
-      {
-         _flash_sim_state     = FLASH_SIM_STATE_IDLE;
-         _flash_sim_erase_len = 0;
-      }
-      break;
-
-   case EXT_FLASH_CMD_BLOCK_ERASE_32K:
-      // If write enable latch is set, set the state to address setting, otherwise just ignore the command
-      if (_flash_sim_wel)
-      {
-         _flash_sim_state     = FLASH_SIM_SET_ADDR;
-         _flash_sim_erase_len = 32768;
-      }
-      else
-      {
-         _flash_sim_state     = FLASH_SIM_STATE_IDLE;
-         _flash_sim_erase_len = 0;
-      }
-      break;
-
-   case EXT_FLASH_CMD_BLOCK_ERASE_64K:
-      // If write enable latch is set, set the state to address setting, otherwise just ignore the command
-      if (_flash_sim_wel)
-      {
-         _flash_sim_state     = FLASH_SIM_SET_ADDR;
-         _flash_sim_erase_len = 65536;
-      }
-      else
-      {
-         _flash_sim_state     = FLASH_SIM_STATE_IDLE;
-         _flash_sim_erase_len = 0;
-      }
-      break;
-
-   case EXT_FLASH_CMD_CHIP_ERASE:
-      // If write enable latch is set, set the state to address setting, otherwise just ignore the command
-      if (_flash_sim_wel)
-      {
-         _flash_sim_erase_len = FLASH_SIM_MEM_SIZE;
-         memset(_flash_sim_mem, 0xFF, FLASH_SIM_MEM_SIZE);
-      }
-      else
-      {
-         _flash_sim_state     = FLASH_SIM_STATE_IDLE;
-         _flash_sim_erase_len = 0;
-      }
-      break;
-
-   case EXT_FLASH_CMD_POWER_DOWN:
-      // Do nothing
-      break;
-
-   case EXT_FLASH_CMD_RELEASE_POWER_DOWN:
-      // Do nothing
-      break;
-
-   case EXT_FLASH_CMD_JEDEC_ID:
-      // Set the state to get the JEDEC ID
-      _flash_sim_state = FLASH_SIM_GET_JEDEC_ID;
-      break;
-
-   default:
-      // Unknown command, set to IDLE
-      _flash_sim_state = FLASH_SIM_STATE_IDLE;
-      // Return an error
-      return(-1);
-   }
-   // Return success
-   return(0);
-}
-
-// Flash simulation address setter
-int flash_sim_set_addr(uint8_t next_byte)
-{
-   // Each address is 3 bytes long, passed in a byte at a time. The first byte is the most significant byte.
-   // The address is stored in the flash_sim_addr variable.
-   // Shift the address left by 8 bits and add the next byte, if its the first byte, clear the address first.
-   static uint8_t addr_byte = 0;
-
-   if (addr_byte == 0)
-   {
-      _flash_sim_addr = 0;
-   }
-   _flash_sim_addr = (_flash_sim_addr << 8) | next_byte;
-   addr_byte++;
-
-   // If the address is 3 bytes long, return success
-   if (addr_byte == 3)
-   {
-      addr_byte = 0;
-      // Make sure the address is within the flash memory range by modulating it
-      _flash_sim_addr %= FLASH_SIM_MEM_SIZE;
-      return(0);
-   }
-
-   // Otherwise return failure
-   return(-1);
-}
-
-// Flash simulation jedec id getter
-uint8_t flash_sim_get_jedec_id(void)
-{
-   // The jedec id is a 3 byte value. Return the next byte in the sequence, and reset the state when done.
-   static uint8_t jedec_id_byte = 0;
-   uint8_t        ret           = FLASH_SIM_JEDEC_ID >> (8 * (2 - jedec_id_byte++));
-
-   if (jedec_id_byte == 3)
-   {
-      jedec_id_byte = 0;
-   }
-   return(ret);
-}
-
-// Flash simulation state machine
-uint8_t flash_sim_sm(uint8_t next_byte)
-{
-   // Switch based on the state
-   switch (_flash_sim_state)
-   {
-   case FLASH_SIM_STATE_IDLE:
-      // Parse the command, regardless of the result return 0xFF
-      flash_sim_parse_cmd(next_byte);
-      return(0xFF);
-
-      break;
-
-   case FLASH_SIM_SET_ADDR:
-      // Parse the address, if its successful set the state to read or write depending on the WEL, return 0xFF regardless
-      if (flash_sim_set_addr(next_byte) == 0)
-      {
-         if (_flash_sim_wel && _flash_sim_erase_len == 0)
-         {
-            _flash_sim_state = FLASH_SIM_STATE_WRITE;
-         }
-         else if (_flash_sim_wel && _flash_sim_erase_len > 0)
-         {
-            // Erase the address space specified by the current address and the erase length
-            for (uint32_t i = 0; i < _flash_sim_erase_len; i++)
-            {
-               _flash_sim_mem[(_flash_sim_addr + i) % FLASH_SIM_MEM_SIZE] = 0xFF;
-            }
-            // Set the status register to busy
-            _flash_sim_status_reg |= EXT_FLASH_STATUS_REG_BUSY;
-            // Clear the WEL in the status register
-            _flash_sim_status_reg &= ~EXT_FLASH_STATUS_REG_WEL;
-            _flash_sim_wel         = false;
-         }
-         else
-         {
-            _flash_sim_state = FLASH_SIM_STATE_READ;
-         }
-      }
-      return(0xFF);
-
-      break;
-
-   case FLASH_SIM_STATE_READ: {
-      // Return the next byte of the read
-      uint8_t ret = _flash_sim_mem[_flash_sim_addr];
-      // Increment the address, protect against overflow
-      _flash_sim_addr = (_flash_sim_addr + 1) % FLASH_SIM_MEM_SIZE;
-      return(ret);
-   } break;
-
-   case FLASH_SIM_STATE_WRITE:
-      // Write the next byte to the memory by AND'ing it with the byte
-      _flash_sim_mem[_flash_sim_addr] &= next_byte;
-      // Increment the address, protect against overflow
-      _flash_sim_addr = (_flash_sim_addr + 1) % FLASH_SIM_MEM_SIZE;
-      // Make sure the status byte is set to write in progress
-      _flash_sim_status_reg |= EXT_FLASH_STATUS_REG_BUSY;
-      // Clear the WEL in the status register
-      _flash_sim_status_reg &= ~EXT_FLASH_STATUS_REG_WEL;
-      _flash_sim_wel         = false;
-      return(0xFF);
-
-      break;
-
-   case FLASH_SIM_STATUS_REG_READ:
-      // Return the status register
-      return(_flash_sim_status_reg);
-
-      break;
-
-   case FLASH_SIM_STATUS_REG_WRITE:
-      // Write the next byte to the status register
-      _flash_sim_status_reg = next_byte;
-      break;
-
-   case FLASH_SIM_GET_JEDEC_ID:
-      // Return the next byte of the JEDEC ID
-      return(flash_sim_get_jedec_id());
-
-      break;
-
-   default:
-      // Unknown state, set to IDLE
-      _flash_sim_state = FLASH_SIM_STATE_IDLE;
-      break;
-   }
-
-   // Return the next byte to send
-   return(0xFF);
-}
-
-// Interface "selected" flag
-bool _is_selected = false;
-
-// Interface select method
-void _select()
-{
-   _is_selected = true;
-}
-
-// Interface deselect method
-void _deselect()
-{
-   _is_selected = false;
-   // Set the state to idle
-   _flash_sim_state = FLASH_SIM_STATE_IDLE;
-   // Set the erase length to 0
-   _flash_sim_erase_len = 0;
-   // Clear the busy bit in the status register
-   _flash_sim_status_reg &= ~EXT_FLASH_STATUS_REG_BUSY;
-   // Set the address to 0
-   _flash_sim_addr = 0;
-}
-
-// Interface buffer write method, returns 0 if successful, -1 if not.
-int _write(uint8_t *data, uint16_t len)
-{
-   // Run the flash simulation state machine for each byte in the buffer
-   for (uint16_t i = 0; i < len; i++)
-   {
-      flash_sim_sm(data[i]);
-   }
-   return(0);
-}
-
-// Interface buffer read method, returns 0 if successful, -1 if not.
-int _read(uint8_t *data, uint16_t len)
-{
-   // Run the flash simulation state machine for each byte in the buffer
-   for (uint16_t i = 0; i < len; i++)
-   {
-      data[i] = flash_sim_sm(0xFF);
-   }
-   return(0);
-}
-
-// Interface delay method for a specified duration in microseconds.
-void _delay_us(uint32_t duration)
-{
-   // Do nothing
-}
-
-// Make a global interface struct
-emb_flash_intf_handle_t _intf = {
-   false,
-   _select,
-   _deselect,
-   _write,
-   _read,
-   _delay_us };
+#include <emb_ext_flash_chips.h>
+#include "emb_ext_flash_sim.h"
 
 // Class for facilitating embedded external flash memory tests
 class emb_ext_flash_test : public ::testing::Test
@@ -729,3 +369,818 @@ TEST_F(emb_ext_flash_test, block_64k_erase)
       addr += 32768;
    }
 }
+
+TEST_F(emb_ext_flash_test, batch_validation)
+{
+   uint8_t            buf[8];
+   uint32_t           saved = 0;
+   emb_ext_flash_op_t ops[2] = { { EXT_FLASH_OP_READ, 0, buf, sizeof(buf), 0 }, { EXT_FLASH_OP_WRITE, 0, NULL, 4, 0 } };
+
+   // Nothing runs when any operation is invalid
+   flash_sim_reset(0xFF);
+   ASSERT_EQ(emb_ext_flash_batch(NULL, ops, 2, &saved), -1);
+   ASSERT_EQ(emb_ext_flash_batch(&_intf, ops, 0, &saved), -1);
+   ASSERT_EQ(emb_ext_flash_batch(&_intf, ops, 2, &saved), -1);
+   ops[1].data = buf;
+   ops[1].len  = 0x10000;
+   ASSERT_EQ(emb_ext_flash_batch(&_intf, ops, 2, &saved), -1);
+   ops[1].type = 9;
+   ASSERT_EQ(emb_ext_flash_batch(&_intf, ops, 2, &saved), -1);
+   ops[1].type = EXT_FLASH_OP_STATUS;
+   ops[0].len  = 0x10000;
+   ASSERT_EQ(emb_ext_flash_batch(&_intf, ops, 2, &saved), -1);
+   ASSERT_EQ(_flash_sim_stats.transactions, 0u);
+}
+
+TEST_F(emb_ext_flash_test, batch_status_while_busy)
+{
+   uint8_t            st[3];
+   uint32_t           saved  = 0;
+   emb_ext_flash_op_t ops[3] = { { EXT_FLASH_OP_STATUS, 0, &st[0], 0, 0 }, { EXT_FLASH_OP_STATUS, 0, &st[1], 0, 0 },
+                                 { EXT_FLASH_OP_STATUS, 0, &st[2], 0, 0 } };
+
+   // A status read that found a program running is read again, once the chip is idle the next one reuses it
+   flash_sim_reset(0xFF);
+   _intf.deselect();
+   flash_sim_hold_busy(1);
+   ASSERT_EQ(emb_ext_flash_batch(&_intf, ops, 3, &saved), 3);
+   ASSERT_EQ(st[0] & EXT_FLASH_STATUS_REG_BUSY, EXT_FLASH_STATUS_REG_BUSY);
+   ASSERT_EQ(st[1], 0);
+   ASSERT_EQ(st[2], 0);
+   ASSERT_EQ(saved, 1u);
+   ASSERT_EQ(_flash_sim_stats.status_reads, 2u);
+}
+
+TEST_F(emb_ext_flash_test, batch_boot_sequence)
+{
+   uint8_t  cfg[4][16];
+   uint8_t  hdr[8];
+   uint8_t  tail[8];
+   uint8_t  st[2];
+   uint8_t  rec[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+   uint32_t saved  = 0;
+
+   flash_sim_reset(0xFF);
+   for (uint32_t i = 0; i < 0x200; i++)
+   {
+      _flash_sim_mem[0x1000 + i] = (uint8_t)i;
+   }
+
+   // Config blocks back to back, a header after a small gap, status checks and a log record
+   emb_ext_flash_op_t ops[] = {
+      { EXT_FLASH_OP_READ, 0x1000, cfg[0], 16, 0 },  { EXT_FLASH_OP_READ, 0x1010, cfg[1], 16, 0 },
+      { EXT_FLASH_OP_READ, 0x1020, cfg[2], 16, 0 },  { EXT_FLASH_OP_READ, 0x1030, cfg[3], 16, 0 },
+      { EXT_FLASH_OP_READ, 0x1043, hdr, 8, 0 },      { EXT_FLASH_OP_STATUS, 0, &st[0], 0, 0 },
+      { EXT_FLASH_OP_STATUS, 0, &st[1], 0, 0 },      { EXT_FLASH_OP_ERASE, 0x2000, NULL, EXT_FLASH_SECTOR_SIZE, 0 },
+      { EXT_FLASH_OP_WRITE, 0x2000, rec, 8, 0 },     { EXT_FLASH_OP_READ, 0x1100, tail, 8, 0 },
+   };
+   uint16_t count = sizeof(ops) / sizeof(ops[0]);
+
+   ASSERT_EQ(emb_ext_flash_batch(&_intf, ops, count, &saved), count);
+   uint32_t batched = _flash_sim_stats.transactions;
+
+   // Every operation got the right data and result
+   for (int i = 0; i < 4; i++)
+   {
+      ASSERT_EQ(ops[i].result, 16);
+      ASSERT_EQ(cfg[i][0], (uint8_t)(i * 16));
+      ASSERT_EQ(cfg[i][15], (uint8_t)(i * 16 + 15));
+   }
+   ASSERT_EQ(hdr[0], 0x43);
+   ASSERT_EQ(st[0], 0);
+   ASSERT_EQ(st[1], 0);
+   ASSERT_EQ(ops[7].result, 0);
+   ASSERT_EQ(ops[8].result, 8);
+   ASSERT_EQ(_flash_sim_mem[0x2007], 8);
+   ASSERT_EQ(tail[0], 0x00);
+   ASSERT_EQ(tail[7], 0x07);
+
+   // Five reads went out as one command and the second status read reused the first
+   ASSERT_EQ(saved, 5u);
+
+   // The same sequence as separate calls
+   flash_sim_reset(0xFF);
+   for (uint32_t i = 0; i < 0x200; i++)
+   {
+      _flash_sim_mem[0x1000 + i] = (uint8_t)i;
+   }
+   for (uint16_t i = 0; i < count; i++)
+   {
+      emb_ext_flash_op_t *p_op = &ops[i];
+      switch (p_op->type)
+      {
+      case EXT_FLASH_OP_READ:
+         ASSERT_EQ(emb_ext_flash_read(&_intf, p_op->address, p_op->data, p_op->len), (int)p_op->len);
+         break;
+      case EXT_FLASH_OP_WRITE:
+         ASSERT_EQ(emb_ext_flash_write(&_intf, p_op->address, p_op->data, p_op->len), (int)p_op->len);
+         break;
+      case EXT_FLASH_OP_ERASE:
+         ASSERT_EQ(emb_ext_flash_erase(&_intf, p_op->address, p_op->len), 0);
+         break;
+      default:
+         *p_op->data = emb_ext_flash_get_status(&_intf);
+         break;
+      }
+   }
+   printf("boot sequence: %u chip select cycles as separate calls, %u batched\n", (unsigned)_flash_sim_stats.transactions,
+          (unsigned)batched);
+   ASSERT_EQ(_flash_sim_stats.transactions - batched, saved);
+}
+
+// Class for facilitating power management tests, these run with the simulator tRES1 and optionally a time base
+class emb_ext_flash_pm_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      _intf.get_time_us = NULL;
+      _intf.t_res1_us   = FLASH_SIM_TRES1_US;
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   void TearDown()
+   {
+      // Hand the global interface back the way the other tests expect it
+      _intf.get_time_us = NULL;
+      _intf.t_res1_us   = 0;
+      emb_ext_flash_init_intf(&_intf);
+   }
+};
+
+TEST_F(emb_ext_flash_pm_test, auto_wake_without_time_base)
+{
+   uint8_t data[4] = { 1, 2, 3, 4 };
+   uint8_t rx[4]   = { 0 };
+
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0x100, data, 4), 4);
+
+   // Automatic sleep needs a time base
+   ASSERT_EQ(emb_ext_flash_pm_enable(&_intf, 1000), -1);
+   ASSERT_EQ(emb_ext_flash_pm_poll(&_intf), 0);
+
+   // Forget to wake the chip, the read wakes it and waits the full tRES1
+   ASSERT_EQ(emb_ext_flash_sleep(&_intf), 0);
+   ASSERT_TRUE(_flash_sim_powered_down);
+   uint32_t t0 = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0x100, rx, 4), 4);
+   ASSERT_EQ(memcmp(data, rx, 4), 0);
+   ASSERT_FALSE(_flash_sim_powered_down);
+   ASSERT_EQ(_flash_sim_time_us - t0, FLASH_SIM_TRES1_US);
+   ASSERT_EQ(_flash_sim_stats.ignored_cmds, 0);
+
+   // Manual wake still works and sleeping twice only sends one command
+   ASSERT_EQ(emb_ext_flash_sleep(&_intf), 0);
+   ASSERT_EQ(emb_ext_flash_sleep(&_intf), 0);
+   ASSERT_EQ(_flash_sim_stats.power_downs, 2);
+   ASSERT_EQ(emb_ext_flash_wake(&_intf), 0);
+   ASSERT_EQ(emb_ext_flash_get_status(&_intf) & EXT_FLASH_STATUS_REG_BUSY, 0);
+   ASSERT_EQ(_flash_sim_stats.ignored_cmds, 0);
+}
+
+TEST_F(emb_ext_flash_pm_test, idle_sleep_and_lazy_wake)
+{
+   uint8_t  rx[4];
+   uint64_t asleep_us = 0;
+   uint64_t awake_us  = 0;
+
+   _intf.get_time_us = _get_time_us;
+   emb_ext_flash_init_intf(&_intf);
+   ASSERT_EQ(emb_ext_flash_pm_enable(&_intf, 1000), 0);
+
+   // Not idle long enough
+   flash_sim_advance(500);
+   ASSERT_EQ(emb_ext_flash_pm_poll(&_intf), 0);
+
+   // An access restarts the idle timer
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0, rx, 4), 4);
+   flash_sim_advance(600);
+   ASSERT_EQ(emb_ext_flash_pm_poll(&_intf), 0);
+   flash_sim_advance(400);
+   ASSERT_EQ(emb_ext_flash_pm_poll(&_intf), 1);
+   ASSERT_TRUE(_flash_sim_powered_down);
+   ASSERT_EQ(emb_ext_flash_pm_poll(&_intf), 0);
+
+   // Asleep for 5 ms, then the next operation wakes the chip and pays tRES1 once
+   flash_sim_advance(5000);
+   uint32_t t0 = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0, rx, 4), 4);
+   ASSERT_EQ(_flash_sim_time_us - t0, FLASH_SIM_TRES1_US);
+   ASSERT_EQ(_flash_sim_stats.ignored_cmds, 0);
+   ASSERT_EQ(_intf.pm.sleeps, 1);
+   ASSERT_EQ(_intf.pm.wakes, 1);
+
+   // Time asleep and awake add up to the elapsed time
+   ASSERT_EQ(emb_ext_flash_pm_get_times(&_intf, &asleep_us, &awake_us), 0);
+   ASSERT_EQ(asleep_us, 5000);
+   ASSERT_EQ(asleep_us + awake_us, _flash_sim_time_us);
+}
+
+TEST_F(emb_ext_flash_pm_test, early_wake_hides_tres1)
+{
+   uint8_t rx[4];
+
+   _intf.get_time_us = _get_time_us;
+   emb_ext_flash_init_intf(&_intf);
+   ASSERT_EQ(emb_ext_flash_sleep(&_intf), 0);
+
+   // Waking returns straight away, the delay is deferred to the next operation
+   uint32_t t0 = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_wake(&_intf), 0);
+   ASSERT_EQ(_flash_sim_time_us, t0);
+
+   // Part of tRES1 passes doing other work, only the remainder is waited out
+   flash_sim_advance(FLASH_SIM_TRES1_US / 2);
+   t0 = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0, rx, 4), 4);
+   ASSERT_EQ(_flash_sim_time_us - t0, FLASH_SIM_TRES1_US - FLASH_SIM_TRES1_US / 2);
+
+   // All of tRES1 passes, no delay at all
+   ASSERT_EQ(emb_ext_flash_sleep(&_intf), 0);
+   ASSERT_EQ(emb_ext_flash_wake(&_intf), 0);
+   flash_sim_advance(FLASH_SIM_TRES1_US);
+   t0 = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0, rx, 4), 4);
+   ASSERT_EQ(_flash_sim_time_us, t0);
+   ASSERT_EQ(_intf.pm.wakes_no_delay, 1);
+   ASSERT_EQ(_flash_sim_stats.ignored_cmds, 0);
+}
+
+// Class for facilitating deadline tests, these run with the simulator time base so the limits are measured in virtual time
+class emb_ext_flash_deadline_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      _intf.get_time_us = _get_time_us;
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   void TearDown()
+   {
+      // Hand the global interface back the way the other tests expect it
+      flash_sim_reset(0xFF);
+      _intf.get_time_us = NULL;
+      _intf.delay_us    = _delay_us;
+      emb_ext_flash_init_intf(&_intf);
+   }
+};
+
+// Delay hook that cancels the wait in progress after a few polls
+static uint32_t _cancel_after = 0;
+static void     _delay_us_cancel(uint32_t duration)
+{
+   _delay_us(duration);
+   if (_cancel_after && --_cancel_after == 0)
+   {
+      emb_ext_flash_cancel(&_intf);
+   }
+}
+
+TEST_F(emb_ext_flash_deadline_test, stuck_program_times_out)
+{
+   uint8_t data[16] = { 0 };
+
+   // The program is committed but the chip never finishes it
+   _flash_sim_busy_cycles = FLASH_SIM_BUSY_FOREVER;
+   uint32_t t0            = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_write_timeout(&_intf, 0x100, data, sizeof(data), 0), EXT_FLASH_ERR_TIMEOUT);
+   ASSERT_GE(_flash_sim_time_us - t0, EXT_FLASH_DEFAULT_TPP_MAX_US);
+   ASSERT_LT(_flash_sim_time_us - t0, EXT_FLASH_DEFAULT_TPP_MAX_US + 2 * EXT_FLASH_MIN_POLL_US);
+   ASSERT_EQ(_intf.dl.timeouts, 1);
+   ASSERT_EQ(_intf.dl.max_permille[EXT_FLASH_WAIT_PROGRAM], 1000);
+
+   // The chip is still busy, so the next write cannot even set WEL
+   ASSERT_EQ(emb_ext_flash_wait_idle(&_intf, 100), EXT_FLASH_ERR_TIMEOUT);
+   ASSERT_EQ(emb_ext_flash_write_timeout(&_intf, 0x200, data, sizeof(data), 0), EXT_FLASH_ERR_TIMEOUT);
+   ASSERT_EQ(_intf.dl.max_permille[EXT_FLASH_WAIT_WEL], 1000);
+   ASSERT_EQ(_intf.dl.timeouts, 3);
+   ASSERT_GT(_flash_sim_stats.ignored_cmds, 0);
+}
+
+TEST_F(emb_ext_flash_deadline_test, stuck_erase_times_out)
+{
+   // Already busy, the erase never gets WEL
+   flash_sim_hold_busy(FLASH_SIM_BUSY_FOREVER);
+   ASSERT_EQ(emb_ext_flash_erase_timeout(&_intf, 0, EXT_FLASH_SECTOR_SIZE, 0), EXT_FLASH_ERR_TIMEOUT);
+   ASSERT_EQ(emb_ext_flash_chip_erase_timeout(&_intf, 0), EXT_FLASH_ERR_TIMEOUT);
+   ASSERT_EQ(_flash_sim_stats.erases, 0);
+
+   // Gets WEL but never finishes the 64K block, bounded by five times the sector erase limit
+   flash_sim_reset(0xFF);
+   _flash_sim_busy_cycles = FLASH_SIM_BUSY_FOREVER;
+   uint32_t t0            = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_erase_timeout(&_intf, 0, EXT_FLASH_BLOCK_64K_SIZE, 0), EXT_FLASH_ERR_TIMEOUT);
+   ASSERT_GE(_flash_sim_time_us - t0, EXT_FLASH_DEFAULT_TSE_MAX_MS * 5000);
+   ASSERT_EQ(_flash_sim_stats.erases, 1);
+}
+
+TEST_F(emb_ext_flash_deadline_test, explicit_timeout_and_margin)
+{
+   uint8_t data[300];
+   uint8_t rx[300];
+   memset(data, 0x5A, sizeof(data));
+
+   // A slow chip that takes a few polls per program still makes an ample deadline, and the margin is recorded
+   _flash_sim_busy_cycles = 3;
+   ASSERT_EQ(emb_ext_flash_write_timeout(&_intf, 0x1F0, data, sizeof(data), 10000), (int)sizeof(data));
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0x1F0, rx, sizeof(rx)), (int)sizeof(rx));
+   ASSERT_EQ(memcmp(data, rx, sizeof(rx)), 0);
+   ASSERT_GT(_intf.dl.max_permille[EXT_FLASH_WAIT_PROGRAM], 0);
+   ASSERT_LT(_intf.dl.max_permille[EXT_FLASH_WAIT_PROGRAM], 100);
+   ASSERT_EQ(_intf.dl.timeouts, 0);
+
+   // The timeout covers the whole call, a deadline too short for the second page fails part way
+   _flash_sim_busy_cycles = 100;
+   ASSERT_EQ(emb_ext_flash_write_timeout(&_intf, 0x10F0, data, sizeof(data), 1500), EXT_FLASH_ERR_TIMEOUT);
+   ASSERT_EQ(_intf.dl.timeouts, 1);
+
+   // Waiting it out recovers the chip
+   ASSERT_EQ(emb_ext_flash_wait_idle(&_intf, 100000), 0);
+   ASSERT_EQ(emb_ext_flash_wait_idle(&_intf, 0), 0);
+}
+
+TEST_F(emb_ext_flash_deadline_test, cancel)
+{
+   uint8_t data[4] = { 1, 2, 3, 4 };
+
+   // Cancelled from the delay hook part way through a stuck erase
+   _flash_sim_busy_cycles = FLASH_SIM_BUSY_FOREVER;
+   _intf.delay_us         = _delay_us_cancel;
+   _cancel_after          = 5;
+   ASSERT_EQ(emb_ext_flash_erase_timeout(&_intf, 0, EXT_FLASH_SECTOR_SIZE, 0), EXT_FLASH_ERR_CANCELLED);
+   ASSERT_EQ(_intf.dl.cancels, 1);
+   ASSERT_EQ(_intf.dl.timeouts, 0);
+   ASSERT_EQ(_intf.dl.cancel, 0);
+
+   // A cancel request is consumed, the next operation runs normally
+   flash_sim_reset(0xFF);
+   ASSERT_EQ(emb_ext_flash_write_timeout(&_intf, 0, data, sizeof(data), 0), (int)sizeof(data));
+   ASSERT_EQ(_intf.dl.cancels, 1);
+}
+
+TEST_F(emb_ext_flash_deadline_test, chip_limits_and_legacy_path)
+{
+   static const emb_ext_flash_chip_t chip = { 0xEF4016, 22, EXT_FLASH_CHIP_ERASE_ALL, EXT_FLASH_READ_MODE_NORMAL, 0, 400, 3000,
+                                              45, 400, 3 };
+   uint8_t                           data[4] = { 1, 2, 3, 4 };
+   uint8_t                           rx[4]   = { 0 };
+
+   // The chip's own maximum program time bounds the wait
+   ASSERT_EQ(emb_ext_flash_set_chip(&_intf, &chip), 0);
+   _flash_sim_busy_cycles = FLASH_SIM_BUSY_FOREVER;
+   uint32_t t0            = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_write_timeout(&_intf, 0, data, sizeof(data), 0), EXT_FLASH_ERR_TIMEOUT);
+   ASSERT_GE(_flash_sim_time_us - t0, 3000);
+   ASSERT_LT(_flash_sim_time_us - t0, 3000 + 400 / EXT_FLASH_POLL_DIVISOR * 2);
+
+   // The functions without a timeout still wait for as long as it takes and ignore cancel requests
+   flash_sim_reset(0xFF);
+   _flash_sim_busy_cycles = 20;
+   emb_ext_flash_cancel(&_intf);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, 0x1000, EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_chip_erase(&_intf), 0);
+   ASSERT_EQ(emb_ext_flash_read(&_intf, 0, rx, sizeof(rx)), (int)sizeof(rx));
+   ASSERT_EQ(rx[0], 0xFF);
+   ASSERT_EQ(_intf.dl.cancels, 0);
+   ASSERT_EQ(emb_ext_flash_set_chip(&_intf, NULL), 0);
+}
+
+// Class for facilitating low round trip tests
+class emb_ext_flash_rt_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   void TearDown()
+   {
+      // Hand the global interface back the way the other tests expect it
+      flash_sim_reset(0xFF);
+      _intf.get_time_us = NULL;
+      _intf.write       = _write;
+      emb_ext_flash_init_intf(&_intf);
+   }
+};
+
+// Write hook that fails the next write enable command, which still reaches the chip
+static bool _fail_wren = false;
+static int  _write_fail_wren(uint8_t *data, uint16_t len)
+{
+   int rtn = _write(data, len);
+   if (_fail_wren && len == 1 && data[0] == EXT_FLASH_CMD_WRITE_ENABLE)
+   {
+      _fail_wren = false;
+      return(-1);
+   }
+   return(rtn);
+}
+
+TEST_F(emb_ext_flash_rt_test, transactions_per_page)
+{
+   static uint8_t data[EXT_FLASH_SECTOR_SIZE];
+   static uint8_t rx[EXT_FLASH_SECTOR_SIZE];
+   double         per_page[2], model_us[2];
+   uint32_t       status_bytes[2];
+
+   for (uint32_t i = 0; i < sizeof(data); i++)
+   {
+      data[i] = (uint8_t)(i * 7);
+   }
+
+   // A sector written page by page to a chip that stays busy for two polls after each program, without and with the mode
+   ASSERT_EQ(emb_ext_flash_set_low_round_trip(NULL, 1), -1);
+   for (int mode = 0; mode < 2; mode++)
+   {
+      flash_sim_reset(0xFF);
+      _flash_sim_busy_cycles = 2;
+      ASSERT_EQ(emb_ext_flash_set_low_round_trip(&_intf, (uint8_t)mode), 0);
+      ASSERT_EQ(emb_ext_flash_write(&_intf, 0x3000, data, sizeof(data)), (int)sizeof(data));
+      per_page[mode]     = flash_sim_transactions_per_page();
+      model_us[mode]     = flash_sim_model_time_us();
+      status_bytes[mode] = _flash_sim_stats.status_reads;
+      ASSERT_EQ(_flash_sim_stats.programs, sizeof(data) / EXT_FLASH_PAGE_SIZE);
+      ASSERT_EQ(emb_ext_flash_read(&_intf, 0x3000, rx, sizeof(rx)), (int)sizeof(rx));
+      ASSERT_EQ(memcmp(data, rx, sizeof(rx)), 0);
+   }
+   printf("4K write: %.2f chip select cycles per page, %u status bytes, %.0f us plain, %.2f, %u, %.0f us low round trip\n",
+          per_page[0], (unsigned)status_bytes[0], model_us[0], per_page[1], (unsigned)status_bytes[1], model_us[1]);
+
+   // Write enable, WEL poll, program and three busy polls per page, against write enable, program and one held status read
+   ASSERT_EQ(per_page[0], 6.0);
+   ASSERT_EQ(per_page[1], 3.0 + 1.0 / 16);
+   ASSERT_EQ(status_bytes[1], status_bytes[0] - 16 + 1);
+
+   // WEL was only read back before the first page, when nothing was known about the chip yet
+   ASSERT_EQ(_intf.rt.wel_verified, 1u);
+   ASSERT_EQ(_intf.rt.wel_trusted, 15u);
+
+   // The chip is known to be idle, so its status needs no round trip
+   uint32_t transactions = _flash_sim_stats.transactions;
+   ASSERT_EQ(emb_ext_flash_get_status(&_intf), 0);
+   ASSERT_EQ(emb_ext_flash_get_status(&_intf) & EXT_FLASH_STATUS_REG_BUSY, 0);
+   ASSERT_EQ(_flash_sim_stats.transactions, transactions);
+   ASSERT_EQ(_intf.rt.status_reused, 2u);
+
+   // Until a command starts something, a background erase is polled for again
+   ASSERT_EQ(emb_ext_flash_erase_begin(&_intf, 0x3000), 0);
+   ASSERT_NE(emb_ext_flash_get_status(&_intf) & EXT_FLASH_STATUS_REG_BUSY, 0);
+   ASSERT_EQ(emb_ext_flash_wait_idle(&_intf, 100000), 0);
+   ASSERT_EQ(emb_ext_flash_get_status(&_intf) & EXT_FLASH_STATUS_REG_BUSY, 0);
+   ASSERT_EQ(_intf.rt.status_reused, 3u);
+}
+
+TEST_F(emb_ext_flash_rt_test, failure_paths)
+{
+   uint8_t data[16];
+   memset(data, 0xA5, sizeof(data));
+
+   // A write enable that did not go out cleanly has WEL read back
+   ASSERT_EQ(emb_ext_flash_set_low_round_trip(&_intf, 1), 0);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0x100, data, sizeof(data)), (int)sizeof(data));
+   _intf.write = _write_fail_wren;
+   _fail_wren  = true;
+   ASSERT_EQ(emb_ext_flash_write(&_intf, 0x200, data, sizeof(data)), (int)sizeof(data));
+   ASSERT_EQ(_intf.rt.wel_verified, 2u);
+   ASSERT_EQ(_intf.rt.wel_trusted, 0u);
+   ASSERT_EQ(_flash_sim_mem[0x20F], 0xA5);
+
+   // The held status read still gives up on a chip that never finishes
+   flash_sim_reset(0xFF);
+   _intf.get_time_us      = _get_time_us;
+   _flash_sim_busy_cycles = FLASH_SIM_BUSY_FOREVER;
+   uint32_t t0            = _flash_sim_time_us;
+   ASSERT_EQ(emb_ext_flash_write_timeout(&_intf, 0x100, data, sizeof(data), 0), EXT_FLASH_ERR_TIMEOUT);
+   ASSERT_GE(_flash_sim_time_us - t0, EXT_FLASH_DEFAULT_TPP_MAX_US);
+   ASSERT_EQ(_flash_sim_stats.transactions, 3u);
+   ASSERT_GT(_flash_sim_stats.status_reads, 100u);
+
+   // Nothing is trusted while the chip is busy, the next write enable is read back and times out
+   ASSERT_NE(emb_ext_flash_get_status(&_intf) & EXT_FLASH_STATUS_REG_BUSY, 0);
+   ASSERT_EQ(emb_ext_flash_write_timeout(&_intf, 0x200, data, sizeof(data), 0), EXT_FLASH_ERR_TIMEOUT);
+   ASSERT_EQ(_intf.dl.timeouts, 2u);
+}
+
+// Class for facilitating read-ahead tests
+class emb_ext_flash_ra_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      for (uint32_t i = 0; i < 0x8000; i++)
+      {
+         _flash_sim_mem[0x8000 + i] = (uint8_t)(i ^ (i >> 8));
+      }
+   }
+
+   void TearDown()
+   {
+      _intf.deselect();
+      _intf.t_res1_us = 0;
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+   }
+
+   // Read a log in small chunks and check every byte, returns 0 if it all matched
+   static int replay(uint32_t start, uint32_t len, uint16_t chunk)
+   {
+      uint8_t rx[64];
+      for (uint32_t off = 0; off < len; off += chunk)
+      {
+         if (emb_ext_flash_read(&_intf, start + off, rx, chunk) != chunk ||
+             memcmp(rx, &_flash_sim_mem[start + off], chunk) != 0)
+         {
+            return(-1);
+         }
+      }
+      return(0);
+   }
+};
+
+TEST_F(emb_ext_flash_ra_test, sequential_log_replay)
+{
+   static uint8_t buf[512];
+   uint32_t       transactions[3], bytes[3];
+
+   ASSERT_EQ(emb_ext_flash_set_read_ahead(NULL, buf, sizeof(buf), 0), -1);
+   ASSERT_EQ(emb_ext_flash_set_read_ahead(&_intf, buf, 0, 0), -1);
+
+   // A 16K log read back 32 bytes at a time, plain, through the buffer and through the buffer holding the read open
+   for (int mode = 0; mode < 3; mode++)
+   {
+      emb_ext_flash_init_intf(&_intf);
+      if (mode)
+      {
+         ASSERT_EQ(emb_ext_flash_set_read_ahead(&_intf, buf, sizeof(buf), mode == 2), 0);
+      }
+      memset(&_flash_sim_stats, 0, sizeof(_flash_sim_stats));
+      ASSERT_EQ(replay(0x8000, 0x4000, 32), 0);
+      emb_ext_flash_release(&_intf);
+      transactions[mode] = _flash_sim_stats.transactions;
+      bytes[mode]        = _flash_sim_stats.bytes;
+   }
+   printf("16K log in 32 byte reads: %u commands %u bus bytes plain, %u %u read ahead, %u %u holding the read open\n",
+          (unsigned)transactions[0], (unsigned)bytes[0], (unsigned)transactions[1], (unsigned)bytes[1],
+          (unsigned)transactions[2], (unsigned)bytes[2]);
+   printf("read ahead hit rate %.1f%%, %u bytes prefetched, %u wasted\n", 100.0 * _intf.ra.hits / _intf.ra.reads,
+          (unsigned)_intf.ra.prefetched, (unsigned)_intf.ra.wasted);
+
+   // One command per read, one per window, and one for the whole log
+   ASSERT_EQ(transactions[0], 512u);
+   ASSERT_EQ(transactions[1], 2u + (0x4000 - 64) / (sizeof(buf) + 32));
+   ASSERT_EQ(transactions[2], 2u);
+   ASSERT_EQ(_intf.ra.reads, 512u);
+   ASSERT_EQ(_intf.ra.continued, _intf.ra.reads - _intf.ra.hits - 2);
+   ASSERT_GE(_intf.ra.hits, 480u);
+
+   // Only the window past the end of the log went unread
+   ASSERT_EQ(emb_ext_flash_set_read_ahead(&_intf, NULL, 0, 0), 0);
+   ASSERT_EQ(_intf.ra.prefetched - _intf.ra.wasted, 0x4000u - 64 - (_intf.ra.reads - _intf.ra.hits - 2) * 32);
+   ASSERT_EQ(_intf.ra.wasted, sizeof(buf));
+}
+
+TEST_F(emb_ext_flash_ra_test, cancelled_by_other_accesses)
+{
+   static uint8_t buf[256];
+   uint8_t        rx[32];
+   uint8_t        rec[16];
+
+   memset(rec, 0x11, sizeof(rec));
+   for (uint8_t hold = 0; hold < 2; hold++)
+   {
+      ASSERT_EQ(emb_ext_flash_set_read_ahead(&_intf, buf, sizeof(buf), hold), 0);
+
+      // A write into the window is seen by the next read
+      ASSERT_EQ(replay(0x8000, 64, 32), 0);
+      ASSERT_EQ(emb_ext_flash_erase(&_intf, 0x9000, EXT_FLASH_SECTOR_SIZE), 0);
+      ASSERT_EQ(replay(0x9000, 64, 32), 0);
+      ASSERT_EQ(emb_ext_flash_write(&_intf, 0x9040, rec, sizeof(rec)), (int)sizeof(rec));
+      ASSERT_EQ(emb_ext_flash_read(&_intf, 0x9040, rx, sizeof(rx)), (int)sizeof(rx));
+      ASSERT_EQ(memcmp(rx, &_flash_sim_mem[0x9040], sizeof(rx)), 0);
+      ASSERT_EQ(rx[0], 0x11);
+
+      // A read elsewhere drops the window, a status read in between closes the open read
+      uint32_t wasted = _intf.ra.wasted;
+      ASSERT_EQ(replay(0xA000, 96, 32), 0);
+      ASSERT_EQ(emb_ext_flash_get_status(&_intf), 0);
+      ASSERT_EQ(replay(0xA060, 64, 32), 0);
+      ASSERT_EQ(replay(0xB000, 32, 32), 0);
+      ASSERT_GT(_intf.ra.wasted, wasted);
+
+      // Sleep and wake in the middle of a stream
+      _intf.t_res1_us = FLASH_SIM_TRES1_US;
+      ASSERT_EQ(replay(0xC000, 64, 32), 0);
+      ASSERT_EQ(emb_ext_flash_sleep(&_intf), 0);
+      ASSERT_EQ(replay(0xC040, 512, 32), 0);
+      ASSERT_EQ(emb_ext_flash_wake(&_intf), 0);
+      ASSERT_EQ(replay(0xC240, 512, 16), 0);
+      emb_ext_flash_release(&_intf);
+   }
+   ASSERT_EQ(_flash_sim_stats.ignored_cmds, 0u);
+}
+
+// Class for facilitating wrapped burst read tests, on a part that wraps the driver's reads
+class emb_ext_flash_wrap_test : public ::testing::Test
+{
+public:
+   emb_ext_flash_chip_t _chip;
+
+   // Address of the critical byte, and the bus bytes clocked up to it since _start_bytes
+   static uint32_t _target;
+   static uint32_t _start_bytes;
+   static uint32_t _first_bytes;
+
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+      for (uint32_t i = 0; i < 0x1000; i++)
+      {
+         _flash_sim_mem[0x4000 + i] = (uint8_t)(i * 7 + (i >> 8));
+      }
+      memset(&_chip, 0, sizeof(_chip));
+      _chip.capacity_log2 = 18;
+      _chip.erase_sizes   = EXT_FLASH_CHIP_ERASE_ALL;
+      _chip.flags         = EXT_FLASH_CHIP_FLAG_WRAP_READ;
+      ASSERT_EQ(emb_ext_flash_set_chip(&_intf, &_chip), 0);
+      _flash_sim_wrap_reads = true;
+   }
+
+   void TearDown()
+   {
+      _intf.read = _read;
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+   }
+
+   // Bus read that notes when the critical byte comes out
+   static int timed_read(uint8_t *data, uint16_t len)
+   {
+      for (uint16_t i = 0; i < len; i++)
+      {
+         if (_flash_sim_addr == _target && !_first_bytes)
+         {
+            _first_bytes = _flash_sim_stats.bytes - _start_bytes;
+         }
+         _read(&data[i], 1);
+      }
+      return(0);
+   }
+
+   // Check a line came back critical byte first
+   static void expect_wrapped(uint32_t address, const uint8_t *data, uint8_t len)
+   {
+      uint32_t line = address & ~(uint32_t)(len - 1);
+      for (uint8_t i = 0; i < len; i++)
+      {
+         ASSERT_EQ(data[i], _flash_sim_mem[line + ((address - line + i) & (len - 1))]) << "byte " << (int)i;
+      }
+   }
+};
+
+uint32_t emb_ext_flash_wrap_test::_target      = 0;
+uint32_t emb_ext_flash_wrap_test::_start_bytes = 0;
+uint32_t emb_ext_flash_wrap_test::_first_bytes = 0;
+
+TEST_F(emb_ext_flash_wrap_test, every_wrap_length)
+{
+   uint8_t rx[64];
+
+   for (uint8_t len = 8; len && len <= 64; len <<= 1)
+   {
+      // Emulated with two linear reads
+      ASSERT_EQ(emb_ext_flash_set_burst_wrap(&_intf, 0), 0);
+      uint32_t transactions = _flash_sim_stats.transactions;
+      ASSERT_EQ(emb_ext_flash_read_wrapped(&_intf, 0x4123, rx, len), len);
+      expect_wrapped(0x4123, rx, len);
+      ASSERT_EQ(_flash_sim_stats.transactions - transactions, 2u);
+      ASSERT_EQ(_flash_sim_wrap, 0);
+
+      // Done by the chip, which is set once for a run of fills
+      ASSERT_EQ(emb_ext_flash_set_burst_wrap(&_intf, len), 0);
+      uint32_t sets = _intf.wrap.sets;
+      for (uint32_t address = 0x4200; address < 0x4200u + 2u * (uint32_t)len; address += 3)
+      {
+         ASSERT_EQ(emb_ext_flash_read_wrapped(&_intf, address, rx, len), len);
+         expect_wrapped(address, rx, len);
+      }
+      ASSERT_EQ(_flash_sim_wrap, len);
+      ASSERT_EQ(_intf.wrap.sets, sets + 1);
+
+      // A line starting on its boundary is a plain read
+      ASSERT_EQ(emb_ext_flash_read_wrapped(&_intf, 0x4400, rx, len), len);
+      ASSERT_EQ(memcmp(rx, &_flash_sim_mem[0x4400], len), 0);
+
+      // A linear read turns wrapping off first
+      ASSERT_EQ(emb_ext_flash_read(&_intf, 0x4400 + len - 4, rx, 16), 16);
+      ASSERT_EQ(memcmp(rx, &_flash_sim_mem[0x4400 + len - 4], 16), 0);
+      ASSERT_EQ(_flash_sim_wrap, 0);
+      ASSERT_EQ(_intf.wrap.active, 0);
+   }
+
+   // Lengths the chip cannot wrap at
+   ASSERT_EQ(emb_ext_flash_set_burst_wrap(&_intf, 12), -1);
+   ASSERT_EQ(emb_ext_flash_set_burst_wrap(&_intf, 128), -1);
+   ASSERT_EQ(emb_ext_flash_read_wrapped(&_intf, 0x4000, rx, 24), 0);
+   ASSERT_EQ(emb_ext_flash_read_wrapped(&_intf, 0x4000, NULL, 32), 0);
+
+   // Batches turn wrapping off too
+   ASSERT_EQ(emb_ext_flash_set_burst_wrap(&_intf, 32), 0);
+   ASSERT_EQ(emb_ext_flash_read_wrapped(&_intf, 0x4010, rx, 32), 32);
+   emb_ext_flash_op_t op = { EXT_FLASH_OP_READ, 0x401C, rx, 8 };
+   ASSERT_EQ(emb_ext_flash_batch(&_intf, &op, 1, NULL), 1);
+   ASSERT_EQ(memcmp(rx, &_flash_sim_mem[0x401C], 8), 0);
+}
+
+TEST_F(emb_ext_flash_wrap_test, needs_wrap_capability)
+{
+   uint8_t rx[32];
+
+   // Parts in the table, and unknown parts, only wrap quad I/O reads or use a different command
+   _flash_sim_wrap_reads = false;
+   ASSERT_EQ(emb_ext_flash_set_chip(&_intf, NULL), 0);
+   ASSERT_EQ(emb_ext_flash_set_burst_wrap(&_intf, 32), -1);
+   ASSERT_EQ(emb_ext_flash_set_chip(&_intf, emb_ext_flash_chip_lookup(0xEF4018)), 0);
+   ASSERT_EQ(emb_ext_flash_set_burst_wrap(&_intf, 32), -1);
+   ASSERT_EQ(emb_ext_flash_set_burst_wrap(&_intf, 0), 0);
+
+   // So wrapped reads are always split and come back right
+   ASSERT_EQ(emb_ext_flash_read_wrapped(&_intf, 0x4013, rx, 32), 32);
+   expect_wrapped(0x4013, rx, 32);
+   ASSERT_EQ(_intf.wrap.sets, 0u);
+   ASSERT_EQ(_intf.wrap.split, 1u);
+
+   // A wrap setting left behind by a chip that lost the capability is ignored
+   ASSERT_EQ(emb_ext_flash_set_chip(&_intf, &_chip), 0);
+   ASSERT_EQ(emb_ext_flash_set_burst_wrap(&_intf, 32), 0);
+   ASSERT_EQ(emb_ext_flash_set_chip(&_intf, emb_ext_flash_chip_lookup(0xEF4018)), 0);
+   ASSERT_EQ(emb_ext_flash_read_wrapped(&_intf, 0x4025, rx, 32), 32);
+   expect_wrapped(0x4025, rx, 32);
+   ASSERT_EQ(_intf.wrap.wrapped, 0u);
+}
+
+// 32 byte cache line fills after misses on each 4 byte word: bus bytes until the missed word arrives, per fill in total, and
+// chip select cycles per fill
+TEST_F(emb_ext_flash_wrap_test, bench_time_to_first_word)
+{
+   const char *names[3] = { "linear", "split", "wrapped" };
+   double      first[3], bytes[3], cycles[3];
+   uint8_t     rx[32];
+
+   _intf.read = timed_read;
+   for (int mode = 0; mode < 3; mode++)
+   {
+      uint32_t fills         = 0;
+      uint32_t total_first   = 0;
+      uint32_t bytes_before  = _flash_sim_stats.bytes;
+      uint32_t cycles_before = _flash_sim_stats.transactions;
+
+      ASSERT_EQ(emb_ext_flash_set_burst_wrap(&_intf, mode == 2 ? 32 : 0), 0);
+      for (uint32_t line = 0x4000; line < 0x4800; line += 32)
+      {
+         for (uint32_t word = 0; word < 32; word += 4)
+         {
+            _target      = line + word;
+            _start_bytes = _flash_sim_stats.bytes;
+            _first_bytes = 0;
+            if (mode == 0)
+            {
+               ASSERT_EQ(emb_ext_flash_read(&_intf, line, rx, sizeof(rx)), (int)sizeof(rx));
+               ASSERT_EQ(memcmp(rx, &_flash_sim_mem[line], sizeof(rx)), 0);
+            }
+            else
+            {
+               ASSERT_EQ(emb_ext_flash_read_wrapped(&_intf, _target, rx, sizeof(rx)), (int)sizeof(rx));
+               expect_wrapped(_target, rx, sizeof(rx));
+            }
+            total_first += _first_bytes;
+            fills++;
+         }
+      }
+      first[mode]  = (double)total_first / fills;
+      bytes[mode]  = (double)(_flash_sim_stats.bytes - bytes_before) / fills;
+      cycles[mode] = (double)(_flash_sim_stats.transactions - cycles_before) / fills;
+   }
+
+   printf("fill      first word bytes   bytes per fill   cycles per fill\n");
+   for (int mode = 0; mode < 3; mode++)
+   {
+      printf("%-8s %17.2f %16.2f %17.2f\n", names[mode], first[mode], bytes[mode], cycles[mode]);
+   }
+   EXPECT_LT(first[2], first[0] / 2);
+   EXPECT_LT(bytes[2], bytes[1]);
+   EXPECT_LT(cycles[2], cycles[1]);
+}
@@ -0,0 +1,285 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <vector>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_ts.h>
+#include "emb_ext_flash_sim.h"
+
+// Region and record size used by the time-series tests
+#define TS_REGION_START    0x10000
+#define TS_SECTORS         8
+#define TS_PAYLOAD         12
+
+// Records per sector for the test payload
+#define TS_RECS_PER_SECTOR ((EXT_FLASH_SECTOR_SIZE - EXT_FLASH_TS_HEADER_SIZE) / (EXT_FLASH_TS_RECORD_HEADER + TS_PAYLOAD))
+
+// Class for facilitating time-series store tests
+class emb_ext_flash_ts_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   void TearDown() { flash_sim_reset(0xFF); }
+
+   // Payload derived from the timestamp so that returned records can be checked
+   static void payload(uint32_t t, uint8_t *p)
+   {
+      for (int i = 0; i < TS_PAYLOAD; i++)
+      {
+         p[i] = (uint8_t)(t * 7 + i);
+      }
+   }
+
+   // Run a query and return the timestamps, checking every payload on the way
+   static std::vector <uint32_t> query(emb_ext_flash_ts_t *p_ts, uint32_t t_start, uint32_t t_end)
+   {
+      emb_ext_flash_ts_cursor_t cur;
+      std::vector <uint32_t>    out;
+      uint8_t                   got[TS_PAYLOAD], want[TS_PAYLOAD];
+      uint32_t                  t;
+      int                       rtn;
+
+      EXPECT_EQ(emb_ext_flash_ts_query(p_ts, &cur, t_start, t_end), 0);
+      while ((rtn = emb_ext_flash_ts_next(p_ts, &cur, &t, got)) == 1)
+      {
+         payload(t, want);
+         EXPECT_EQ(memcmp(got, want, TS_PAYLOAD), 0);
+         out.push_back(t);
+      }
+      EXPECT_EQ(rtn, 0);
+      return(out);
+   }
+
+   // The same query as a linear scan over the appended records the store still retains
+   static std::vector <uint32_t> scan(emb_ext_flash_ts_t *p_ts, const std::vector <uint32_t> &all, uint32_t t_start,
+                                      uint32_t t_end)
+   {
+      std::vector <uint32_t> out;
+      size_t                 kept = p_ts->count ? (size_t)(p_ts->count - 1) * TS_RECS_PER_SECTOR + p_ts->fill : 0;
+      for (size_t i = all.size() - kept; i < all.size(); i++)
+      {
+         uint32_t t = all[i];
+         if (t >= t_start && t <= t_end)
+         {
+            out.push_back(t);
+         }
+      }
+      return(out);
+   }
+
+   // Append count records with rising timestamps, some of them repeated
+   static void append(emb_ext_flash_ts_t *p_ts, std::vector <uint32_t> &all, uint32_t &t, int count)
+   {
+      uint8_t p[TS_PAYLOAD];
+
+      for (int i = 0; i < count; i++)
+      {
+         t += (rand() % 4 == 0) ? 0 : 1 + rand() % 5;
+         payload(t, p);
+         ASSERT_EQ(emb_ext_flash_ts_append(p_ts, t, p), 0);
+         all.push_back(t);
+      }
+   }
+};
+
+TEST_F(emb_ext_flash_ts_test, ranges_match_linear_scan)
+{
+   emb_ext_flash_ts_t     ts;
+   std::vector <uint32_t> all;
+   uint32_t               t = 1000, first, last;
+   uint8_t                p[TS_PAYLOAD] = {0};
+
+   // Argument checks
+   ASSERT_EQ(emb_ext_flash_ts_format(&ts, &_intf, TS_REGION_START + 1, TS_SECTORS * EXT_FLASH_SECTOR_SIZE, TS_PAYLOAD), -1);
+   ASSERT_EQ(emb_ext_flash_ts_format(&ts, &_intf, TS_REGION_START, EXT_FLASH_SECTOR_SIZE, TS_PAYLOAD), -1);
+   ASSERT_EQ(emb_ext_flash_ts_format(&ts, &_intf, TS_REGION_START, TS_SECTORS * EXT_FLASH_SECTOR_SIZE, 0), -1);
+   ASSERT_EQ(emb_ext_flash_ts_format(&ts, &_intf, TS_REGION_START, TS_SECTORS * EXT_FLASH_SECTOR_SIZE,
+                                     EXT_FLASH_TS_MAX_PAYLOAD + 1), -1);
+   ASSERT_EQ(emb_ext_flash_ts_format(&ts, &_intf, TS_REGION_START, TS_SECTORS * EXT_FLASH_SECTOR_SIZE, TS_PAYLOAD), 0);
+   ASSERT_EQ(emb_ext_flash_ts_span(&ts, &first, &last), -1);
+   ASSERT_TRUE(query(&ts, 0, 0xFFFFFFFE).empty());
+
+   // Timestamps never go backwards
+   ASSERT_EQ(emb_ext_flash_ts_append(&ts, 0xFFFFFFFF, p), -1);
+   ASSERT_EQ(emb_ext_flash_ts_append(&ts, t, NULL), -1);
+   payload(t, p);
+   ASSERT_EQ(emb_ext_flash_ts_append(&ts, t, p), 0);
+   all.push_back(t);
+   ASSERT_EQ(emb_ext_flash_ts_append(&ts, t - 1, p), -1);
+
+   // Fill the ring more than twice over, the format left every sector erased so only the wrap erases
+   srand(39);
+   append(&ts, all, t, TS_SECTORS * TS_RECS_PER_SECTOR * 5 / 2);
+   ASSERT_EQ(ts.count, TS_SECTORS);
+   ASSERT_EQ(ts.stat_erases, (all.size() - 1) / TS_RECS_PER_SECTOR - (TS_SECTORS - 1));
+   ASSERT_EQ(emb_ext_flash_ts_span(&ts, &first, &last), 0);
+   ASSERT_EQ(last, t);
+
+   // Retention is the last full sectors plus the newest one
+   size_t kept = (TS_SECTORS - 1) * TS_RECS_PER_SECTOR + ts.fill;
+   ASSERT_EQ(first, all[all.size() - kept]);
+   ASSERT_EQ(query(&ts, 0, 0xFFFFFFFE).size(), kept);
+
+   // Random ranges, including ones around sector boundaries, before the oldest and past the newest
+   for (int i = 0; i < 300; i++)
+   {
+      uint32_t a = first - 50 + rand() % (last - first + 100);
+      uint32_t b = a + rand() % ((i % 3) ? 40 : 3000);
+      ASSERT_EQ(query(&ts, a, b), scan(&ts, all, a, b)) << a << ".." << b;
+   }
+   for (uint16_t pos = 1; pos < ts.count; pos++)
+   {
+      uint32_t edge = ts.t_first[(ts.oldest + pos) % TS_SECTORS];
+      ASSERT_EQ(query(&ts, edge, edge), scan(&ts, all, edge, edge));
+      ASSERT_EQ(query(&ts, edge - 1, edge + 1), scan(&ts, all, edge - 1, edge + 1));
+   }
+   ASSERT_TRUE(query(&ts, last + 1, 0xFFFFFFFE).empty());
+   ASSERT_TRUE(query(&ts, 20, 10).empty());
+}
+
+TEST_F(emb_ext_flash_ts_test, remount_and_invalidated_query)
+{
+   emb_ext_flash_ts_t        ts, again;
+   emb_ext_flash_ts_cursor_t cur;
+   std::vector <uint32_t>    all;
+   uint32_t                  t = 5, first, last, got, erases = 0;
+
+   // An erased region mounts as an empty store
+   ASSERT_EQ(emb_ext_flash_ts_mount(&ts, &_intf, TS_REGION_START, TS_SECTORS * EXT_FLASH_SECTOR_SIZE, TS_PAYLOAD), 0);
+   ASSERT_EQ(ts.count, 0);
+
+   // Remount part way through the first pass and after wrapping, the mount must agree with the running store
+   ASSERT_EQ(emb_ext_flash_ts_format(&ts, &_intf, TS_REGION_START, TS_SECTORS * EXT_FLASH_SECTOR_SIZE, TS_PAYLOAD), 0);
+   srand(40);
+   for (int round = 0; round < 6; round++)
+   {
+      append(&ts, all, t, TS_RECS_PER_SECTOR * 3 + 17 * round);
+      ASSERT_EQ(emb_ext_flash_ts_mount(&again, &_intf, TS_REGION_START, TS_SECTORS * EXT_FLASH_SECTOR_SIZE, TS_PAYLOAD), 0);
+      ASSERT_EQ(again.oldest, ts.oldest);
+      ASSERT_EQ(again.newest, ts.newest);
+      ASSERT_EQ(again.count, ts.count);
+      ASSERT_EQ(again.fill, ts.fill);
+      ASSERT_EQ(again.seq, ts.seq);
+      ASSERT_EQ(again.t_last, ts.t_last);
+      ASSERT_EQ(emb_ext_flash_ts_span(&again, &first, &last), 0);
+      ASSERT_EQ(query(&again, 0, 0xFFFFFFFE), scan(&again, all, 0, 0xFFFFFFFE));
+
+      // Carry on with the mounted copy, a remounted store erases before reusing a sector
+      erases += ts.stat_erases;
+      ts      = again;
+   }
+   ASSERT_GT(erases, 0u);
+
+   // Appends that erase the oldest sector invalidate an open query
+   ASSERT_EQ(emb_ext_flash_ts_query(&ts, &cur, 0, 0xFFFFFFFE), 0);
+   ASSERT_EQ(emb_ext_flash_ts_next(&ts, &cur, &got, NULL), 1);
+   append(&ts, all, t, TS_RECS_PER_SECTOR);
+   ASSERT_EQ(emb_ext_flash_ts_next(&ts, &cur, &got, NULL), -1);
+}
+
+TEST_F(emb_ext_flash_ts_test, torn_records_are_skipped)
+{
+   emb_ext_flash_ts_t     ts;
+   std::vector <uint32_t> all;
+   uint32_t               t = 100, first, last;
+   uint8_t                zero[TS_PAYLOAD] = {0};
+
+   ASSERT_EQ(emb_ext_flash_ts_format(&ts, &_intf, TS_REGION_START, TS_SECTORS * EXT_FLASH_SECTOR_SIZE, TS_PAYLOAD), 0);
+   srand(41);
+   append(&ts, all, t, 50);
+
+   // Clear bits in the payload of record 10 of the first sector as if its program was cut short
+   uint32_t rec_addr = TS_REGION_START + EXT_FLASH_TS_HEADER_SIZE + 10 * (EXT_FLASH_TS_RECORD_HEADER + TS_PAYLOAD);
+   ASSERT_EQ(emb_ext_flash_write(&_intf, rec_addr + EXT_FLASH_TS_RECORD_HEADER + 4, zero, 4), 4);
+   std::vector <uint32_t> want = all;
+   want.erase(want.begin() + 10);
+   ASSERT_EQ(query(&ts, 0, 0xFFFFFFFE), want);
+
+   // A record after the end that only got part of its timestamp programmed reads high. Mount skips it, takes the newest
+   // timestamp from the record before and carries on in the next sector, so later appends are not held back
+   uint8_t ts_only[4] = {(uint8_t)(t + 1), (uint8_t)((t + 1) >> 8), 0xF0, 0x7F};
+   ASSERT_EQ(emb_ext_flash_write(&_intf, rec_addr + 40 * (EXT_FLASH_TS_RECORD_HEADER + TS_PAYLOAD), ts_only, 4), 4);
+   ASSERT_EQ(emb_ext_flash_ts_mount(&ts, &_intf, TS_REGION_START, TS_SECTORS * EXT_FLASH_SECTOR_SIZE, TS_PAYLOAD), 0);
+   ASSERT_EQ(ts.fill, 51);
+   ASSERT_EQ(ts.closed, 1);
+   ASSERT_EQ(ts.t_last, t);
+   ASSERT_EQ(query(&ts, 0, 0xFFFFFFFE), want);
+   append(&ts, all, t, 10);
+   want.insert(want.end(), all.end() - 10, all.end());
+   ASSERT_EQ(ts.newest, 1);
+   ASSERT_EQ(query(&ts, 0, 0xFFFFFFFE), want);
+   ASSERT_EQ(emb_ext_flash_ts_span(&ts, &first, &last), 0);
+   ASSERT_EQ(last, t);
+}
+
+TEST_F(emb_ext_flash_ts_test, bench_short_range_queries)
+{
+   emb_ext_flash_ts_t     ts;
+   std::vector <uint32_t> all;
+   uint32_t               t = 0, first, last;
+   const int              sectors = 48, queries = 200;
+
+   ASSERT_EQ(emb_ext_flash_ts_format(&ts, &_intf, TS_REGION_START, sectors * EXT_FLASH_SECTOR_SIZE, TS_PAYLOAD), 0);
+   srand(42);
+   append(&ts, all, t, sectors * TS_RECS_PER_SECTOR - 1);
+   ASSERT_EQ(emb_ext_flash_ts_span(&ts, &first, &last), 0);
+
+   // Ranges of about 20 records at random places, indexed and then by a linear scan from the oldest record
+   uint32_t search = ts.stat_search_reads, stream = ts.stat_stream_reads, bytes = _flash_sim_stats.bytes;
+   double   start_us = flash_sim_model_time_us();
+   size_t   found = 0;
+   for (int i = 0; i < queries; i++)
+   {
+      uint32_t a = first + rand() % (last - first);
+      std::vector <uint32_t> got = query(&ts, a, a + 50);
+      ASSERT_EQ(got, scan(&ts, all, a, a + 50));
+      found += got.size();
+   }
+   double   idx_us    = flash_sim_model_time_us() - start_us;
+   uint32_t idx_bytes = _flash_sim_stats.bytes - bytes;
+   search = ts.stat_search_reads - search;
+   stream = ts.stat_stream_reads - stream;
+
+   start_us = flash_sim_model_time_us();
+   bytes    = _flash_sim_stats.bytes;
+   uint8_t buf[EXT_FLASH_TS_STREAM_SIZE];
+   for (int i = 0; i < queries / 20; i++)
+   {
+      for (uint32_t addr = TS_REGION_START; addr < TS_REGION_START + sectors * EXT_FLASH_SECTOR_SIZE; addr += sizeof(buf))
+      {
+         ASSERT_EQ(emb_ext_flash_read(&_intf, addr, buf, sizeof(buf)), (int)sizeof(buf));
+      }
+   }
+   double   scan_us    = (flash_sim_model_time_us() - start_us) * 20;
+   uint32_t scan_bytes = (_flash_sim_stats.bytes - bytes) * 20;
+
+   printf("%d queries over %u records, %u found: %.1f search reads and %.1f stream reads per query\n", queries,
+          (unsigned)all.size(), (unsigned)found, (double)search / queries, (double)stream / queries);
+   printf("indexed: %u bus bytes, %.0f us per query; linear scan: %u bus bytes, %.0f us per query\n", idx_bytes,
+          idx_us / queries, scan_bytes, scan_us / queries);
+   ASSERT_LT(idx_us * 50, scan_us);
+}
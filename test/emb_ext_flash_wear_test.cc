@@ -0,0 +1,227 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_pool.h>
+#include <emb_ext_flash_wear.h>
+#include "emb_ext_flash_sim.h"
+
+// Tracked region, the store sits in its last two sectors
+#define WEAR_REGION_START    0x10000
+#define WEAR_SECTORS         48
+#define WEAR_STORE           (WEAR_REGION_START + (WEAR_SECTORS - 2) * EXT_FLASH_SECTOR_SIZE)
+
+// Class for facilitating erase counter tests
+class emb_ext_flash_wear_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      flash_sim_reset(0xFF);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+
+   void TearDown()
+   {
+      flash_sim_reset(0xFF);
+      _intf.erase_hook  = NULL;
+      _intf.p_erase_ctx = NULL;
+   }
+
+   // Every tracked count matches what the simulator saw
+   static void match_sim(emb_ext_flash_wear_t *p_wear)
+   {
+      for (uint16_t s = 0; s < p_wear->sectors; s++)
+      {
+         ASSERT_EQ(p_wear->counts[s], _flash_sim_sector_erases[p_wear->base / EXT_FLASH_SECTOR_SIZE + s]) << "sector " << s;
+      }
+   }
+};
+
+TEST_F(emb_ext_flash_wear_test, counts_every_erase_path)
+{
+   static emb_ext_flash_wear_t wear;
+   uint32_t                    min, max, total, addr;
+   uint16_t                    bins[4];
+   uint8_t                     free_map[(WEAR_SECTORS + 7) / 8];
+
+   // Argument checks
+   ASSERT_EQ(emb_ext_flash_wear_attach(&wear, &_intf, WEAR_REGION_START + 1, WEAR_SECTORS, EXT_FLASH_WEAR_NO_STORE), -1);
+   ASSERT_EQ(emb_ext_flash_wear_attach(&wear, &_intf, WEAR_REGION_START, 0, EXT_FLASH_WEAR_NO_STORE), -1);
+   ASSERT_EQ(emb_ext_flash_wear_attach(&wear, &_intf, WEAR_REGION_START, EXT_FLASH_WEAR_MAX_SECTORS + 1,
+                                       EXT_FLASH_WEAR_NO_STORE), -1);
+   ASSERT_EQ(emb_ext_flash_wear_attach(&wear, &_intf, WEAR_REGION_START, WEAR_SECTORS, WEAR_STORE + 1), -1);
+   ASSERT_EQ(emb_ext_flash_wear_attach(&wear, &_intf, WEAR_REGION_START, WEAR_SECTORS, EXT_FLASH_WEAR_NO_STORE), 0);
+   ASSERT_EQ(emb_ext_flash_wear_sync(&wear), -1);
+
+   // Sector, block, background, batched and chip erases all count, erases outside the region do not
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, WEAR_REGION_START + 0x1000, EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, WEAR_REGION_START + 0x8000, EXT_FLASH_BLOCK_32K_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, WEAR_REGION_START + 0x10000, EXT_FLASH_BLOCK_64K_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_erase_begin(&_intf, WEAR_REGION_START + 0x2123), 0);
+   ASSERT_EQ(emb_ext_flash_wait_idle(&_intf, 0), 0);
+   emb_ext_flash_op_t op = { EXT_FLASH_OP_ERASE, WEAR_REGION_START + 0x1000, NULL, EXT_FLASH_SECTOR_SIZE, 0 };
+   ASSERT_EQ(emb_ext_flash_batch(&_intf, &op, 1, NULL), 1);
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, 0x0000, EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_wear_count(&wear, WEAR_REGION_START + 0x1FFF), 2u);
+   ASSERT_EQ(emb_ext_flash_wear_count(&wear, WEAR_REGION_START + 0x2000), 1u);
+   ASSERT_EQ(emb_ext_flash_wear_count(&wear, WEAR_REGION_START + 0xF000), 1u);
+   ASSERT_EQ(emb_ext_flash_wear_count(&wear, WEAR_REGION_START + 0x1F000), 1u);
+   ASSERT_EQ(emb_ext_flash_wear_count(&wear, 0x0000), 0u);
+   match_sim(&wear);
+   ASSERT_EQ(emb_ext_flash_chip_erase(&_intf), 0);
+   match_sim(&wear);
+
+   ASSERT_EQ(emb_ext_flash_wear_summary(&wear, &min, &max, &total), 0);
+   ASSERT_EQ(min, 1u);
+   ASSERT_EQ(max, 3u);
+   ASSERT_EQ(total, WEAR_SECTORS + 2u + 8u + 16u + 1u);
+   ASSERT_EQ(emb_ext_flash_wear_histogram(&wear, 1, bins, 4), 0);
+   ASSERT_EQ(bins[0], 0);
+   ASSERT_EQ(bins[1], WEAR_SECTORS - 26);
+   ASSERT_EQ(bins[2], 25);
+   ASSERT_EQ(bins[3], 1);
+
+   // The least worn free sector, none when nothing is free
+   memset(free_map, 0x00, sizeof(free_map));
+   free_map[0] = 0x06;
+   ASSERT_EQ(emb_ext_flash_wear_least_worn(&wear, free_map, &addr), 0);
+   ASSERT_EQ(addr, WEAR_REGION_START + 0x2000);
+   ASSERT_EQ(emb_ext_flash_wear_least_worn(&wear, NULL, &addr), 0);
+   ASSERT_EQ(addr, WEAR_REGION_START);
+   free_map[0] = 0;
+   ASSERT_EQ(emb_ext_flash_wear_least_worn(&wear, free_map, &addr), -1);
+
+   // Detached, nothing more is counted
+   emb_ext_flash_wear_detach(&wear);
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, WEAR_REGION_START, EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_wear_count(&wear, WEAR_REGION_START), 1u);
+}
+
+TEST_F(emb_ext_flash_wear_test, persisted_counts)
+{
+   static emb_ext_flash_wear_t wear, again;
+
+   // A blank store starts with a snapshot, which counts the erase of its own sector
+   ASSERT_EQ(emb_ext_flash_wear_attach(&wear, &_intf, WEAR_REGION_START, WEAR_SECTORS, WEAR_STORE), 0);
+   ASSERT_EQ(wear.stat_snapshots, 1u);
+   match_sim(&wear);
+
+   // Enough erases to fill the log more than once
+   srand(41);
+   for (int i = 0; i < 5000; i++)
+   {
+      uint32_t s = (rand() % 4) ? rand() % 6 : rand() % (WEAR_SECTORS - 2);
+      ASSERT_EQ(emb_ext_flash_erase(&_intf, WEAR_REGION_START + s * EXT_FLASH_SECTOR_SIZE, EXT_FLASH_SECTOR_SIZE), 0);
+   }
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, WEAR_REGION_START, EXT_FLASH_BLOCK_64K_SIZE), 0);
+   ASSERT_GT(wear.stat_snapshots, 2u);
+   match_sim(&wear);
+
+   // Attaching again loads the snapshot and replays the log, once the first counter has let go of the hook
+   ASSERT_EQ(emb_ext_flash_wear_attach(&again, &_intf, WEAR_REGION_START, WEAR_SECTORS, WEAR_STORE), -1);
+   emb_ext_flash_wear_detach(&wear);
+   ASSERT_EQ(emb_ext_flash_wear_attach(&again, &_intf, WEAR_REGION_START, WEAR_SECTORS, WEAR_STORE), 0);
+   ASSERT_EQ(again.seq, wear.seq);
+   ASSERT_EQ(again.log_next, wear.log_next);
+   ASSERT_EQ(memcmp(again.counts, wear.counts, sizeof(wear.counts)), 0);
+
+   // The log entry goes out ahead of the erase, so an erase cut short by a power loss is still counted
+   uint32_t before = again.counts[3];
+   flash_sim_cut_power_in_erase(1);
+   ASSERT_EQ(emb_ext_flash_erase(&_intf, WEAR_REGION_START + 0x3000, EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_TRUE(flash_sim_power_lost());
+   flash_sim_restore_power();
+   emb_ext_flash_init_intf(&_intf);
+   _intf.deselect();
+   emb_ext_flash_wear_detach(&again);
+   ASSERT_EQ(emb_ext_flash_wear_attach(&wear, &_intf, WEAR_REGION_START, WEAR_SECTORS, WEAR_STORE), 0);
+   ASSERT_EQ(wear.counts[3], before + 1);
+   match_sim(&wear);
+
+   // A snapshot that did not commit is passed over for the previous one
+   ASSERT_EQ(emb_ext_flash_wear_sync(&wear), 0);
+   uint8_t zero[4] = { 0 };
+   ASSERT_EQ(emb_ext_flash_write(&_intf, WEAR_STORE + wear.active * EXT_FLASH_SECTOR_SIZE + 4, zero, 4), 4);
+   emb_ext_flash_wear_detach(&wear);
+   ASSERT_EQ(emb_ext_flash_wear_attach(&again, &_intf, WEAR_REGION_START, WEAR_SECTORS, WEAR_STORE), 0);
+   ASSERT_EQ(again.active, wear.active ^ 1);
+   ASSERT_EQ(again.seq, wear.seq - 1);
+
+   // A log write that fails is counted, and the erase still counts in RAM
+   uint32_t count = again.counts[5];
+   flash_sim_hold_busy(FLASH_SIM_BUSY_FOREVER);
+   ASSERT_LT(emb_ext_flash_erase_timeout(&_intf, WEAR_REGION_START + 0x5000, EXT_FLASH_SECTOR_SIZE, 0), 0);
+   ASSERT_EQ(again.stat_failures, 1u);
+   ASSERT_EQ(again.counts[5], count + 1);
+}
+
+TEST_F(emb_ext_flash_wear_test, bench_hot_spot)
+{
+   static emb_ext_flash_wear_t wear;
+   static uint8_t              record[64];
+   const int                   updates = 2000, sectors = 32;
+   uint32_t                    min, max, total, addr = WEAR_REGION_START;
+   uint16_t                    bins[8];
+   uint8_t                     free_map[(sectors + 7) / 8];
+
+   memset(record, 0x5A, sizeof(record));
+
+   // A settings record rewritten in place wears its one sector out
+   ASSERT_EQ(emb_ext_flash_wear_attach(&wear, &_intf, WEAR_REGION_START, sectors, EXT_FLASH_WEAR_NO_STORE), 0);
+   for (int i = 0; i < updates; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_erase(&_intf, WEAR_REGION_START, EXT_FLASH_SECTOR_SIZE), 0);
+      ASSERT_EQ(emb_ext_flash_write(&_intf, WEAR_REGION_START, record, sizeof(record)), (int)sizeof(record));
+   }
+   ASSERT_EQ(emb_ext_flash_wear_summary(&wear, &min, &max, &total), 0);
+   double in_place = (double)max * sectors / total;
+   ASSERT_EQ(in_place, flash_sim_wear_ratio(WEAR_REGION_START, sectors * EXT_FLASH_SECTOR_SIZE));
+
+   // Moving it to the least worn other sector on every update spreads the erases over the region
+   flash_sim_reset(0xFF);
+   ASSERT_EQ(emb_ext_flash_wear_attach(&wear, &_intf, WEAR_REGION_START, sectors, EXT_FLASH_WEAR_NO_STORE), 0);
+   for (int i = 0; i < updates; i++)
+   {
+      uint16_t cur = (uint16_t)((addr - WEAR_REGION_START) / EXT_FLASH_SECTOR_SIZE);
+      memset(free_map, 0xFF, sizeof(free_map));
+      free_map[cur >> 3] &= (uint8_t)~(1 << (cur & 7));
+      ASSERT_EQ(emb_ext_flash_wear_least_worn(&wear, free_map, &addr), 0);
+      ASSERT_EQ(emb_ext_flash_erase(&_intf, addr, EXT_FLASH_SECTOR_SIZE), 0);
+      ASSERT_EQ(emb_ext_flash_write(&_intf, addr, record, sizeof(record)), (int)sizeof(record));
+   }
+   ASSERT_EQ(emb_ext_flash_wear_summary(&wear, &min, &max, &total), 0);
+   double leveled = (double)max * sectors / total;
+   ASSERT_EQ(emb_ext_flash_wear_histogram(&wear, 16, bins, 8), 0);
+
+   printf("%d updates over %d sectors: wear max/mean %.2f in place, %.2f least worn (erases per sector %u to %u)\n",
+          updates, sectors, in_place, leveled, (unsigned)min, (unsigned)max);
+   printf("least worn histogram, 16 erases per bin:");
+   for (int i = 0; i < 8; i++)
+   {
+      printf(" %u", bins[i]);
+   }
+   printf("\n");
+
+   ASSERT_EQ(in_place, (double)sectors);
+   ASSERT_LT(leveled, 1.05);
+}
@@ -0,0 +1,136 @@
+/*********************************************************************************
+*  DISCLAIMER:
+*
+*  This code is protected under the MIT open source license. The code is provided
+*  "as is" without warranty of any kind, either express or implied, including but
+*  not limited to the implied warranties of merchantability, fitness for a particular
+*  purpose, or non-infringement. In no event shall the author or any other party be
+*  liable for any direct, indirect, incidental, special, exemplary, or consequential
+*  damages, however caused and on any theory of liability, whether in contract,
+*  strict liability, or tort (including negligence or otherwise), arising in any way
+*  out of the use of this code or performance or use of the results of this code. By
+*  using this code, you agree to hold the author and any other party harmless from
+*  any and all liability and to use the code at your own risk.
+*
+*  This code was written by GitHub user: budgettsfrog
+*  Contact: budgettsfrog@protonmail.com
+*  GitHub: https://github.com/warrenwoolseyiii
+*********************************************************************************/
+
+#include <gtest/gtest.h>
+#include <emb_ext_flash.h>
+#include <emb_ext_flash_crc.h>
+#include <emb_ext_flash_writer.h>
+#include "emb_ext_flash_sim.h"
+
+// Class for facilitating streaming writer tests
+class emb_ext_flash_writer_test : public ::testing::Test
+{
+public:
+   void SetUp()
+   {
+      // Start every test from a dirty, all zero, memory bank so missing erases show up
+      flash_sim_reset(0x00);
+      emb_ext_flash_init_intf(&_intf);
+      _intf.deselect();
+   }
+};
+
+TEST_F(emb_ext_flash_writer_test, crc32_check_value)
+{
+   // Standard CRC-32 check value
+   uint8_t data[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+
+   ASSERT_EQ(emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, data, sizeof(data)), 0xCBF43926);
+
+   // Split computation must match
+   uint32_t crc = emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, data, 4);
+   ASSERT_EQ(emb_ext_flash_crc32(crc, &data[4], 5), 0xCBF43926);
+}
+
+TEST_F(emb_ext_flash_writer_test, open_checks)
+{
+   emb_ext_flash_writer_t w;
+
+   ASSERT_EQ(emb_ext_flash_writer_open(NULL, &_intf, 0, EXT_FLASH_SECTOR_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_writer_open(&w, NULL, 0, EXT_FLASH_SECTOR_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_writer_open(&w, &_intf, 0x100, EXT_FLASH_SECTOR_SIZE), -1);
+   ASSERT_EQ(emb_ext_flash_writer_open(&w, &_intf, 0, 0x100), -1);
+   ASSERT_EQ(emb_ext_flash_writer_open(&w, &_intf, 0, 0), -1);
+   ASSERT_EQ(emb_ext_flash_writer_open(&w, &_intf, 0, EXT_FLASH_SECTOR_SIZE), 0);
+   ASSERT_EQ(emb_ext_flash_writer_close(&w, 0, NULL), 0);
+   ASSERT_EQ(emb_ext_flash_writer_close(&w, 0, NULL), -1);
+   ASSERT_EQ(emb_ext_flash_writer_append(&w, NULL, 0), -1);
+}
+
+TEST_F(emb_ext_flash_writer_test, odd_sized_appends)
+{
+   // Image spanning a 32K block, a sector and a partial tail, written starting at a 32K aligned address
+   static uint8_t image[EXT_FLASH_BLOCK_32K_SIZE + EXT_FLASH_SECTOR_SIZE + 123];
+   static uint8_t rx[sizeof(image)];
+   uint32_t       start = EXT_FLASH_BLOCK_32K_SIZE;
+
+   for (uint32_t i = 0; i < sizeof(image); i++)
+   {
+      image[i] = (uint8_t)(i * 7 + (i >> 8));
+   }
+
+   emb_ext_flash_writer_t w;
+   ASSERT_EQ(emb_ext_flash_writer_open(&w, &_intf, start, EXT_FLASH_BLOCK_32K_SIZE + 4 * EXT_FLASH_SECTOR_SIZE), 0);
+
+   // Mix of tiny, page crossing and multi page appends
+   uint32_t sizes[] = { 1, 3, 255, 256, 257, 1000, 4096, 17 };
+   uint32_t off     = 0;
+   for (int i = 0; off < sizeof(image); i = (i + 1) % 8)
+   {
+      uint32_t len = sizes[i];
+      if (len > sizeof(image) - off)
+      {
+         len = sizeof(image) - off;
+      }
+      ASSERT_EQ(emb_ext_flash_writer_append(&w, &image[off], len), 0);
+      off += len;
+   }
+
+   uint32_t crc = 0;
+   ASSERT_EQ(emb_ext_flash_writer_close(&w, 1, &crc), (int)sizeof(image) + 4);
+   ASSERT_EQ(crc, emb_ext_flash_crc32(EXT_FLASH_CRC32_INIT, image, sizeof(image)));
+
+   // The image reads back intact
+   for (uint32_t i = 0; i < sizeof(image); i += 0x8000)
+   {
+      uint16_t len = (sizeof(image) - i) > 0x8000 ? 0x8000 : (sizeof(image) - i);
+      ASSERT_EQ(emb_ext_flash_read(&_intf, start + i, &rx[i], len), len);
+   }
+   ASSERT_EQ(memcmp(image, rx, sizeof(image)), 0);
+
+   // The CRC trailer follows the image
+   uint8_t trailer[4];
+   ASSERT_EQ(emb_ext_flash_read(&_intf, start + sizeof(image), trailer, 4), 4);
+   ASSERT_EQ((uint32_t)(trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24)), crc);
+
+   // The 32K block is erased in one go, after that only the sectors in use are erased, the rest of the slot and the memory outside of it are untouched
+   ASSERT_EQ(_flash_sim_mem[start - 1], 0x00);
+   ASSERT_EQ(_flash_sim_mem[start + sizeof(image) + 4], 0xFF);
+   ASSERT_EQ(_flash_sim_mem[start + EXT_FLASH_BLOCK_32K_SIZE + 2 * EXT_FLASH_SECTOR_SIZE], 0x00);
+}
+
+TEST_F(emb_ext_flash_writer_test, slot_overflow)
+{
+   uint8_t                data[EXT_FLASH_PAGE_SIZE] = { 0 };
+   emb_ext_flash_writer_t w;
+
+   ASSERT_EQ(emb_ext_flash_writer_open(&w, &_intf, 0, EXT_FLASH_SECTOR_SIZE), 0);
+   for (int i = 0; i < EXT_FLASH_SECTOR_SIZE / EXT_FLASH_PAGE_SIZE; i++)
+   {
+      ASSERT_EQ(emb_ext_flash_writer_append(&w, data, sizeof(data)), 0);
+   }
+
+   // Slot is full, even a single byte or the CRC trailer must be rejected
+   ASSERT_EQ(emb_ext_flash_writer_append(&w, data, 1), -1);
+   ASSERT_EQ(emb_ext_flash_writer_close(&w, 1, NULL), -1);
+   ASSERT_EQ(emb_ext_flash_writer_close(&w, 0, NULL), EXT_FLASH_SECTOR_SIZE);
+
+   // Nothing past the slot was erased
+   ASSERT_EQ(_flash_sim_mem[EXT_FLASH_SECTOR_SIZE], 0x00);
+}